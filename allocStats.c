@@ -0,0 +1,285 @@
+#define _DEFAULT_SOURCE /* for getrusage */
+#define ALLOC_STATS_IMPLEMENTATION
+#include "allocStats.h"
+#include "global.h"
+#include <pthread.h>
+#include <sys/resource.h>
+
+#define INITIAL_TRACKED_BLOCKS 1024 /* slots of the live block table, it doubles when half full */
+#define MAX_ALLOC_SITES 4096 /* call sites counted, the ones after it are counted as "(other)" */
+
+typedef struct AllocCounter {
+    unsigned long count; /* allocations (a realloc that moves or grows a block counts as one) */
+    unsigned long bytes; /* bytes asked for */
+    unsigned long live; /* bytes allocated and not freed yet */
+    unsigned long peakLive;
+} AllocCounter;
+
+typedef struct AllocSite {
+    const char *file; /* __FILE__ of the call, a string literal so the pointer is the key */
+    int line;
+    AllocCounter counter;
+} AllocSite;
+
+typedef struct TrackedBlock { /* a live block, for what its free takes off */
+    void *block; /* NULL for an empty slot, DELETED_BLOCK for a freed one */
+    size_t size;
+    unsigned int site;
+    AllocStage stage;
+} TrackedBlock;
+
+static const char *const stageNames[ALLOC_STAGES] = {"other", "preprocessor", "first pass", "second pass", "output"};
+static char deletedBlock;
+#define DELETED_BLOCK ((void*)&deletedBlock)
+
+static Bool enabled = FALSE;
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t stageKey;
+static AllocCounter stageCounters[ALLOC_STAGES];
+static AllocCounter total;
+static AllocSite sites[MAX_ALLOC_SITES + 1]; /* the last one is "(other)" */
+static unsigned int siteCount = 0;
+static TrackedBlock *blocks = NULL;
+static size_t blockCapacity = 0, blockUsed = 0; /* used counts the deleted slots too */
+static unsigned long sourceLines = 0;
+
+void enableAllocStats(void)
+{
+    if (enabled)
+        return;
+    blocks = calloc(INITIAL_TRACKED_BLOCKS, sizeof(TrackedBlock));
+    if (blocks == NULL || pthread_key_create(&stageKey, NULL) != 0)
+        return;
+    blockCapacity = INITIAL_TRACKED_BLOCKS;
+    sites[MAX_ALLOC_SITES].file = "(other)";
+    sites[MAX_ALLOC_SITES].line = 0; /* printed without a line */
+    enabled = TRUE;
+}
+
+void setAllocStage(AllocStage stage)
+{
+    if (enabled)
+        pthread_setspecific(stageKey, (void*)(stageNames + stage)); /* a non NULL pointer that encodes the stage */
+}
+
+AllocStage getAllocStage(void)
+{
+    const char *const *name = enabled ? pthread_getspecific(stageKey) : NULL;
+    return name == NULL ? ALLOC_STAGE_OTHER : (AllocStage)(name - stageNames);
+}
+
+void addAllocSourceLines(const char *source, size_t length)
+{
+    const char *end = source + length;
+    unsigned long lines = 0;
+
+    if (!enabled)
+        return;
+    for (; source < end; source++)
+        if (*source == '\n')
+            lines++;
+    pthread_mutex_lock(&statsLock);
+    sourceLines += lines;
+    pthread_mutex_unlock(&statsLock);
+}
+
+/* table functions, called with statsLock held */
+
+static unsigned int findSite(const char *file, int line)
+{
+    unsigned int i;
+    for (i = 0; i < siteCount; i++)
+        if (sites[i].line == line && sites[i].file == file)
+            return i;
+    if (siteCount == MAX_ALLOC_SITES)
+        return MAX_ALLOC_SITES;
+    sites[siteCount].file = file;
+    sites[siteCount].line = line;
+    return siteCount++;
+}
+
+static size_t blockSlot(const void *block, size_t capacity)
+{
+    unsigned long key = (unsigned long)block;
+    return (size_t)((key >> 4) ^ (key >> 16)) & (capacity - 1); /* capacity is a power of 2 */
+}
+
+/* growBlocks - doubles the table (and drops the deleted slots), FALSE if malloc failed */
+static Bool growBlocks(void)
+{
+    size_t capacity = blockCapacity * 2, i, slot;
+    TrackedBlock *grown = calloc(capacity, sizeof(TrackedBlock));
+
+    if (grown == NULL)
+        return FALSE;
+    blockUsed = 0;
+    for (i = 0; i < blockCapacity; i++) {
+        if (blocks[i].block == NULL || blocks[i].block == DELETED_BLOCK)
+            continue;
+        for (slot = blockSlot(blocks[i].block, capacity); grown[slot].block != NULL; slot = (slot + 1) & (capacity - 1))
+            ;
+        grown[slot] = blocks[i];
+        blockUsed++;
+    }
+    free(blocks);
+    blocks = grown;
+    blockCapacity = capacity;
+    return TRUE;
+}
+
+static void addCounter(AllocCounter *counter, size_t size)
+{
+    counter->count++;
+    counter->bytes += size;
+    counter->live += size;
+    if (counter->live > counter->peakLive)
+        counter->peakLive = counter->live;
+}
+
+static void trackBlock(void *block, size_t size, const char *file, int line)
+{
+    TrackedBlock *tracked;
+    size_t slot;
+
+    if (2 * (blockUsed + 1) > blockCapacity && !growBlocks())
+        return; /* not tracked, its free finds nothing */
+    for (slot = blockSlot(block, blockCapacity); blocks[slot].block != NULL && blocks[slot].block != DELETED_BLOCK;
+         slot = (slot + 1) & (blockCapacity - 1))
+        ;
+    tracked = &blocks[slot];
+    if (tracked->block == NULL)
+        blockUsed++;
+    tracked->block = block;
+    tracked->size = size;
+    tracked->site = findSite(file, line);
+    tracked->stage = getAllocStage();
+    addCounter(&sites[tracked->site].counter, size);
+    addCounter(&stageCounters[tracked->stage], size);
+    addCounter(&total, size);
+}
+
+/* findBlock - the slot of a live block, NULL for a block of libc (open_memstream) or from before enableAllocStats */
+static TrackedBlock* findBlock(const void *block)
+{
+    size_t slot;
+
+    for (slot = blockSlot(block, blockCapacity); blocks[slot].block != NULL; slot = (slot + 1) & (blockCapacity - 1))
+        if (blocks[slot].block == block)
+            return &blocks[slot];
+    return NULL;
+}
+
+static void untrackBlock(TrackedBlock *tracked)
+{
+    if (tracked == NULL)
+        return;
+    sites[tracked->site].counter.live -= tracked->size;
+    stageCounters[tracked->stage].live -= tracked->size;
+    total.live -= tracked->size;
+    tracked->block = DELETED_BLOCK;
+}
+
+/* the counting functions */
+
+void* countedMalloc(size_t size, const char *file, int line)
+{
+    void *block = malloc(size);
+    if (enabled && block != NULL) {
+        pthread_mutex_lock(&statsLock);
+        trackBlock(block, size, file, line);
+        pthread_mutex_unlock(&statsLock);
+    }
+    return block;
+}
+
+void* countedCalloc(size_t count, size_t size, const char *file, int line)
+{
+    void *block = calloc(count, size);
+    if (enabled && block != NULL) {
+        pthread_mutex_lock(&statsLock);
+        trackBlock(block, count * size, file, line);
+        pthread_mutex_unlock(&statsLock);
+    }
+    return block;
+}
+
+void* countedRealloc(void *block, size_t size, const char *file, int line)
+{
+    TrackedBlock *tracked;
+    void *moved;
+
+    if (!enabled)
+        return realloc(block, size);
+    pthread_mutex_lock(&statsLock); /* held across realloc so no other thread gets the old address in between */
+    tracked = block != NULL ? findBlock(block) : NULL; /* looked up first, the old pointer is invalid after realloc */
+    moved = realloc(block, size);
+    if (moved != NULL) {
+        untrackBlock(tracked);
+        trackBlock(moved, size, file, line);
+    }
+    pthread_mutex_unlock(&statsLock);
+    return moved;
+}
+
+void countedFree(void *block)
+{
+    if (enabled && block != NULL) {
+        pthread_mutex_lock(&statsLock); /* untracked before the address can be handed out again */
+        untrackBlock(findBlock(block));
+        free(block);
+        pthread_mutex_unlock(&statsLock);
+        return;
+    }
+    free(block);
+}
+
+/* the report */
+
+static int compareSites(const void *a, const void *b)
+{
+    const AllocSite *x = (const AllocSite*)a, *y = (const AllocSite*)b;
+    if (x->counter.bytes != y->counter.bytes)
+        return x->counter.bytes < y->counter.bytes ? 1 : -1;
+    return x->line - y->line;
+}
+
+static void printCounter(FILE *stream, const char *name, int line, const AllocCounter *counter)
+{
+    char label[64];
+    if (line > 0)
+        sprintf(label, "%.50s:%d", name, line);
+    else
+        sprintf(label, "%.50s", name);
+    fprintf(stream, "  %-24s %12lu %14lu %14lu\n", label, counter->count, counter->bytes, counter->peakLive);
+}
+
+void printAllocStats(FILE *stream)
+{
+    struct rusage usage;
+    unsigned int i, count;
+
+    if (!enabled)
+        return;
+    pthread_mutex_lock(&statsLock);
+    fprintf(stream, "\nallocation stats:\n  %-24s %12s %14s %14s\n", "stage", "allocations", "bytes", "peak live");
+    for (i = 0; i < ALLOC_STAGES; i++)
+        printCounter(stream, stageNames[i], 0, &stageCounters[i]);
+    printCounter(stream, "total", 0, &total);
+
+    count = siteCount;
+    if (sites[MAX_ALLOC_SITES].counter.count > 0) /* "(other)" is sorted with the rest */
+        sites[count++] = sites[MAX_ALLOC_SITES];
+    qsort(sites, count, sizeof(AllocSite), compareSites);
+    fprintf(stream, "\n  %-24s %12s %14s %14s\n", "call site", "allocations", "bytes", "peak live");
+    for (i = 0; i < count; i++)
+        printCounter(stream, sites[i].file, sites[i].line, &sites[i].counter);
+    siteCount = 0; /* the site indexes of the table are no longer valid */
+    enabled = FALSE;
+
+    if (sourceLines > 0)
+        fprintf(stream, "\n  %lu source line(s), %.2f allocations and %.1f bytes per line\n", sourceLines,
+                (double)total.count / (double)sourceLines, (double)total.bytes / (double)sourceLines);
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        fprintf(stream, "  peak RSS %ld KB\n", usage.ru_maxrss);
+    pthread_mutex_unlock(&statsLock);
+}
@@ -0,0 +1,38 @@
+#ifndef ALLOC_STATS_H
+#define ALLOC_STATS_H
+#include "global.h"
+
+/* the allocation profiler (--alloc-stats): the files that include this header last get their malloc, calloc,
+ * realloc and free replaced by counting versions. they count the allocations, bytes and peak live bytes of every
+ * call site (file:line) and of every stage, printAllocStats reports them with the peak RSS.
+ * until enableAllocStats is called the counting versions only pass the call on */
+
+#define ALLOC_STAGES 5
+
+typedef enum AllocStage { /* what the thread is doing, set with setAllocStage */
+    ALLOC_STAGE_OTHER,
+    ALLOC_STAGE_PREPROCESSOR,
+    ALLOC_STAGE_FIRST_PASS,
+    ALLOC_STAGE_SECOND_PASS,
+    ALLOC_STAGE_OUTPUT
+} AllocStage;
+
+void enableAllocStats(void); /* start counting, call it before any other thread starts */
+void setAllocStage(AllocStage stage); /* the stage of the calling thread */
+AllocStage getAllocStage(void);
+void addAllocSourceLines(const char *source, size_t length); /* count the lines of an assembled source */
+void printAllocStats(FILE *stream);
+
+void* countedMalloc(size_t size, const char *file, int line);
+void* countedCalloc(size_t count, size_t size, const char *file, int line);
+void* countedRealloc(void *block, size_t size, const char *file, int line);
+void countedFree(void *block);
+
+#ifndef ALLOC_STATS_IMPLEMENTATION /* allocStats.c uses the real ones */
+#define malloc(size) countedMalloc((size), __FILE__, __LINE__)
+#define calloc(count, size) countedCalloc((count), (size), __FILE__, __LINE__)
+#define realloc(block, size) countedRealloc((block), (size), __FILE__, __LINE__)
+#define free(block) countedFree(block)
+#endif
+
+#endif
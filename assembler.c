@@ -0,0 +1,213 @@
+#include "assembler.h"
+#include "global.h"
+#include "error.h"
+#include "preprocessor.h"
+#include "firstPass.h"
+#include "secondPass.h"
+#include "writeFiles.h"
+#include "lexer.h"
+#include "tables.h"
+#include "util.h"
+#include "parallel.h"
+#include "incremental.h"
+#include "probes.h"
+#include "allocStats.h"
+
+AssemblerContext* createAssemblerContext(void)
+{
+    AssemblerContext *context = malloc(sizeof(AssemblerContext));
+    if (context == NULL)
+        return NULL;
+
+    context->jobs = DEFAULT_JOBS;
+    context->maxErrors = 0; /* no limit */
+    context->incremental = FALSE;
+    context->checkOnly = FALSE;
+    context->sourceDirectory = NULL;
+    context->readInclude = NULL; /* no includes until the caller gives a reader */
+    context->readerArg = NULL;
+    context->macroLibraries = NULL;
+    context->name = NULL;
+    context->stage = STAGE_PREPROCESSOR;
+    context->running = STAGE_DONE;
+    initTextBuffer(&context->amText);
+    context->ICF = 0;
+    context->DCF = 0;
+    context->entries = NULL;
+    context->entryCount = 0;
+    initExternList(&context->externs);
+    context->macroTable = NULL;
+    context->symbolTable = NULL;
+    context->errorList = NULL;
+    context->program = NULL;
+    context->lineExterns = NULL;
+    context->stageHook = NULL;
+    context->chunkHook = NULL;
+    context->hookArg = NULL;
+    return context;
+}
+
+/* enterStage - marks the end of the running stage and the start of stage (STAGE_DONE once none runs) for the
+ * allocation stats, the stage hook and the probes */
+void enterStage(AssemblerContext *context, AssemblerStage stage)
+{
+    if (context->running != STAGE_DONE)
+        PROBE2(stage__exit, context->name, (int)context->running);
+    context->running = stage;
+    if (stage != STAGE_DONE)
+        PROBE2(stage__enter, context->name, (int)stage);
+    setAllocStage(stage == STAGE_DONE ? ALLOC_STAGE_OTHER : (AllocStage)(ALLOC_STAGE_PREPROCESSOR + stage));
+    if (context->stageHook != NULL)
+        context->stageHook(context->hookArg, stage);
+}
+
+/* createRunMacroTable - a macro table that resolves the includes of context->name against sourceDirectory and
+ * reads them like context says */
+MacroTable* createRunMacroTable(const AssemblerContext *context)
+{
+    MacroTable *table = createMacroTable();
+
+    if (table == NULL)
+        return NULL;
+    table->includeBase = joinPath(context->sourceDirectory, context->name);
+    if (table->includeBase == NULL) {
+        freeMacroTable(table);
+        return NULL;
+    }
+    table->readInclude = context->readInclude;
+    table->readerArg = context->readerArg;
+    table->macroLibraries = context->macroLibraries;
+    return table;
+}
+
+/* clearAssemblerResults - frees everything the last assembleSource call made, the options stay */
+void clearAssemblerResults(AssemblerContext *context)
+{
+    freeKeptProgram(context);
+    freeTableAndLists(context->macroTable, context->symbolTable, context->errorList);
+    context->macroTable = NULL;
+    context->symbolTable = NULL;
+    context->errorList = NULL;
+    freeTextBuffer(&context->amText);
+    clearExternRecords(&context->externs);
+    if (context->entries != NULL)
+        free(context->entries);
+    context->entries = NULL;
+    context->entryCount = 0;
+    if (context->name != NULL)
+        free(context->name);
+    context->name = NULL;
+    context->ICF = 0;
+    context->DCF = 0;
+    context->stage = STAGE_PREPROCESSOR;
+}
+
+void freeAssemblerContext(AssemblerContext *context)
+{
+    if (context == NULL)
+        return;
+    clearAssemblerResults(context);
+    free(context);
+}
+
+/* assembleSource - runs the preprocessor and both passes on length bytes of source.
+ * the results of the previous call are freed first, on failure context->stage is the stage that failed
+ * and context->errorList has its errors (the results of the stages before it are still there).
+ * with context->incremental set a source of the same name as the last successful call is reassembled from the
+ * kept IR first, and assembled in full if that fails.
+ * Returns ASSEMBLER_SUCCESS_S or ASSEMBLER_FAILURE_S.
+ */
+ErrCode assembleSource(AssemblerContext *context, const char *name, const char *source, size_t length)
+{
+    if (context->incremental && context->program != NULL && strcmp(context->name, name) == 0 &&
+        reassembleSource(context, source, length) == ASSEMBLER_SUCCESS_S)
+        return ASSEMBLER_SUCCESS_S;
+
+    if (preprocessSource(context, name, source, length) != ASSEMBLER_SUCCESS_S)
+        return ASSEMBLER_FAILURE_S;
+    return assembleProgram(context);
+}
+
+/* preprocessSource - frees the results of the previous call and runs only the preprocessor, assembleProgram
+ * runs the rest. Returns ASSEMBLER_SUCCESS_S (context->stage is then STAGE_FIRST_PASS) or ASSEMBLER_FAILURE_S
+ */
+ErrCode preprocessSource(AssemblerContext *context, const char *name, const char *source, size_t length)
+{
+    ErrCode errCode;
+
+    clearAssemblerResults(context);
+    memset(context->codeImage, 0, sizeof(context->codeImage));
+    memset(context->dataImage, 0, sizeof(context->dataImage));
+
+    context->name = strDup(name);
+    context->macroTable = context->name != NULL ? createRunMacroTable(context) : NULL;
+    context->symbolTable = createSymbolTable();
+    context->errorList = createErrorList(context->name);
+    if (context->name == NULL || context->macroTable == NULL || context->symbolTable == NULL || context->errorList == NULL) {
+        if (context->errorList != NULL)
+            addErrorToList(context->errorList, MALLOC_ERROR_F);
+        return ASSEMBLER_FAILURE_S;
+    }
+    context->errorList->maxErrors = context->maxErrors;
+
+    context->stage = STAGE_PREPROCESSOR;
+    context->errorList->stage = "preprocessor";
+    addAllocSourceLines(source, length);
+    enterStage(context, STAGE_PREPROCESSOR);
+    errCode = executePreprocessor(source, length, &context->amText, context->macroTable, context->errorList);
+    enterStage(context, STAGE_DONE);
+    if (errCode == PREPROCESSOR_FAILURE_S)
+        return ASSEMBLER_FAILURE_S;
+
+    context->stage = STAGE_FIRST_PASS;
+    return ASSEMBLER_SUCCESS_S;
+}
+
+/* assembleProgram - runs both passes on the .am text of a successful preprocessSource.
+ * Returns ASSEMBLER_SUCCESS_S or ASSEMBLER_FAILURE_S.
+ */
+ErrCode assembleProgram(AssemblerContext *context)
+{
+    ErrCode errCode;
+    ParsedProgram* program = NULL; /* the lexed .am lines */
+    TaskObserver chunks; /* the chunk hook of the passes */
+
+    if (context->stage != STAGE_FIRST_PASS) /* the preprocessor failed or the program was already assembled */
+        return context->stage == STAGE_DONE ? ASSEMBLER_SUCCESS_S : ASSEMBLER_FAILURE_S;
+
+    context->errorList->stage = "first pass";
+    enterStage(context, STAGE_FIRST_PASS);
+    chunks.hook = context->chunkHook;
+    chunks.hookArg = context->hookArg;
+    errCode = executeFirstPass(&context->amText, &program, context->checkOnly ? NULL : context->dataImage,
+                               &context->DCF, &context->ICF, context->macroTable, context->symbolTable,
+                               context->errorList, context->jobs, &chunks);
+    if (errCode == FIRSTPASS_FAILURE_S) {
+        enterStage(context, STAGE_DONE);
+        freeParsedProgram(program);
+        return ASSEMBLER_FAILURE_S;
+    }
+
+    context->stage = STAGE_SECOND_PASS;
+    context->errorList->stage = "second pass";
+    enterStage(context, STAGE_SECOND_PASS);
+    errCode = executeSecondPass(program, context->symbolTable, context->checkOnly ? NULL : context->codeImage,
+                                &context->ICF, &context->externs, context->errorList, context->jobs, &chunks);
+    enterStage(context, STAGE_DONE);
+    if (errCode == SECOND_PASS_FAILURE_S) {
+        freeParsedProgram(program);
+        return ASSEMBLER_FAILURE_S;
+    }
+
+    if (!context->checkOnly &&
+        collectEntries(context->symbolTable, &context->entries, &context->entryCount) != UTIL_SUCCESS_S) {
+        freeParsedProgram(program);
+        addErrorToList(context->errorList, MALLOC_ERROR_F);
+        return ASSEMBLER_FAILURE_S;
+    }
+    if (!context->incremental || context->checkOnly || keepProgram(context, program) != UTIL_SUCCESS_S)
+        freeParsedProgram(program); /* keepProgram failing only costs the next run its head start */
+
+    context->stage = STAGE_DONE;
+    return ASSEMBLER_SUCCESS_S;
+}
@@ -0,0 +1,78 @@
+#ifndef ASSEMBLER_H
+#define ASSEMBLER_H
+#include "global.h"
+#include "error.h"
+#include "tables.h"
+#include "util.h" /* for TextBuffer */
+#include "writeFiles.h" /* for ExternList and EntryRec */
+#include "lexer.h" /* for ParsedProgram */
+#include "parallel.h" /* for TaskHook */
+#include "macroLibrary.h" /* for MacroLibraries */
+
+/* the library interface of the assembler: it assembles source text held in memory and keeps every result in
+ * an AssemblerContext, every thread can assemble with its own context.
+ * it keeps no state of its own between the contexts: what they share is given to them by the caller, the compiled
+ * macro libraries (macroLibraries) and the reader of the files the source includes (readInclude). the only process
+ * wide state is the allocation counters of allocStats.h, counted only once they are enabled (--alloc-stats).
+ * the trace file (trace.h) and the perf counters belong to the command line, not to the library.
+ * it doesn't print or write files, the caller decides what to do with the results (main.c writes them to disk).
+ * the file of every mcroinclude and .incbin line is read with readInclude, its path resolved against
+ * sourceDirectory and the name of the source (main.c reads them from disk, readIncludeFromDisk). the binary files
+ * are kept until the program is freed, the macro table lists every file that was read (includedFiles) */
+
+typedef enum AssemblerStage { /* the stages of assembleSource in the order they run */
+    STAGE_PREPROCESSOR,
+    STAGE_FIRST_PASS,
+    STAGE_SECOND_PASS,
+    STAGE_DONE /* all stages passed */
+} AssemblerStage;
+
+/* called as every stage of context starts and with STAGE_DONE when the library returns or stops between stages */
+typedef void (*StageHook)(void *hookArg, AssemblerStage stage);
+
+typedef struct AssemblerContext {
+    /* options, read by assembleSource */
+    unsigned int jobs; /* threads used by the passes */
+    unsigned int maxErrors; /* stop a stage after this many errors, 0 for no limit */
+    Bool incremental; /* keep the line IR of a successful run and reassemble only the edit of the next one (incremental.h) */
+    Bool checkOnly; /* only report the errors: no code or data image, no extern use-sites or entries (--check) */
+    const char *sourceDirectory; /* the directory of the source, for its includes (mcroinclude, .incbin), NULL for the working directory */
+    IncludeReader readInclude; /* reads the included files (tables.h), NULL fails every include */
+    void *readerArg; /* passed to readInclude */
+    MacroLibraries *macroLibraries; /* the compiled macro libraries shared with other contexts, NULL to compile them for every run */
+    StageHook stageHook; /* NULL for none, for profiling (--perf) */
+    TaskHook chunkHook; /* NULL for none, called on its own thread around every chunk of the passes (--trace) */
+    void *hookArg; /* passed to stageHook and chunkHook */
+
+    /* results of the last assembleSource call */
+    char *name; /* the name given to assembleSource, used in the error messages */
+    AssemblerStage stage; /* the stage that failed, STAGE_DONE if the source assembled */
+    AssemblerStage running; /* the stage that runs now, STAGE_DONE between them (see enterStage) */
+    TextBuffer amText; /* the source after the preprocessor (the .am file) */
+    CodeWord codeImage[MAX_MEMORY_SIZE];
+    DataWord dataImage[MAX_MEMORY_SIZE];
+    unsigned int ICF; /* words in codeImage */
+    unsigned int DCF; /* words in dataImage */
+    EntryRec *entries; /* the entry symbols (the .ent file) */
+    unsigned int entryCount;
+    ExternList externs; /* the extern use-sites (the .ext file) */
+    MacroTable *macroTable;
+    SymbolTable *symbolTable;
+    ErrorList *errorList; /* the diagnostics of the stage that ran last */
+    ParsedProgram *program; /* the kept line IR, NULL unless incremental and the last run succeeded */
+    ExternList *lineExterns; /* the kept extern use-sites of every line of program */
+} AssemblerContext;
+
+AssemblerContext* createAssemblerContext(void); /* a context with the default options, NULL if malloc failed */
+/* assemble length bytes of source, returns ASSEMBLER_SUCCESS_S or ASSEMBLER_FAILURE_S (see context->stage) */
+ErrCode assembleSource(AssemblerContext *context, const char *name, const char *source, size_t length);
+/* assembleSource in two steps, so the stages of different files can run at the same time (no incremental reassembly) */
+ErrCode preprocessSource(AssemblerContext *context, const char *name, const char *source, size_t length);
+ErrCode assembleProgram(AssemblerContext *context); /* the passes, after a successful preprocessSource */
+void clearAssemblerResults(AssemblerContext *context); /* free the results of the last call, keeps the options */
+void freeAssemblerContext(AssemblerContext *context);
+void enterStage(AssemblerContext *context, AssemblerStage stage); /* used by the stages to call stageHook */
+/* the macro table of a run of context: reads the includes of context->name, NULL if malloc failed */
+MacroTable* createRunMacroTable(const AssemblerContext *context);
+
+#endif
@@ -0,0 +1,142 @@
+#define _POSIX_C_SOURCE 200809L /* for clock_gettime */
+#include "bench.h"
+#include "global.h"
+#include "error.h"
+#include "assembler.h"
+#include "driver.h"
+#include "util.h"
+#include <time.h>
+
+#define BENCH_OUTPUT 3 /* the indexes of the stages that aren't AssemblerStage */
+#define BENCH_TOTAL 4
+
+static const char *const stageNames[BENCH_STAGES] = {"preprocessor", "first pass", "second pass", "output", "total"};
+
+typedef struct BenchRun { /* the times of the run that is measured, the hookArg of its context */
+    double *times[BENCH_STAGES]; /* the ms of every run of every stage */
+    unsigned int run;
+    AssemblerStage stage; /* the stage that runs, STAGE_DONE for none */
+    double start; /* when it started */
+} BenchRun;
+
+static double nowMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+/* benchStageHook - charges the time since the last call to the stage that ran */
+static void benchStageHook(void *arg, AssemblerStage stage)
+{
+    BenchRun *bench = (BenchRun*)arg;
+    double now = nowMs();
+
+    if (bench->stage != STAGE_DONE)
+        bench->times[bench->stage][bench->run] += now - bench->start;
+    bench->stage = stage;
+    bench->start = now;
+}
+
+/* measureRun - assembles the source once, its report goes to memory and is dropped */
+static void measureRun(BenchRun *bench, char *fileName, const TextBuffer *source, AssemblerContext *context)
+{
+    OutputTarget target;
+    double start = nowMs(), output;
+    int stage;
+
+    for (stage = 0; stage < BENCH_STAGES; stage++)
+        bench->times[stage][bench->run] = 0;
+    assembleSource(context, fileName, source->text != NULL ? source->text : "", source->length);
+
+    output = nowMs();
+    if (initCaptureTarget(&target) == UTIL_SUCCESS_S) {
+        reportAssembly(fileName, context, &target);
+        closeOutputTarget(&target);
+        freeOutputTarget(&target);
+    }
+    bench->times[BENCH_OUTPUT][bench->run] = nowMs() - output;
+    bench->times[BENCH_TOTAL][bench->run] = nowMs() - start;
+}
+
+static int compareTimes(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* printBench - sorts the times of every stage and prints their min, median and p99 */
+static void printBench(BenchRun *bench, const char *fileName, unsigned int runs, unsigned long lines)
+{
+    unsigned int p99 = (runs * 99 + 99) / 100 - 1; /* the index of the 99th percentile (rounded up) */
+    double sum = 0;
+    unsigned int i;
+    int stage;
+
+    for (i = 0; i < runs; i++)
+        sum += bench->times[BENCH_TOTAL][i];
+    printf("bench %s: %u runs, %lu lines\n  %-13s %11s %11s %11s\n", fileName, runs, lines, "stage", "min ms",
+           "median ms", "p99 ms");
+    for (stage = 0; stage < BENCH_STAGES; stage++) {
+        qsort(bench->times[stage], runs, sizeof(double), compareTimes);
+        printf("  %-13s %11.4f %11.4f %11.4f\n", stageNames[stage], bench->times[stage][0],
+               bench->times[stage][runs / 2], bench->times[stage][p99]);
+    }
+    if (sum > 0)
+        printf("  %.0f lines/sec (median run %.0f lines/sec)\n", (double)lines * runs / (sum / 1000.0),
+               bench->times[BENCH_TOTAL][runs / 2] > 0 ? lines / (bench->times[BENCH_TOTAL][runs / 2] / 1000.0) : 0.0);
+}
+
+/* runBench - reads fileName.as and measures runs assemblies of it */
+ErrCode runBench(char *fileName, unsigned int runs, unsigned int jobs, unsigned int maxErrors, MacroLibraries *libraries)
+{
+    AssemblerContext *context;
+    TextBuffer source;
+    BenchRun bench;
+    ErrCode errCode;
+    unsigned long lines = 0;
+    size_t i;
+    int stage, made = 0;
+
+    initTextBuffer(&source);
+    errCode = readSourceFile(fileName, NULL, &source);
+    if (errCode != UTIL_SUCCESS_S) {
+        freeTextBuffer(&source);
+        return errCode;
+    }
+    for (i = 0; i < source.length; i++)
+        if (source.text[i] == '\n')
+            lines++;
+
+    context = createAssemblerContext();
+    for (; context != NULL && made < BENCH_STAGES; made++) {
+        bench.times[made] = malloc(sizeof(double) * runs);
+        if (bench.times[made] == NULL)
+            break;
+    }
+    if (made < BENCH_STAGES) {
+        for (stage = 0; stage < made; stage++)
+            free(bench.times[stage]);
+        freeAssemblerContext(context);
+        freeTextBuffer(&source);
+        return MALLOC_ERROR_F;
+    }
+    context->jobs = jobs;
+    context->maxErrors = maxErrors;
+    useDiskIncludes(context, libraries);
+    context->stageHook = benchStageHook;
+    context->hookArg = &bench;
+    bench.stage = STAGE_DONE;
+
+    for (bench.run = 0; bench.run < runs; bench.run++)
+        measureRun(&bench, fileName, &source, context);
+    if (context->stage != STAGE_DONE)
+        printf("note: %s doesn't assemble, the stages after the failed one were not measured\n", fileName);
+    printBench(&bench, fileName, runs, lines);
+
+    for (stage = 0; stage < BENCH_STAGES; stage++)
+        free(bench.times[stage]);
+    freeAssemblerContext(context);
+    freeTextBuffer(&source);
+    return UTIL_SUCCESS_S;
+}
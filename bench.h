@@ -0,0 +1,16 @@
+#ifndef BENCH_H
+#define BENCH_H
+#include "global.h"
+#include "error.h"
+#include "macroLibrary.h" /* for MacroLibraries */
+
+/* benchmark mode (--bench N): reads a file once and assembles it N times in this process, reporting the output
+ * into memory and dropping it, then prints the min, median and p99 time of every stage and the lines per second.
+ * only the assembler is measured, not the disk */
+
+#define BENCH_STAGES 5 /* preprocessor, first pass, second pass, output, total */
+#define MAX_BENCH_RUNS 1000000
+
+ErrCode runBench(char *fileName, unsigned int runs, unsigned int jobs, unsigned int maxErrors, MacroLibraries *libraries);
+
+#endif
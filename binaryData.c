@@ -0,0 +1,71 @@
+#include "binaryData.h"
+#include "global.h"
+#include "error.h"
+#include "tables.h"
+#include "util.h"
+#include "allocStats.h"
+
+static int signExtend(unsigned int value)
+{
+    return value & 0x200u ? (int)value - 0x400 : (int)value;
+}
+
+/* packedWord - word i of the file, for the words outside of a whole group */
+static int packedWord(const unsigned char *bytes, unsigned int i)
+{
+    unsigned long bit = (unsigned long)i * PACKED_WORD_BITS;
+    unsigned int low = bytes[bit / 8], high = bytes[bit / 8 + 1]; /* 10 bits always span 2 bytes of the file */
+    return signExtend(((low | high << 8) >> (bit % 8)) & 0x3FFu);
+}
+
+/* hasZeroPadding - the bits after the last word are 0 */
+static Bool hasZeroPadding(const PackedData *data)
+{
+    unsigned long usedBits = (unsigned long)data->wordCount * PACKED_WORD_BITS;
+    if (usedBits == (unsigned long)data->file.size * 8)
+        return TRUE;
+    return (data->file.bytes[data->file.size - 1] >> (usedBits % 8)) == 0;
+}
+
+ErrCode readPackedFile(MacroTable *table, const char *path, PackedData *data, ContentHash *fileHash)
+{
+    data->wordCount = 0;
+    if (readIncludedData(table, path, &data->file) != UTIL_SUCCESS_S)
+        return BINARY_FILE_UNREADABLE_E;
+    initContentHash(fileHash);
+    updateContentHash(fileHash, data->file.bytes, data->file.size);
+    if (data->file.size == 0 || (unsigned long)data->file.size * 8 / PACKED_WORD_BITS > MAX_MEMORY_SIZE) {
+        releasePackedFile(data);
+        return BINARY_FILE_SIZE_E;
+    }
+    data->wordCount = (unsigned int)(data->file.size * 8 / PACKED_WORD_BITS);
+    if (data->file.size * 8 - (size_t)data->wordCount * PACKED_WORD_BITS >= 8 || !hasZeroPadding(data)) {
+        releasePackedFile(data); /* a whole byte too many, or padding that looks like a cut word */
+        return BINARY_FILE_PADDING_E;
+    }
+    return UTIL_SUCCESS_S;
+}
+
+void releasePackedFile(PackedData *data)
+{
+    releaseIncludedData(&data->file);
+    data->wordCount = 0;
+}
+
+void unpackWords(const PackedData *data, unsigned int first, unsigned int count, DataWord words[])
+{
+    const unsigned char *group;
+    unsigned int i = 0, end = first + count < data->wordCount ? first + count : data->wordCount;
+
+    for (; first < end && first % PACKED_WORDS_PER_GROUP != 0; first++) /* up to the start of a group */
+        words[i++].value = packedWord(data->file.bytes, first);
+    for (; first + PACKED_WORDS_PER_GROUP <= end; first += PACKED_WORDS_PER_GROUP) { /* 4 words from 5 bytes */
+        group = data->file.bytes + first / PACKED_WORDS_PER_GROUP * PACKED_BYTES_PER_GROUP;
+        words[i++].value = signExtend((group[0] | group[1] << 8) & 0x3FFu);
+        words[i++].value = signExtend((group[1] >> 2 | group[2] << 6) & 0x3FFu);
+        words[i++].value = signExtend((group[2] >> 4 | group[3] << 4) & 0x3FFu);
+        words[i++].value = signExtend((group[3] >> 6 | group[4] << 2) & 0x3FFu);
+    }
+    for (; first < end; first++) /* the words of the last group */
+        words[i++].value = packedWord(data->file.bytes, first);
+}
@@ -0,0 +1,33 @@
+#ifndef BINARY_DATA_H
+#define BINARY_DATA_H
+#include "global.h"
+#include "error.h"
+#include "tables.h" /* for IncludedData and the reader of the table */
+#include "util.h" /* for ContentHash */
+
+/* binary includes: LABEL: .incbin "path" puts the words of a binary file in the data image, the file is read
+ * by the lexer with the include reader of the macro table (the command line maps it) and decoded by the first
+ * pass straight into the image, it never goes through the text.
+ * the file is packed 10 bit words, little endian: word i is bits 10i to 10i+9 of the file, bit 0 being the lowest
+ * bit of the first byte, and each word is a signed (two's complement) data word.
+ * the bits after the last word must be 0 and fewer than 8, so the file has exactly the bytes its words need.
+ * path is relative to the directory of the .as file */
+
+#define BINARY_DIRECTIVE ".incbin"
+#define PACKED_WORD_BITS 10
+#define PACKED_WORDS_PER_GROUP 4 /* 4 words are 5 whole bytes */
+#define PACKED_BYTES_PER_GROUP 5
+
+typedef struct PackedData { /* a binary file, kept as the reader gave it */
+    IncludedData file;
+    unsigned int wordCount;
+} PackedData;
+
+/* reads the file at path with the reader of table and checks it: BINARY_FILE_UNREADABLE_E, BINARY_FILE_SIZE_E,
+ * BINARY_FILE_PADDING_E. fileHash is the hash of the contents unless it is BINARY_FILE_UNREADABLE_E */
+ErrCode readPackedFile(MacroTable *table, const char *path, PackedData *data, ContentHash *fileHash);
+void releasePackedFile(PackedData *data);
+/* decodes count words of data from word first on into words */
+void unpackWords(const PackedData *data, unsigned int first, unsigned int count, DataWord words[]);
+
+#endif
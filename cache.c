@@ -0,0 +1,220 @@
+#define _POSIX_C_SOURCE 200809L /* for mkdir and getpid */
+#include "cache.h"
+#include "global.h"
+#include "driver.h"
+#include "error.h"
+#include "util.h"
+#include "macroLibrary.h" /* for IncludedFile */
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "allocStats.h"
+
+/* writeReplacing - writes length bytes to a temporary file next to path and renames it, so readers never see half
+ * of it. a failed write is ignored, the cache is only an optimization */
+static void writeReplacing(const char *path, const char *data, size_t length)
+{
+    char *temporaryPath = malloc(strlen(path) + 32);
+    FILE *fp;
+    Bool written;
+
+    if (temporaryPath == NULL)
+        return;
+    sprintf(temporaryPath, "%s.%ld", path, (long)getpid());
+    fp = fopen(temporaryPath, "wb");
+    if (fp != NULL) {
+        written = fwrite(data, 1, length, fp) == length;
+        if (fclose(fp) != 0 || !written || rename(temporaryPath, path) != 0)
+            remove(temporaryPath);
+    }
+    free(temporaryPath);
+}
+
+/* hashExecutable - hashes the running executable into version. the hash is kept in the VERSION_STAMP_FILE of
+ * the directory with the identity of the file it was read from (device, inode, size, modification time), so it
+ * is only read again after the assembler was rebuilt */
+static void hashExecutable(const char *directory, ContentHash *version)
+{
+    char identity[128], stamp[128 + CONTENT_HASH_DIGITS + 2], digits[CONTENT_HASH_DIGITS + NULL_TERMINATOR];
+    char *path = malloc(strlen(directory) + strlen(VERSION_STAMP_FILE) + 2);
+    struct stat info;
+    ContentHash hash;
+    size_t n, identityLength;
+    FILE *fp;
+
+    if (path == NULL || stat(SELF_EXECUTABLE, &info) != 0) {
+        free(path);
+        return; /* only ASSEMBLER_VERSION */
+    }
+    sprintf(path, "%s/%s", directory, VERSION_STAMP_FILE);
+    sprintf(identity, "%lu %lu %ld %ld %ld ", (unsigned long)info.st_dev, (unsigned long)info.st_ino,
+            (long)info.st_size, (long)info.st_mtim.tv_sec, (long)info.st_mtim.tv_nsec);
+    identityLength = strlen(identity);
+
+    fp = fopen(path, "rb");
+    n = fp != NULL ? fread(stamp, 1, sizeof(stamp) - 1, fp) : 0;
+    if (fp != NULL)
+        fclose(fp);
+    stamp[n] = '\0';
+    if (n == identityLength + CONTENT_HASH_DIGITS && strncmp(stamp, identity, identityLength) == 0 &&
+        parseContentHash(stamp + identityLength, &hash)) {
+        updateContentHash(version, (const char*)hash.lanes, sizeof(hash.lanes));
+        free(path);
+        return;
+    }
+
+    if (!hashFile(SELF_EXECUTABLE, &hash)) {
+        free(path);
+        return;
+    }
+    updateContentHash(version, (const char*)hash.lanes, sizeof(hash.lanes));
+
+    formatContentHash(&hash, digits);
+    sprintf(stamp, "%s%s", identity, digits);
+    writeReplacing(path, stamp, strlen(stamp));
+    free(path);
+}
+
+ErrCode openBuildCache(BuildCache *cache, const char *directory)
+{
+    if (mkdir(directory, 0777) != 0 && errno != EEXIST)
+        return CACHE_DIRECTORY_ERROR_F;
+    cache->directory = directory;
+
+    initContentHash(&cache->version);
+    updateContentHash(&cache->version, ASSEMBLER_VERSION, strlen(ASSEMBLER_VERSION));
+    hashExecutable(directory, &cache->version); /* a rebuilt assembler never reuses the runs of the old one */
+    return UTIL_SUCCESS_S;
+}
+
+/* cachePath - directory/key.run */
+static char* cachePath(const BuildCache *cache, const ContentHash *key)
+{
+    char *path = malloc(strlen(cache->directory) + CONTENT_HASH_DIGITS + strlen(CACHE_FILE_ENDING) + 2);
+    char digits[CONTENT_HASH_DIGITS + NULL_TERMINATOR];
+
+    if (path == NULL)
+        return NULL;
+    formatContentHash(key, digits);
+    sprintf(path, "%s/%s%s", cache->directory, digits, CACHE_FILE_ENDING);
+    return path;
+}
+
+/* loadCachedRun - reads the run stored under key, FALSE if there is none */
+static Bool loadCachedRun(const BuildCache *cache, const ContentHash *key, TextBuffer *frames)
+{
+    char *path = cachePath(cache, key);
+    FILE *fp = path != NULL ? fopen(path, "rb") : NULL;
+    Bool found = FALSE;
+
+    if (fp != NULL) {
+        found = readFileText(fp, frames) == UTIL_SUCCESS_S;
+        fclose(fp);
+    }
+    freeStrings(path, NULL, NULL);
+    return found;
+}
+
+/* storeCachedRun - writes the run under key */
+static void storeCachedRun(const BuildCache *cache, const ContentHash *key, const TextBuffer *frames)
+{
+    char *path = cachePath(cache, key);
+
+    if (path != NULL)
+        writeReplacing(path, frames->text, frames->length);
+    freeStrings(path, NULL, NULL);
+}
+
+/* appendIncludedFiles - an INCLUDE frame for every file the run read: the hash digits of its contents (dashes if
+ * it couldn't be read) and its path */
+static ErrCode appendIncludedFiles(TextBuffer *frames, const IncludedFile *file)
+{
+    TextBuffer data;
+    char digits[CONTENT_HASH_DIGITS + NULL_TERMINATOR];
+    ErrCode errCode = UTIL_SUCCESS_S;
+
+    initTextBuffer(&data);
+    for (; file != NULL && errCode == UTIL_SUCCESS_S; file = file->next) {
+        if (file->found)
+            formatContentHash(&file->hash, digits);
+        else
+            memset(digits, '-', CONTENT_HASH_DIGITS);
+        data.length = 0;
+        errCode = appendBytes(&data, digits, CONTENT_HASH_DIGITS);
+        if (errCode == UTIL_SUCCESS_S)
+            errCode = appendBytes(&data, file->path, strlen(file->path));
+        if (errCode == UTIL_SUCCESS_S)
+            errCode = appendFrame(frames, FRAME_INCLUDE, data.text, data.length);
+    }
+    freeTextBuffer(&data);
+    return errCode;
+}
+
+/* sameIncludedFiles - every file the stored run read still has the contents it had (or is still missing) */
+static Bool sameIncludedFiles(const TextBuffer *frames)
+{
+    size_t position = 0, dataLength;
+    const char *data;
+    FrameTag tag;
+    ContentHash stored, current;
+    char *path;
+    Bool same = TRUE, found;
+
+    while (same && nextFrame(frames->text, frames->length, &position, &tag, &data, &dataLength) && tag != FRAME_END) {
+        if (tag != FRAME_INCLUDE)
+            continue;
+        if (dataLength <= CONTENT_HASH_DIGITS ||
+            (path = strnDup(data + CONTENT_HASH_DIGITS, (unsigned int)(dataLength - CONTENT_HASH_DIGITS))) == NULL)
+            return FALSE;
+        found = hashFile(path, &current);
+        if (data[0] == '-')
+            same = !found;
+        else
+            same = found && parseContentHash(data, &stored) && sameContentHash(&stored, &current);
+        free(path);
+    }
+    return same;
+}
+
+Bool assembleWithCache(BuildCache *cache, char *fileName, AssemblerContext *context)
+{
+    TextBuffer source, frames;
+    OutputTarget target;
+    ContentHash key;
+    char options[32];
+    Bool done = FALSE, recorded;
+
+    initTextBuffer(&source);
+    initTextBuffer(&frames);
+    if (readSourceFile(fileName, NULL, &source) != UTIL_SUCCESS_S) {
+        freeTextBuffer(&source);
+        return FALSE; /* executeAssembler reports it */
+    }
+
+    key = cache->version;
+    sprintf(options, "%u", context->maxErrors); /* the number of jobs doesn't change the output */
+    updateContentHash(&key, options, strlen(options) + NULL_TERMINATOR);
+    updateContentHash(&key, fileName, strlen(fileName) + NULL_TERMINATOR); /* the messages have the name */
+    updateContentHash(&key, source.text, source.length);
+
+    if (loadCachedRun(cache, &key, &frames) && sameIncludedFiles(&frames) &&
+        replayCapturedRun(frames.text, frames.length, fileName))
+        done = TRUE;
+    else if (initCaptureTarget(&target) == UTIL_SUCCESS_S) {
+        frames.length = 0;
+        executeAssembler(fileName, source.text != NULL ? source.text : "", source.length, context, &target);
+        recorded = context->macroTable != NULL && /* the files it read go first, a run without them isn't stored */
+                   appendIncludedFiles(&frames, context->macroTable->includedFiles) == UTIL_SUCCESS_S;
+        if (encodeCapturedRun(&target, &frames) == UTIL_SUCCESS_S && replayCapturedRun(frames.text, frames.length, fileName)) {
+            if (recorded)
+                storeCachedRun(cache, &key, &frames);
+            done = TRUE;
+        }
+        freeOutputTarget(&target);
+    }
+
+    freeTextBuffer(&source);
+    freeTextBuffer(&frames);
+    return done;
+}
@@ -0,0 +1,29 @@
+#ifndef CACHE_H
+#define CACHE_H
+#include "global.h"
+#include "error.h"
+#include "util.h" /* for ContentHash */
+#include "assembler.h"
+
+/* the build cache: a directory of captured runs (see driver.h) keyed by a hash of the assembler itself, the
+ * options that change the output, the file name and the .as contents. a stored run starts with an INCLUDE frame
+ * for every file it read (mcroinclude and .incbin, wherever the line came from), and is only used while they
+ * still have the contents they had. on a hit the run is replayed (its messages printed and its files written)
+ * without assembling anything.
+ * the keys are 128 bit content hashes (util.h), the executable is hashed once per build of it (VERSION_STAMP_FILE) */
+
+#define ASSEMBLER_VERSION "mman14 3" /* hashed into every key, with the running executable when it can be read */
+#define CACHE_FILE_ENDING ".run"
+#define SELF_EXECUTABLE "/proc/self/exe"
+#define VERSION_STAMP_FILE "assembler.version" /* the hash of the executable, read once per build of it */
+
+typedef struct BuildCache {
+    const char *directory;
+    ContentHash version; /* the hash of ASSEMBLER_VERSION and the running executable */
+} BuildCache;
+
+ErrCode openBuildCache(BuildCache *cache, const char *directory); /* makes the directory if it is missing */
+/* replays fileName from the cache or assembles it and stores it, FALSE if fileName.as can't be read (nothing done) */
+Bool assembleWithCache(BuildCache *cache, char *fileName, AssemblerContext *context);
+
+#endif
@@ -0,0 +1,256 @@
+#define _POSIX_C_SOURCE 200809L /* for lstat, open_memstream and sysconf */
+#include "check.h"
+#include "global.h"
+#include "error.h"
+#include "assembler.h"
+#include "driver.h"
+#include "parallel.h"
+#include "util.h"
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "allocStats.h"
+
+typedef struct CheckFiles { /* the file names to check, without .as */
+    char **names;
+    unsigned int count;
+    unsigned int capacity;
+} CheckFiles;
+
+typedef struct CheckResult { /* what checking one file printed */
+    char *text; /* NULL if it printed nothing */
+    size_t length;
+    Bool failed;
+} CheckResult;
+
+typedef struct CheckRun { /* shared by the workers */
+    CheckFiles *files;
+    CheckResult *results; /* one for every file */
+    unsigned int next; /* the next file a worker takes */
+    unsigned int maxErrors;
+    MacroLibraries *libraries; /* shared by the contexts of the workers */
+    pthread_mutex_t lock;
+} CheckRun;
+
+typedef struct CheckWorker { /* the task argument of a worker */
+    CheckRun *run;
+} CheckWorker;
+
+/* addCheckFile - adds path (the .as ending is dropped) to files */
+static ErrCode addCheckFile(CheckFiles *files, const char *path)
+{
+    size_t length = strlen(path), ending = strlen(CHECK_EXTENSION);
+    char **names;
+
+    if (files->count == files->capacity) {
+        names = realloc(files->names, sizeof(char*) * (files->capacity == 0 ? 64 : files->capacity * 2));
+        if (names == NULL)
+            return MALLOC_ERROR_F;
+        files->names = names;
+        files->capacity = files->capacity == 0 ? 64 : files->capacity * 2;
+    }
+    if (length > ending && strcmp(path + length - ending, CHECK_EXTENSION) == 0)
+        length -= ending; /* readSourceFile adds it */
+    files->names[files->count] = strnDup(path, (unsigned int)length);
+    if (files->names[files->count] == NULL)
+        return MALLOC_ERROR_F;
+    files->count++;
+    return UTIL_SUCCESS_S;
+}
+
+/* walkDirectory - adds every .as file under directory, returns CHECK_PATH_ERROR_F for a directory that can't be read */
+static ErrCode walkDirectory(CheckFiles *files, const char *directory)
+{
+    DIR *dir = opendir(directory);
+    struct dirent *entry;
+    struct stat info;
+    size_t length, ending = strlen(CHECK_EXTENSION);
+    char *path;
+    ErrCode errCode = UTIL_SUCCESS_S, walkCode;
+
+    if (dir == NULL) {
+        printErrorMsg(CHECK_PATH_ERROR_F, directory, 0);
+        return CHECK_PATH_ERROR_F;
+    }
+    while (errCode != MALLOC_ERROR_F && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        path = malloc(strlen(directory) + strlen(entry->d_name) + 2);
+        if (path == NULL) {
+            errCode = MALLOC_ERROR_F;
+            break;
+        }
+        sprintf(path, "%s/%s", directory, entry->d_name);
+        length = strlen(entry->d_name);
+
+        if (lstat(path, &info) != 0) /* removed since it was listed */
+            walkCode = UTIL_SUCCESS_S;
+        else if (S_ISDIR(info.st_mode))
+            walkCode = walkDirectory(files, path);
+        else if (length > ending && strcmp(entry->d_name + length - ending, CHECK_EXTENSION) == 0)
+            walkCode = addCheckFile(files, path); /* a file or a link to one, it is read through the link */
+        else
+            walkCode = UTIL_SUCCESS_S;
+        if (walkCode != UTIL_SUCCESS_S)
+            errCode = walkCode;
+        free(path);
+    }
+    closedir(dir);
+    return errCode;
+}
+
+/* collectCheckFiles - the files of paths, walking the directories. a directory that can't be read is reported
+ * and the rest are still checked */
+static ErrCode collectCheckFiles(CheckFiles *files, char const *paths[], unsigned int pathCount)
+{
+    struct stat info;
+    ErrCode errCode = UTIL_SUCCESS_S, pathCode;
+    unsigned int i;
+
+    for (i = 0; i < pathCount && errCode != MALLOC_ERROR_F; i++) {
+        if (stat(paths[i], &info) == 0 && S_ISDIR(info.st_mode))
+            pathCode = walkDirectory(files, paths[i]);
+        else
+            pathCode = addCheckFile(files, paths[i]); /* a missing file is reported when it is read */
+        if (pathCode != UTIL_SUCCESS_S)
+            errCode = pathCode;
+    }
+    return errCode;
+}
+
+static int compareNames(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* checkFile - checks one file on the context of the worker and prints its errors to stream */
+static Bool checkFile(char *fileName, AssemblerContext *context, FILE *stream)
+{
+    TextBuffer source;
+    ErrCode errCode;
+
+    initTextBuffer(&source);
+    errCode = readSourceFile(fileName, NULL, &source);
+    if (errCode != UTIL_SUCCESS_S) {
+        fprintf(stream, "Error opening file %s.as: %s\n", fileName, getErrorMessage(errCode));
+        freeTextBuffer(&source);
+        return FALSE;
+    }
+    assembleSource(context, fileName, source.text != NULL ? source.text : "", source.length);
+    freeTextBuffer(&source);
+
+    if (context->errorList == NULL) {
+        fprintErrorMsg(stream, MALLOC_ERROR_F, fileName, 0);
+        return FALSE;
+    }
+    if (context->stage != STAGE_DONE) {
+        printErrors(stream, context->errorList);
+        fprintf(stream, "\n");
+        return FALSE;
+    }
+    if (context->ICF + context->DCF > MEMORY_WARNING_WORDS)
+        fprintf(stream, "Warning: %s: ICF + DCF exceeds %d\n", fileName, MEMORY_WARNING_WORDS);
+    return TRUE;
+}
+
+/* checkWorker - takes the next file until there are none left, every file is printed into its own result */
+static void checkWorker(void *arg)
+{
+    CheckRun *run = ((CheckWorker*)arg)->run;
+    AssemblerContext *context = createAssemblerContext();
+    CheckResult *result;
+    FILE *stream;
+    unsigned int file;
+
+    if (context != NULL) { /* the passes run on this thread (jobs 1), the files are the parallel work */
+        context->checkOnly = TRUE;
+        context->maxErrors = run->maxErrors;
+        useDiskIncludes(context, run->libraries);
+    }
+    for (;;) {
+        pthread_mutex_lock(&run->lock);
+        file = run->next++;
+        pthread_mutex_unlock(&run->lock);
+        if (file >= run->files->count)
+            break;
+
+        result = &run->results[file];
+        stream = open_memstream(&result->text, &result->length);
+        if (stream == NULL || context == NULL) {
+            result->failed = TRUE;
+            if (stream != NULL)
+                fclose(stream);
+            continue; /* no text, reported as out of memory */
+        }
+        result->failed = !checkFile(run->files->names[file], context, stream);
+        fclose(stream);
+    }
+    freeAssemblerContext(context);
+}
+
+/* workerCount - jobs, or one per processor for 0, no more than there are files */
+static unsigned int workerCount(unsigned int jobs, unsigned int fileCount)
+{
+    long processors;
+
+    if (jobs == 0) {
+        processors = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = processors < 1 ? 1 : processors > MAX_JOBS ? MAX_JOBS : (unsigned int)processors;
+    }
+    return jobs < fileCount ? jobs : fileCount;
+}
+
+int runCheck(char const *paths[], unsigned int pathCount, unsigned int jobs, unsigned int maxErrors, MacroLibraries *libraries)
+{
+    CheckFiles files;
+    CheckRun run;
+    CheckWorker workers[MAX_JOBS];
+    unsigned int i, failed = 0, workersAmount;
+    ErrCode errCode;
+
+    files.names = NULL;
+    files.count = 0;
+    files.capacity = 0;
+    errCode = collectCheckFiles(&files, paths, pathCount);
+    if (errCode == MALLOC_ERROR_F)
+        printErrorMsg(errCode, "check", 0);
+    if (files.count > 0)
+        qsort(files.names, files.count, sizeof(char*), compareNames);
+
+    run.files = &files;
+    run.results = calloc(files.count > 0 ? files.count : 1, sizeof(CheckResult));
+    run.next = 0;
+    run.maxErrors = maxErrors;
+    run.libraries = libraries;
+    if (run.results == NULL) {
+        printErrorMsg(MALLOC_ERROR_F, "check", 0);
+        for (i = 0; i < files.count; i++)
+            free(files.names[i]);
+        free(files.names);
+        return 1;
+    }
+    pthread_mutex_init(&run.lock, NULL);
+
+    workersAmount = workerCount(jobs, files.count);
+    for (i = 0; i < workersAmount; i++)
+        workers[i].run = &run;
+    if (workersAmount > 0)
+        runParallel(checkWorker, workers, sizeof(CheckWorker), workersAmount);
+
+    for (i = 0; i < files.count; i++) { /* in the order of the names */
+        if (run.results[i].length > 0)
+            fwrite(run.results[i].text, 1, run.results[i].length, stderr);
+        else if (run.results[i].failed)
+            printErrorMsg(MALLOC_ERROR_F, files.names[i], 0);
+        if (run.results[i].failed)
+            failed++;
+        free(run.results[i].text);
+        free(files.names[i]);
+    }
+    printf("checked %u file(s), %u with errors\n", files.count, failed);
+
+    pthread_mutex_destroy(&run.lock);
+    free(run.results);
+    free(files.names);
+    return failed > 0 || errCode != UTIL_SUCCESS_S ? 1 : 0;
+}
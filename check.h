@@ -0,0 +1,19 @@
+#ifndef CHECK_H
+#define CHECK_H
+#include "global.h"
+#include "error.h"
+#include "macroLibrary.h" /* for MacroLibraries */
+
+/* lint mode (--check): validates many files without building them. the given paths are files or directories,
+ * directories are walked for .as files (symbolic links to directories aren't followed).
+ * every file runs the preprocessor, the first pass and the symbol resolution of the second pass on its own
+ * context, the files are spread over the threads and no code or data image, .am, .ob, .ent or .ext is made.
+ * the errors are printed in the order of the sorted file names, whatever order the files finished in */
+
+#define CHECK_EXTENSION ".as"
+
+/* checks the files of paths on up to jobs threads (0 for one per processor), returns the exit code:
+ * 0 if every file is valid, 1 if any file has errors or couldn't be read */
+int runCheck(char const *paths[], unsigned int pathCount, unsigned int jobs, unsigned int maxErrors, MacroLibraries *libraries);
+
+#endif
@@ -0,0 +1,506 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+/* dfaGen - compiles the token grammar (lexer.grammar) into a byte class DFA for the lexer
+ * usage: dfaGen grammarFile outputBase   (writes outputBase.c and outputBase.h)
+ *
+ * every grammar line is "TOKEN_NAME pattern", a pattern is made of:
+ *   c       a literal byte          .      any byte
+ *   [set]   bytes and a-b ranges    [^set] every byte not in the set
+ *   (p|q)   alternatives            p* p+ p?  repeats
+ *   \s whitespace, \d digits, \xHH a byte, \c the byte c itself
+ * the patterns are turned into one NFA (Thompson construction), then into a DFA (subset construction),
+ * and bytes that move every state the same way are merged into one byte class.
+ * a string can match several tokens, so every DFA state keeps a bit mask of the tokens it accepts */
+
+#define MAX_GRAMMAR_LINE 512
+#define MAX_TOKEN_NAME 64
+#define MAX_RULES 32 /* one bit per rule in the accept masks */
+#define MAX_NFA_STATES 4096
+#define MAX_DFA_STATES 1024
+#define BYTE_VALUES 256
+#define SET_WORDS (BYTE_VALUES / 32)
+#define NFA_WORDS (MAX_NFA_STATES / 32)
+#define NO_STATE -1
+#define DEAD_STATE 0 /* the DFA state of the empty set */
+#define START_STATE 1
+
+typedef struct NfaState {
+    int epsilon[2]; /* up to two empty moves, NO_STATE if unused */
+    int next; /* the target of the byte move, NO_STATE if there is none */
+    unsigned int bytes[SET_WORDS]; /* the bytes of the byte move */
+    unsigned int accept; /* the bits of the rules that end in this state */
+} NfaState;
+
+typedef struct Fragment { /* a piece of the NFA with one entry and one exit (the exit has no moves yet) */
+    int start;
+    int end;
+} Fragment;
+
+static NfaState nfa[MAX_NFA_STATES];
+static int nfaCount = 0;
+
+static unsigned int dfaSets[MAX_DFA_STATES][NFA_WORDS]; /* the NFA states of every DFA state */
+static int dfaNext[MAX_DFA_STATES][BYTE_VALUES];
+static unsigned int dfaAccept[MAX_DFA_STATES];
+static int dfaCount = 0;
+
+static char ruleNames[MAX_RULES][MAX_TOKEN_NAME];
+static int ruleCount = 0;
+
+static const char *pattern; /* the pattern being parsed */
+static int grammarLine = 0; /* for error messages */
+
+static void fail(const char *message)
+{
+    fprintf(stderr, "dfaGen: line %d: %s\n", grammarLine, message);
+    exit(1);
+}
+
+static void addByte(unsigned int set[], int byte)
+{
+    set[byte / 32] |= 1u << (byte % 32);
+}
+
+static int hasByte(const unsigned int set[], int byte)
+{
+    return (set[byte / 32] >> (byte % 32)) & 1u;
+}
+
+static int newState(void)
+{
+    NfaState *state;
+
+    if (nfaCount == MAX_NFA_STATES)
+        fail("grammar too large (increase MAX_NFA_STATES)");
+    state = &nfa[nfaCount];
+    state->epsilon[0] = NO_STATE;
+    state->epsilon[1] = NO_STATE;
+    state->next = NO_STATE;
+    memset(state->bytes, 0, sizeof(state->bytes));
+    state->accept = 0;
+    return nfaCount++;
+}
+
+static void addEpsilon(int from, int to)
+{
+    if (nfa[from].epsilon[0] == NO_STATE)
+        nfa[from].epsilon[0] = to;
+    else if (nfa[from].epsilon[1] == NO_STATE)
+        nfa[from].epsilon[1] = to;
+    else
+        fail("internal error - too many empty moves");
+}
+
+/* a fragment that reads one byte of the set */
+static Fragment byteFragment(const unsigned int set[])
+{
+    Fragment f;
+
+    f.start = newState();
+    f.end = newState();
+    nfa[f.start].next = f.end;
+    memcpy(nfa[f.start].bytes, set, sizeof(nfa[f.start].bytes));
+    return f;
+}
+
+static int hexValue(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    fail("bad \\x escape");
+    return 0;
+}
+
+/* reads an escape (after the '\') into set, returns the byte if it is a single byte or -1 for a class */
+static int parseEscape(unsigned int set[])
+{
+    int byte;
+    char c = *pattern++;
+
+    if (c == 's') {
+        addByte(set, ' '); addByte(set, '\t'); addByte(set, '\n');
+        addByte(set, '\v'); addByte(set, '\f'); addByte(set, '\r');
+        return -1;
+    }
+    if (c == 'd') {
+        for (byte = '0'; byte <= '9'; byte++)
+            addByte(set, byte);
+        return -1;
+    }
+    if (c == 'x') {
+        byte = hexValue(pattern[0]) * 16 + hexValue(pattern[1]);
+        pattern += 2;
+    }
+    else if (c == '\0')
+        fail("pattern ends with '\\'");
+    else
+        byte = (unsigned char)c;
+
+    if (byte == 0)
+        fail("the byte 0 can't be matched");
+    addByte(set, byte);
+    return byte;
+}
+
+/* reads a [set] (after the '[') */
+static Fragment parseSet(void)
+{
+    unsigned int set[SET_WORDS];
+    int negate = 0, byte, last;
+
+    memset(set, 0, sizeof(set));
+    if (*pattern == '^') {
+        negate = 1;
+        pattern++;
+    }
+
+    while (*pattern != ']') {
+        if (*pattern == '\0')
+            fail("missing ']'");
+        if (*pattern == '\\') {
+            pattern++;
+            byte = parseEscape(set);
+        }
+        else {
+            byte = (unsigned char)*pattern++;
+            addByte(set, byte);
+        }
+
+        if (byte != -1 && pattern[0] == '-' && pattern[1] != ']' && pattern[1] != '\0') { /* a range */
+            pattern++;
+            if (*pattern == '\\') {
+                unsigned int end[SET_WORDS];
+                pattern++;
+                memset(end, 0, sizeof(end));
+                last = parseEscape(end);
+                if (last == -1)
+                    fail("a range can't end with a class");
+            }
+            else
+                last = (unsigned char)*pattern++;
+            for (; byte <= last; byte++)
+                addByte(set, byte);
+        }
+    }
+    pattern++; /* skip the ']' */
+
+    if (negate)
+        for (byte = 1; byte < BYTE_VALUES; byte++)
+            set[byte / 32] ^= 1u << (byte % 32);
+    set[0] &= ~1u; /* never the byte 0 */
+    return byteFragment(set);
+}
+
+static Fragment parseAlternation(void);
+
+static Fragment parseAtom(void)
+{
+    unsigned int set[SET_WORDS];
+    Fragment f;
+    int byte;
+
+    memset(set, 0, sizeof(set));
+    switch (*pattern) {
+        case '(':
+            pattern++;
+            f = parseAlternation();
+            if (*pattern != ')')
+                fail("missing ')'");
+            pattern++;
+            return f;
+        case '[':
+            pattern++;
+            return parseSet();
+        case '\\':
+            pattern++;
+            parseEscape(set);
+            return byteFragment(set);
+        case '.':
+            pattern++;
+            for (byte = 1; byte < BYTE_VALUES; byte++)
+                addByte(set, byte);
+            return byteFragment(set);
+        case '*': case '+': case '?':
+            fail("repeat with nothing before it");
+            break;
+        default:
+            addByte(set, (unsigned char)*pattern++);
+            return byteFragment(set);
+    }
+    return byteFragment(set); /* not reached */
+}
+
+static Fragment parseRepeat(void)
+{
+    Fragment f = parseAtom();
+
+    while (*pattern == '*' || *pattern == '+' || *pattern == '?') {
+        Fragment r;
+        r.start = newState();
+        r.end = newState();
+        addEpsilon(r.start, f.start);
+        if (*pattern != '+')
+            addEpsilon(r.start, r.end); /* zero times */
+        if (*pattern != '?')
+            addEpsilon(f.end, f.start); /* again */
+        addEpsilon(f.end, r.end);
+        pattern++;
+        f = r;
+    }
+    return f;
+}
+
+static Fragment parseConcatenation(void)
+{
+    Fragment f, g;
+
+    f.start = f.end = newState(); /* an empty fragment */
+    while (*pattern != '\0' && *pattern != '|' && *pattern != ')') {
+        g = parseRepeat();
+        addEpsilon(f.end, g.start);
+        f.end = g.end;
+    }
+    return f;
+}
+
+static Fragment parseAlternation(void)
+{
+    Fragment f = parseConcatenation();
+
+    while (*pattern == '|') {
+        Fragment g, a;
+        pattern++;
+        g = parseConcatenation();
+        a.start = newState();
+        a.end = newState();
+        addEpsilon(a.start, f.start);
+        addEpsilon(a.start, g.start);
+        addEpsilon(f.end, a.end);
+        addEpsilon(g.end, a.end);
+        f = a;
+    }
+    return f;
+}
+
+/* adds the empty move closure of the states in set to set */
+static void closure(unsigned int set[])
+{
+    static int stack[MAX_NFA_STATES];
+    int top = 0, s, i;
+
+    for (s = 0; s < nfaCount; s++)
+        if ((set[s / 32] >> (s % 32)) & 1u)
+            stack[top++] = s;
+
+    while (top > 0) {
+        s = stack[--top];
+        for (i = 0; i < 2; i++) {
+            int t = nfa[s].epsilon[i];
+            if (t != NO_STATE && !((set[t / 32] >> (t % 32)) & 1u)) {
+                set[t / 32] |= 1u << (t % 32);
+                stack[top++] = t;
+            }
+        }
+    }
+}
+
+/* returns the DFA state of the NFA set, adding it if it is new */
+static int findDfaState(const unsigned int set[])
+{
+    int d, s;
+
+    for (d = 0; d < dfaCount; d++)
+        if (memcmp(dfaSets[d], set, sizeof(dfaSets[d])) == 0)
+            return d;
+
+    if (dfaCount == MAX_DFA_STATES)
+        fail("grammar too large (increase MAX_DFA_STATES)");
+    memcpy(dfaSets[dfaCount], set, sizeof(dfaSets[dfaCount]));
+    dfaAccept[dfaCount] = 0;
+    for (s = 0; s < nfaCount; s++)
+        if ((set[s / 32] >> (s % 32)) & 1u)
+            dfaAccept[dfaCount] |= nfa[s].accept;
+    return dfaCount++;
+}
+
+static void buildDfa(int nfaStart)
+{
+    unsigned int set[NFA_WORDS];
+    int d, byte, s;
+
+    memset(set, 0, sizeof(set));
+    findDfaState(set); /* DEAD_STATE */
+    set[nfaStart / 32] |= 1u << (nfaStart % 32);
+    closure(set);
+    findDfaState(set); /* START_STATE */
+
+    for (d = 0; d < dfaCount; d++) { /* dfaCount grows while we go */
+        dfaNext[d][0] = DEAD_STATE;
+        for (byte = 1; byte < BYTE_VALUES; byte++) {
+            memset(set, 0, sizeof(set));
+            for (s = 0; s < nfaCount; s++)
+                if (((dfaSets[d][s / 32] >> (s % 32)) & 1u) && nfa[s].next != NO_STATE && hasByte(nfa[s].bytes, byte))
+                    set[nfa[s].next / 32] |= 1u << (nfa[s].next % 32);
+            closure(set);
+            dfaNext[d][byte] = findDfaState(set);
+        }
+    }
+}
+
+/* bytes with the same column in the transition table share a class, returns the number of classes */
+static int buildByteClasses(int byteClass[], int classByte[])
+{
+    int classes = 0, byte, other, d;
+
+    for (byte = 0; byte < BYTE_VALUES; byte++) {
+        byteClass[byte] = -1;
+        for (other = 0; other < byte && byteClass[byte] == -1; other++) {
+            for (d = 0; d < dfaCount && dfaNext[d][byte] == dfaNext[d][other]; d++)
+                ;
+            if (d == dfaCount)
+                byteClass[byte] = byteClass[other];
+        }
+        if (byteClass[byte] == -1) {
+            classByte[classes] = byte; /* the first byte of the class stands for it */
+            byteClass[byte] = classes++;
+        }
+    }
+    return classes;
+}
+
+static void readGrammar(FILE *fp, int nfaStart)
+{
+    char line[MAX_GRAMMAR_LINE];
+    int link = nfaStart; /* the start state has an empty move to every rule, through a chain of link states */
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char *name = line, *end;
+        Fragment f;
+
+        grammarLine++;
+        line[strcspn(line, "\r\n")] = '\0';
+        while (*name == ' ' || *name == '\t')
+            name++;
+        if (*name == '\0' || *name == '#') /* empty line or comment */
+            continue;
+
+        end = name + strcspn(name, " \t");
+        if (*end == '\0')
+            fail("missing pattern");
+        *end = '\0';
+        if (strlen(name) >= MAX_TOKEN_NAME)
+            fail("token name too long");
+        if (ruleCount == MAX_RULES)
+            fail("too many tokens");
+
+        pattern = end + 1;
+        while (*pattern == ' ' || *pattern == '\t')
+            pattern++;
+        f = parseAlternation();
+        if (*pattern != '\0')
+            fail("unexpected ')'");
+
+        strcpy(ruleNames[ruleCount], name);
+        nfa[f.end].accept |= 1u << ruleCount;
+        addEpsilon(link, f.start);
+        addEpsilon(link, newState());
+        link = nfa[link].epsilon[1];
+        ruleCount++;
+    }
+}
+
+static void writeHeader(FILE *fp, int classes)
+{
+    int r;
+
+    fprintf(fp, "/* generated by dfaGen from the token grammar - do not edit */\n");
+    fprintf(fp, "#ifndef LEXER_DFA_H\n#define LEXER_DFA_H\n\n");
+    fprintf(fp, "#define DFA_STATES %d\n#define DFA_CLASSES %d\n", dfaCount, classes);
+    fprintf(fp, "#define DFA_DEAD_STATE %d\n#define DFA_START_STATE %d\n\n", DEAD_STATE, START_STATE);
+    for (r = 0; r < ruleCount; r++)
+        fprintf(fp, "#define TOKEN_%s 0x%xu\n", ruleNames[r], 1u << r);
+    fprintf(fp, "\nextern const unsigned char dfaByteClass[%d]; /* the class of every byte */\n", BYTE_VALUES);
+    fprintf(fp, "extern const unsigned short dfaNext[DFA_STATES][DFA_CLASSES]; /* the next state by state and byte class */\n");
+    fprintf(fp, "extern const unsigned int dfaAccept[DFA_STATES]; /* the TOKEN_ bits a string ending in the state matches */\n");
+    fprintf(fp, "\n#endif\n");
+}
+
+static void writeTables(FILE *fp, const char *base, const int byteClass[], const int classByte[], int classes)
+{
+    int byte, d, c;
+
+    fprintf(fp, "/* generated by dfaGen from the token grammar - do not edit */\n");
+    fprintf(fp, "#include \"%s.h\"\n\n", strrchr(base, '/') != NULL ? strrchr(base, '/') + 1 : base);
+
+    fprintf(fp, "const unsigned char dfaByteClass[%d] = {", BYTE_VALUES);
+    for (byte = 0; byte < BYTE_VALUES; byte++)
+        fprintf(fp, "%s%d%s", byte % 16 == 0 ? "\n    " : " ", byteClass[byte], byte + 1 < BYTE_VALUES ? "," : "\n");
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "const unsigned short dfaNext[DFA_STATES][DFA_CLASSES] = {\n");
+    for (d = 0; d < dfaCount; d++) {
+        fprintf(fp, "    {");
+        for (c = 0; c < classes; c++)
+            fprintf(fp, "%d%s", dfaNext[d][classByte[c]], c + 1 < classes ? ", " : "");
+        fprintf(fp, "}%s\n", d + 1 < dfaCount ? "," : "");
+    }
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "const unsigned int dfaAccept[DFA_STATES] = {");
+    for (d = 0; d < dfaCount; d++)
+        fprintf(fp, "%s0x%xu%s", d % 8 == 0 ? "\n    " : " ", dfaAccept[d], d + 1 < dfaCount ? "," : "\n");
+    fprintf(fp, "};\n");
+}
+
+static FILE* openOutput(const char *base, const char *extension)
+{
+    char name[MAX_GRAMMAR_LINE];
+    FILE *fp;
+
+    if (strlen(base) + strlen(extension) >= sizeof(name))
+        fail("output name too long");
+    sprintf(name, "%s%s", base, extension);
+    fp = fopen(name, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "dfaGen: can't write %s\n", name);
+        exit(1);
+    }
+    return fp;
+}
+
+int main(int argc, char *argv[])
+{
+    int byteClass[BYTE_VALUES], classByte[BYTE_VALUES];
+    int classes, start;
+    FILE *fp;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: dfaGen grammarFile outputBase\n");
+        return 1;
+    }
+
+    fp = fopen(argv[1], "r");
+    if (fp == NULL) {
+        fprintf(stderr, "dfaGen: can't read %s\n", argv[1]);
+        return 1;
+    }
+    start = newState();
+    readGrammar(fp, start);
+    fclose(fp);
+    if (ruleCount == 0)
+        fail("no tokens in the grammar");
+
+    buildDfa(start);
+    classes = buildByteClasses(byteClass, classByte);
+
+    fp = openOutput(argv[2], ".h");
+    writeHeader(fp, classes);
+    fclose(fp);
+    fp = openOutput(argv[2], ".c");
+    writeTables(fp, argv[2], byteClass, classByte, classes);
+    fclose(fp);
+    return 0;
+}
@@ -0,0 +1,458 @@
+#define _POSIX_C_SOURCE 200809L /* for open_memstream, mmap and fstat */
+#include "driver.h"
+#include "global.h"
+#include "assembler.h"
+#include "writeFiles.h"
+#include "error.h"
+#include "tables.h"
+#include "util.h"
+#include "trace.h"
+#include "allocStats.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+const char *const outputEndings[OUTPUT_ENDINGS] = {".am", ".ob", ".ent", ".ext"};
+
+static const FrameTag fileFrames[OUTPUT_ENDINGS] = {FRAME_FILE_AM, FRAME_FILE_OB, FRAME_FILE_ENT, FRAME_FILE_EXT};
+
+static void initCapturedText(CapturedText *captured)
+{
+    captured->stream = NULL;
+    captured->text = NULL;
+    captured->length = 0;
+}
+
+/* openCapturedText - (re)opens a memory stream, its text is valid once the stream is closed */
+static FILE* openCapturedText(CapturedText *captured)
+{
+    if (captured->text != NULL)
+        free(captured->text);
+    captured->text = NULL;
+    captured->length = 0;
+    captured->stream = open_memstream(&captured->text, &captured->length);
+    return captured->stream;
+}
+
+static void closeCapturedText(CapturedText *captured)
+{
+    if (captured->stream != NULL)
+        fclose(captured->stream);
+    captured->stream = NULL;
+}
+
+static void freeCapturedText(CapturedText *captured)
+{
+    closeCapturedText(captured);
+    if (captured->text != NULL)
+        free(captured->text);
+    initCapturedText(captured);
+}
+
+void initOutputTarget(OutputTarget *target, FILE *out, FILE *err)
+{
+    int i;
+    target->out = out;
+    target->err = err;
+    target->directory = NULL;
+    target->capture = FALSE;
+    initCapturedText(&target->outText);
+    initCapturedText(&target->errText);
+    for (i = 0; i < OUTPUT_ENDINGS; i++)
+        initCapturedText(&target->files[i]);
+}
+
+ErrCode initCaptureTarget(OutputTarget *target)
+{
+    initOutputTarget(target, NULL, NULL);
+    target->capture = TRUE;
+    target->out = openCapturedText(&target->outText);
+    target->err = openCapturedText(&target->errText);
+    if (target->out == NULL || target->err == NULL) {
+        freeOutputTarget(target);
+        return MALLOC_ERROR_F;
+    }
+    return UTIL_SUCCESS_S;
+}
+
+void closeOutputTarget(OutputTarget *target)
+{
+    int i;
+    closeCapturedText(&target->outText);
+    closeCapturedText(&target->errText);
+    for (i = 0; i < OUTPUT_ENDINGS; i++)
+        closeCapturedText(&target->files[i]);
+}
+
+void freeOutputTarget(OutputTarget *target)
+{
+    int i;
+    freeCapturedText(&target->outText);
+    freeCapturedText(&target->errText);
+    for (i = 0; i < OUTPUT_ENDINGS; i++)
+        freeCapturedText(&target->files[i]);
+}
+
+/* openOutputFile - opens fileName.ending for writing, or a memory stream if the target captures the files */
+static FILE* openOutputFile(OutputTarget *target, const char *fileName, OutputEnding ending, ErrCode *errCode)
+{
+    CapturedText *captured = &target->files[ending];
+
+    if (!target->capture)
+        return openFile(fileName, outputEndings[ending], "w", errCode);
+
+    if (captured->stream == NULL) /* a second open of the same ending (never happens) keeps writing the first */
+        openCapturedText(captured);
+    *errCode = captured->stream != NULL ? UTIL_SUCCESS_S : MALLOC_ERROR_F;
+    return captured->stream;
+}
+
+/* closeOutputFile - closes a file of openOutputFile, captured files stay open until closeOutputTarget */
+static void closeOutputFile(OutputTarget *target, FILE *fp)
+{
+    if (!target->capture)
+        freeFiles(fp, NULL, NULL);
+}
+
+static void unmapIncludedData(IncludedData *data)
+{
+    munmap((void*)data->bytes, data->size);
+}
+
+/* readIncludeFromDisk - maps the file at path (mmap), an empty file has no bytes. a directory or another file that
+ * isn't a regular file can't be read */
+ErrCode readIncludeFromDisk(void *readerArg, const char *path, IncludedData *data)
+{
+    struct stat info;
+    void *bytes;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return INPUT_FILE_UNREADABLE_F;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        close(fd);
+        return INPUT_FILE_UNREADABLE_F;
+    }
+    if (info.st_size == 0) { /* an empty file can't be mapped */
+        close(fd);
+        return UTIL_SUCCESS_S;
+    }
+    bytes = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); /* the mapping stays */
+    if (bytes == MAP_FAILED)
+        return INPUT_FILE_UNREADABLE_F;
+    data->bytes = (const unsigned char*)bytes;
+    data->size = (size_t)info.st_size;
+    data->release = unmapIncludedData;
+    return UTIL_SUCCESS_S;
+}
+
+void useDiskIncludes(AssemblerContext *context, MacroLibraries *libraries)
+{
+    context->readInclude = readIncludeFromDisk;
+    context->readerArg = NULL;
+    context->macroLibraries = libraries;
+}
+
+/* readSourceFile - reads fileName.as (from directory if it isn't NULL and fileName is relative) into source */
+ErrCode readSourceFile(const char *fileName, const char *directory, TextBuffer *source)
+{
+    ErrCode errCode = NULL_INITIAL;
+    FILE *asFile;
+    char *prefix = NULL, *path = NULL;
+
+    if (directory != NULL && fileName[0] != '/') {
+        prefix = mergeStrings(directory, "/");
+        path = prefix != NULL ? mergeStrings(prefix, fileName) : NULL;
+        if (path == NULL) {
+            freeStrings(prefix, NULL, NULL);
+            return MALLOC_ERROR_F;
+        }
+    }
+
+    asFile = openFile(path != NULL ? path : fileName, ".as", "r", &errCode);
+    freeStrings(prefix, path, NULL);
+    if (errCode == FILE_READ_ERROR_F)
+        errCode = INPUT_FILE_UNREADABLE_F;
+    if (errCode != UTIL_SUCCESS_S)
+        return errCode;
+
+    errCode = readFileText(asFile, source);
+    freeFiles(asFile, NULL, NULL);
+    return errCode;
+}
+
+/* executeAssembler - assembles fileName.as (or the given source), prints the progress and the errors to the
+ * target and writes the .am, .ob, .ent and .ext files */
+void executeAssembler(char* fileName, const char *source, size_t length, AssemblerContext *context, OutputTarget *target)
+{
+    ErrCode errCode = NULL_INITIAL;
+    TextBuffer sourceText; /* the whole .as file */
+    double start = traceClock();
+
+    initTextBuffer(&sourceText);
+    if (source == NULL) {
+        errCode = readSourceFile(fileName, target->directory, &sourceText);
+        if (errCode != UTIL_SUCCESS_S) {
+            reportReadError(fileName, errCode, target);
+            freeTextBuffer(&sourceText);
+            traceSpan(fileName, "file", fileName, start); /* the context still has the results of the last file */
+            return;
+        }
+        source = sourceText.text != NULL ? sourceText.text : "";
+        length = sourceText.length;
+    }
+
+    context->sourceDirectory = target->directory; /* its includes are next to it */
+    assembleSource(context, fileName, source, length);
+    context->sourceDirectory = NULL;
+    freeTextBuffer(&sourceText);
+    reportAssembly(fileName, context, target);
+    traceFile(fileName, context, start);
+}
+
+void reportReadError(char *fileName, ErrCode errCode, OutputTarget *target)
+{
+    fprintf(target->out, "Starting preprocessor...\n");
+    fprintf(target->out, "Error opening file %s.as: %s\n", fileName, getErrorMessage(errCode));
+}
+
+/* reportAssembly - prints the progress and the errors of the assembled context and writes its files */
+void reportAssembly(char *fileName, AssemblerContext *context, OutputTarget *target)
+{
+    ErrCode errCode = NULL_INITIAL;
+    FILE *amFile = NULL;
+
+    fprintf(target->out, "Starting preprocessor...\n");
+    if (context->errorList == NULL) {
+        fprintErrorMsg(target->err, MALLOC_ERROR_F, "tables", 0);
+        return;
+    }
+    if (context->stage == STAGE_PREPROCESSOR) { /* the .am file is only written after a successful preprocessor */
+        printErrors(target->err, context->errorList);
+        return;
+    }
+
+    amFile = openOutputFile(target, fileName, OUTPUT_AM, &errCode);
+    if (errCode != UTIL_SUCCESS_S) {
+        fprintf(target->out, "Error opening file %s.am: %s\n", fileName, getErrorMessage(errCode));
+        return;
+    }
+    if (context->amText.text != NULL)
+        fputs(context->amText.text, amFile);
+    closeOutputFile(target, amFile);
+    fprintf(target->out, "\nPreprocessor executed successfully.\n");
+
+    fprintf(target->out, "Starting first pass...\n");
+    if (context->stage == STAGE_FIRST_PASS) {
+        printErrors(target->err, context->errorList);
+        return;
+    }
+    fprintf(target->out, "\nFirst pass executed successfully.\n");
+
+    fprintf(target->out, "Starting second pass...\n");
+    if (context->stage == STAGE_SECOND_PASS) {
+        printSymbolTableSorted(target->out, context->symbolTable);
+        printErrors(target->err, context->errorList);
+        return;
+    }
+
+    if (context->ICF + context->DCF > MEMORY_WARNING_WORDS){
+        fprintf(target->out, "Warning: ICF + DCF exceeds %d\n", MEMORY_WARNING_WORDS);
+    }
+
+    fprintf(target->out, "Writing output files...\n");
+    setAllocStage(ALLOC_STAGE_OUTPUT);
+    if (writeOutputFiles(fileName, context, target) == UTIL_SUCCESS_S)
+        fprintf(target->out, "Successfully executed file %s\n", fileName);
+    setAllocStage(ALLOC_STAGE_OTHER);
+}
+
+/* writeOutputFiles - writes the .ob file and the .ent and .ext files if they aren't empty */
+ErrCode writeOutputFiles(char* fileName, AssemblerContext *context, OutputTarget *target)
+{
+    ErrCode errCode = NULL_INITIAL;
+    FILE *obFile, *entFile, *extFile;
+    double start;
+
+    obFile = openOutputFile(target, fileName, OUTPUT_OB, &errCode);
+    if (errCode != UTIL_SUCCESS_S) {
+        fprintf(target->out, "Error opening file %s.ob: %s\n", fileName, getErrorMessage(errCode));
+        return errCode;
+    }
+    start = traceClock();
+    writeObjectFile(obFile, context->codeImage, context->ICF, context->dataImage, context->DCF);
+    closeOutputFile(target, obFile);
+    traceSpan("writeObjectFile", "output", fileName, start);
+
+    if (context->entryCount > 0) {
+        start = traceClock();
+        entFile = openOutputFile(target, fileName, OUTPUT_ENT, &errCode);
+        if (errCode == UTIL_SUCCESS_S)
+            errCode = writeEntryFile(entFile, context->entries, context->entryCount);
+        if (errCode != UTIL_SUCCESS_S)
+            fprintf(target->out, "Error writing .ent file: %s\n", getErrorMessage(errCode));
+        closeOutputFile(target, entFile);
+        traceSpan("writeEntryFile", "output", fileName, start);
+    }
+
+    if (context->externs.head != NULL) {
+        start = traceClock();
+        extFile = openOutputFile(target, fileName, OUTPUT_EXT, &errCode);
+        if (errCode == UTIL_SUCCESS_S)
+            errCode = writeExternFile(extFile, &context->externs);
+        if (errCode != UTIL_SUCCESS_S)
+            fprintf(target->out, "Error writing .ext file: %s\n", getErrorMessage(errCode));
+        closeOutputFile(target, extFile);
+        traceSpan("writeExternFile", "output", fileName, start);
+    }
+
+    return UTIL_SUCCESS_S;
+}
+
+/* writeDescriptor - writes a captured file to the file descriptor fd and closes it */
+static Bool writeDescriptor(int fd, const CapturedText *captured)
+{
+    FILE *fp = fdopen(fd, "w");
+    Bool written;
+
+    if (fp == NULL)
+        return FALSE;
+    written = captured->length == 0 || fwrite(captured->text, 1, captured->length, fp) == captured->length;
+    return fclose(fp) == 0 && written;
+}
+
+Bool assembleStream(FILE *input, FILE *output, int entFd, int extFd, AssemblerContext *context)
+{
+    OutputTarget target;
+    TextBuffer source, frames;
+    Bool written = TRUE;
+    int ending;
+
+    initTextBuffer(&source);
+    initTextBuffer(&frames);
+    if (readFileText(input, &source) != UTIL_SUCCESS_S || initCaptureTarget(&target) != UTIL_SUCCESS_S) {
+        printErrorMsg(MALLOC_ERROR_F, STREAM_SOURCE_NAME, 0);
+        freeTextBuffer(&source);
+        return FALSE;
+    }
+    executeAssembler(STREAM_SOURCE_NAME, source.text != NULL ? source.text : "", source.length, context, &target);
+    freeTextBuffer(&source);
+    closeOutputTarget(&target);
+
+    /* stdout only has the output, the messages go to stderr */
+    fwrite(target.outText.text, 1, target.outText.length, stderr);
+    fwrite(target.errText.text, 1, target.errText.length, stderr);
+
+    if (entFd == NO_DESCRIPTOR && extFd == NO_DESCRIPTOR) {
+        for (ending = OUTPUT_OB; ending <= OUTPUT_EXT && written; ending++)
+            if (target.files[ending].text != NULL)
+                written = appendFrame(&frames, fileFrames[ending], target.files[ending].text, target.files[ending].length) == UTIL_SUCCESS_S;
+        written = written && appendFrame(&frames, FRAME_END, NULL, 0) == UTIL_SUCCESS_S &&
+                  fwrite(frames.text, 1, frames.length, output) == frames.length;
+    }
+    else {
+        if (target.files[OUTPUT_OB].text != NULL)
+            written = fwrite(target.files[OUTPUT_OB].text, 1, target.files[OUTPUT_OB].length, output) == target.files[OUTPUT_OB].length;
+        if (entFd != NO_DESCRIPTOR) /* closed even if there are no entries, so the reader sees the end */
+            written = writeDescriptor(entFd, &target.files[OUTPUT_ENT]) && written;
+        if (extFd != NO_DESCRIPTOR)
+            written = writeDescriptor(extFd, &target.files[OUTPUT_EXT]) && written;
+    }
+    written = fflush(output) == 0 && written;
+    if (!written)
+        printErrorMsg(FILE_WRITE_ERROR_F, STREAM_SOURCE_NAME, 0);
+
+    freeOutputTarget(&target);
+    freeTextBuffer(&frames);
+    return written && context->stage == STAGE_DONE;
+}
+
+/* captured runs */
+
+ErrCode appendFrame(TextBuffer *frames, FrameTag tag, const char *data, size_t length)
+{
+    char header[FRAME_HEADER_LENGTH];
+    header[0] = (char)tag;
+    header[1] = (char)((length >> 24) & 0xFF);
+    header[2] = (char)((length >> 16) & 0xFF);
+    header[3] = (char)((length >> 8) & 0xFF);
+    header[4] = (char)(length & 0xFF);
+    if (appendBytes(frames, header, FRAME_HEADER_LENGTH) != UTIL_SUCCESS_S)
+        return MALLOC_ERROR_F;
+    return length == 0 ? UTIL_SUCCESS_S : appendBytes(frames, data, length);
+}
+
+Bool nextFrame(const char *frames, size_t length, size_t *position, FrameTag *tag, const char **data, size_t *dataLength)
+{
+    const unsigned char *header = (const unsigned char*)frames + *position;
+    unsigned long frameLength;
+
+    if (*position + FRAME_HEADER_LENGTH > length)
+        return FALSE;
+    frameLength = ((unsigned long)header[1] << 24) | ((unsigned long)header[2] << 16) | ((unsigned long)header[3] << 8) | header[4];
+    if (frameLength > MAX_FRAME_LENGTH || frameLength > length - *position - FRAME_HEADER_LENGTH)
+        return FALSE;
+
+    *tag = (FrameTag)header[0];
+    *data = frames + *position + FRAME_HEADER_LENGTH;
+    *dataLength = (size_t)frameLength;
+    *position += FRAME_HEADER_LENGTH + (size_t)frameLength;
+    return TRUE;
+}
+
+ErrCode encodeCapturedRun(OutputTarget *target, TextBuffer *frames)
+{
+    int i;
+
+    closeOutputTarget(target);
+    if (appendFrame(frames, FRAME_STDOUT, target->outText.text, target->outText.length) != UTIL_SUCCESS_S ||
+        appendFrame(frames, FRAME_STDERR, target->errText.text, target->errText.length) != UTIL_SUCCESS_S)
+        return MALLOC_ERROR_F;
+    for (i = 0; i < OUTPUT_ENDINGS; i++)
+        if (target->files[i].text != NULL && /* only the files that were written */
+            appendFrame(frames, fileFrames[i], target->files[i].text, target->files[i].length) != UTIL_SUCCESS_S)
+            return MALLOC_ERROR_F;
+    return appendFrame(frames, FRAME_END, NULL, 0);
+}
+
+/* writeCapturedFile - writes one output file of a captured run */
+static void writeCapturedFile(char *fileName, OutputEnding ending, const char *data, size_t length)
+{
+    ErrCode errCode = NULL_INITIAL;
+    FILE *fp = openFile(fileName, outputEndings[ending], "w", &errCode);
+
+    if (errCode != UTIL_SUCCESS_S) {
+        printf("Error opening file %s%s: %s\n", fileName, outputEndings[ending], getErrorMessage(errCode));
+        return;
+    }
+    if (length > 0)
+        fwrite(data, 1, length, fp);
+    freeFiles(fp, NULL, NULL);
+}
+
+Bool replayCapturedRun(const char *frames, size_t length, char *fileName)
+{
+    size_t position = 0, dataLength;
+    const char *data;
+    FrameTag tag = FRAME_STDOUT;
+    int i;
+
+    while (nextFrame(frames, length, &position, &tag, &data, &dataLength) && tag != FRAME_END)
+        ;
+    if (tag != FRAME_END) /* cut, don't replay half a run */
+        return FALSE;
+
+    position = 0;
+    while (nextFrame(frames, length, &position, &tag, &data, &dataLength) && tag != FRAME_END) {
+        if (tag == FRAME_STDOUT && dataLength > 0)
+            fwrite(data, 1, dataLength, stdout);
+        else if (tag == FRAME_STDERR && dataLength > 0)
+            fwrite(data, 1, dataLength, stderr);
+        for (i = 0; i < OUTPUT_ENDINGS; i++)
+            if (tag == fileFrames[i])
+                writeCapturedFile(fileName, (OutputEnding)i, data, dataLength);
+    }
+    return TRUE;
+}
@@ -0,0 +1,96 @@
+#ifndef DRIVER_H
+#define DRIVER_H
+#include "global.h"
+#include "error.h"
+#include "assembler.h"
+
+/* the command line side of the assembler: reads a .as file, assembles it with the library (assembler.h),
+ * prints the progress and error messages and writes the output files.
+ * everything goes through an OutputTarget so a run can be captured in memory and replayed later, by the client
+ * of the server (server.h) or from the build cache (cache.h).
+ * a captured run is a list of frames, a frame is a tag byte, a 4 byte big endian length and length bytes:
+ * STDOUT, STDERR, a FILE_ frame for every output file that was written, END */
+
+#define OUTPUT_ENDINGS 4 /* .am .ob .ent .ext */
+#define MEMORY_WARNING_WORDS 164 /* more code and data words than this get a warning */
+
+typedef enum OutputEnding {
+    OUTPUT_AM,
+    OUTPUT_OB,
+    OUTPUT_ENT,
+    OUTPUT_EXT
+} OutputEnding;
+
+#define FRAME_HEADER_LENGTH 5
+#define MAX_FRAME_LENGTH (64UL * 1024 * 1024) /* bigger frames are rejected */
+
+typedef enum FrameTag {
+    FRAME_STDOUT = 'O', /* what the run printed to stdout */
+    FRAME_STDERR = 'R', /* what the run printed to stderr */
+    FRAME_FILE_AM = 'a', /* the output files, in the order of OutputEnding */
+    FRAME_FILE_OB = 'o',
+    FRAME_FILE_ENT = 'n',
+    FRAME_FILE_EXT = 'x',
+    FRAME_END = 'E',
+    /* server requests, see server.h */
+    FRAME_NAME = 'N',
+    FRAME_DIRECTORY = 'D',
+    FRAME_SOURCE = 'S',
+    FRAME_JOBS = 'J',
+    FRAME_MAX_ERRORS = 'M',
+    /* cached runs, see cache.h */
+    FRAME_INCLUDE = 'I'
+} FrameTag;
+
+typedef struct CapturedText { /* a stream kept in memory (open_memstream) */
+    FILE *stream; /* NULL if nothing was written */
+    char *text; /* valid after closeOutputTarget */
+    size_t length;
+} CapturedText;
+
+typedef struct OutputTarget { /* where executeAssembler sends its messages and output files */
+    FILE *out; /* progress messages */
+    FILE *err; /* error messages */
+    const char *directory; /* fileName.as is read from here, NULL for the working directory */
+    Bool capture; /* keep the messages and the output files in memory instead of printing and writing them */
+    CapturedText outText; /* the captured out */
+    CapturedText errText; /* the captured err */
+    CapturedText files[OUTPUT_ENDINGS];
+} OutputTarget;
+
+extern const char *const outputEndings[OUTPUT_ENDINGS]; /* ".am", ".ob", ".ent", ".ext" */
+
+void initOutputTarget(OutputTarget *target, FILE *out, FILE *err); /* print to out and err, write the files */
+ErrCode initCaptureTarget(OutputTarget *target); /* capture everything in memory */
+void closeOutputTarget(OutputTarget *target); /* close the captured streams so their text can be read */
+void freeOutputTarget(OutputTarget *target); /* free the captured text */
+
+/* captured runs */
+ErrCode appendFrame(TextBuffer *frames, FrameTag tag, const char *data, size_t length);
+/* reads the frame at *position, returns FALSE at the end of frames or if the frame is cut */
+Bool nextFrame(const char *frames, size_t length, size_t *position, FrameTag *tag, const char **data, size_t *dataLength);
+ErrCode encodeCapturedRun(OutputTarget *target, TextBuffer *frames); /* closes the target and encodes what it captured */
+Bool replayCapturedRun(const char *frames, size_t length, char *fileName); /* print and write a run, FALSE if it is cut */
+
+ErrCode readSourceFile(const char *fileName, const char *directory, TextBuffer *source); /* read fileName.as */
+/* the include reader of the command line (an IncludeReader, readerArg is unused): maps the file from disk */
+ErrCode readIncludeFromDisk(void *readerArg, const char *path, IncludedData *data);
+/* context reads its includes from disk and shares the compiled macro libraries of libraries (NULL for none) */
+void useDiskIncludes(AssemblerContext *context, MacroLibraries *libraries);
+/* assemble fileName.as (or length bytes of source if it isn't NULL) and report it to target */
+void executeAssembler(char* fileName, const char *source, size_t length, AssemblerContext *context, OutputTarget *target);
+void reportReadError(char *fileName, ErrCode errCode, OutputTarget *target); /* what executeAssembler prints if fileName.as can't be read */
+void reportAssembly(char *fileName, AssemblerContext *context, OutputTarget *target); /* the rest of it, after the source was assembled */
+ErrCode writeOutputFiles(char* fileName, AssemblerContext *context, OutputTarget *target);
+
+/* streams: run - reads the source from stdin, prints the messages to stderr and writes no files.
+ * stdout gets the .ob, .ent and .ext as FILE_ frames and END, unless .ent or .ext are sent to their own file
+ * descriptors (--ent-fd, --ext-fd), then stdout is the plain .ob and a file without a descriptor is dropped */
+#define STREAM_FILE_NAME "-" /* the file name that means stdin */
+#define STREAM_SOURCE_NAME "stdin" /* the name of the source in the messages */
+#define NO_DESCRIPTOR -1
+
+/* assemble the source of input and write it to output as above, FALSE if it didn't assemble */
+Bool assembleStream(FILE *input, FILE *output, int entFd, int extFd, AssemblerContext *context);
+
+#endif
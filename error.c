@@ -1,5 +1,6 @@
 #include "global.h"
 #include "error.h"
+#include "allocStats.h"
 
 char* getErrorMessage(ErrCode code)
 {
@@ -171,6 +172,8 @@ char* getErrorMessage(ErrCode code)
             return "lea source operand cannot be a number, pls enter a matrix or a label.";
         case INSTRUCTION_DST_OP_CANT_NUM_E:
             return "instruction destination operand cannot be a number, pls enter a register, matrix or a label.";
+        case SPACE_INVALID_SIZE_E:
+            return ".space needs the number of words to reserve, should be a positive integer.";
 
         /* tables errors 50 - 69 */
         case SYMBOL_NAME_EXISTS_E:
@@ -179,6 +182,16 @@ char* getErrorMessage(ErrCode code)
         /* preprocessor errors 70 - 79 */
         case UNMATCHED_MACRO_END_E:
             return "had \"macroend\" without having an opening macro definition.";
+        case MACRO_INCLUDE_PATH_E:
+            return "mcroinclude needs the name of the macro file in double quotes.";
+        case MACRO_INCLUDE_UNREADABLE_E:
+            return "couldn't read the included macro file, make sure it exists and is readable.";
+        case MACRO_INCLUDE_LINE_E:
+            return "an included macro file can only have macro definitions, comments and empty lines.";
+        case MACRO_INCLUDE_UNCLOSED_E:
+            return "the included macro file ends inside a macro definition.";
+        case MACRO_INCLUDE_IN_MACRO_E:
+            return "mcroinclude can't be used inside a macro definition.";
 
         /* firstPass errors 60 - 69 */
         case FIRSTPASS_FAILURE_S:
@@ -188,6 +201,38 @@ char* getErrorMessage(ErrCode code)
         case ENTRY_LABEL_DOES_NOT_EXIST_E:
             return "entry label does not exist in Symbol Table, should be defined before use.";
 
+        /* server errors 140 - 149 */
+        case SERVER_SOCKET_ERROR_F:
+            return "couldn't create, bind or listen on the server socket.";
+        case SERVER_ALREADY_RUNNING_F:
+            return "another server is already listening on this socket.";
+
+        /* cache errors 150 - 159 */
+        case CACHE_DIRECTORY_ERROR_F:
+            return "couldn't create the cache directory.";
+
+        /* watch errors 160 - 169 */
+        case WATCH_ERROR_F:
+            return "couldn't watch the input files for changes.";
+
+        /* trace errors 170 - 179 */
+        case TRACE_FILE_ERROR_F:
+            return "couldn't open the trace file.";
+
+        /* check errors 180 - 189 */
+        case CHECK_PATH_ERROR_F:
+            return "couldn't read the file or directory to check.";
+
+        /* binary include errors 190 - 199 */
+        case BINARY_INCLUDE_PATH_E:
+            return ".incbin needs the name of the binary file in double quotes.";
+        case BINARY_FILE_UNREADABLE_E:
+            return "couldn't read the binary file of .incbin, make sure it exists and is readable.";
+        case BINARY_FILE_SIZE_E:
+            return "the binary file of .incbin is empty or has more words than the data image.";
+        case BINARY_FILE_PADDING_E:
+            return "the binary file of .incbin must end with its last 10 bit word, the bits after it must be 0.";
+
         /* it should never reach here */
         default:
             return "unrecognized error code - shouldn't reach this point.";
@@ -208,6 +253,12 @@ Bool isFatalErr(ErrCode code)
         case INVALID_FILE_MODE_F:
         case MALLOC_ERROR_File_Del_F:
         case MALLOC_ERROR_LIST_F:
+        case SERVER_SOCKET_ERROR_F:
+        case SERVER_ALREADY_RUNNING_F:
+        case CACHE_DIRECTORY_ERROR_F:
+        case WATCH_ERROR_F:
+        case TRACE_FILE_ERROR_F:
+        case CHECK_PATH_ERROR_F:
             return TRUE;
         default:
             return FALSE; /* all other errors are not fatal */
@@ -227,20 +278,25 @@ Bool isNoteErr(ErrCode code)
     }
 }
 
-void printErrorMsg(ErrCode code, const char *stage, unsigned int line)
+void fprintErrorMsg(FILE *stream, ErrCode code, const char *stage, unsigned int line)
 {
     if (isFatalErr(code))
-        fprintf(stderr, "FATAL ERROR: ");
-    fprintf(stderr, "code: %d - ", code);
+        fprintf(stream, "FATAL ERROR: ");
+    fprintf(stream, "code: %d - ", code);
     if (line != 0)
-        fprintf(stderr, "line %u ", line);
+        fprintf(stream, "line %u ", line);
     if (stage != NULL)
-        fprintf(stderr, "at %s stage ", stage);
+        fprintf(stream, "at %s stage ", stage);
     
     if (line != 0 || stage != NULL)
-        fprintf(stderr, "- ");
+        fprintf(stream, "- ");
         
-    fprintf(stderr, "%s\n", getErrorMessage(code));
+    fprintf(stream, "%s\n", getErrorMessage(code));
+}
+
+void printErrorMsg(ErrCode code, const char *stage, unsigned int line)
+{
+    fprintErrorMsg(stderr, code, stage, line);
 }
 
 ErrorList* createErrorList(char *filename)
@@ -255,72 +311,160 @@ ErrorList* createErrorList(char *filename)
     newList->fatalError = FALSE; /* initialize fatal error flag to FALSE */
     newList->filename = filename;
     newList->stage = NULL; /* initialize stage to NULL */
-    newList->head = NULL;
-    newList->tail = NULL;
+    newList->maxErrors = 0; /* no limit */
+    newList->limitReached = FALSE;
+    newList->foldRepeats = TRUE;
+    newList->entries = NULL; /* allocated with the first error */
+    newList->size = 0;
+    newList->capacity = 0;
+    newList->first = 0;
     return newList;
 }
 
-void addErrorToList(ErrorList *list, ErrCode code)
+/* the workers keep every error unfolded so the parent list folds them the same way for any number of workers */
+ErrorList* createChildErrorList(ErrorList *parent)
 {
-    ErrorNode *newNode = malloc(sizeof(ErrorNode));
-    list->count++; /* increment the count of errors by 1 for the new error being added */
-    if (newNode == NULL) {
-        list->fatalError = TRUE; /* set fatal error flag if memory allocation fails */
-        list->count++; /* increment the count of errors by 1 for the malloc failure */
-        printErrorMsg(code, NULL, list->currentLine); /* print the error message */
-        printErrorMsg(MALLOC_ERROR_LIST_F, NULL, list->currentLine); /* print the error message */
+    ErrorList* newList = createErrorList(parent->filename);
+    if (newList == NULL)
+        return NULL;
+
+    newList->foldRepeats = FALSE;
+    newList->maxErrors = parent->maxErrors; /* a worker that reached the limit alone can stop, the parent would too */
+    return newList;
+}
+
+/* groupError - the index of the error that the notes before end follow (end itself if there are none), the
+ * error and its notes are one group. returns list->first if no error is before them */
+static unsigned int groupError(const ErrorList *list, unsigned int end)
+{
+    while (end > list->first && isNoteErr(list->entries[end - 1].errCode))
+        end--;
+    return end > list->first ? end - 1 : list->first;
+}
+
+/* foldLastGroup - folds the last error and its notes into the group before it if it is the same error on the
+ * next line with the same notes, so an operand error folds together with the operand note after it.
+ * a group is only complete once the next error is added, printErrors folds the last one */
+static void foldLastGroup(ErrorList *list)
+{
+    unsigned int last, previous, length, i;
+
+    if (list->size == list->first || isNoteErr(list->entries[groupError(list, list->size)].errCode))
+        return; /* no error, or only notes */
+    last = groupError(list, list->size);
+    if (last == list->first)
+        return; /* no group before it */
+    previous = groupError(list, last);
+    length = list->size - last;
+    if (isNoteErr(list->entries[previous].errCode) || last - previous != length ||
+        list->entries[previous].errCode != list->entries[last].errCode || list->entries[previous].line == 0 ||
+        list->entries[previous].lastLine + 1 != list->entries[last].line)
         return;
+    for (i = 1; i < length; i++)
+        if (list->entries[previous + i].errCode != list->entries[last + i].errCode)
+            return; /* other notes */
+
+    list->entries[previous].lastLine = list->entries[last].lastLine;
+    list->size = last;
+}
+
+/* appends an entry (after folding the group it completes), returns FALSE if the array couldn't grow */
+static Bool appendErrorEntry(ErrorList *list, ErrCode code, unsigned int line)
+{
+    if (list->foldRepeats && !isNoteErr(code))
+        foldLastGroup(list);
+
+    if (list->size == list->capacity) { /* grow the array */
+        unsigned int newCapacity = list->capacity == 0 ? INITIAL_ERROR_CAPACITY : list->capacity * 2;
+        ErrorEntry *newEntries = realloc(list->entries, sizeof(ErrorEntry) * newCapacity);
+        if (newEntries == NULL)
+            return FALSE;
+        list->entries = newEntries;
+        list->capacity = newCapacity;
     }
 
-    newNode->errCode = code;
-    newNode->line = list->currentLine; /* set the line number of the error */
-    newNode->next = NULL;
+    list->entries[list->size].errCode = code;
+    list->entries[list->size].line = line;
+    list->entries[list->size].lastLine = line;
+    list->size++;
+    return TRUE;
+}
+
+/* adds an error found in the given line */
+static void addErrorInLine(ErrorList *list, ErrCode code, unsigned int line)
+{
+    if (isNoteErr(code))
+        line = 0; /* will fix the printing of note error message, notes are not counted */
+    else
+        list->count++; /* increment the count of errors by 1 for the new error being added */
 
-    if (list->head == NULL) { /* if the list is empty */
-        list->head = newNode;
-        list->tail = newNode;
-    } else { /* if the list is not empty */
-        list->tail->next = newNode; /* link the new node to the end of the list */
-        list->tail = newNode; /* update the tail to the new node */
+    if (!appendErrorEntry(list, code, line)) {
+        list->fatalError = TRUE; /* set fatal error flag if memory allocation fails */
+        list->count++; /* increment the count of errors by 1 for the malloc failure */
+        printErrorMsg(code, NULL, line); /* print the error message */
+        printErrorMsg(MALLOC_ERROR_LIST_F, NULL, line); /* print the error message */
+        return;
     }
 
     if (isFatalErr(code)) /* if the error is fatal */
         list->fatalError = TRUE; /* set fatal error flag if isFatal is TRUE */
 
-    if (isNoteErr(code)) {
-        newNode->line = 0; /* will fix the printing of note error message */
-        list->count--; /* do not count note errors */
+    if (list->maxErrors != 0 && list->count >= list->maxErrors)
+        list->limitReached = TRUE; /* the stage stops after this line */
+}
+
+void addErrorToList(ErrorList *list, ErrCode code)
+{
+    addErrorInLine(list, code, list->currentLine);
+}
+
+/* moveLineErrors - moves the errors of one line from the front of src to the end of dest.
+ * src must hold its errors in line order (like a worker's list), notes move with the error before them.
+ */
+void moveLineErrors(ErrorList *dest, ErrorList *src, unsigned int line)
+{
+    while (src->first < src->size && (src->entries[src->first].line == line || isNoteErr(src->entries[src->first].errCode))) {
+        ErrorEntry *entry = &src->entries[src->first++];
+        addErrorInLine(dest, entry->errCode, entry->line);
+        if (!isNoteErr(entry->errCode)) /* notes are not counted */
+            src->count--;
     }
 }
 
-void printErrors(ErrorList *list)
+Bool isStageStopped(const ErrorList *list)
 {
-    ErrorNode *curr = list->head;
-    fprintf(stderr, "there were %d error(s) in file %s during the %s:\n", list->count, list->filename, list->stage);
-    while (curr != NULL) {
-        if (!isNoteErr(curr->errCode))
-            fprintf(stderr, "\n"); /* print a new line for better readability */
-
-        printErrorMsg(curr->errCode, NULL, curr->line); /* print each error message */
-        curr = curr->next;
-    
+    return list->fatalError || list->limitReached;
+}
+
+void printErrors(FILE *stream, ErrorList *list)
+{
+    unsigned int i;
+    if (list->foldRepeats)
+        foldLastGroup(list);
+    fprintf(stream, "there were %d error(s) in file %s during the %s:\n", list->count, list->filename, list->stage);
+    for (i = list->first; i < list->size; i++) {
+        ErrorEntry *entry = &list->entries[i];
+        if (!isNoteErr(entry->errCode))
+            fprintf(stream, "\n"); /* print a new line for better readability */
+
+        if (entry->lastLine == entry->line)
+            fprintErrorMsg(stream, entry->errCode, NULL, entry->line); /* print each error message */
+        else /* folded errors */
+            fprintf(stream, "code: %d - lines %u-%u - %s (%u times)\n", entry->errCode, entry->line, entry->lastLine,
+                    getErrorMessage(entry->errCode), entry->lastLine - entry->line + 1);
     }
+
+    if (list->limitReached)
+        fprintf(stream, "\nstopped the %s after %u error(s) (--max-errors %u)\n", list->stage, list->count, list->maxErrors);
 }
 
 void freeErrorsList(ErrorList *list)
 {
-    ErrorNode* curr;
     if (list == NULL)
         return;
     
-    curr = list->head;
-    while (curr != NULL) {
-        ErrorNode *temp = curr;
-        curr = curr->next;
-        free(temp);
-    }
-    list->head = NULL;
-    list->tail = NULL;
+    free(list->entries);
+    list->entries = NULL;
     list->stage = NULL; /* we don't need to free the stage string because it is a constant string */
     list->filename = NULL; /* we don't need to free the filename string because it is a argv[i] string */
     free(list);
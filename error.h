@@ -99,6 +99,7 @@ typedef enum ErrCode {
     INSTRUCTION_SRC_OP_CANT_REGISTER_E = 86, /* instruction source operand cannot be a register */
     INSTRUCTION_SRC_OP_CANT_NUM_E = 87, /* instruction source operand cannot be a number */
     INSTRUCTION_DST_OP_CANT_NUM_E = 88, /* instruction destination operand cannot be a number */
+    SPACE_INVALID_SIZE_E = 89, /* .space size is not a positive integer */
 
     /* tables errors 90 - 99 */
     TABLES_SUCCESS_S = 90, /* macro operation was successful */
@@ -109,6 +110,11 @@ typedef enum ErrCode {
     PREPROCESSOR_SUCCESS_S = 100, /* preprocessor executed successfully */
     PREPROCESSOR_FAILURE_S = 101, /* preprocessor failed */
     UNMATCHED_MACRO_END_E = 102, /* macro closer not found */
+    MACRO_INCLUDE_PATH_E = 103, /* mcroinclude without a quoted file name */
+    MACRO_INCLUDE_UNREADABLE_E = 104, /* the included macro file can't be read */
+    MACRO_INCLUDE_LINE_E = 105, /* a line of the included file isn't part of a macro definition */
+    MACRO_INCLUDE_UNCLOSED_E = 106, /* the included file ends inside a macro definition */
+    MACRO_INCLUDE_IN_MACRO_E = 107, /* mcroinclude inside a macro definition */
 
     /* firstPass errors 110 - 119 */
     FIRSTPASS_SUCCESS_S = 110, /* first pass was successful */
@@ -117,15 +123,43 @@ typedef enum ErrCode {
     /* secondPass errors 120 - 129 */
     SECOND_PASS_SUCCESS_S = 120, /* second pass was successful */
     SECOND_PASS_FAILURE_S = 121, /* second pass error */
-    ENTRY_LABEL_DOES_NOT_EXIST_E = 122 /* label does not exist error */
+    ENTRY_LABEL_DOES_NOT_EXIST_E = 122, /* label does not exist error */
+
+    /* assembler (library) errors 130 - 139 */
+    ASSEMBLER_SUCCESS_S = 130, /* all the stages were successful */
+    ASSEMBLER_FAILURE_S = 131, /* a stage failed */
+
+    /* server errors 140 - 149 */
+    SERVER_SOCKET_ERROR_F = 140, /* the server socket couldn't be made */
+    SERVER_ALREADY_RUNNING_F = 141, /* another server listens on the socket */
+
+    /* cache errors 150 - 159 */
+    CACHE_DIRECTORY_ERROR_F = 150, /* the cache directory couldn't be made */
+
+    /* watch errors 160 - 169 */
+    WATCH_ERROR_F = 160, /* inotify couldn't watch the input files */
+
+    /* trace errors 170 - 179 */
+    TRACE_FILE_ERROR_F = 170, /* the trace file couldn't be opened */
+
+    /* check errors 180 - 189 */
+    CHECK_PATH_ERROR_F = 180, /* a file or directory given to --check couldn't be read */
+
+    /* binary include errors 190 - 199 */
+    BINARY_INCLUDE_PATH_E = 190, /* .incbin without a quoted file name */
+    BINARY_FILE_UNREADABLE_E = 191, /* the file of .incbin can't be read */
+    BINARY_FILE_SIZE_E = 192, /* it is empty or has more words than the data image */
+    BINARY_FILE_PADDING_E = 193 /* it doesn't end with its last word */
 
 } ErrCode;
 
-typedef struct ErrorNode {
+#define INITIAL_ERROR_CAPACITY 16 /* entries of a new error list, it doubles when full */
+
+typedef struct ErrorEntry {
     ErrCode errCode;
-    unsigned int line;
-    struct ErrorNode *next;
-} ErrorNode;
+    unsigned int line; /* the line of the error (0 for notes), the first line if errors were folded */
+    unsigned int lastLine; /* the last line of the folded errors (same as line if nothing was folded) */
+} ErrorEntry;
 
 typedef struct ErrorList {
     unsigned int count; /* the number of errors in the list */
@@ -133,20 +167,29 @@ typedef struct ErrorList {
     char* stage; /* the stage that the error(s) occurred in, e.g. "preprocessor", "first pass" */
     char* filename; /* the name of the file where the error(s) occurred */
     Bool fatalError; /* indicates if there is a fatal error in the list like malloc failure */
-    struct ErrorNode* head;
-    struct ErrorNode* tail;
+    unsigned int maxErrors; /* the stage stops after the line that reached this many errors, 0 for no limit */
+    Bool limitReached; /* maxErrors was reached */
+    Bool foldRepeats; /* fold the same error (with the same notes) on consecutive lines into one entry */
+    ErrorEntry *entries; /* the errors in the order they were added */
+    unsigned int size; /* entries in use */
+    unsigned int capacity; /* entries allocated */
+    unsigned int first; /* entries before first were already moved to another list */
 } ErrorList;
 
 /* errorcode handling functions prototypes */
 char* getErrorMessage(ErrCode error); /* print error message based on error code */
 void printErrorMsg(ErrCode code, const char *stage, unsigned int line); /* print error message based on error code */
+void fprintErrorMsg(FILE *stream, ErrCode code, const char *stage, unsigned int line); /* printErrorMsg to any stream */
 Bool isFatalErr(ErrCode code);
 Bool isNoteErr(ErrCode code); /* check if the error is a note error */
 
 /* error list handling functions prototypes */
 ErrorList* createErrorList(char *filename); /* initialize the error list */
+ErrorList* createChildErrorList(ErrorList *parent); /* a list for one worker, its errors are moved to the parent in line order */
 void addErrorToList(ErrorList *list, ErrCode code); /* add error to the list */
-void printErrors(ErrorList *list); /* print all errors in the list */
+void moveLineErrors(ErrorList *dest, ErrorList *src, unsigned int line); /* move the errors of one line between lists */
+Bool isStageStopped(const ErrorList *list); /* a fatal error or the --max-errors limit stops the stage */
+void printErrors(FILE *stream, ErrorList *list); /* print all errors in the list */
 void freeErrorsList(ErrorList *list); /* free the error list */
 
 #endif
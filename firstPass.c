@@ -4,55 +4,243 @@
 #include "lexer.h"
 #include "util.h"
 #include "tables.h"
+#include "parallel.h"
+#include "allocStats.h"
 
 /* .am -> .ob , .ext , .ent*/
 /* 17 has an explanation for the first pass */
 /*page 19 or 31 for algorithm for preprocessing */
 
-ErrCode executeFirstPass(FILE* amFile, DataWord dataImage[], unsigned int* DC, unsigned int* IC, MacroTable* macroNames, SymbolTable* symbolTable, ErrorList* errorList)
+/* the .am lines are split into line-aligned chunks, each chunk is lexed on its own thread
+ * into its own error list. the only order dependent part of the pass is the IC/DC running sum,
+ * so every chunk counts its own words, the chunk start addresses are a prefix sum of those counts,
+ * and the symbols and errors are then merged in line order - the result is the same as a serial pass */
+typedef struct FirstPassChunk { /* a line-aligned slice of the .am text handled by one worker */
+    char **lineTexts; /* all the lines of the .am text */
+    ParsedProgram *program; /* where the lexed lines and their addresses go */
+    unsigned int firstLine; /* first line of the chunk (0 based) */
+    unsigned int endLine; /* one past the last line of the chunk */
+    MacroTable *macroNames;
+    DataWord *dataImage;
+    ErrorList *errorList; /* the chunk's own errors, in line order */
+    unsigned int IC; /* words of code in the chunk, then the IC the chunk starts at */
+    unsigned int DC; /* words of data in the chunk, then the DC the chunk starts at */
+} FirstPassChunk;
+
+static char** splitLines(TextBuffer *amText, unsigned int *lineCount);
+static void lexChunk(void *arg);
+static void assignChunkAddresses(void *arg);
+
+ErrCode executeFirstPass(TextBuffer* amText, ParsedProgram** program, DataWord dataImage[], unsigned int* DC, unsigned int* IC, MacroTable* macroNames, SymbolTable* symbolTable, ErrorList* errorList, unsigned int jobs, const TaskObserver *observer)
 {
-    ErrCode errorCode = NULL_INITIAL; /* initialize error code to NULL_INITIAL */
+    FirstPassChunk chunks[MAX_JOBS];
+    unsigned int lineCount = 0, chunksAmount, linesPerChunk, i, line;
+    unsigned int chunkIC = 0, chunkDC = 0; /* running prefix sums of the chunk sizes */
+    char **lineTexts;
     errorList->currentLine = 0; /* reset the current line number */
 
-    /* table setup? */
-    
-    while (errorCode != EOF_REACHED_S) {
-        parsedLine *pLine; /* parsed line structure to hold the line and its type */
-        if (errorList->fatalError) /* check if there was a fatal error in previous iterations */
-            return FIRSTPASS_FAILURE_S;
-        
-        errorList->currentLine++; /* increase the current line number */
-        pLine = readParsedLine(amFile, &errorCode, macroNames, errorList); /* read a line from the .as file 1 */
-        if (errorCode == EOF_REACHED_S)
-            break; /* end of file reached, exit the loop */
-        
-        if (errorCode == LEXER_FAILURE_S) /* if reading the line failed */
-            continue; /* continue to the next line */
-
-        if (pLine->typesOfLine == EMPTY_LINE || pLine->typesOfLine == COMMENT_LINE) {
-            freeParsedLine(pLine); /* free the parsed line structure */
-            continue; /* skip empty or comment lines */
+    lineTexts = splitLines(amText, &lineCount);
+    *program = lineTexts == NULL ? NULL : createParsedProgram(lineCount);
+    if (*program == NULL) {
+        if (lineTexts != NULL) {
+            free(lineTexts[0]);
+            free(lineTexts);
         }
+        addErrorToList(errorList, MALLOC_ERROR_F);
+        return FIRSTPASS_FAILURE_S;
+    }
 
-        if (pLine->typesOfLine == DIRECTIVE_LINE)
-            firstPassDirectiveLine(pLine, DC, dataImage, symbolTable, errorList); /* handle directive lines */
-        else if (pLine->typesOfLine == INSTRUCTION_LINE) 
-            firstPassInstructionLine(pLine, IC, macroNames, symbolTable, errorList); /* parse the instruction line */
-        
-        freeParsedLine(pLine);
-    } /* end of while loop */
+    chunksAmount = chunkCount(lineCount, jobs);
+    linesPerChunk = (lineCount + chunksAmount - 1) / chunksAmount;
+    for (i = 0; i < chunksAmount; i++) {
+        chunks[i].lineTexts = lineTexts;
+        chunks[i].program = *program;
+        chunks[i].firstLine = i * linesPerChunk < lineCount ? i * linesPerChunk : lineCount;
+        chunks[i].endLine = (i + 1) * linesPerChunk < lineCount ? (i + 1) * linesPerChunk : lineCount;
+        chunks[i].macroNames = macroNames;
+        chunks[i].dataImage = dataImage;
+        chunks[i].errorList = createChildErrorList(errorList);
+        chunks[i].IC = 0;
+        chunks[i].DC = 0;
+        if (chunks[i].errorList == NULL) { /* the chunk can't report errors, so it can't run */
+            addErrorToList(errorList, MALLOC_ERROR_F);
+            chunks[i].endLine = chunks[i].firstLine;
+        }
+    }
 
-    if(errorList->count > 0) /* if there are errors in the error list */
+    runObservedParallel(lexChunk, chunks, sizeof(FirstPassChunk), chunksAmount, observer); /* lex and count words */
+
+    for (i = 0; i < chunksAmount; i++) { /* prefix sum - each chunk starts where the one before it ends */
+        unsigned int wordsIC = chunks[i].IC, wordsDC = chunks[i].DC;
+        chunks[i].IC = chunkIC;
+        chunks[i].DC = chunkDC;
+        chunkIC += wordsIC;
+        chunkDC = addDataCount(chunkDC, wordsDC);
+    }
+
+    runObservedParallel(assignChunkAddresses, chunks, sizeof(FirstPassChunk), chunksAmount, observer); /* fill addresses and data image */
+
+    /* merge the symbols and errors in line order */
+    for (i = 0; i < chunksAmount && !isStageStopped(errorList); i++) {
+        for (line = chunks[i].firstLine; line < chunks[i].endLine; line++) {
+            parsedLine *pLine = (*program)->lines[line];
+            if (isStageStopped(errorList)) /* check if there was a fatal error (or too many errors) in previous lines */
+                break;
+
+            errorList->currentLine = line + 1; /* lines are counted from 1 */
+            moveLineErrors(errorList, chunks[i].errorList, errorList->currentLine);
+            if (pLine == NULL) /* lexing the line failed, its errors were just moved */
+                continue;
+
+            if (pLine->typesOfLine == DIRECTIVE_LINE)
+                firstPassDirectiveLine(pLine, (*program)->addresses[line], symbolTable, errorList); /* handle directive lines */
+            else if (pLine->typesOfLine == INSTRUCTION_LINE) 
+                firstPassInstructionLine(pLine, (*program)->addresses[line], symbolTable, errorList); /* handle instruction lines */
+        }
+    }
+
+    for (i = 0; i < chunksAmount; i++)
+        freeErrorsList(chunks[i].errorList);
+    free(lineTexts[0]); /* the copy of the text all the lines point into */
+    free(lineTexts);
+
+    if(errorList->count > 0 || errorList->fatalError) /* if there are errors in the error list */
         return FIRSTPASS_FAILURE_S;
 
+    *IC = chunkIC;
+    *DC = chunkDC;
     addToAddress(symbolTable, 100, "code");
     addToAddress(symbolTable, 100 + *IC, "data");
 
     return FIRSTPASS_SUCCESS_S; 
 }
- 
 
-void firstPassDirectiveLine(parsedLine *pLine, unsigned int *DC, DataWord dataImage[], SymbolTable* symbolTable, ErrorList* errorList)
+/* lexChunk - lexes the lines of one chunk and counts the code and data words they need */
+static void lexChunk(void *arg)
+{
+    FirstPassChunk *chunk = (FirstPassChunk*)arg;
+    ErrCode errorCode = NULL_INITIAL;
+    unsigned int line;
+
+    for (line = chunk->firstLine; line < chunk->endLine; line++) {
+        parsedLine *pLine;
+        if (isStageStopped(chunk->errorList)) /* check if there was a fatal error in previous iterations */
+            return;
+
+        chunk->errorList->currentLine = line + 1;
+        pLine = parseLineText(chunk->lineTexts[line], &errorCode, chunk->macroNames, chunk->errorList);
+        chunk->program->lines[line] = pLine;
+        if (pLine == NULL) /* if lexing the line failed */
+            continue;
+
+        if (pLine->typesOfLine == INSTRUCTION_LINE)
+            chunk->IC += pLine->lineContentUnion.instruction.wordCount;
+        else if (isDataDirective(pLine))
+            chunk->DC = addDataCount(chunk->DC, pLine->lineContentUnion.directive.dataCount);
+    }
+}
+
+/* assignChunkAddresses - gives every line of the chunk its IC/DC and puts its data in the data image */
+static void assignChunkAddresses(void *arg)
+{
+    FirstPassChunk *chunk = (FirstPassChunk*)arg;
+    unsigned int line, IC = chunk->IC, DC = chunk->DC;
+
+    for (line = chunk->firstLine; line < chunk->endLine; line++) {
+        parsedLine *pLine = chunk->program->lines[line];
+        if (pLine == NULL)
+            continue;
+
+        if (pLine->typesOfLine == INSTRUCTION_LINE) {
+            chunk->program->addresses[line] = IC;
+            IC += pLine->lineContentUnion.instruction.wordCount; /* increase the instruction counter by the words of the instruction */
+        }
+        else if (isDataDirective(pLine)) {
+            chunk->program->addresses[line] = DC;
+            if (chunk->dataImage != NULL)
+                placeDirectiveData(pLine, chunk->dataImage, DC);
+            DC = addDataCount(DC, pLine->lineContentUnion.directive.dataCount); /* increase the data counter by the number of data items */
+        }
+    }
+}
+
+/* placeDirectiveData - puts the words of a data directive that starts at DC in the data image, as many as fit.
+ * the words after the items of the line (the rest of a .mat, a .space) are only made here, as 0 */
+void placeDirectiveData(parsedLine *pLine, DataWord dataImage[], unsigned int DC)
+{
+    unsigned int i, count = addDataCount(DC, pLine->lineContentUnion.directive.dataCount) - DC;
+    unsigned int items = pLine->lineContentUnion.directive.itemCount < count ? pLine->lineContentUnion.directive.itemCount : count;
+
+    if (pLine->lineContentUnion.directive.packed.file.bytes != NULL) { /* .incbin, decoded from the file as it was read */
+        unpackWords(&pLine->lineContentUnion.directive.packed, 0, count, dataImage + DC);
+        return;
+    }
+    for (i = 0; i < items; i++)
+        dataImage[DC + i].value = pLine->lineContentUnion.directive.dataItems[i]; /* set the data items in the data image */
+    for (; i < count; i++)
+        dataImage[DC + i].value = 0; /* an incremental run may place the line over older words */
+}
+
+/* the data counter stops growing once the data image is full */
+unsigned int addDataCount(unsigned int DC, unsigned int dataCount)
+{
+    if (DC >= MAX_MEMORY_SIZE || dataCount > MAX_MEMORY_SIZE - DC)
+        return MAX_MEMORY_SIZE;
+    return DC + dataCount;
+}
+
+Bool isDataDirective(parsedLine *pLine)
+{
+    const char* directiveName;
+    if (pLine->typesOfLine != DIRECTIVE_LINE)
+        return FALSE;
+
+    directiveName = pLine->lineContentUnion.directive.directiveName;
+    return (strcmp(directiveName, ".data") == 0 ||
+            strcmp(directiveName, ".string") == 0 ||
+            strcmp(directiveName, ".mat") == 0 ||
+            strcmp(directiveName, ".space") == 0 ||
+            strcmp(directiveName, BINARY_DIRECTIVE) == 0);
+}
+
+Bool isBinaryInclude(const parsedLine *pLine)
+{
+    return pLine != NULL && pLine->typesOfLine == DIRECTIVE_LINE &&
+           strcmp(pLine->lineContentUnion.directive.directiveName, BINARY_DIRECTIVE) == 0;
+}
+
+/* splitLines - copies the .am text and splits the copy into lines in place.
+ * returns the array of lines (lines[0] is also the start of the copy) or NULL if malloc failed
+ */
+static char** splitLines(TextBuffer *amText, unsigned int *lineCount)
+{
+    char **lines, *text, *lineEnd;
+    unsigned int count = 0;
+
+    text = strDup(amText->text != NULL ? amText->text : "");
+    if (text == NULL)
+        return NULL;
+
+    for (lineEnd = strchr(text, '\n'); lineEnd != NULL; lineEnd = strchr(lineEnd + 1, '\n'))
+        count++; /* every line of the .am text ends with '\n' */
+
+    lines = malloc(sizeof(char*) * (count + 1)); /* +1 so lines[0] always holds the copy */
+    if (lines == NULL) {
+        free(text);
+        return NULL;
+    }
+
+    lines[0] = text;
+    *lineCount = 0;
+    while ((lineEnd = strchr(text, '\n')) != NULL) {
+        *lineEnd = '\0';
+        lines[(*lineCount)++] = text;
+        text = lineEnd + 1;
+    }
+    return lines;
+}
+
+void firstPassDirectiveLine(parsedLine *pLine, unsigned int DC, SymbolTable* symbolTable, ErrorList* errorList)
 {
     ErrCode errorCode = NULL_INITIAL; /* initialize error code to NULL_INITIAL */
     const char* directiveName = pLine->lineContentUnion.directive.directiveName; /* get the directive name */
@@ -60,32 +248,18 @@ void firstPassDirectiveLine(parsedLine *pLine, unsigned int *DC, DataWord dataIm
     if (strcmp(directiveName, ".entry") == 0)
         return; /* .entry directive is handled in the second pass */
 
-    if (strcmp(directiveName, ".data") == 0 ||
-        strcmp(directiveName, ".string") == 0 ||
-        strcmp(directiveName, ".mat") == 0) {
-        int i;
-
+    if (isDataDirective(pLine)) { /* .data .string .mat .space or .incbin, the data itself is already in the data image */
         if (pLine->label != NULL) { /* if the line has a label */
             char* labelNoColon = delColonFromLabel(pLine->label); /* remove the colon from the label */
             if (labelNoColon == NULL) { /* if the label is empty after removing the colon */
                 addErrorToList(errorList, MALLOC_ERROR_F);
                 return;
             }
-            errorCode = addSymbol(symbolTable, labelNoColon, *DC, pLine->lineContentUnion.instruction.operationName); /* add the label to the symbol table */
+            errorCode = addSymbol(symbolTable, labelNoColon, DC, pLine->lineContentUnion.instruction.operationName); /* add the label to the symbol table */
             if (errorCode != TABLES_SUCCESS_S) 
                 addErrorToList(errorList, errorCode);
+            free(labelNoColon);
         }
-
-        for (i = 0; i < pLine->lineContentUnion.directive.dataCount; i++){
-            if (*DC + i >= MAX_MEMORY_SIZE){ /* check if there is enough space in the data image */
-                *DC += i;
-                return;
-            }
-            dataImage[*DC + i].value = pLine->lineContentUnion.directive.dataItems[i]; /* set the data items in the directive image */
-        }
-        
-        
-        *DC += pLine->lineContentUnion.directive.dataCount; /* increase the data counter by the number of data items */
         return; /* return after handling the directive */
     }
 
@@ -99,7 +273,7 @@ void firstPassDirectiveLine(parsedLine *pLine, unsigned int *DC, DataWord dataIm
 
 }
 
-void firstPassInstructionLine(parsedLine *pLine, unsigned int *IC, MacroTable *macroNames, SymbolTable *symbolTable, ErrorList *errorList)
+void firstPassInstructionLine(parsedLine *pLine, unsigned int IC, SymbolTable *symbolTable, ErrorList *errorList)
 {
     ErrCode errorCode = NULL_INITIAL;
 
@@ -109,11 +283,9 @@ void firstPassInstructionLine(parsedLine *pLine, unsigned int *IC, MacroTable *m
             addErrorToList(errorList, MALLOC_ERROR_F);
             return;
         }
-        errorCode = addSymbol(symbolTable, labelNoColon, *IC, pLine->lineContentUnion.instruction.operationName); /* add the label to the symbol table */
+        errorCode = addSymbol(symbolTable, labelNoColon, IC, pLine->lineContentUnion.instruction.operationName); /* add the label to the symbol table */
         if (errorCode != TABLES_SUCCESS_S) 
             addErrorToList(errorList, errorCode);
+        free(labelNoColon);
     }
-
-    /* increase the instruction counter by the number of words in the instruction */
-    *IC += pLine->lineContentUnion.instruction.wordCount;
 }
@@ -4,13 +4,20 @@
 #include "error.h"
 #include "lexer.h"
 #include "tables.h"
+#include "util.h" /* for TextBuffer */
+#include "parallel.h" /* for TaskObserver */
 
 #define EXTERN_SYMBOL_ADDRESS 0 /* address of an extern symbol in the symbol table */
 
 /* Preprocessor functions prototypes */
-ErrCode executeFirstPass(FILE* amFile, DataWord dataImage[], unsigned int* DC, unsigned int* IC, MacroTable* macroTable, SymbolTable* symbolTable, ErrorList* errorList); /* main function for the preprocessor */
+/* main function for the first pass, lexes amText on up to jobs threads into *program, a NULL dataImage isn't filled */
+ErrCode executeFirstPass(TextBuffer* amText, ParsedProgram** program, DataWord dataImage[], unsigned int* DC, unsigned int* IC, MacroTable* macroTable, SymbolTable* symbolTable, ErrorList* errorList, unsigned int jobs, const TaskObserver *observer);
 
-void firstPassDirectiveLine(parsedLine *pLine, unsigned int *DC, DataWord dataImage[], SymbolTable* symbolTable, ErrorList* errorList); /* handle directive lines in the first pass */
-void firstPassInstructionLine(parsedLine *pLine, unsigned int *IC, MacroTable *macroNames, SymbolTable *symbolTable, ErrorList *errorList); /* handle instruction lines in the first pass */
+void firstPassDirectiveLine(parsedLine *pLine, unsigned int DC, SymbolTable* symbolTable, ErrorList* errorList); /* add the symbols of a directive line that starts at DC */
+unsigned int addDataCount(unsigned int DC, unsigned int dataCount); /* DC after dataCount more words, at most MAX_MEMORY_SIZE */
+void placeDirectiveData(parsedLine *pLine, DataWord dataImage[], unsigned int DC); /* the words of a data directive at DC */
+Bool isDataDirective(parsedLine *pLine); /* .data, .string, .mat, .space or .incbin */
+Bool isBinaryInclude(const parsedLine *pLine); /* .incbin, its words are read from a file */
+void firstPassInstructionLine(parsedLine *pLine, unsigned int IC, SymbolTable *symbolTable, ErrorList *errorList); /* add the label of an instruction line that starts at IC */
 
 #endif
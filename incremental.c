@@ -0,0 +1,519 @@
+#include "incremental.h"
+#include "global.h"
+#include "assembler.h"
+#include "preprocessor.h"
+#include "firstPass.h"
+#include "secondPass.h"
+#include "writeFiles.h"
+#include "error.h"
+#include "lexer.h"
+#include "tables.h"
+#include "util.h"
+#include "allocStats.h"
+
+/* the new state of the file, built next to the kept one. the lines that weren't edited (and their extern
+ * use-sites) are borrowed from the kept program, so nothing of the kept state is freed until the reassembly
+ * succeeded - if it fails the context is exactly as it was and a full run takes over */
+typedef struct Reassembly {
+    AssemblerContext *context; /* holds the kept state */
+    TextBuffer amText;
+    MacroTable *macroTable;
+    ErrorList *errorList;
+    SymbolTable *symbolTable; /* the kept table unless ownTable */
+    Bool ownTable; /* the symbol table was built again */
+    ParsedProgram *program;
+    ExternList *lineExterns; /* the extern use-sites of every line, borrowed unless encoded */
+    int *oldLine; /* the kept line a line was taken from, NEW_LINE for the edited lines */
+    Bool *encoded; /* the line was encoded again, its lineExterns entry is its own */
+    unsigned int firstEdited; /* the edited lines are [firstEdited, endEdited) of the new program */
+    unsigned int endEdited;
+    unsigned int oldEndEdited; /* and [firstEdited, oldEndEdited) of the kept one */
+    unsigned int filled; /* the lines of the new program lexEdit has set up */
+    unsigned int IC, DC; /* the running counters while the addresses are assigned */
+    Bool moved; /* the lines after the edit got new addresses */
+    ExternList externs; /* all the extern use-sites in address order */
+    EntryRec *entries;
+    unsigned int entryCount;
+} Reassembly;
+
+/* lineStarts - the offset of every '\n' terminated line of text and one past the last one, NULL if malloc failed */
+static size_t* lineStarts(const TextBuffer *text, unsigned int *count)
+{
+    const char *start = text->text != NULL ? text->text : "", *end = start + text->length, *lineEnd;
+    size_t *starts;
+    unsigned int i = 0;
+
+    *count = 0;
+    for (lineEnd = memchr(start, '\n', text->length); lineEnd != NULL; lineEnd = memchr(lineEnd + 1, '\n', end - lineEnd - 1))
+        (*count)++;
+
+    starts = malloc(sizeof(size_t) * (*count + 1));
+    if (starts == NULL)
+        return NULL;
+    starts[0] = 0;
+    for (lineEnd = memchr(start, '\n', text->length); lineEnd != NULL; lineEnd = memchr(lineEnd + 1, '\n', end - lineEnd - 1))
+        starts[++i] = (size_t)(lineEnd - start) + 1;
+    return starts;
+}
+
+static Bool sameLine(const TextBuffer *a, const size_t *aStarts, unsigned int i,
+                     const TextBuffer *b, const size_t *bStarts, unsigned int j)
+{
+    size_t length = aStarts[i + 1] - aStarts[i];
+    return length == bStarts[j + 1] - bStarts[j] && memcmp(a->text + aStarts[i], b->text + bStarts[j], length) == 0;
+}
+
+/* sameMacroNames - the lexer checks labels against the macro names, the kept lines are only valid if they didn't change */
+static Bool sameMacroNames(MacroTable *a, MacroTable *b)
+{
+    MacroNode *x = a->macroHead, *y = b->macroHead;
+    IncludedLibrary *p = a->libraries, *q = b->libraries;
+    while (x != NULL && y != NULL && strcmp(x->macroName, y->macroName) == 0) {
+        x = x->nextMacro;
+        y = y->nextMacro;
+    }
+    while (p != NULL && q != NULL && p->library == q->library) { /* a loaded library never changes */
+        p = p->next;
+        q = q->next;
+    }
+    return x == NULL && y == NULL && p == NULL && q == NULL;
+}
+
+/* countersBefore - the IC and DC at the start of line, from the last instruction and data lines before it */
+static void countersBefore(ParsedProgram *program, unsigned int line, unsigned int *IC, unsigned int *DC)
+{
+    Bool haveIC = FALSE, haveDC = FALSE;
+
+    *IC = 0;
+    *DC = 0;
+    while (line > 0 && !(haveIC && haveDC)) {
+        parsedLine *pLine = program->lines[--line];
+        if (pLine == NULL)
+            continue;
+        if (!haveIC && pLine->typesOfLine == INSTRUCTION_LINE) {
+            *IC = program->addresses[line] + pLine->lineContentUnion.instruction.wordCount;
+            haveIC = TRUE;
+        }
+        else if (!haveDC && isDataDirective(pLine)) {
+            *DC = addDataCount(program->addresses[line], pLine->lineContentUnion.directive.dataCount);
+            haveDC = TRUE;
+        }
+    }
+}
+
+/* assignLine - gives the line its address from the running counters and puts its data in the data image */
+static void assignLine(Reassembly *run, unsigned int line)
+{
+    parsedLine *pLine = run->program->lines[line];
+
+    if (pLine == NULL)
+        return;
+    if (pLine->typesOfLine == INSTRUCTION_LINE) {
+        run->program->addresses[line] = run->IC;
+        run->IC += pLine->lineContentUnion.instruction.wordCount;
+    }
+    else if (isDataDirective(pLine)) {
+        run->program->addresses[line] = run->DC;
+        placeDirectiveData(pLine, run->context->dataImage, run->DC);
+        run->DC = addDataCount(run->DC, pLine->lineContentUnion.directive.dataCount);
+    }
+}
+
+/* definesSymbol - the line adds a symbol in the first pass */
+static Bool definesSymbol(parsedLine *pLine)
+{
+    if (pLine == NULL)
+        return FALSE;
+    if (pLine->typesOfLine == INSTRUCTION_LINE || isDataDirective(pLine))
+        return pLine->label != NULL;
+    return pLine->typesOfLine == DIRECTIVE_LINE && strcmp(pLine->lineContentUnion.directive.directiveName, ".extern") == 0;
+}
+
+static Bool isSymbolOperand(operandType type)
+{
+    return type == LABEL_TABLE_OPERAND || type == LABEL_SYNTAX_OPERAND || type == MATRIX_TABLE_OPERAND || type == MATRIX_SYNTAX_OPERAND;
+}
+
+/* usesSymbol - one of the operands of the instruction line is one of the count names */
+static Bool usesSymbol(parsedLine *pLine, const char **names, unsigned int count)
+{
+    struct instructionData *instruction = &pLine->lineContentUnion.instruction;
+    unsigned int i;
+
+    for (i = 0; i < count; i++)
+        if ((isSymbolOperand(instruction->operand1Type) && strcmp(instruction->operand1, names[i]) == 0) ||
+            (isSymbolOperand(instruction->operand2Type) && strcmp(instruction->operand2, names[i]) == 0))
+            return TRUE;
+    return FALSE;
+}
+
+/* lexEdit - finds the edited lines by diffing the .am texts and lexes only them, the rest is borrowed */
+static Bool lexEdit(Reassembly *run)
+{
+    AssemblerContext *context = run->context;
+    ParsedProgram *old = context->program;
+    unsigned int oldCount, newCount, prefix = 0, suffix = 0, i;
+    size_t *oldStarts = lineStarts(&context->amText, &oldCount), *newStarts = lineStarts(&run->amText, &newCount);
+    ErrCode errorCode = NULL_INITIAL;
+    Bool lexed = FALSE;
+
+    if (oldStarts == NULL || newStarts == NULL || oldCount != old->count)
+        goto done;
+    /* an .incbin line is never kept, its file may have changed while its text didn't */
+    while (prefix < oldCount && prefix < newCount && !isBinaryInclude(old->lines[prefix]) &&
+           sameLine(&context->amText, oldStarts, prefix, &run->amText, newStarts, prefix))
+        prefix++;
+    while (suffix < oldCount - prefix && suffix < newCount - prefix && !isBinaryInclude(old->lines[oldCount - 1 - suffix]) &&
+           sameLine(&context->amText, oldStarts, oldCount - 1 - suffix, &run->amText, newStarts, newCount - 1 - suffix))
+        suffix++;
+    run->firstEdited = prefix;
+    run->endEdited = newCount - suffix;
+    run->oldEndEdited = oldCount - suffix;
+
+    run->program = createParsedProgram(newCount);
+    run->lineExterns = malloc(sizeof(ExternList) * (newCount + 1));
+    run->oldLine = malloc(sizeof(int) * (newCount + 1));
+    run->encoded = calloc(newCount + 1, sizeof(Bool));
+    if (run->program == NULL || run->lineExterns == NULL || run->oldLine == NULL || run->encoded == NULL)
+        goto done;
+
+    for (i = 0; i < newCount; i++) {
+        unsigned int from = i < run->endEdited ? i : i - run->endEdited + run->oldEndEdited;
+        if (i >= run->firstEdited && i < run->endEdited) { /* an edited line */
+            char *text = strnDup(run->amText.text + newStarts[i], (unsigned int)(newStarts[i + 1] - newStarts[i] - 1));
+            run->errorList->currentLine = i + 1;
+            run->oldLine[i] = NEW_LINE;
+            initExternList(&run->lineExterns[i]);
+            run->filled = i + 1;
+            if (text == NULL) {
+                addErrorToList(run->errorList, MALLOC_ERROR_F);
+                goto done;
+            }
+            run->program->lines[i] = parseLine(text, &errorCode, run->macroTable, run->errorList);
+        }
+        else {
+            run->oldLine[i] = (int)from;
+            run->program->lines[i] = old->lines[from];
+            run->program->addresses[i] = old->addresses[from];
+            run->lineExterns[i] = context->lineExterns[from];
+        }
+        run->filled = i + 1;
+    }
+    lexed = run->errorList->count == 0 && !run->errorList->fatalError;
+
+done:
+    freeStrings((char*)oldStarts, (char*)newStarts, NULL);
+    return lexed;
+}
+
+/* assignAddresses - assigns the edited lines, and the lines after them only if the edit changed the word counts */
+static void assignAddresses(Reassembly *run)
+{
+    ParsedProgram *old = run->context->program;
+    unsigned int line, oldIC, oldDC;
+
+    countersBefore(run->program, run->firstEdited, &run->IC, &run->DC); /* the lines before the edit are the same */
+    for (line = run->firstEdited; line < run->endEdited; line++)
+        assignLine(run, line);
+
+    countersBefore(old, run->oldEndEdited, &oldIC, &oldDC); /* where the kept lines after the edit start */
+    run->moved = run->IC != oldIC || run->DC != oldDC;
+    if (run->moved) {
+        for (line = run->endEdited; line < run->program->count; line++)
+            assignLine(run, line);
+    }
+    else {
+        run->IC = run->context->ICF;
+        run->DC = run->context->DCF;
+    }
+}
+
+/* updateSymbols - builds the symbol table again if a symbol could have changed and marks the .entry symbols */
+static Bool updateSymbols(Reassembly *run)
+{
+    ParsedProgram *program = run->program, *old = run->context->program;
+    Bool rebuild = run->moved || run->IC != run->context->ICF;
+    SymbolNode *sym;
+    unsigned int line;
+
+    for (line = run->firstEdited; line < run->endEdited && !rebuild; line++)
+        rebuild = definesSymbol(program->lines[line]);
+    for (line = run->firstEdited; line < run->oldEndEdited && !rebuild; line++)
+        rebuild = definesSymbol(old->lines[line]);
+
+    if (rebuild) { /* the same as the first pass, from the IR */
+        run->symbolTable = createSymbolTable();
+        run->ownTable = TRUE;
+        if (run->symbolTable == NULL)
+            return FALSE;
+        for (line = 0; line < program->count && run->errorList->count == 0; line++) {
+            parsedLine *pLine = program->lines[line];
+            run->errorList->currentLine = line + 1;
+            if (pLine != NULL && pLine->typesOfLine == DIRECTIVE_LINE)
+                firstPassDirectiveLine(pLine, program->addresses[line], run->symbolTable, run->errorList);
+            else if (pLine != NULL && pLine->typesOfLine == INSTRUCTION_LINE)
+                firstPassInstructionLine(pLine, program->addresses[line], run->symbolTable, run->errorList);
+        }
+        if (run->errorList->count > 0 || run->errorList->fatalError)
+            return FALSE;
+        addToAddress(run->symbolTable, CODE_START_ADDRESS, "code");
+        addToAddress(run->symbolTable, CODE_START_ADDRESS + run->IC, "data");
+    }
+    else
+        run->symbolTable = run->context->symbolTable;
+
+    for (sym = run->symbolTable->head; sym != NULL; sym = sym->next)
+        sym->isEntry = FALSE;
+    run->symbolTable->haveEntry = FALSE;
+    for (line = 0; line < program->count; line++) {
+        parsedLine *pLine = program->lines[line];
+        if (pLine == NULL || pLine->typesOfLine != DIRECTIVE_LINE ||
+            strcmp(pLine->lineContentUnion.directive.directiveName, ".entry") != 0)
+            continue;
+        sym = findSymbol(run->symbolTable, pLine->lineContentUnion.directive.directiveLabel);
+        if (sym == NULL)
+            return FALSE; /* ENTRY_LABEL_DOES_NOT_EXIST_E, the full run reports it */
+        sym->isEntry = TRUE;
+        run->symbolTable->haveEntry = TRUE;
+    }
+    return TRUE;
+}
+
+/* movedSymbols - the names of the symbols that are new, gone, or have another address or type */
+static const char** movedSymbols(Reassembly *run, unsigned int *count)
+{
+    SymbolTable *old = run->context->symbolTable, *table = run->symbolTable;
+    const char **names;
+    SymbolNode *sym, *other;
+
+    *count = 0;
+    if (!run->ownTable)
+        return NULL;
+    names = malloc(sizeof(char*) * (old->count + table->count + 1));
+    if (names == NULL)
+        return NULL;
+    for (sym = table->head; sym != NULL; sym = sym->next) {
+        other = findSymbol(old, sym->symbolName);
+        if (other == NULL || other->address != sym->address || other->type != sym->type)
+            names[(*count)++] = sym->symbolName;
+    }
+    for (sym = old->head; sym != NULL; sym = sym->next)
+        if (findSymbol(table, sym->symbolName) == NULL)
+            names[(*count)++] = sym->symbolName;
+    return names;
+}
+
+/* encodeChanges - encodes the instructions that were edited, moved or use a moved symbol */
+static Bool encodeChanges(Reassembly *run)
+{
+    ParsedProgram *program = run->program, *old = run->context->program;
+    unsigned int movedCount, line;
+    const char **moved = movedSymbols(run, &movedCount);
+
+    if (run->ownTable && moved == NULL)
+        return FALSE;
+    for (line = 0; line < program->count && run->errorList->count == 0; line++) {
+        parsedLine *pLine = program->lines[line];
+        if (pLine == NULL || pLine->typesOfLine != INSTRUCTION_LINE)
+            continue;
+        if (run->oldLine[line] != NEW_LINE && program->addresses[line] == old->addresses[run->oldLine[line]] &&
+            !usesSymbol(pLine, moved, movedCount))
+            continue; /* its words in the code image are still right */
+
+        if (run->oldLine[line] != NEW_LINE)
+            initExternList(&run->lineExterns[line]); /* the borrowed use-sites stay with the kept line */
+        run->encoded[line] = TRUE;
+        run->errorList->currentLine = line + 1;
+        encodeInstruction(pLine, program->addresses[line], run->context->codeImage, run->symbolTable,
+                          &run->lineExterns[line], run->errorList);
+    }
+    if (moved != NULL)
+        free((void*)moved);
+    return run->errorList->count == 0 && !run->errorList->fatalError;
+}
+
+/* collectResults - the extern use-sites in address order and the entries, before anything kept is freed */
+static Bool collectResults(Reassembly *run)
+{
+    unsigned int line;
+    ExternRec *rec;
+
+    for (line = 0; line < run->program->count; line++)
+        for (rec = run->lineExterns[line].head; rec != NULL; rec = rec->next)
+            if (recordExternReference(&run->externs, rec->name, rec->address) != UTIL_SUCCESS_S)
+                return FALSE;
+    return collectEntries(run->symbolTable, &run->entries, &run->entryCount) == UTIL_SUCCESS_S;
+}
+
+/* abandonReassembly - frees what the reassembly made, the borrowed lines stay with the kept program */
+static void abandonReassembly(Reassembly *run)
+{
+    unsigned int line;
+
+    enterStage(run->context, STAGE_DONE);
+    if (run->program != NULL) {
+        for (line = 0; line < run->filled; line++) {
+            if (run->oldLine[line] == NEW_LINE || run->encoded[line])
+                clearExternRecords(&run->lineExterns[line]); /* its own use-sites */
+            if (run->oldLine[line] != NEW_LINE)
+                run->program->lines[line] = NULL; /* borrowed */
+        }
+        freeParsedProgram(run->program);
+    }
+    if (run->ownTable)
+        freeSymbolTable(run->symbolTable);
+    freeStrings((char*)run->lineExterns, (char*)run->oldLine, (char*)run->encoded);
+    clearExternRecords(&run->externs);
+    if (run->entries != NULL)
+        free(run->entries);
+    freeMacroTable(run->macroTable);
+    freeErrorsList(run->errorList);
+    freeTextBuffer(&run->amText);
+}
+
+/* commitReassembly - frees the kept lines that were replaced and makes the new state the kept one */
+static void commitReassembly(Reassembly *run)
+{
+    AssemblerContext *context = run->context;
+    ParsedProgram *old = context->program;
+    unsigned int line;
+
+    for (line = run->firstEdited; line < run->oldEndEdited; line++) { /* the lines the edit replaced */
+        freeParsedLine(old->lines[line]);
+        clearExternRecords(&context->lineExterns[line]);
+    }
+    for (line = 0; line < run->program->count; line++)
+        if (run->encoded[line] && run->oldLine[line] != NEW_LINE) /* their use-sites were found again */
+            clearExternRecords(&context->lineExterns[run->oldLine[line]]);
+    for (line = 0; line < old->count; line++)
+        old->lines[line] = NULL; /* freed above or moved to the new program */
+    freeParsedProgram(old);
+    free(context->lineExterns);
+    free(run->oldLine);
+    free(run->encoded);
+    context->program = run->program;
+    context->lineExterns = run->lineExterns;
+
+    for (line = run->IC; line < context->ICF && line < MAX_MEMORY_SIZE; line++) /* a shorter program, like a full run */
+        context->codeImage[line].allBits = 0;
+    for (line = run->DC; line < context->DCF && line < MAX_MEMORY_SIZE; line++)
+        context->dataImage[line].value = 0;
+    context->ICF = run->IC;
+    context->DCF = run->DC;
+
+    if (run->ownTable) {
+        freeSymbolTable(context->symbolTable);
+        context->symbolTable = run->symbolTable;
+    }
+    freeMacroTable(context->macroTable);
+    context->macroTable = run->macroTable;
+    freeErrorsList(context->errorList);
+    context->errorList = run->errorList;
+    freeTextBuffer(&context->amText);
+    context->amText = run->amText;
+    clearExternRecords(&context->externs);
+    context->externs = run->externs;
+    if (context->entries != NULL)
+        free(context->entries);
+    context->entries = run->entries;
+    context->entryCount = run->entryCount;
+    context->stage = STAGE_DONE;
+}
+
+ErrCode reassembleSource(AssemblerContext *context, const char *source, size_t length)
+{
+    Reassembly run;
+
+    if (context->program == NULL || context->lineExterns == NULL || context->stage != STAGE_DONE)
+        return ASSEMBLER_FAILURE_S;
+
+    memset(&run, 0, sizeof(run));
+    run.context = context;
+    initTextBuffer(&run.amText);
+    initExternList(&run.externs);
+    run.macroTable = createRunMacroTable(context);
+    run.errorList = createErrorList(context->name);
+    if (run.macroTable == NULL || run.errorList == NULL) {
+        abandonReassembly(&run);
+        return ASSEMBLER_FAILURE_S;
+    }
+    run.errorList->maxErrors = context->maxErrors;
+
+    run.errorList->stage = "preprocessor";
+    addAllocSourceLines(source, length);
+    enterStage(context, STAGE_PREPROCESSOR);
+    if (executePreprocessor(source, length, &run.amText, run.macroTable, run.errorList) == PREPROCESSOR_FAILURE_S ||
+        !sameMacroNames(context->macroTable, run.macroTable)) {
+        abandonReassembly(&run);
+        return ASSEMBLER_FAILURE_S;
+    }
+
+    run.errorList->stage = "first pass";
+    enterStage(context, STAGE_FIRST_PASS);
+    if (!lexEdit(&run)) {
+        abandonReassembly(&run);
+        return ASSEMBLER_FAILURE_S;
+    }
+    assignAddresses(&run);
+    if (!updateSymbols(&run)) {
+        abandonReassembly(&run);
+        return ASSEMBLER_FAILURE_S;
+    }
+
+    run.errorList->stage = "second pass";
+    enterStage(context, STAGE_SECOND_PASS);
+    if (!encodeChanges(&run) || !collectResults(&run)) {
+        abandonReassembly(&run);
+        return ASSEMBLER_FAILURE_S;
+    }
+
+    commitReassembly(&run);
+    enterStage(context, STAGE_DONE);
+    return ASSEMBLER_SUCCESS_S;
+}
+
+ErrCode keepProgram(AssemblerContext *context, ParsedProgram *program)
+{
+    ExternRec *rec = context->externs.head;
+    unsigned int line;
+
+    context->lineExterns = malloc(sizeof(ExternList) * (program->count + 1));
+    if (context->lineExterns == NULL)
+        return MALLOC_ERROR_F;
+    for (line = 0; line < program->count; line++)
+        initExternList(&context->lineExterns[line]);
+
+    /* the use-sites are in address order, and so are the instruction lines */
+    for (line = 0; line < program->count && rec != NULL; line++) {
+        parsedLine *pLine = program->lines[line];
+        unsigned int start, end;
+        if (pLine == NULL || pLine->typesOfLine != INSTRUCTION_LINE)
+            continue;
+        start = CODE_START_ADDRESS + program->addresses[line];
+        end = start + pLine->lineContentUnion.instruction.wordCount;
+        for (; rec != NULL && rec->address < end; rec = rec->next)
+            if (rec->address >= start && recordExternReference(&context->lineExterns[line], rec->name, rec->address) != UTIL_SUCCESS_S) {
+                for (line = 0; line < program->count; line++) /* the caller still frees program */
+                    clearExternRecords(&context->lineExterns[line]);
+                free(context->lineExterns);
+                context->lineExterns = NULL;
+                return MALLOC_ERROR_F;
+            }
+    }
+    context->program = program;
+    return UTIL_SUCCESS_S;
+}
+
+void freeKeptProgram(AssemblerContext *context)
+{
+    unsigned int line;
+
+    if (context->lineExterns != NULL) {
+        for (line = 0; line < context->program->count; line++)
+            clearExternRecords(&context->lineExterns[line]);
+        free(context->lineExterns);
+    }
+    freeParsedProgram(context->program);
+    context->lineExterns = NULL;
+    context->program = NULL;
+}
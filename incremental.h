@@ -0,0 +1,22 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+#include "global.h"
+#include "error.h"
+#include "lexer.h"
+#include "assembler.h"
+
+/* incremental reassembly: when context->incremental is set the line IR of a successful run is kept, and the next
+ * run of the same name only lexes the lines that were edited (the .am text is diffed against the last one).
+ * the addresses after the edit are only assigned again if its word count changed, the symbol table is only
+ * rebuilt if a symbol could have changed, and only the instructions that were edited, moved or use a symbol that
+ * moved are encoded again. if anything reports an error the caller assembles the whole file, so the errors
+ * (and everything else) are always the same as a full run */
+
+#define NEW_LINE -1 /* a line of the new program that was lexed now, not taken from the last run */
+
+ErrCode keepProgram(AssemblerContext *context, ParsedProgram *program); /* keep the IR of a successful full run */
+void freeKeptProgram(AssemblerContext *context);
+/* reassemble source reusing the kept IR, ASSEMBLER_FAILURE_S if it can't (the context is then left for a full run) */
+ErrCode reassembleSource(AssemblerContext *context, const char *source, size_t length);
+
+#endif
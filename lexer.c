@@ -3,6 +3,15 @@
 #include "error.h"
 #include "util.h"
 #include "tables.h"
+#include "lexerDfa.h"
+#include "macroLibrary.h" /* for parseIncludePath and recordIncludedFile */
+#include "probes.h"
+#include "allocStats.h"
+
+#define KEYWORD_TOKENS (TOKEN_OPERATION | TOKEN_DIRECTIVE | TOKEN_MACRO_DEF | TOKEN_MACRO_END | TOKEN_MACRO_INCLUDE)
+
+static parsedLine* lexLine(char *line, ErrCode *errorCode, MacroTable *macroNames, ErrorList *errorList);
+static ErrCode dropMatrixParts(char **name, char **row, char **col, ErrCode errorCode);
 
 parsedLine* createParsedLine()
 {
@@ -16,22 +25,36 @@ parsedLine* createParsedLine()
     return pLine;
 }
 
-/* readParsedLine - reads a line from the file and returns a parsedLine structure
- * errorCode:  EOF_REACHED_S, LEXER_SUCCESS_S, LEXER_FAILURE_S
+/* parseLineText - lexes one line of text without changing it (the text is copied first)
+ * only touches its own arguments so lines can be lexed on several threads with one errorList each
+ * errorCode:  LEXER_SUCCESS_S, LEXER_FAILURE_S
  */
-parsedLine* readParsedLine(FILE *fp, ErrCode *errorCode, MacroTable *macroNames, ErrorList *errorList)
+parsedLine* parseLineText(const char *text, ErrCode *errorCode, MacroTable *macroNames, ErrorList *errorList)
 {
-    parsedLine* pLine;
-    char* line;
-
-    line = readLine(fp, errorCode); /* we will delete the parsed parts from this line */
-    if (*errorCode == EOF_REACHED_S) 
-        return NULL; /* end of file reached, return NULL */
-    
-    if (*errorCode != UTIL_SUCCESS_S){
-        addErrorToList(errorList, *errorCode); /* add the error to the error list */
+    char* line = strDup(text); /* we will delete the parsed parts from this line */
+    if (line == NULL) {
+        addErrorToList(errorList, MALLOC_ERROR_F);
+        *errorCode = LEXER_FAILURE_S;
         return NULL;
     }
+    return parseLine(line, errorCode, macroNames, errorList);
+}
+
+/* parseLine - lexes a line that was allocated by the caller and frees it
+ * errorCode:  LEXER_SUCCESS_S, LEXER_FAILURE_S
+ */
+parsedLine* parseLine(char *line, ErrCode *errorCode, MacroTable *macroNames, ErrorList *errorList)
+{
+    parsedLine *pLine = lexLine(line, errorCode, macroNames, errorList);
+    PROBE2(line, errorList->currentLine, pLine != NULL ? (int)pLine->typesOfLine : -1);
+    return pLine;
+}
+
+/* lexLine - parseLine without the probe */
+static parsedLine* lexLine(char *line, ErrCode *errorCode, MacroTable *macroNames, ErrorList *errorList)
+{
+    parsedLine* pLine;
+    LineIndex index; /* positions of the structural characters of the raw line */
 
     pLine = createParsedLine(); /* create a new parsedLine structure */
     if (pLine == NULL) {
@@ -41,8 +64,8 @@ parsedLine* readParsedLine(FILE *fp, ErrCode *errorCode, MacroTable *macroNames,
         return NULL;
     }
 
-
-    if (isEndOfLine(line)) { /* if the line is empty */
+    buildLineIndex(line, &index);
+    if (skipSpacesFrom(&index, 0) == index.length) { /* if the line is empty */
         free(line);
         pLine->typesOfLine = EMPTY_LINE; /* set the type of line to EMPTY_LINE */
         *errorCode = LEXER_SUCCESS_S; /* return success */
@@ -56,7 +79,7 @@ parsedLine* readParsedLine(FILE *fp, ErrCode *errorCode, MacroTable *macroNames,
     }
 
     /* get the label from the line */
-    *errorCode = getLabelFromLine(pLine, line, macroNames, errorList);
+    *errorCode = getLabelFromLine(pLine, line, &index, macroNames, errorList);
     if (*errorCode == LEXER_FAILURE_S) { /* if getting the label from the line failed */
         freeParsedLine(pLine);
         free(line);
@@ -99,26 +122,31 @@ parsedLine* readParsedLine(FILE *fp, ErrCode *errorCode, MacroTable *macroNames,
 /* gets the label from the line and sets it in the parsedLine structure
  * errorCode:  LEXER_SUCCESS_S, LEXER_FAILURE_S
  */
-ErrCode getLabelFromLine(parsedLine *pLine, char *line, MacroTable *macroNames, ErrorList *errorList)
+ErrCode getLabelFromLine(parsedLine *pLine, char *line, const LineIndex *index, MacroTable *macroNames, ErrorList *errorList)
 {
     char *token;
-    char *labelEnd; /* use to determine if the first token is a label */
     ErrCode errorCode = NULL_INITIAL;
-    
+    unsigned int tokenStart = skipSpacesFrom(index, 0);
+    unsigned int tokenEnd = index->length; /* the first token ends at a space or a '[' (not counting its first character) */
+    int space = nextOfClass(index, SCAN_SPACE, tokenStart + 1);
+    int bracket = nextOfClass(index, SCAN_OPEN_BRACKET, tokenStart + 1);
+    int colon = nextOfClass(index, SCAN_COLON, tokenStart); /* ':' is only found in labels */
+
     pLine->label = NULL; /* initialize the label to NULL */
-    
+
+    if (space != NOT_FOUND && (unsigned int)space < tokenEnd)
+        tokenEnd = space;
+    if (bracket != NOT_FOUND && (unsigned int)bracket < tokenEnd)
+        tokenEnd = bracket;
+    if (colon == NOT_FOUND || (unsigned int)colon >= tokenEnd) /* if the first token is not a label (starting labels have a colon [at the end]) */
+        return LEXER_SUCCESS_S; /* no need to copy the token */
+
     token = getFirstToken(line, &errorCode);
     if (errorCode != UTIL_SUCCESS_S){
         addErrorToList(errorList, errorCode); /* add the error to the error list */
         return LEXER_FAILURE_S;
     }
 
-    labelEnd = strchr(token, ':'); /* check if the string contains ':' only found in labels */
-    if (labelEnd == NULL) { /* if the first token is not a label (starting labels have a colon [at the end]) */
-        free(token);
-        return LEXER_SUCCESS_S;
-    }
-
     errorCode = isValidLabelColon(macroNames, token); /* check if the label is valid */
     if(errorCode != LEXER_SUCCESS_S) {
         addErrorToList(errorList, errorCode); /* add the error to the error list */
@@ -137,6 +165,7 @@ ErrCode getLabelFromLine(parsedLine *pLine, char *line, MacroTable *macroNames,
 ErrCode determineLineType(parsedLine *pLine, char *line, MacroTable *macroNames, ErrorList *errorList) 
 {
     char *token;
+    unsigned int tokens; /* what the first token is */
     ErrCode errorCode = NULL_INITIAL; /* reset error code to initial state */
 
     pLine->typesOfLine = UNSET_LINE; /* initialize the type of line to UNSET_LINE */
@@ -151,13 +180,14 @@ ErrCode determineLineType(parsedLine *pLine, char *line, MacroTable *macroNames,
         return LEXER_FAILURE_S; /* return failure if memory allocation failed */
     }
     
-    if (isOperationName(token)){   /* if the line is an instruction */
+    tokens = scanToken(token);
+    if (tokens & TOKEN_OPERATION){   /* if the line is an instruction */
         pLine->typesOfLine = INSTRUCTION_LINE;
         pLine->lineContentUnion.instruction.operationName = token; /* set the operation name */
         return LEXER_SUCCESS_S;
     }
 
-    if (isDirective(token)){
+    if (tokens & TOKEN_DIRECTIVE){
         pLine->typesOfLine = DIRECTIVE_LINE; /* if the line is a directive */
         pLine->lineContentUnion.directive.directiveName = token; /* set the directive name */
         return LEXER_SUCCESS_S;
@@ -175,13 +205,13 @@ ErrCode determineLineType(parsedLine *pLine, char *line, MacroTable *macroNames,
         return LEXER_FAILURE_S;
     }
 
-    if (isMacroDef(token)) { /* if the token is a macro definition */
+    if (tokens & TOKEN_MACRO_DEF) { /* if the token is a macro definition */
         free(token);
         addErrorToList(errorList, MACRO_DEF_AFTER_LABEL_E); /* add the error to the error list */
         return LEXER_FAILURE_S;
     }
 
-    if (isMacroEnd(token)) { /* if the token is a macro end */
+    if (tokens & TOKEN_MACRO_END) { /* if the token is a macro end */
         free(token);
         addErrorToList(errorList, MACRO_END_AFTER_LABEL_E); /* add the error to the error list */
         return LEXER_FAILURE_S;
@@ -216,6 +246,12 @@ ErrCode parseDirectiveLine(parsedLine *pLine, char *line, MacroTable *macroNames
     if (strcmp(pLine->lineContentUnion.directive.directiveName, ".mat") == 0) 
       return parseMatDirectiveLine(pLine, line, errorList);
 
+    if (strcmp(pLine->lineContentUnion.directive.directiveName, ".space") == 0)
+        return parseSpaceDirectiveLine(pLine, line, errorList);
+
+    if (strcmp(pLine->lineContentUnion.directive.directiveName, BINARY_DIRECTIVE) == 0)
+        return parseBinaryDirectiveLine(pLine, line, macroNames, errorList);
+
     if (strcmp(pLine->lineContentUnion.directive.directiveName, ".entry") == 0 ||
         strcmp(pLine->lineContentUnion.directive.directiveName, ".extern") == 0) 
         return parseEntryExternDirectiveLine(pLine, line, macroNames, errorList);
@@ -225,7 +261,9 @@ ErrCode parseDirectiveLine(parsedLine *pLine, char *line, MacroTable *macroNames
 
 ErrCode parseDataDirectiveLine(parsedLine *pLine, char *line, ErrorList *errorList)
 {
-    char *token, *endPtr;
+    LineIndex index; /* comma, space and digit positions of the data list */
+    unsigned int pos;
+    Bool moreItems = TRUE;
     unsigned int startErrCount = errorList->count; /* save the current error count to check if any errors were added */
     unsigned int dataCount = 0, arrSize = INITIAL_DATA_ITEMS_SIZE; /* arrSize is the initial size of the dataItems array */
     
@@ -235,39 +273,22 @@ ErrCode parseDataDirectiveLine(parsedLine *pLine, char *line, ErrorList *errorLi
         return LEXER_FAILURE_S;
     }
 
-    token = line; /* start parsing from the beginning of the line */
+    buildLineIndex(line, &index);
+    pos = 0; /* start parsing from the beginning of the line */
 
-    while (token != NULL) {
-        double value;
-        char *nextComma = strchr(token, ','); /* find the next comma */
+    while (moreItems) {
+        int value;
+        int nextComma = nextOfClass(&index, SCAN_COMMA, pos); /* find the next comma */
 
-        while (isspace(*token)) /* skip leading whitespace */
-            token++;
+        pos = skipSpacesFrom(&index, pos); /* skip leading whitespace */
 
-        if (nextComma != NULL && nextComma == token) { /* if there is a comma but no number before it */
+        if (nextComma != NOT_FOUND && (unsigned int)nextComma == pos) { /* if there is a comma but no number before it */
             addErrorToList(errorList, DATA_MISSING_NUMBERS_E);
-            token = nextComma + 1; /* +1 to move past the comma */
+            pos = nextComma + 1; /* +1 to move past the comma */
             continue;
         }
 
-        endPtr = token; /* set endPtr to the start of the token */
-        value = strtod(token, &endPtr);
-
-        while (isspace(*endPtr)) /* skip trailing whitespace */
-            endPtr++;
-
-        if (endPtr == token) /* if no number was found */
-            addErrorToList(errorList, DATA_INVALID_VALUE_E);
-        else if (endPtr[0] != ',' && endPtr[0] != '\0'){ /* if there are non-numeric and non-whitespace characters after the number */
-            if (isdigit(endPtr[0])) /* if the character is a digit */
-                addErrorToList(errorList, DATA_COMMA_BETWEEN_NUMS_E);
-            else if (isalpha(endPtr[0])) /* if the character is a letter */
-                addErrorToList(errorList, DATA_EXTRANEOUS_TEXT_E);
-        }
-        else if (value != (int)value) /* if the value is not an integer */
-            addErrorToList(errorList, DATA_ITEM_NOT_INTEGER_E);
-        else if (!isValidInteger10bits((int)value)) /* check if the integer value is valid for the assembler */
-            addErrorToList(errorList, INTEGER_OUT_OF_RANGE10_BITS_E);        
+        value = parseDataItem(&index, pos, errorList);
 
         if (dataCount >= arrSize) { /* resize array if needed */
             int *temp;
@@ -281,8 +302,9 @@ ErrCode parseDataDirectiveLine(parsedLine *pLine, char *line, ErrorList *errorLi
             dataItems = temp;
         }
 
-        dataItems[dataCount++] = (int)value;
-        token = nextComma != NULL ? nextComma + 1 : NULL; /* +1 to move past the comma */
+        dataItems[dataCount++] = value;
+        moreItems = nextComma != NOT_FOUND;
+        pos = nextComma + 1; /* +1 to move past the comma */
     } /* end of while */
 
     if (startErrCount < errorList->count) { /* if new errors were added */
@@ -292,6 +314,7 @@ ErrCode parseDataDirectiveLine(parsedLine *pLine, char *line, ErrorList *errorLi
 
     pLine->lineContentUnion.directive.dataItems = dataItems;
     pLine->lineContentUnion.directive.dataCount = dataCount;
+    pLine->lineContentUnion.directive.itemCount = dataCount;
 
     return LEXER_SUCCESS_S;
 }
@@ -299,82 +322,105 @@ ErrCode parseDataDirectiveLine(parsedLine *pLine, char *line, ErrorList *errorLi
 ErrCode parseStrDirectiveLine(parsedLine *pLine, char *line, ErrorList *errorList)
 {
     unsigned int startErrCount = errorList->count; /* save the current error count to check if any errors were added */
-    unsigned int i, arrSize = INITIAL_DATA_ITEMS_SIZE;
-    char *startQuote, *endQuote;
-    int* dataItems = malloc(sizeof(int) * INITIAL_DATA_ITEMS_SIZE);
+    unsigned int i, length = strlen(line);
+    int* dataItems = malloc(sizeof(int) * length); /* the string and its null terminator always fit in the line length */
     if (dataItems == NULL) {
         addErrorToList(errorList, MALLOC_ERROR_F);
         return LEXER_FAILURE_S;
     }
 
-    startQuote = strchr(line, '"'); /* find the first quote */
-    endQuote = strrchr(line, '"'); /* find the last quote */
-
-    if (startQuote == NULL){ /* if didn't find any quote */
-        addErrorToList(errorList, STR_MISSING_OPEN_QUOTE_E);
-        addErrorToList(errorList, STR_MISSING_CLOSE_QUOTE_E);
-    }
-    else if (startQuote != line) /* if the first character is not '"' (line already skipped whitespace) */
-        addErrorToList(errorList, STR_MISSING_OPEN_QUOTE_E);
-    else if (endQuote == startQuote) /* if didn't find a closing quote */
-        addErrorToList(errorList, STR_MISSING_CLOSE_QUOTE_E);
+    if (!(scanToken(line) & TOKEN_STRING)) /* a valid string needs no more checks */
+        checkStrDirectiveText(line, errorList);
 
-    for (i = 1; i < strlen(line) - 1; i++)
-    {
-        if(!isAscii(line[i])) /* if the first character is not a valid ASCII character */
-            addErrorToList(errorList, STR_INVALID_CHAR_E);
-        
-        if (i - 1 >= arrSize) { /* resize array if needed */
-            int *temp;
-            arrSize *= 2;
-            temp = realloc(dataItems, sizeof(int) * arrSize);
-            if (temp == NULL) {
-                free(dataItems);
-                addErrorToList(errorList, MALLOC_ERROR_F);
-                return LEXER_FAILURE_S;
-            }
-            dataItems = temp;
-        }
-        
+    for (i = 1; i + 1 < length; i++)
         dataItems[i - 1] = (int)line[i]; /* store the character in the dataItems array */
-    }
-
-    /* if found a closing quote and there is extraneous text after the string */
-    if (endQuote != NULL && endQuote != startQuote && !isEndOfLine(endQuote + QUOTE_LENGTH))
-        addErrorToList(errorList, EXTRANEOUS_TEXT_E);
 
     if (startErrCount < errorList->count){ /* if new errors were added we return failure */
         free(dataItems);
         return LEXER_FAILURE_S;
     }
 
-    if (i - 1 >= arrSize) { /* resize array if needed */
-            int *temp;
-            arrSize += 1; /* add one more space for the null terminator */
-            temp = realloc(dataItems, sizeof(int) * arrSize);
-            if (temp == NULL) {
-                free(dataItems);
-                addErrorToList(errorList, MALLOC_ERROR_F);
-                return LEXER_FAILURE_S;
-            }
-            dataItems = temp;
-    }
-
     dataItems[i - 1] = '\0'; /* add null terminator to the end of the string */
     
     pLine->lineContentUnion.directive.dataItems = dataItems; /* set the data items in the parsed line */
     pLine->lineContentUnion.directive.dataCount = i; /* set the data count in the parsed line */
+    pLine->lineContentUnion.directive.itemCount = i;
+    return LEXER_SUCCESS_S;
+}
+
+/* parseBinaryDirectiveLine - reads the file of .incbin "path" with the include reader of the macro table, the words
+ * stay in the file until the first pass decodes them into the data image. the path is relative to the .as file
+ * (the includeBase of the macro table)
+ * errorCode:  LEXER_SUCCESS_S, LEXER_FAILURE_S
+ */
+ErrCode parseBinaryDirectiveLine(parsedLine *pLine, char *line, MacroTable *macroNames, ErrorList *errorList)
+{
+    ErrCode errorCode = NULL_INITIAL;
+    char *path = parseIncludePath(line, &errorCode), *resolved;
+    ContentHash fileHash;
+
+    if (path == NULL) {
+        addErrorToList(errorList, errorCode == MACRO_INCLUDE_PATH_E ? BINARY_INCLUDE_PATH_E :
+                                  errorCode == UTIL_SUCCESS_S ? MALLOC_ERROR_F : errorCode);
+        return LEXER_FAILURE_S;
+    }
+    resolved = resolveIncludePath(macroNames != NULL ? macroNames->includeBase : NULL, path);
+    errorCode = resolved != NULL ? readPackedFile(macroNames, resolved, &pLine->lineContentUnion.directive.packed, &fileHash)
+                                 : MALLOC_ERROR_F;
+    if (resolved != NULL && macroNames != NULL && /* the build cache needs every file the run read */
+        recordIncludedFile(macroNames, resolved, errorCode != BINARY_FILE_UNREADABLE_E ? &fileHash : NULL) != UTIL_SUCCESS_S) {
+        releasePackedFile(&pLine->lineContentUnion.directive.packed);
+        errorCode = MALLOC_ERROR_F;
+    }
+    freeStrings(path, resolved, NULL);
+    if (errorCode != UTIL_SUCCESS_S) {
+        addErrorToList(errorList, errorCode);
+        return LEXER_FAILURE_S;
+    }
+    pLine->lineContentUnion.directive.dataCount = pLine->lineContentUnion.directive.packed.wordCount;
     return LEXER_SUCCESS_S;
 }
 
+/* reports what is wrong with the text of a .string directive that the token grammar didn't accept */
+void checkStrDirectiveText(const char *line, ErrorList *errorList)
+{
+    unsigned int invalidChars;
+    int startQuote, endQuote;
+    LineIndex index; /* quote and non ASCII positions of the string */
+
+    buildLineIndex(line, &index);
+    startQuote = nextOfClass(&index, SCAN_QUOTE, 0); /* find the first quote */
+    endQuote = lastOfClass(&index, SCAN_QUOTE); /* find the last quote */
+
+    if (startQuote == NOT_FOUND){ /* if didn't find any quote */
+        addErrorToList(errorList, STR_MISSING_OPEN_QUOTE_E);
+        addErrorToList(errorList, STR_MISSING_CLOSE_QUOTE_E);
+    }
+    else if (startQuote != 0) /* if the first character is not '"' (line already skipped whitespace) */
+        addErrorToList(errorList, STR_MISSING_OPEN_QUOTE_E);
+    else if (endQuote == startQuote) /* if didn't find a closing quote */
+        addErrorToList(errorList, STR_MISSING_CLOSE_QUOTE_E);
+
+    invalidChars = index.length > 1 ? countOfClass(&index, SCAN_NON_ASCII, 1, index.length - 1) : 0;
+    while (invalidChars-- > 0) /* one error per character that is not a valid ASCII character */
+        addErrorToList(errorList, STR_INVALID_CHAR_E);
+
+    /* if found a closing quote and there is extraneous text after the string */
+    if (endQuote != NOT_FOUND && endQuote != startQuote && !isEndOfLine(line + endQuote + QUOTE_LENGTH))
+        addErrorToList(errorList, EXTRANEOUS_TEXT_E);
+}
+
 ErrCode parseMatDirectiveLine(parsedLine *pLine, char *line, ErrorList *errorList)
 {
     ErrCode errorCode = NULL_INITIAL;
     unsigned int startErrCount = errorList->count; /* save the current error count to check if any errors were added */
-    unsigned int dataCount = 0, i = 0; 
+    unsigned int dataCount = 0, i = 0, arrSize = 0;
     int row = 0, col = 0;
-    char *token, *endPtr;
+    char *token;
     int* dataItems = NULL;
+    LineIndex index; /* comma, space and digit positions of the matrix values */
+    unsigned int pos;
+    Bool moreItems = TRUE;
     
     token = cutFirstToken(line, &errorCode); /* should be "[row]"*/
     if (errorCode != UTIL_SUCCESS_S) {
@@ -408,26 +454,20 @@ ErrCode parseMatDirectiveLine(parsedLine *pLine, char *line, ErrorList *errorLis
         return LEXER_FAILURE_S;
     }
 
-    dataCount = row * col; /* calculate the number of data items in the matrix */
-    dataItems = calloc(dataCount, sizeof(int)); /* allocate memory for the data items (zero-initialized) */
-    if (dataItems == NULL) {
-        addErrorToList(errorList, MALLOC_ERROR_F);
-        return LEXER_FAILURE_S;
-    }
+    /* the number of words in the matrix, one that can't fit the data image overflows it either way */
+    dataCount = (unsigned int)row > OVERSIZED_DATA_COUNT / (unsigned int)col ? OVERSIZED_DATA_COUNT : (unsigned int)(row * col);
 
-    i = 0;
-    token = line;
+    buildLineIndex(line, &index);
+    pos = 0;
 
-    while (token != NULL) {
-        double value;
-        char *nextComma = strchr(token, ','); /* find the next comma */
+    while (moreItems) { /* only the values written are kept, the words after them are 0 */
+        int nextComma = nextOfClass(&index, SCAN_COMMA, pos); /* find the next comma */
 
-        while (isspace(*token)) /* skip leading whitespace */
-            token++;
+        pos = skipSpacesFrom(&index, pos); /* skip leading whitespace */
 
-        if (nextComma != NULL && nextComma == token) { /* if there is a comma but no number before it */
+        if (nextComma != NOT_FOUND && (unsigned int)nextComma == pos) { /* if there is a comma but no number before it */
             addErrorToList(errorList, DATA_MISSING_NUMBERS_E);
-            token = nextComma + 1; /* +1 to move past the comma */
+            pos = nextComma + 1; /* +1 to move past the comma */
             continue;
         }
 
@@ -437,36 +477,65 @@ ErrCode parseMatDirectiveLine(parsedLine *pLine, char *line, ErrorList *errorLis
             return LEXER_FAILURE_S;    
         }
 
-        endPtr = token; /* set endPtr to the start of the token */
-        value = strtod(token, &endPtr);
-
-        while (isspace(*endPtr)) /* skip trailing whitespace */
-            endPtr++;
-
-        if (endPtr == token) /* if no number was found */
-            addErrorToList(errorList, DATA_INVALID_VALUE_E);
-        else if (endPtr[0] != ',' && endPtr[0] != '\0') /* if there are non-numeric and non-whitespace characters after the number */
-            if (isdigit(endPtr[0])) /* if the character is a digit */
-                addErrorToList(errorList, DATA_COMMA_BETWEEN_NUMS_E);
-            else if (isalpha(endPtr[0])) /* if the character is a letter */
-                addErrorToList(errorList, DATA_EXTRANEOUS_TEXT_E);
-        else if (value != (int)value) /* if the value is not an integer */
-            addErrorToList(errorList, DATA_ITEM_NOT_INTEGER_E);
-        else if (!isValidInteger10bits((int)value)) /* check if the integer value is valid for the assembler */
-            addErrorToList(errorList, INTEGER_OUT_OF_RANGE10_BITS_E);        
+        if (i >= arrSize) { /* resize array if needed, never past the matrix size */
+            int *temp;
+            arrSize = arrSize == 0 ? INITIAL_DATA_ITEMS_SIZE : arrSize * 2;
+            arrSize = arrSize < dataCount ? arrSize : dataCount;
+            temp = realloc(dataItems, sizeof(int) * arrSize);
+            if (temp == NULL) {
+                free(dataItems);
+                addErrorToList(errorList, MALLOC_ERROR_F);
+                return LEXER_FAILURE_S;
+            }
+            dataItems = temp;
+        }
 
-        dataItems[i++] = (int)value;
-        token = nextComma != NULL ? nextComma + 1 : NULL; /* +1 to move past the comma */
+        dataItems[i++] = parseDataItem(&index, pos, errorList);
+        moreItems = nextComma != NOT_FOUND;
+        pos = nextComma + 1; /* +1 to move past the comma */
     }
 
-    free(token);
-    if (startErrCount < errorList->count) /* if new errors were added */
+    if (startErrCount < errorList->count) { /* if new errors were added */
+        free(dataItems);
         return LEXER_FAILURE_S;
-    
+    }
 
     pLine->lineContentUnion.directive.dataItems = dataItems; /* set the data items in the parsed line */
     pLine->lineContentUnion.directive.dataCount = dataCount; /* set the data count in the parsed line */
+    pLine->lineContentUnion.directive.itemCount = i;
+
+    return LEXER_SUCCESS_S;
+}
+
+/* parseSpaceDirectiveLine - .space N reserves N words of 0, the line keeps only the count
+ * errorCode:  LEXER_SUCCESS_S, LEXER_FAILURE_S
+ */
+ErrCode parseSpaceDirectiveLine(parsedLine *pLine, char *line, ErrorList *errorList)
+{
+    ErrCode errorCode = NULL_INITIAL;
+    unsigned int words = 0, i;
+    char *token = cutFirstToken(line, &errorCode); /* should be a positive integer */
+
+    if (errorCode != UTIL_SUCCESS_S) {
+        addErrorToList(errorList, errorCode);
+        return LEXER_FAILURE_S;
+    }
+
+    for (i = token[0] == '+' ? 1 : 0; isdigit((unsigned char)token[i]); i++) /* stops growing past the data image */
+        words = words < OVERSIZED_DATA_COUNT ? words * 10 + (unsigned int)(token[i] - '0') : OVERSIZED_DATA_COUNT;
+    if (token[i] != '\0' || words == 0) {
+        addErrorToList(errorList, SPACE_INVALID_SIZE_E);
+        free(token);
+        return LEXER_FAILURE_S;
+    }
+    free(token);
 
+    if (!isEndOfLine(line)) {
+        addErrorToList(errorList, EXTRANEOUS_TEXT_E);
+        return LEXER_FAILURE_S;
+    }
+
+    pLine->lineContentUnion.directive.dataCount = words < OVERSIZED_DATA_COUNT ? words : OVERSIZED_DATA_COUNT;
     return LEXER_SUCCESS_S;
 }
 
@@ -532,7 +601,7 @@ ErrCode parseInstructionLine(parsedLine *pLine, char *line, MacroTable *macroNam
     }
 
     /* the instruction has at least one operand - lets check the first operand type */
-    errorCode = determineOperandType(pLine->lineContentUnion.instruction.operand1, &opType1, &matLabel, &row, &col, macroNames, errorList);
+    errorCode = determineOperandType(pLine->lineContentUnion.instruction.operand1, &opType1, &pLine->lineContentUnion.instruction.number1, &matLabel, &row, &col, macroNames, errorList);
     if (errorCode == LEXER_FAILURE_S){ /* if the operand type is not valid */
         errorOccurred = TRUE; /* set the error flag to true */
         addErrorToList(errorList, OPERAND1_ERROR_N); /* add the error to the error list */
@@ -563,7 +632,7 @@ ErrCode parseInstructionLine(parsedLine *pLine, char *line, MacroTable *macroNam
     }
     
     /* the instruction has two operands, we need to check the second operand */
-    errorCode = determineOperandType(pLine->lineContentUnion.instruction.operand2, &opType2, &matLabel, &row, &col, macroNames, errorList);
+    errorCode = determineOperandType(pLine->lineContentUnion.instruction.operand2, &opType2, &pLine->lineContentUnion.instruction.number2, &matLabel, &row, &col, macroNames, errorList);
     if (errorCode == LEXER_FAILURE_S){ /* if the operand type is not valid */
         errorOccurred = TRUE;
         addErrorToList(errorList, OPERAND2_ERROR_N);
@@ -603,6 +672,7 @@ ErrCode parseInstructionLineOperand(parsedLine *pLine, char *line, ErrorList *er
 {
     char *operand1 = NULL, *operand2 = NULL;
     char* commaExists = NULL; /* used to find the first comma in the line for error checking */
+    char* nextToken = NULL; /* where commaToken() continues from */
 
     if (pLine->lineContentUnion.instruction.operandCount == NO_OPERANDS) { /* if the instruction has no operands */
         if (!isEndOfLine(line)) { /* if there is extraneous text after the instruction */
@@ -614,7 +684,7 @@ ErrCode parseInstructionLineOperand(parsedLine *pLine, char *line, ErrorList *er
 
     commaExists = strchr(line, ','); /* find the first comma in the line */
 
-    operand1 = strtok(line, ","); /* get the first operand */
+    operand1 = commaToken(line, &nextToken); /* get the first operand */
     if (operand1 == NULL) { /* if the first operand is missing */
         addErrorToList(errorList, MISSING_FIRST_OPERAND_E);
         return LEXER_FAILURE_S;
@@ -635,7 +705,7 @@ ErrCode parseInstructionLineOperand(parsedLine *pLine, char *line, ErrorList *er
         return LEXER_SUCCESS_S;
     }
 
-    operand2 = strtok(NULL, ","); /* get the second operand */
+    operand2 = commaToken(NULL, &nextToken); /* get the second operand */
     if (operand2 == NULL || isEndOfLine(operand2)) { /* if the second operand is missing */
         addErrorToList(errorList, MISSING_SECOND_OPERAND_E);
         return MISSING_SECOND_OPERAND_E;
@@ -649,23 +719,53 @@ ErrCode parseInstructionLineOperand(parsedLine *pLine, char *line, ErrorList *er
 
     pLine->lineContentUnion.instruction.operand2 = operand2; /* set the second operand */
 
-    if (strtok(NULL, ",") == NULL) /* if there are no more commas after the second operand */
+    if (commaToken(NULL, &nextToken) == NULL) /* if there are no more commas after the second operand */
         return LEXER_SUCCESS_S;
     
     addErrorToList(errorList, THIRD_OPERAND_DETECTED_E); /* if there are more than two operands */
     return THIRD_OPERAND_DETECTED_E;
 }
 
+/* commaToken - reentrant strtok(str, ",") - returns the next comma separated token of str
+ * (skipping empty ones) and keeps where to continue from in *next instead of a static variable
+ */
+char* commaToken(char *str, char **next)
+{
+    char *token = str != NULL ? str : *next;
+    char *tokenEnd;
+
+    if (token == NULL)
+        return NULL;
+
+    while (*token == ',') /* skip leading commas like strtok does */
+        token++;
+
+    if (*token == '\0') {
+        *next = NULL;
+        return NULL;
+    }
+
+    tokenEnd = strchr(token, ',');
+    if (tokenEnd == NULL)
+        *next = NULL;
+    else {
+        *tokenEnd = '\0'; /* end the token on the comma */
+        *next = tokenEnd + 1;
+    }
+    return token;
+}
+
 /* Determines the type of the operand and sets it in the parsedLine structure
  * unknown lines are assumed to be labels
  * errorCode:  LEXER_SUCCESS_S, LEXER_FAILURE_S
  */
-ErrCode determineOperandType(const char *operand, operandType *opType, char **matLabel, char **row, char **col, MacroTable *macroNames, ErrorList *errorList)
+ErrCode determineOperandType(const char *operand, operandType *opType, int *number, char **matLabel, char **row, char **col, MacroTable *macroNames, ErrorList *errorList)
 {
     ErrCode errorCode = NULL_INITIAL;
+    unsigned int tokens = scanToken(operand); /* one pass to know what the operand can be */
     *opType = UNKNOWN_OPERAND;
 
-    if (isKeywords(operand)) { /* if the operand is a keyword */
+    if (tokens & KEYWORD_TOKENS) { /* if the operand is a keyword */
         addErrorToList(errorList, OPERAND_IS_KEYWORD_E); /* add an error to the error list */
         return LEXER_FAILURE_S; /* return failure if the operand is a keyword */
     }
@@ -675,6 +775,23 @@ ErrCode determineOperandType(const char *operand, operandType *opType, char **ma
         return LEXER_FAILURE_S; /* return failure if the operand is a macro */
     }
 
+    /* the fast path - operands the grammar accepts get the same result the checks below would give them */
+    if (tokens & TOKEN_REGISTER) {
+        *opType = REGISTER_OPERAND;
+        return LEXER_SUCCESS_S;
+    }
+    if ((tokens & TOKEN_MATRIX) && !(tokens & TOKEN_REGISTER_EXTRA)) { /* r0[..] is reported as a register with extra text */
+        if (parseMatrixOperand(operand, matLabel, row, col) == LEXER_SUCCESS_S) { /* only splits it, the syntax is known to be valid */
+            *opType = MATRIX_SYNTAX_OPERAND;
+            return LEXER_SUCCESS_S;
+        }
+    }
+    if ((tokens & TOKEN_LABEL) && !(tokens & TOKEN_REGISTER_EXTRA) && strlen(operand) <= MAX_LABEL_LENGTH) {
+        *opType = LABEL_SYNTAX_OPERAND;
+        return LEXER_SUCCESS_S;
+    }
+
+    /* the slow path - find out what is wrong with the operand (or that it is a number) */
     errorCode = isRegisterOperand(operand); /* check if the first operand is a register */
     if (errorCode == LEXER_SUCCESS_S) { /* if the operand is a register */
         *opType = REGISTER_OPERAND; /* set the operand type to REGISTER_OPERAND */
@@ -688,7 +805,7 @@ ErrCode determineOperandType(const char *operand, operandType *opType, char **ma
 
     /* so the operand is not a register, lets check if it is a number */
 
-    errorCode = isNumberOperand(operand);
+    errorCode = isNumberOperand(operand, number);
     if (errorCode == LEXER_SUCCESS_S) { /* if the operand is a number */
         *opType = NUMBER_OPERAND; /* set the operand type to NUMBER_OPERAND */
         return LEXER_SUCCESS_S; /* return success */
@@ -719,7 +836,7 @@ ErrCode determineOperandType(const char *operand, operandType *opType, char **ma
         }
 
         if (errorOccurred) /* if one of the row or column is not a valid register */
-            return LEXER_FAILURE_S; /* return failure if the operand is not a valid matrix */
+            return dropMatrixParts(matLabel, row, col, LEXER_FAILURE_S); /* the line doesn't keep the parts */
 
         /* if both row and column are valid registers, set the operand type to matrix */
         *opType = MATRIX_SYNTAX_OPERAND; /* set the operand type to MATRIX_SYNTAX_OPERAND */
@@ -877,6 +994,7 @@ void freeParsedLine(parsedLine *pLine)
                 free(pLine->lineContentUnion.directive.directiveName);
             if (pLine->lineContentUnion.directive.dataItems != NULL)
                 free(pLine->lineContentUnion.directive.dataItems);
+            releasePackedFile(&pLine->lineContentUnion.directive.packed);
             if (pLine->lineContentUnion.directive.directiveLabel != NULL)
                 free(pLine->lineContentUnion.directive.directiveLabel);
             break;
@@ -903,6 +1021,41 @@ void freeParsedLine(parsedLine *pLine)
     free(pLine);
 }
 
+/* ParsedProgram functions */
+
+ParsedProgram* createParsedProgram(unsigned int lineCount)
+{
+    ParsedProgram* program = malloc(sizeof(ParsedProgram));
+    if (program == NULL)
+        return NULL;
+
+    program->count = lineCount;
+    /* +1 so an empty file still gets valid (empty) arrays */
+    program->lines = calloc(lineCount + 1, sizeof(parsedLine*));
+    program->addresses = calloc(lineCount + 1, sizeof(unsigned int));
+    if (program->lines == NULL || program->addresses == NULL) {
+        freeParsedProgram(program);
+        return NULL;
+    }
+    return program;
+}
+
+void freeParsedProgram(ParsedProgram *program)
+{
+    unsigned int i;
+    if (program == NULL)
+        return;
+
+    if (program->lines != NULL) {
+        for (i = 0; i < program->count; i++)
+            freeParsedLine(program->lines[i]);
+        free(program->lines);
+    }
+    if (program->addresses != NULL)
+        free(program->addresses);
+    free(program);
+}
+
 void printParsedLine(parsedLine *pLine)
 {
     if (pLine == NULL){
@@ -954,13 +1107,15 @@ void printParsedLine(parsedLine *pLine)
                 printf("\"");
             } else if (strcmp(pLine->lineContentUnion.directive.directiveName, ".data") == 0 ||
                         strcmp(pLine->lineContentUnion.directive.directiveName, ".mat") == 0 ||
+                        strcmp(pLine->lineContentUnion.directive.directiveName, ".space") == 0 ||
                         strcmp(pLine->lineContentUnion.directive.directiveName, ".string") == 0) 
             {
                 printf(" %s", pLine->lineContentUnion.directive.directiveName);
                 if (pLine->lineContentUnion.directive.dataCount > 0) {
                     unsigned int i;
                     for (i = 0; i < pLine->lineContentUnion.directive.dataCount; i++) {
-                        printf(" %d", pLine->lineContentUnion.directive.dataItems[i]);
+                        printf(" %d", i < pLine->lineContentUnion.directive.itemCount ?
+                                      pLine->lineContentUnion.directive.dataItems[i] : 0);
                         if (i < pLine->lineContentUnion.directive.dataCount - 1)
                             printf(",");
                     }
@@ -1020,57 +1175,45 @@ Bool isEndOfLine(const char *str){
     return (str[i] == '\0'); /* return TRUE if the string is empty or contains only whitespace */
 }
 
+/* scanToken - runs the token DFA (generated from lexer.grammar) over the whole string
+ * returns the TOKEN_ bits of every token the string matches, 0 if it matches none
+ */
+unsigned int scanToken(const char *token)
+{
+    const unsigned char *p = (const unsigned char*)token;
+    unsigned int state = DFA_START_STATE;
+
+    while (*p != '\0') /* no early exit, the dead state loops to itself */
+        state = dfaNext[state][dfaByteClass[*p++]];
+    return dfaAccept[state];
+}
+
 Bool isOperationName(const char* arg){
-    return (strcmp(arg, "mov") == 0 ||
-        strcmp(arg, "cmp") == 0 ||
-        strcmp(arg, "add") == 0 ||
-        strcmp(arg, "sub") == 0 ||
-        strcmp(arg, "lea") == 0 ||
-        strcmp(arg, "clr") == 0 ||
-        strcmp(arg, "not") == 0 ||
-        strcmp(arg, "inc") == 0 ||
-        strcmp(arg, "dec") == 0 ||
-        strcmp(arg, "jmp") == 0 ||
-        strcmp(arg, "bne") == 0 ||
-        strcmp(arg, "jsr") == 0 ||
-        strcmp(arg, "red") == 0 ||
-        strcmp(arg, "prn") == 0 ||
-        strcmp(arg, "rts") == 0 ||
-        strcmp(arg, "stop") == 0);
+    return (scanToken(arg) & TOKEN_OPERATION) != 0;
 }
 
 Bool isRegister(const char* arg){
-    return (strcmp(arg, "r0") == 0 ||
-        strcmp(arg, "r1") == 0 ||
-        strcmp(arg, "r2") == 0 ||
-        strcmp(arg, "r3") == 0 ||
-        strcmp(arg, "r4") == 0 ||
-        strcmp(arg, "r5") == 0 ||
-        strcmp(arg, "r6") == 0 ||
-        strcmp(arg, "r7") == 0);
+    return (scanToken(arg) & TOKEN_REGISTER) != 0;
 }
 
 Bool isDirective(const char* arg){
-    return (strcmp(arg, ".data") == 0 ||
-        strcmp(arg, ".string") == 0 ||
-        strcmp(arg, ".mat") == 0 ||
-        strcmp(arg, ".entry") == 0 ||
-        strcmp(arg, ".extern") == 0);
+    return (scanToken(arg) & TOKEN_DIRECTIVE) != 0;
 }
 
 Bool isMacroDef(const char* arg){
-    return (strcmp(arg, "mcro") == 0);
+    return (scanToken(arg) & TOKEN_MACRO_DEF) != 0;
 }
 
 Bool isMacroEnd(const char* arg){
-    return (strcmp(arg, "mcroend") == 0);
+    return (scanToken(arg) & TOKEN_MACRO_END) != 0;
+}
+
+Bool isMacroInclude(const char* arg){
+    return (scanToken(arg) & TOKEN_MACRO_INCLUDE) != 0;
 }
 
 Bool isKeywords(const char *arg){
-    return (isOperationName(arg) ||
-        isDirective(arg) ||
-        isMacroDef(arg) ||
-        isMacroEnd(arg));
+    return (scanToken(arg) & KEYWORD_TOKENS) != 0;
 }
 
 /* check if the integer value can fit in 10 bits (-512 to 511) */
@@ -1087,6 +1230,9 @@ Bool isValidInteger8bits(int value){
  */
 ErrCode isValidLabelSyntax(const char *operand)
 {
+    if ((scanToken(operand) & TOKEN_LABEL) && strlen(operand) <= MAX_LABEL_LENGTH) /* the common case in one pass */
+        return LEXER_SUCCESS_S;
+
     if (strlen(operand) > MAX_LABEL_LENGTH) /* check if the operand is empty */
         return LABEL_TOO_LONG_E;
     
@@ -1124,13 +1270,13 @@ ErrCode isRegisterOperand(const char* operand)
     return LEXER_SUCCESS_S;
 }
 
-/* Check if the operand is a number
+/* Check if the operand is a number and sets its value
  * returns: LEXER_SUCCESS_S, MISSING_NUM_OPERAND_E, NUMBER_OPERAND_IS_NOT_INTEGER_E, OPERAND_EXTRANEOUS_TEXT_E, INTEGER_OPERAND_OUT_OF_RANGE8_BITS_E, LEXER_FAILURE_S
  */
-ErrCode isNumberOperand(const char *operand)
+ErrCode isNumberOperand(const char *operand, int *value)
 {
-    double value;
-    char *endPtr;
+    IntegerStatus status;
+    const char *endPtr;
 
     if (operand[0] != '#') 
         return LEXER_FAILURE_S;
@@ -1139,22 +1285,135 @@ ErrCode isNumberOperand(const char *operand)
     if (isEndOfLine(operand))
         return MISSING_NUM_OPERAND_E;
 
-    value = strtod(operand, &endPtr);
-    if (operand == endPtr)  /* no digits were found */
+    status = parseInteger(operand, MIN_8BIT_INT, MAX_8BIT_INT, value, &endPtr);
+    if (status == INTEGER_MISSING)  /* no digits were found */
         return MISSING_NUM_OPERAND_E;
 
-    if (value != (int)value)  /* check if the value is an integer */
+    if (status == INTEGER_NOT_WHOLE)  /* check if the value is an integer */
         return NUMBER_OPERAND_IS_NOT_INTEGER_E;
 
     if (!isEndOfLine(endPtr))  /* extraneous characters */
         return OPERAND_EXTRANEOUS_TEXT_E;
 
-    if (!isValidInteger8bits((int)value))  /* check if the value is within 8-bit range */
+    if (status == INTEGER_OUT_OF_RANGE)  /* check if the value is within 8-bit range */
         return INTEGER_OPERAND_OUT_OF_RANGE8_BITS_E;
 
     return LEXER_SUCCESS_S;
 }
 
+/* the shared tail of parseInteger and parseIndexedInteger, str[pos] to str[digitsEnd - 1] are the digits after the sign
+ * a fraction is allowed only if it is all zeros (5.0 is the integer 5), the value is clamped when it is out of range
+ */
+static IntegerStatus finishInteger(const char *str, unsigned int start, unsigned int pos, unsigned int digitsEnd, Bool negative,
+                                   int minValue, int maxValue, int *value, unsigned int *end)
+{
+    long limit = negative ? -(long)minValue : (long)maxValue; /* the largest magnitude allowed */
+    long magnitude = 0;
+    Bool hasDigits = digitsEnd > pos, isWhole = TRUE;
+
+    for (; pos < digitsEnd; pos++) {
+        magnitude = magnitude * 10 + (str[pos] - '0');
+        if (magnitude > limit)
+            magnitude = limit + 1; /* stop growing, it can't overflow and it is still out of range */
+    }
+
+    if (str[pos] == '.') { /* the fraction part */
+        pos++;
+        for (; isdigit((unsigned char)str[pos]); pos++) {
+            hasDigits = TRUE;
+            if (str[pos] != '0')
+                isWhole = FALSE;
+        }
+    }
+
+    if (!hasDigits) {
+        *value = 0;
+        *end = start; /* nothing was parsed */
+        return INTEGER_MISSING;
+    }
+
+    *end = pos;
+    *value = (int)(negative ? -magnitude : magnitude);
+    if (!isWhole)
+        return INTEGER_NOT_WHOLE;
+    if (magnitude > limit)
+        return INTEGER_OUT_OF_RANGE;
+    return INTEGER_VALID;
+}
+
+/* parses a signed decimal integer (leading whitespace is skipped) in one scan
+ * *end is set after the number, or to str if there was no number
+ */
+IntegerStatus parseInteger(const char *str, int minValue, int maxValue, int *value, const char **end)
+{
+    unsigned int pos = 0, digitsEnd, endPos;
+    Bool negative = FALSE;
+    IntegerStatus status;
+
+    while (isspace((unsigned char)str[pos]))
+        pos++;
+    if (str[pos] == '-' || str[pos] == '+')
+        negative = str[pos++] == '-';
+
+    for (digitsEnd = pos; isdigit((unsigned char)str[digitsEnd]); digitsEnd++)
+        ;
+
+    status = finishInteger(str, 0, pos, digitsEnd, negative, minValue, maxValue, value, &endPos);
+    *end = str + endPos;
+    return status;
+}
+
+/* same as parseInteger starting at index->line[from], the digits run is found with one scan of the digit mask
+ * so long .data lists don't test their digits one by one
+ */
+IntegerStatus parseIndexedInteger(const LineIndex *index, unsigned int from, int minValue, int maxValue, int *value, unsigned int *end)
+{
+    const char *line = index->line;
+    unsigned int pos = skipSpacesFrom(index, from);
+    Bool negative = FALSE;
+
+    if (line[pos] == '-' || line[pos] == '+')
+        negative = line[pos++] == '-';
+
+    return finishInteger(line, from, pos, skipClassFrom(index, SCAN_DIGIT, pos), negative, minValue, maxValue, value, end);
+}
+
+/* parses one .data or .mat item that starts at from and adds its errors to the list
+ * returns the value of the item (clamped if it is out of range)
+ */
+int parseDataItem(const LineIndex *index, unsigned int from, ErrorList *errorList)
+{
+    int value;
+    unsigned int end;
+    IntegerStatus status = parseIndexedInteger(index, from, MIN_10BIT_INT, MAX_10BIT_INT, &value, &end);
+    char next = index->line[skipSpacesFrom(index, end)]; /* the first character after the number */
+
+    if (status == INTEGER_MISSING) /* if no number was found */
+        addErrorToList(errorList, DATA_INVALID_VALUE_E);
+    else if (next != ',' && next != '\0') { /* if there are non-numeric and non-whitespace characters after the number */
+        if (isdigit((unsigned char)next)) /* if the character is a digit */
+            addErrorToList(errorList, DATA_COMMA_BETWEEN_NUMS_E);
+        else
+            addErrorToList(errorList, DATA_EXTRANEOUS_TEXT_E);
+    }
+    else if (status == INTEGER_NOT_WHOLE) /* if the value is not an integer */
+        addErrorToList(errorList, DATA_ITEM_NOT_INTEGER_E);
+    else if (status == INTEGER_OUT_OF_RANGE) /* check if the integer value is valid for the assembler */
+        addErrorToList(errorList, INTEGER_OUT_OF_RANGE10_BITS_E);
+
+    return value;
+}
+
+/* dropMatrixParts - frees the parts of a matrix operand and clears them, so a failed operand keeps none, returns errorCode */
+static ErrCode dropMatrixParts(char **name, char **row, char **col, ErrCode errorCode)
+{
+    freeStrings(*name, *row, *col);
+    *name = NULL;
+    *row = NULL;
+    *col = NULL;
+    return errorCode;
+}
+
 ErrCode parseMatrixOperand(const char *operandStr, char **name, char **row, char **col)
 {
     const char *p = operandStr;
@@ -1177,56 +1436,44 @@ ErrCode parseMatrixOperand(const char *operandStr, char **name, char **row, char
     *name = strnDup(start, len);
 
     while (isspace(*p)) p++;
-    if (*p != '[') {
-        freeStrings(*name, *row, *col);
-        return LEXER_FAILURE_S;
-    }
+    if (*p != '[')
+        return dropMatrixParts(name, row, col, LEXER_FAILURE_S);
     p++; /* skip the '[' */
 
     while (isspace(*p)) p++;
-    if (*p == '\0' || *p == ']') {
-        freeStrings(*name, *row, *col);
-        return MAT_EMPTY_ROW_INDEX_E;
-    }
+    if (*p == '\0' || *p == ']')
+        return dropMatrixParts(name, row, col, MAT_EMPTY_ROW_INDEX_E);
 
     start = p;
     while (*p != '\0' && *p != ']') p++;
-    if (*p != ']') {
-        freeStrings(*name, *row, *col);
-        return MAT_MISSING_FIRST_CLOSING_BRACKET_E;
-    }
+    if (*p != ']')
+        return dropMatrixParts(name, row, col, MAT_MISSING_FIRST_CLOSING_BRACKET_E);
     len = p - start;
     *row = strnDup(start, len);
     p++; /* skip the ']' */
 
     while (isspace(*p)) p++;
-    if (*p != '[') {
-        freeStrings(*name, *row, *col);
-        return MAT_MISSING_SECOND_BRACKET_E;
-    }
+    if (*p != '[')
+        return dropMatrixParts(name, row, col, MAT_MISSING_SECOND_BRACKET_E);
     p++;
 
     while (isspace(*p)) p++;
-    if (*p == '\0' || *p == ']') {
-        freeStrings(*name, *row, *col);
-        return MAT_EMPTY_COLUMN_INDEX_E;
-    }
+    if (*p == '\0' || *p == ']')
+        return dropMatrixParts(name, row, col, MAT_EMPTY_COLUMN_INDEX_E);
 
     start = p;
     while (*p != '\0' && *p != ']') p++;
-    if (*p != ']') {
-        freeStrings(*name, *row, *col);
-        return MAT_MISSING_SECOND_CLOSING_BRACKET_E;
-    }
+    if (*p != ']')
+        return dropMatrixParts(name, row, col, MAT_MISSING_SECOND_CLOSING_BRACKET_E);
     len = p - start;
     *col = strnDup(start, len);
     p++;
 
     while (isspace(*p)) p++;
-    if (*p != '\0') {
-        freeStrings(*name, *row, *col);
-        return OPERAND_EXTRANEOUS_TEXT_E;
-    }
+    if (*p != '\0')
+        return dropMatrixParts(name, row, col, OPERAND_EXTRANEOUS_TEXT_E);
+    if (*name == NULL || *row == NULL || *col == NULL)
+        return dropMatrixParts(name, row, col, MALLOC_ERROR_F);
 
     return LEXER_SUCCESS_S;
 }
@@ -1261,18 +1508,22 @@ ErrCode isValidLabelColon(MacroTable *table, const char *label)
 ErrCode isValidLabelName(MacroTable *macroNames, const char *label)
 {
     ErrCode errorCode = NULL_INITIAL; /* initialize the error code */
+    unsigned int tokens; /* what the label matches in the token grammar */
 
     if (label[0] == '\0') /* check if the label is empty */
         return LABEL_EMPTY_E; /* label is too short */
 
-    errorCode = isValidLabelSyntax(label); /* check if the label syntax is valid */
-    if (errorCode != LEXER_SUCCESS_S) /* if the label syntax is not valid */
-        return errorCode; /* return the error code */
+    tokens = scanToken(label);
+    if (!(tokens & TOKEN_LABEL) || strlen(label) > MAX_LABEL_LENGTH) {
+        errorCode = isValidLabelSyntax(label); /* check if the label syntax is valid */
+        if (errorCode != LEXER_SUCCESS_S) /* if the label syntax is not valid */
+            return errorCode; /* return the error code */
+    }
 
-    if (isKeywords(label)) /* check if the label is a keyword */
+    if (tokens & KEYWORD_TOKENS) /* check if the label is a keyword */
         return LABEL_NAME_IS_KEYWORD_E; /* label cannot be a keyword */
 
-    if (isRegister(label)) /* check if the label is a register */
+    if (tokens & TOKEN_REGISTER) /* check if the label is a register */
         return LABEL_NAME_IS_REGISTER_E; /* label is a register */
 
     if (isMacroExists(macroNames, label)) /* check if the label already exists in the macro table */
@@ -4,11 +4,14 @@
 #include "global.h"
 #include "error.h"
 #include "tables.h"
+#include "lineIndex.h"
+#include "binaryData.h"
 
 #define COLON_LENGTH 1 /* length of the colon character ':' */
 #define QUOTE_LENGTH 1 /* length of the quote character '"' */
 #define REGISTER_LENGTH 2 /* length of the register name, e.g. r0, r1, ..., r7 */
 #define INITIAL_DATA_ITEMS_SIZE 10 /* initial size of the dataItems array for directives */
+#define OVERSIZED_DATA_COUNT (MAX_MEMORY_SIZE + 1) /* the dataCount of a .mat or .space larger than the data image */
 #define ERROR_OPERAND_AMOUNT -1 /* used for error handling when the number of operands is not valid */
 #define NO_OPERANDS 0 /* used for instructions with no operands */
 #define ONE_OPERAND 1 /* used for instructions with one operand */
@@ -42,9 +45,11 @@ typedef struct parsedLine {
     {
         /* if the line is a directive (typesOfLine == DIRECTIVE_LINE), this will hold the directive data */
         struct directiveData {
-            char* directiveName; /* the name of the directive, e.g. .data , .string , .mat , .entry , .extern */
-            unsigned int dataCount; /* number of data items in the directive (also to move DC) */
-            int* dataItems; /* .data , .string , .mat items (length is dataCount [for .str +1]) */
+            char* directiveName; /* the name of the directive, e.g. .data , .string , .mat , .space , .entry , .extern */
+            unsigned int dataCount; /* number of data words of the directive (also to move DC) */
+            unsigned int itemCount; /* the words given in dataItems, the rest of the dataCount words are 0 */
+            int* dataItems; /* .data , .string , .mat items (only the values written for .mat, none for .space) */
+            PackedData packed; /* .incbin: the file of the dataCount words, it has no dataItems */
             char* directiveLabel; /* .entry or .extern label */
         } directive;
 
@@ -62,50 +67,77 @@ typedef struct parsedLine {
             char* operand2; /* second operand */
             char* row2; /* if second operand is a matrix element, this will hold the row in the line */
             char* col2; /* if second operand is a matrix element, this will hold the column in the line */
+            int number1; /* the value of the first operand if it is a number (so the second pass doesn't parse it again) */
+            int number2; /* the value of the second operand if it is a number */
        
         } instruction;
     }lineContentUnion; /* union to hold either directive or instruction data */
 } parsedLine;
 
+typedef enum IntegerStatus { /* the result of parsing a signed decimal integer */
+    INTEGER_VALID = 0,
+    INTEGER_MISSING, /* no digits were found */
+    INTEGER_NOT_WHOLE, /* the number has a fraction that is not zero */
+    INTEGER_OUT_OF_RANGE /* the number doesn't fit in the given range */
+} IntegerStatus;
+
+typedef struct ParsedProgram { /* all the lines of the .am file after lexing, built by the first pass and kept for the second */
+    parsedLine **lines; /* lines[i] is line i + 1 of the .am file, NULL if that line failed to lex */
+    unsigned int *addresses; /* IC (instruction line) or DC (directive line) before the line, counted from 0 */
+    unsigned int count; /* number of lines in the .am file */
+} ParsedProgram;
+
 
 /* for first pass mainly */
 parsedLine* createParsedLine(); /* create a new parsedLine structure */
-parsedLine* readParsedLine(FILE *fp, ErrCode *errorCode, MacroTable *macroNames, ErrorList *errorList); /* read a line from the file and return a parsedLine structure */
-ErrCode getLabelFromLine(parsedLine *pline, char *line, MacroTable *macroNames, ErrorList *errorList); /* get the label from the line if it exists */
+parsedLine* parseLineText(const char *text, ErrCode *errorCode, MacroTable *macroNames, ErrorList *errorList); /* lex a copy of one line of text */
+parsedLine* parseLine(char *line, ErrCode *errorCode, MacroTable *macroNames, ErrorList *errorList); /* lex an allocated line and free it */
+ErrCode getLabelFromLine(parsedLine *pline, char *line, const LineIndex *index, MacroTable *macroNames, ErrorList *errorList); /* get the label from the line if it exists */
 ErrCode determineLineType(parsedLine *pLine, char *line, MacroTable *macroNames,ErrorList *errorList); /* determine the type of the line and if it has a label */
 ErrCode parseDirectiveLine(parsedLine *pline, char *line, MacroTable *macroNames, ErrorList *errorList);
 ErrCode parseDataDirectiveLine(parsedLine *pLine, char *line, ErrorList *errorList);
 ErrCode parseStrDirectiveLine(parsedLine *pLine, char *line, ErrorList *errorList);
+void checkStrDirectiveText(const char *line, ErrorList *errorList); /* report the errors of a .string text the grammar rejected */
 ErrCode parseMatDirectiveLine(parsedLine *pLine, char *line, ErrorList *errorList);
+ErrCode parseSpaceDirectiveLine(parsedLine *pLine, char *line, ErrorList *errorList);
+ErrCode parseBinaryDirectiveLine(parsedLine *pLine, char *line, MacroTable *macroNames, ErrorList *errorList);
 ErrCode parseEntryExternDirectiveLine(parsedLine *pLine, char *line, MacroTable *macroNames, ErrorList *errorList);
 
 ErrCode parseInstructionLine(parsedLine *pLine, char *line, MacroTable *macroNames, ErrorList *errorList);
 ErrCode parseInstructionLineOperand(parsedLine *pLine, char *line, ErrorList *errorList); /* parse the operands of the instruction line */
-ErrCode determineOperandType(const char *operand, operandType *opType, char **matLabel, char **row, char **col, MacroTable *macroNames, ErrorList *errorList);
+char* commaToken(char *str, char **next); /* reentrant strtok(str, ",") */
+ErrCode determineOperandType(const char *operand, operandType *opType, int *number, char **matLabel, char **row, char **col, MacroTable *macroNames, ErrorList *errorList);
 ErrCode isOperandTypesCompatible(parsedLine *pLine, ErrorList *errorList); /* check if the operand types are compatible with the instruction */
 ErrCode areOperandsTypesCompatible(parsedLine *pLine, ErrorList *errorList); /* check if the operand types are compatible with the instruction */
 ErrCode parseLabelOperandsValid(parsedLine *pLine, SymbolTable *symbolTable, ErrorList *errorList); /* parse the label operands and check if it is valid */
 short int numOfOperandsInInstruction(const char *instructionName); /* return the number of operands in the instruction */
 
 void freeParsedLine(parsedLine *pLine); /* free the memory allocated for the parsedLine structure */
+ParsedProgram* createParsedProgram(unsigned int lineCount); /* create an empty program of lineCount lines */
+void freeParsedProgram(ParsedProgram *program); /* free the program and all of its parsed lines */
 void printParsedLine(parsedLine *pLine);
 char* printOpType(operandType opType); /* print the operand type */
 
 /* is X functions prototypes */
 /* keyword functions prototypes */
 Bool isEndOfLine(const char* str); /* check if the string is an end of line */
+unsigned int scanToken(const char *token); /* the TOKEN_ bits (lexerDfa.h) of the tokens the string matches */
 Bool isOperationName(const char* arg); /* check if the string is an operation name */
 Bool isRegister(const char* arg); /* check if the string is a register name */
 Bool isDirective(const char* arg); /* check if the string is a directive */
 Bool isMacroDef(const char* arg); /* check if the string is a macro start */
 Bool isMacroEnd(const char* arg); /* check if the string is a macro end */
+Bool isMacroInclude(const char* arg); /* check if the string is the include of a macro library */
 Bool isKeywords(const char* arg); /* check if the string is a keyword */
 Bool isValidInteger10bits(int value); /* check if the integer value is valid for the assembler */
 Bool isValidInteger8bits(int value); /* check if the integer value is valid for the assembler */
 
 
 ErrCode isRegisterOperand(const char* operand); /* check if the operand is a valid register */
-ErrCode isNumberOperand(const char *operand); /* check if the operand is a valid number */
+ErrCode isNumberOperand(const char *operand, int *value); /* check if the operand is a valid number and get its value */
+IntegerStatus parseInteger(const char *str, int minValue, int maxValue, int *value, const char **end); /* parse a signed decimal integer */
+IntegerStatus parseIndexedInteger(const LineIndex *index, unsigned int from, int minValue, int maxValue, int *value, unsigned int *end); /* parseInteger using the digit positions of the index */
+int parseDataItem(const LineIndex *index, unsigned int from, ErrorList *errorList); /* parse one .data/.mat item and report its errors */
 ErrCode parseMatrixOperand(const char *operandStr, char **name, char **row, char **col); /* check if the operand is a valid matrix operand */
 ErrCode isValidLabelSyntax(const char *operand); /* check if the operand is a valid label (doesn't check in the symbol table) */
 ErrCode isValidLabelColon(MacroTable *table, const char *label); /* check if the label is valid without the colon */
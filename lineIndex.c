@@ -0,0 +1,204 @@
+#include "lineIndex.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static Bool isInClass(int c, ScanClass scanClass);
+static int lowestBit(unsigned int mask);
+static int highestBit(unsigned int mask);
+
+/* stage 1 - classify the bytes of the padded line, one mask word per 16 bytes */
+#if defined(__AVX2__)
+static void classifyBlocks(const char *padded, LineIndex *index)
+{
+    static const char structural[] = {':', ',', '[', ']', '"', ';'}; /* in ScanClass order */
+    int b, c;
+
+    for (b = 0; b < LINE_INDEX_BLOCKS; b += 2) { /* 32 bytes - two mask words at a time */
+        __m256i bytes = _mm256_loadu_si256((const __m256i*)(padded + b * LINE_INDEX_BLOCK));
+        __m256i shifted = _mm256_sub_epi8(bytes, _mm256_set1_epi8(9)); /* '\t'..'\r' become 0..4 */
+        __m256i spaces = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')),
+                         _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(4)), shifted));
+        __m256i digits = _mm256_sub_epi8(bytes, _mm256_set1_epi8('0')); /* '0'..'9' become 0..9 */
+        unsigned int mask;
+
+        for (c = 0; c < SCAN_SPACE; c++) {
+            mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(structural[c])));
+            index->masks[c][b] = mask & 0xFFFF;
+            index->masks[c][b + 1] = mask >> 16;
+        }
+        mask = (unsigned int)_mm256_movemask_epi8(spaces);
+        index->masks[SCAN_SPACE][b] = mask & 0xFFFF;
+        index->masks[SCAN_SPACE][b + 1] = mask >> 16;
+        mask = (unsigned int)_mm256_movemask_epi8(bytes); /* the top bit of every byte */
+        index->masks[SCAN_NON_ASCII][b] = mask & 0xFFFF;
+        index->masks[SCAN_NON_ASCII][b + 1] = mask >> 16;
+        mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(digits, _mm256_set1_epi8(9)), digits));
+        index->masks[SCAN_DIGIT][b] = mask & 0xFFFF;
+        index->masks[SCAN_DIGIT][b + 1] = mask >> 16;
+    }
+}
+#elif defined(__SSE2__)
+static void classifyBlocks(const char *padded, LineIndex *index)
+{
+    static const char structural[] = {':', ',', '[', ']', '"', ';'}; /* in ScanClass order */
+    int b, c;
+
+    for (b = 0; b < LINE_INDEX_BLOCKS; b++) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(padded + b * LINE_INDEX_BLOCK));
+        __m128i shifted = _mm_sub_epi8(bytes, _mm_set1_epi8(9)); /* '\t'..'\r' become 0..4 */
+        __m128i spaces = _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')),
+                         _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(4)), shifted));
+        __m128i digits = _mm_sub_epi8(bytes, _mm_set1_epi8('0')); /* '0'..'9' become 0..9 */
+
+        for (c = 0; c < SCAN_SPACE; c++)
+            index->masks[c][b] = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(structural[c])));
+        index->masks[SCAN_SPACE][b] = (unsigned int)_mm_movemask_epi8(spaces);
+        index->masks[SCAN_NON_ASCII][b] = (unsigned int)_mm_movemask_epi8(bytes); /* the top bit of every byte */
+        index->masks[SCAN_DIGIT][b] = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(digits, _mm_set1_epi8(9)), digits));
+    }
+}
+#else
+static void classifyBlocks(const char *padded, LineIndex *index)
+{
+    int b, i, c;
+
+    for (b = 0; b < LINE_INDEX_BLOCKS; b++) {
+        for (c = 0; c < SCAN_CLASSES; c++)
+            index->masks[c][b] = 0;
+        for (i = 0; i < LINE_INDEX_BLOCK; i++)
+            for (c = 0; c < SCAN_CLASSES; c++)
+                if (isInClass((unsigned char)padded[b * LINE_INDEX_BLOCK + i], (ScanClass)c))
+                    index->masks[c][b] |= 1u << i;
+    }
+}
+#endif
+
+void buildLineIndex(const char *line, LineIndex *index)
+{
+    char padded[MAX_INDEXED_LENGTH]; /* the line padded with '\0' so whole blocks can be loaded */
+    unsigned int copyLength;
+
+    index->line = line;
+    index->length = strlen(line);
+    copyLength = index->length < MAX_INDEXED_LENGTH ? index->length : MAX_INDEXED_LENGTH;
+
+    memcpy(padded, line, copyLength);
+    memset(padded + copyLength, 0, MAX_INDEXED_LENGTH - copyLength); /* '\0' is in no class */
+    classifyBlocks(padded, index);
+}
+
+int nextOfClass(const LineIndex *index, ScanClass scanClass, unsigned int from)
+{
+    unsigned int b, pos;
+
+    for (b = from / LINE_INDEX_BLOCK; b < LINE_INDEX_BLOCKS && b * LINE_INDEX_BLOCK < index->length; b++) {
+        unsigned int mask = index->masks[scanClass][b];
+        if (b == from / LINE_INDEX_BLOCK)
+            mask &= ~0u << (from % LINE_INDEX_BLOCK); /* ignore the positions before from */
+        if (mask != 0)
+            return (int)(b * LINE_INDEX_BLOCK) + lowestBit(mask);
+    }
+
+    /* past the indexed part (only strings longer than a line get here) */
+    for (pos = from > MAX_INDEXED_LENGTH ? from : MAX_INDEXED_LENGTH; pos < index->length; pos++)
+        if (isInClass((unsigned char)index->line[pos], scanClass))
+            return (int)pos;
+    return NOT_FOUND;
+}
+
+int lastOfClass(const LineIndex *index, ScanClass scanClass)
+{
+    int b;
+    unsigned int pos;
+
+    for (pos = index->length; pos > MAX_INDEXED_LENGTH; pos--) /* the part past the index first */
+        if (isInClass((unsigned char)index->line[pos - 1], scanClass))
+            return (int)pos - 1;
+
+    for (b = LINE_INDEX_BLOCKS - 1; b >= 0; b--)
+        if (index->masks[scanClass][b] != 0)
+            return b * LINE_INDEX_BLOCK + highestBit(index->masks[scanClass][b]);
+    return NOT_FOUND;
+}
+
+unsigned int countOfClass(const LineIndex *index, ScanClass scanClass, unsigned int from, unsigned int to)
+{
+    unsigned int count = 0;
+    int pos = nextOfClass(index, scanClass, from);
+
+    while (pos != NOT_FOUND && (unsigned int)pos < to) {
+        count++;
+        pos = nextOfClass(index, scanClass, pos + 1);
+    }
+    return count;
+}
+
+unsigned int skipClassFrom(const LineIndex *index, ScanClass scanClass, unsigned int from)
+{
+    unsigned int b, pos;
+
+    for (b = from / LINE_INDEX_BLOCK; b < LINE_INDEX_BLOCKS && b * LINE_INDEX_BLOCK < index->length; b++) {
+        unsigned int mask = ~index->masks[scanClass][b] & 0xFFFF; /* the positions not in the class */
+        if (b == from / LINE_INDEX_BLOCK)
+            mask &= ~0u << (from % LINE_INDEX_BLOCK);
+        if (mask != 0) {
+            pos = b * LINE_INDEX_BLOCK + lowestBit(mask);
+            return pos < index->length ? pos : index->length; /* the padding is in no class */
+        }
+    }
+
+    for (pos = from > MAX_INDEXED_LENGTH ? from : MAX_INDEXED_LENGTH; pos < index->length; pos++)
+        if (!isInClass((unsigned char)index->line[pos], scanClass))
+            return pos;
+    return index->length;
+}
+
+unsigned int skipSpacesFrom(const LineIndex *index, unsigned int from)
+{
+    return skipClassFrom(index, SCAN_SPACE, from);
+}
+
+/* the scalar definition of the classes, used for the fallback and for long strings */
+static Bool isInClass(int c, ScanClass scanClass)
+{
+    switch (scanClass) {
+        case SCAN_COLON: return c == ':';
+        case SCAN_COMMA: return c == ',';
+        case SCAN_OPEN_BRACKET: return c == '[';
+        case SCAN_CLOSE_BRACKET: return c == ']';
+        case SCAN_QUOTE: return c == '"';
+        case SCAN_SEMICOLON: return c == ';';
+        case SCAN_SPACE: return c != '\0' && isspace(c);
+        case SCAN_NON_ASCII: return c > 127;
+        case SCAN_DIGIT: return c >= '0' && c <= '9';
+        default: return FALSE;
+    }
+}
+
+static int lowestBit(unsigned int mask)
+{
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int bit = 0;
+    while ((mask & 1u) == 0) {
+        mask >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+static int highestBit(unsigned int mask)
+{
+    int bit = -1;
+    while (mask != 0) {
+        mask >>= 1;
+        bit++;
+    }
+    return bit;
+}
@@ -0,0 +1,41 @@
+#ifndef LINE_INDEX_H
+#define LINE_INDEX_H
+#include "global.h"
+
+/* a structural character index of one line, built in a single (vectorized when possible) pass.
+ * for every class below it keeps a bitmask of the positions in the line that belong to it,
+ * so the lexer can jump straight to the next ',' or the end of the spaces instead of re-scanning
+ * the same bytes with strchr and isspace loops */
+
+#define LINE_INDEX_BLOCK 16 /* bytes per mask word (one SSE2 register) */
+#define LINE_INDEX_BLOCKS 6 /* enough blocks for a full line (MAX_LINE_FILE_LENGTH + over length + '\0') */
+#define MAX_INDEXED_LENGTH (LINE_INDEX_BLOCK * LINE_INDEX_BLOCKS) /* longer strings are finished with a scalar scan */
+#define NOT_FOUND -1
+
+typedef enum ScanClass {
+    SCAN_COLON = 0, /* ':' */
+    SCAN_COMMA, /* ',' */
+    SCAN_OPEN_BRACKET, /* '[' */
+    SCAN_CLOSE_BRACKET, /* ']' */
+    SCAN_QUOTE, /* '"' */
+    SCAN_SEMICOLON, /* ';' */
+    SCAN_SPACE, /* anything isspace() accepts */
+    SCAN_NON_ASCII, /* bytes above 127 */
+    SCAN_DIGIT, /* '0' to '9' */
+    SCAN_CLASSES /* number of classes */
+} ScanClass;
+
+typedef struct LineIndex {
+    const char *line; /* the indexed line, used for the part past MAX_INDEXED_LENGTH */
+    unsigned int length; /* length of the whole line */
+    unsigned int masks[SCAN_CLASSES][LINE_INDEX_BLOCKS]; /* bit i of masks[c][b] is set if line[b * 16 + i] is in class c */
+} LineIndex;
+
+void buildLineIndex(const char *line, LineIndex *index); /* index the line (the line must outlive the index) */
+int nextOfClass(const LineIndex *index, ScanClass scanClass, unsigned int from); /* first position >= from in the class, or NOT_FOUND */
+int lastOfClass(const LineIndex *index, ScanClass scanClass); /* last position in the class, or NOT_FOUND */
+unsigned int countOfClass(const LineIndex *index, ScanClass scanClass, unsigned int from, unsigned int to); /* positions in [from, to) in the class */
+unsigned int skipClassFrom(const LineIndex *index, ScanClass scanClass, unsigned int from); /* first position >= from not in the class (length if none) */
+unsigned int skipSpacesFrom(const LineIndex *index, unsigned int from); /* first non space position >= from (length if none) */
+
+#endif
@@ -0,0 +1,570 @@
+#define _POSIX_C_SOURCE 200809L /* for mmap, fstat and getpid */
+#include "macroLibrary.h"
+#include "global.h"
+#include "error.h"
+#include "lexer.h"
+#include "tables.h"
+#include "preprocessor.h" /* for macroDef */
+#include "util.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "allocStats.h"
+
+ErrCode initMacroLibraries(MacroLibraries *libraries, const char *directory)
+{
+    libraries->loaded = NULL;
+    libraries->directory = directory;
+    libraries->releases = 0;
+    return pthread_mutex_init(&libraries->lock, NULL) == 0 ? UTIL_SUCCESS_S : MALLOC_ERROR_F;
+}
+
+static void unloadLibrary(MacroLibrary *library)
+{
+    if (library->mapped)
+        munmap((void*)library->image, library->size);
+    else
+        free((void*)library->image);
+    free(library);
+}
+
+void freeMacroLibraries(MacroLibraries *libraries)
+{
+    MacroLibrary *library, *next;
+
+    pthread_mutex_lock(&libraries->lock);
+    for (library = libraries->loaded; library != NULL; library = next) {
+        next = library->next;
+        unloadLibrary(library);
+    }
+    libraries->loaded = NULL;
+    pthread_mutex_unlock(&libraries->lock);
+    pthread_mutex_destroy(&libraries->lock);
+}
+
+/* dropUnusedLibraries - unloads the oldest unused images past MAX_UNUSED_LIBRARIES, called with the lock held */
+static void dropUnusedLibraries(MacroLibraries *libraries)
+{
+    MacroLibrary **link, **oldest, *victim;
+    unsigned int unused;
+
+    for (;;) {
+        unused = 0;
+        oldest = NULL;
+        for (link = &libraries->loaded; *link != NULL; link = &(*link)->next) {
+            if ((*link)->references > 0)
+                continue;
+            unused++;
+            if (oldest == NULL || (*link)->unusedSince < (*oldest)->unusedSince)
+                oldest = link;
+        }
+        if (unused <= MAX_UNUSED_LIBRARIES)
+            return;
+        victim = *oldest;
+        *oldest = victim->next;
+        unloadLibrary(victim);
+    }
+}
+
+void releaseMacroLibrary(const MacroLibrary *library)
+{
+    MacroLibrary *released = (MacroLibrary*)library; /* the tables only read it */
+    MacroLibraries *owner = released->owner;
+
+    if (owner == NULL) { /* only its own table and loads use it */
+        if (--released->references == 0)
+            unloadLibrary(released);
+        return;
+    }
+    pthread_mutex_lock(&owner->lock);
+    if (released->references > 0 && --released->references == 0) {
+        released->unusedSince = ++owner->releases;
+        dropUnusedLibraries(owner);
+    }
+    pthread_mutex_unlock(&owner->lock);
+}
+
+/* the include directive */
+
+char* parseIncludePath(const char *text, ErrCode *errorCode)
+{
+    const char *end;
+
+    while (isspace((unsigned char)*text))
+        text++;
+    end = *text == INCLUDE_PATH_QUOTE ? strchr(text + 1, INCLUDE_PATH_QUOTE) : NULL;
+    if (end == NULL || end == text + 1) { /* no quotes or an empty path */
+        *errorCode = MACRO_INCLUDE_PATH_E;
+        return NULL;
+    }
+    if (!isEndOfLine(end + 1)) {
+        *errorCode = EXTRANEOUS_TEXT_E;
+        return NULL;
+    }
+    *errorCode = UTIL_SUCCESS_S;
+    return strnDup(text + 1, (unsigned int)(end - text - 1));
+}
+
+char* resolveIncludePath(const char *sourceName, const char *path)
+{
+    const char *slash = sourceName != NULL ? strrchr(sourceName, '/') : NULL;
+    unsigned int directoryLength = slash != NULL ? (unsigned int)(slash - sourceName + 1) : 0; /* with the slash */
+    char *resolved;
+
+    if (path[0] == '/' || directoryLength == 0)
+        return strDup(path);
+    resolved = malloc(directoryLength + strlen(path) + NULL_TERMINATOR);
+    if (resolved == NULL)
+        return NULL;
+    memcpy(resolved, sourceName, directoryLength);
+    strcpy(resolved + directoryLength, path);
+    return resolved;
+}
+
+/* the images */
+
+/* nameHash - the index slot of a name before probing */
+static unsigned int nameHash(const char *name)
+{
+    ContentHash hash;
+    initContentHash(&hash);
+    updateContentHash(&hash, name, strlen(name));
+    return hash.lanes[0];
+}
+
+static const MacroLibraryHeader* libraryHeader(const MacroLibrary *library)
+{
+    return (const MacroLibraryHeader*)library->image;
+}
+
+const LibraryMacro* findLibraryMacro(const MacroLibrary *library, const char *name)
+{
+    const MacroLibraryHeader *header = libraryHeader(library);
+    const unsigned int *index = (const unsigned int*)(library->image + header->indexOffset);
+    const LibraryMacro *macros = (const LibraryMacro*)(library->image + header->macrosOffset);
+    unsigned int slot, probes;
+
+    slot = nameHash(name) & (header->indexSize - 1);
+    for (probes = 0; probes < header->indexSize && index[slot] != 0; probes++) {
+        if (strcmp(library->image + macros[index[slot] - 1].nameOffset, name) == 0)
+            return &macros[index[slot] - 1];
+        slot = (slot + 1) & (header->indexSize - 1);
+    }
+    return NULL;
+}
+
+const LibraryMacro* findIncludedMacro(MacroTable *table, const char *name, const MacroLibrary **library)
+{
+    IncludedLibrary *included;
+    const LibraryMacro *macro;
+
+    for (included = table->libraries; included != NULL; included = included->next) {
+        macro = findLibraryMacro(included->library, name);
+        if (macro != NULL) {
+            if (library != NULL)
+                *library = included->library;
+            return macro;
+        }
+    }
+    return NULL;
+}
+
+const char* libraryMacroName(const MacroLibrary *library, const LibraryMacro *macro)
+{
+    return library->image + macro->nameOffset;
+}
+
+const char* libraryMacroBody(const MacroLibrary *library, const LibraryMacro *macro)
+{
+    return library->image + macro->bodyOffset;
+}
+
+/* isValidImage - checks every offset of an image that was read from the cache directory, a damaged or cut
+ * file is compiled again */
+static Bool isValidImage(const char *image, size_t size)
+{
+    const MacroLibraryHeader *header = (const MacroLibraryHeader*)image;
+    const unsigned int *index;
+    const LibraryMacro *macros;
+    unsigned int i;
+
+    if (size < sizeof(MacroLibraryHeader) || memcmp(header->magic, MACRO_LIBRARY_MAGIC, sizeof(header->magic)) != 0 ||
+        header->size != size || header->indexSize == 0 || (header->indexSize & (header->indexSize - 1)) != 0 ||
+        header->indexOffset % sizeof(unsigned int) != 0 || header->macrosOffset % sizeof(unsigned int) != 0 ||
+        header->indexOffset > size || (size - header->indexOffset) / sizeof(unsigned int) < header->indexSize ||
+        header->macrosOffset > size || (size - header->macrosOffset) / sizeof(LibraryMacro) < header->macroCount)
+        return FALSE;
+    index = (const unsigned int*)(image + header->indexOffset);
+    macros = (const LibraryMacro*)(image + header->macrosOffset);
+    for (i = 0; i < header->indexSize; i++)
+        if (index[i] > header->macroCount)
+            return FALSE;
+    for (i = 0; i < header->macroCount; i++)
+        if (macros[i].nameOffset >= size || memchr(image + macros[i].nameOffset, '\0', size - macros[i].nameOffset) == NULL ||
+            macros[i].bodyOffset > size || size - macros[i].bodyOffset < macros[i].bodyLength)
+            return FALSE;
+    return TRUE;
+}
+
+/* compileLines - reads the macro definitions of a library into table, the first error stops it */
+static ErrCode compileLines(const TextBuffer *text, MacroTable *table)
+{
+    size_t position = 0;
+    ErrCode errorCode = NULL_INITIAL, result = UTIL_SUCCESS_S;
+    Bool inMacroDef = FALSE;
+    char *line, *firstToken;
+
+    while (result == UTIL_SUCCESS_S) {
+        line = readTextLine(text->text, text->length, &position, &errorCode);
+        if (errorCode == EOF_REACHED_S)
+            break;
+        if (errorCode != UTIL_SUCCESS_S)
+            return errorCode;
+        firstToken = getFirstToken(line, &errorCode);
+        if (errorCode == END_OF_LINE_S) { /* empty lines aren't kept, not even in a body */
+            free(line);
+            continue;
+        }
+        if (errorCode != UTIL_SUCCESS_S) {
+            free(line);
+            return errorCode;
+        }
+
+        if (isMacroExists(table, firstToken)) /* a library can't spread a macro, it has no .am text */
+            result = MACRO_INCLUDE_LINE_E;
+        else if (isMacroDef(firstToken)) {
+            cutnChar(line, strlen(firstToken));
+            result = macroDef(table, line);
+            inMacroDef = result == TABLES_SUCCESS_S;
+            if (result == TABLES_SUCCESS_S)
+                result = UTIL_SUCCESS_S;
+        }
+        else if (isMacroEnd(firstToken)) {
+            cutnChar(line, strlen(firstToken));
+            if (!isEndOfLine(line))
+                result = EXTRANEOUS_TEXT_E;
+            else if (!inMacroDef)
+                result = UNMATCHED_MACRO_END_E;
+            inMacroDef = FALSE;
+        }
+        else if (inMacroDef) {
+            if (addMacroLine(table, line) != TABLES_SUCCESS_S)
+                result = MALLOC_ERROR_F;
+        }
+        else if (firstToken[0] != ';') /* comments are allowed between the macros */
+            result = MACRO_INCLUDE_LINE_E;
+        freeStrings(line, firstToken, NULL);
+    }
+    if (result == UTIL_SUCCESS_S && inMacroDef)
+        result = MACRO_INCLUDE_UNCLOSED_E;
+    return result;
+}
+
+/* buildImage - lays the macros of table out as an image. macros with an empty body are left out, the table
+ * never finds those either */
+static ErrCode buildImage(MacroTable *table, TextBuffer *image)
+{
+    MacroLibraryHeader header;
+    LibraryMacro *macros;
+    unsigned int *index;
+    unsigned int count = 0, i, slot;
+    size_t stringsOffset, size;
+    MacroNode *node;
+    MacroBody *body;
+
+    for (node = table->macroHead; node != NULL; node = node->nextMacro)
+        if (node->bodyHead != NULL)
+            count++;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MACRO_LIBRARY_MAGIC, sizeof(header.magic));
+    header.macroCount = count;
+    header.indexSize = 1;
+    while (header.indexSize < count * 2) /* at most half full */
+        header.indexSize *= 2;
+    header.indexOffset = sizeof(MacroLibraryHeader);
+    header.macrosOffset = header.indexOffset + header.indexSize * sizeof(unsigned int);
+    stringsOffset = header.macrosOffset + count * sizeof(LibraryMacro);
+
+    index = calloc(header.indexSize, sizeof(unsigned int));
+    macros = calloc(count > 0 ? count : 1, sizeof(LibraryMacro));
+    if (index == NULL || macros == NULL) {
+        freeStrings((char*)index, (char*)macros, NULL);
+        return MALLOC_ERROR_F;
+    }
+
+    size = stringsOffset; /* the strings go after the fixed parts, they are appended below */
+    for (i = 0, node = table->macroHead; node != NULL; node = node->nextMacro) {
+        if (node->bodyHead == NULL)
+            continue;
+        macros[i].nameOffset = (unsigned int)size;
+        size += strlen(node->macroName) + NULL_TERMINATOR;
+        macros[i].bodyOffset = (unsigned int)size;
+        for (body = node->bodyHead; body != NULL; body = body->nextLine) {
+            macros[i].bodyLength += (unsigned int)strlen(body->line) + 1; /* and its '\n' */
+            macros[i].lineCount++;
+        }
+        size += macros[i].bodyLength;
+        for (slot = nameHash(node->macroName) & (header.indexSize - 1); index[slot] != 0;
+             slot = (slot + 1) & (header.indexSize - 1))
+            ;
+        index[slot] = ++i; /* 1 + the number of the macro */
+    }
+    header.size = (unsigned int)size;
+
+    image->length = 0;
+    if (appendBytes(image, (const char*)&header, sizeof(header)) != UTIL_SUCCESS_S ||
+        appendBytes(image, (const char*)index, header.indexSize * sizeof(unsigned int)) != UTIL_SUCCESS_S ||
+        appendBytes(image, (const char*)macros, count * sizeof(LibraryMacro)) != UTIL_SUCCESS_S) {
+        freeStrings((char*)index, (char*)macros, NULL);
+        return MALLOC_ERROR_F;
+    }
+    freeStrings((char*)index, (char*)macros, NULL);
+    for (node = table->macroHead; node != NULL; node = node->nextMacro) { /* in the same order as the offsets */
+        if (node->bodyHead == NULL)
+            continue;
+        if (appendBytes(image, node->macroName, strlen(node->macroName) + NULL_TERMINATOR) != UTIL_SUCCESS_S)
+            return MALLOC_ERROR_F;
+        for (body = node->bodyHead; body != NULL; body = body->nextLine)
+            if (appendLine(image, body->line) != UTIL_SUCCESS_S)
+                return MALLOC_ERROR_F;
+    }
+    return UTIL_SUCCESS_S;
+}
+
+/* compileLibrary - parses the text of a library into an image */
+static ErrCode compileLibrary(const TextBuffer *text, TextBuffer *image)
+{
+    MacroTable *table = createMacroTable();
+    ErrCode errCode;
+
+    if (table == NULL)
+        return MALLOC_ERROR_F;
+    errCode = compileLines(text, table);
+    if (errCode == UTIL_SUCCESS_S)
+        errCode = buildImage(table, image);
+    freeMacroTable(table);
+    return errCode;
+}
+
+/* the cache directory */
+
+static char* imagePath(const char *directory, const ContentHash *hash, const char *suffix)
+{
+    char digits[CONTENT_HASH_DIGITS + NULL_TERMINATOR];
+    char *path = malloc(strlen(directory) + CONTENT_HASH_DIGITS + strlen(MACRO_LIBRARY_ENDING) +
+                        strlen(suffix) + 2);
+
+    if (path == NULL)
+        return NULL;
+    formatContentHash(hash, digits);
+    sprintf(path, "%s/%s%s%s", directory, digits, MACRO_LIBRARY_ENDING, suffix);
+    return path;
+}
+
+/* mapImage - maps the image of hash stored in directory, FALSE if there is none or it is damaged */
+static Bool mapImage(const char *directory, MacroLibrary *library)
+{
+    char *path = imagePath(directory, &library->hash, "");
+    int fd = path != NULL ? open(path, O_RDONLY) : -1;
+    struct stat info;
+    void *image;
+
+    free(path);
+    if (fd < 0)
+        return FALSE;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(MacroLibraryHeader)) {
+        close(fd);
+        return FALSE;
+    }
+    image = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); /* the mapping stays */
+    if (image == MAP_FAILED)
+        return FALSE;
+    if (!isValidImage((const char*)image, (size_t)info.st_size)) {
+        munmap(image, (size_t)info.st_size);
+        return FALSE;
+    }
+    library->image = (const char*)image;
+    library->size = (size_t)info.st_size;
+    library->mapped = TRUE;
+    return TRUE;
+}
+
+/* storeImage - writes the image to a temporary file and renames it, so another process never maps half of it */
+static void storeImage(const char *directory, const MacroLibrary *library)
+{
+    char suffix[32];
+    char *path, *temporaryPath;
+    FILE *fp;
+    Bool written;
+
+    sprintf(suffix, ".%ld", (long)getpid());
+    path = imagePath(directory, &library->hash, "");
+    temporaryPath = imagePath(directory, &library->hash, suffix);
+    fp = temporaryPath != NULL ? fopen(temporaryPath, "wb") : NULL;
+    if (fp != NULL) {
+        written = fwrite(library->image, 1, library->size, fp) == library->size;
+        if (fclose(fp) != 0 || !written || path == NULL || rename(temporaryPath, path) != 0)
+            remove(temporaryPath); /* only the next process loses, it compiles the file again */
+    }
+    freeStrings(path, temporaryPath, NULL);
+}
+
+/* findLoaded - the loaded library of hash, called with the lock of libraries held */
+static MacroLibrary* findLoaded(const MacroLibraries *libraries, const ContentHash *hash)
+{
+    MacroLibrary *library;
+    for (library = libraries->loaded; library != NULL; library = library->next)
+        if (sameContentHash(&library->hash, hash))
+            return library;
+    return NULL;
+}
+
+/* compileImage - the image of library from the text of its file, mapped from the cache directory of libraries if
+ * it is stored there and stored there if it isn't */
+static ErrCode compileImage(const MacroLibraries *libraries, const TextBuffer *text, MacroLibrary *library)
+{
+    const char *directory = libraries != NULL ? libraries->directory : NULL;
+    TextBuffer image;
+    ErrCode errCode;
+
+    if (directory != NULL && mapImage(directory, library))
+        return UTIL_SUCCESS_S;
+    initTextBuffer(&image);
+    errCode = compileLibrary(text, &image);
+    if (errCode != UTIL_SUCCESS_S) {
+        freeTextBuffer(&image);
+        return errCode;
+    }
+    library->image = image.text; /* the buffer is kept as the image */
+    library->size = image.length;
+    library->mapped = FALSE;
+    if (directory != NULL)
+        storeImage(directory, library);
+    return UTIL_SUCCESS_S;
+}
+
+ErrCode loadMacroLibrary(MacroTable *table, const char *path, const MacroLibrary **library, ContentHash *fileHash)
+{
+    MacroLibraries *libraries = table->macroLibraries;
+    IncludedData data;
+    TextBuffer text;
+    ContentHash hash;
+    MacroLibrary *loaded;
+    ErrCode errCode;
+
+    if (readIncludedData(table, path, &data) != UTIL_SUCCESS_S)
+        return MACRO_INCLUDE_UNREADABLE_E;
+    initTextBuffer(&text); /* the lines are parsed from null terminated text */
+    errCode = appendBytes(&text, (const char*)data.bytes, data.size);
+    releaseIncludedData(&data);
+    if (errCode != UTIL_SUCCESS_S) {
+        freeTextBuffer(&text);
+        return MALLOC_ERROR_F;
+    }
+    initContentHash(fileHash);
+    updateContentHash(fileHash, text.text, text.length);
+    initContentHash(&hash);
+    updateContentHash(&hash, MACRO_LIBRARY_MAGIC, strlen(MACRO_LIBRARY_MAGIC));
+    updateContentHash(&hash, text.text, text.length);
+
+    if (libraries != NULL) {
+        pthread_mutex_lock(&libraries->lock); /* held while compiling, so a library is compiled once */
+        loaded = findLoaded(libraries, &hash);
+        if (loaded != NULL) {
+            loaded->references++;
+            pthread_mutex_unlock(&libraries->lock);
+            freeTextBuffer(&text);
+            *library = loaded;
+            return UTIL_SUCCESS_S;
+        }
+    }
+
+    loaded = malloc(sizeof(MacroLibrary));
+    errCode = loaded != NULL ? UTIL_SUCCESS_S : MALLOC_ERROR_F;
+    if (loaded != NULL) {
+        loaded->hash = hash;
+        loaded->references = 1;
+        loaded->unusedSince = 0;
+        loaded->owner = libraries;
+        loaded->next = NULL;
+        errCode = compileImage(libraries, &text, loaded);
+        if (errCode != UTIL_SUCCESS_S) {
+            free(loaded);
+            loaded = NULL;
+        }
+    }
+    if (loaded != NULL && libraries != NULL) {
+        loaded->next = libraries->loaded;
+        libraries->loaded = loaded;
+    }
+    if (libraries != NULL)
+        pthread_mutex_unlock(&libraries->lock);
+
+    freeTextBuffer(&text);
+    if (loaded == NULL)
+        return errCode;
+    *library = loaded;
+    return UTIL_SUCCESS_S;
+}
+
+ErrCode includeMacroLibrary(MacroTable *table, const MacroLibrary *library)
+{
+    const MacroLibraryHeader *header = libraryHeader(library);
+    const LibraryMacro *macros = (const LibraryMacro*)(library->image + header->macrosOffset);
+    IncludedLibrary *included, **last;
+    unsigned int i;
+
+    for (i = 0; i < header->macroCount; i++)
+        if (isMacroExists(table, libraryMacroName(library, &macros[i]))) {
+            releaseMacroLibrary(library);
+            return MACRO_NAME_EXISTS_E;
+        }
+
+    included = malloc(sizeof(IncludedLibrary));
+    if (included == NULL) {
+        releaseMacroLibrary(library);
+        return MALLOC_ERROR_F;
+    }
+    included->library = library;
+    included->next = NULL;
+    for (last = &table->libraries; *last != NULL; last = &(*last)->next)
+        ;
+    *last = included;
+    return TABLES_SUCCESS_S;
+}
+
+ErrCode recordIncludedFile(MacroTable *table, const char *path, const ContentHash *hash)
+{
+    IncludedFile *file = malloc(sizeof(IncludedFile)), **last;
+    Bool added;
+
+    if (file == NULL || (file->path = strDup(path)) == NULL) {
+        free(file);
+        return MALLOC_ERROR_F;
+    }
+    file->found = hash != NULL;
+    if (hash != NULL)
+        file->hash = *hash;
+    else
+        initContentHash(&file->hash);
+    file->next = NULL;
+
+    pthread_mutex_lock(&table->includedFilesLock);
+    for (last = &table->includedFiles; *last != NULL; last = &(*last)->next)
+        if (strcmp((*last)->path, path) == 0 && (*last)->found == file->found &&
+            sameContentHash(&(*last)->hash, &file->hash))
+            break; /* read before, by another line */
+    added = *last == NULL;
+    if (added)
+        *last = file;
+    pthread_mutex_unlock(&table->includedFilesLock);
+    if (!added) {
+        free(file->path);
+        free(file);
+    }
+    return UTIL_SUCCESS_S;
+}
@@ -0,0 +1,95 @@
+#ifndef MACRO_LIBRARY_H
+#define MACRO_LIBRARY_H
+#include "global.h"
+#include "error.h"
+#include "tables.h"
+#include "util.h" /* for ContentHash */
+#include <pthread.h>
+
+/* macro libraries: a .as file can include a file of shared macro definitions with
+ *     mcroinclude "path"
+ * (path is relative to the directory of the .as file). the macros are used as if they were defined on that line.
+ * an included file is compiled once into an image that is used in place without parsing it again: a header, an
+ * open addressing index of the macro names and the macros, every body already joined into the lines the
+ * preprocessor appends to the .am text.
+ * the file is read with the include reader of the macro table. the images are counted by the macro tables that
+ * include them, and shared by the content hash of the file between the tables given the same MacroLibraries. an
+ * image no table includes is kept there until MAX_UNUSED_LIBRARIES newer ones are unused too, so a library shared
+ * by the files of a build is parsed once, and the old versions of an edited library are dropped (--watch,
+ * --server). with a cache directory they are also stored there as hash.mcl and mapped (mmap) by the next process.
+ * a table without MacroLibraries compiles its own images, they are unloaded with its last reference */
+
+#define MACRO_LIBRARY_MAGIC "MCL1" /* changes with the layout, it is hashed into the key of every image */
+#define MACRO_LIBRARY_ENDING ".mcl"
+#define INCLUDE_PATH_QUOTE '"'
+#define MAX_UNUSED_LIBRARIES 8 /* images kept loaded while no table includes them */
+
+typedef struct MacroLibraryHeader { /* the start of an image, the offsets are from the start of the image */
+    char magic[4];
+    unsigned int size; /* of the whole image */
+    unsigned int macroCount;
+    unsigned int indexSize; /* slots of the index, a power of 2 */
+    unsigned int indexOffset; /* indexSize slots: 0 for an empty slot, else 1 + the number of the macro */
+    unsigned int macrosOffset; /* macroCount LibraryMacro */
+} MacroLibraryHeader;
+
+typedef struct LibraryMacro {
+    unsigned int nameOffset; /* null terminated */
+    unsigned int bodyOffset; /* the lines of the body, each ends with '\n' */
+    unsigned int bodyLength;
+    unsigned int lineCount;
+} LibraryMacro;
+
+typedef struct MacroLibrary { /* a loaded image, shared by the tables that include it */
+    ContentHash hash; /* of MACRO_LIBRARY_MAGIC and the included file */
+    const char *image;
+    size_t size;
+    Bool mapped; /* munmap it, else free it */
+    unsigned int references; /* the tables that include it and the loads not included yet */
+    unsigned long unusedSince; /* the release that left it unused, older unused images are dropped first */
+    struct MacroLibraries *owner; /* NULL if it isn't shared */
+    struct MacroLibrary *next;
+} MacroLibrary;
+
+typedef struct MacroLibraries { /* the loaded images, shared by the macro tables given it (AssemblerContext) */
+    MacroLibrary *loaded;
+    pthread_mutex_t lock; /* the files of a build can be assembled at once */
+    const char *directory; /* store and map the images there, NULL to keep them in memory only */
+    unsigned long releases; /* the clock of unusedSince */
+} MacroLibraries;
+
+typedef struct IncludedFile { /* a file a run read (mcroinclude, .incbin), the build cache checks them on a hit */
+    char *path; /* as it was opened, resolved against the .as file */
+    Bool found; /* FALSE if it couldn't be read, the run reported it */
+    ContentHash hash; /* of the contents (hashFile) */
+    struct IncludedFile *next;
+} IncludedFile;
+
+ErrCode initMacroLibraries(MacroLibraries *libraries, const char *directory); /* none loaded, directory as above */
+void freeMacroLibraries(MacroLibraries *libraries); /* unloads every image, no table may still include one */
+
+/* the path of mcroinclude "path" in text (the rest of the line after the keyword), NULL with errorCode set if
+ * the quotes are missing or there is text after them */
+char* parseIncludePath(const char *text, ErrCode *errorCode);
+char* resolveIncludePath(const char *sourceName, const char *path); /* relative to the directory of sourceName */
+
+/* the library of the file at path with a reference for the caller, read with the reader of table and shared with
+ * the other loads of the same contents in its macroLibraries. fileHash is the hash of the contents once the file
+ * was read. errors in the file are returned as the code of the first one: MACRO_INCLUDE_UNREADABLE_E,
+ * MACRO_INCLUDE_LINE_E, MACRO_INCLUDE_UNCLOSED_E or a macro error */
+ErrCode loadMacroLibrary(MacroTable *table, const char *path, const MacroLibrary **library, ContentHash *fileHash);
+/* adds library to the macros of table, which takes the reference of the load (freeMacroTable releases it).
+ * MACRO_NAME_EXISTS_E (nothing added, the reference is released) if one of its names is taken */
+ErrCode includeMacroLibrary(MacroTable *table, const MacroLibrary *library);
+void releaseMacroLibrary(const MacroLibrary *library); /* drops a reference, an unused image may be unloaded */
+
+const LibraryMacro* findLibraryMacro(const MacroLibrary *library, const char *name);
+const LibraryMacro* findIncludedMacro(MacroTable *table, const char *name, const MacroLibrary **library);
+const char* libraryMacroName(const MacroLibrary *library, const LibraryMacro *macro);
+const char* libraryMacroBody(const MacroLibrary *library, const LibraryMacro *macro);
+
+/* adds path to the files table was read with (table->includedFiles), hash is NULL if it couldn't be read. the
+ * lexer records from the threads of the first pass */
+ErrCode recordIncludedFile(MacroTable *table, const char *path, const ContentHash *hash);
+
+#endif
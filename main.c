@@ -1,159 +1,452 @@
 #include "global.h"
-#include "preprocessor.h"
-#include "firstPass.h"
-#include "secondPass.h"
-#include "writeFiles.h"
+#include "assembler.h"
+#include "driver.h"
+#include "server.h"
+#include "cache.h"
+#include "watch.h"
+#include "pipeline.h"
+#include "allocStats.h"
+#include "perfCounters.h"
+#include "trace.h"
+#include "bench.h"
+#include "sizeReport.h"
+#include "check.h"
+#include "macroLibrary.h"
 #include "error.h"
-#include "lexer.h"
-#include "tables.h"
 #include "util.h"
+#include "parallel.h"
 
-void executeAssembler(char* fileName);
+#define MAX_OPTION_NUMBER 1000000 /* the largest number an option accepts */
+#define OPTION_PARSED 1 /* parseOption results */
+#define NOT_AN_OPTION 0
+#define OPTION_ERROR -1
+
+/* the options that take the next argument as their value */
+static const char *const valuedOptions[] = {"-j", "--jobs", "--max-errors", "--workers", "--server", "--socket", "--cache",
+                                            "--ent-fd", "--ext-fd", "--bench", "--trace", NULL};
+
+typedef struct AssemblerOptions { /* the command line options, they apply to every file */
+    unsigned int jobs; /* threads used by the passes (-j N), 0 until -j is given */
+    unsigned int maxErrors; /* stop a stage after this many errors (--max-errors N), 0 for no limit */
+    const char *serverSocket; /* run as a server on this socket (--server PATH) */
+    unsigned int workers; /* requests the server serves at the same time (--workers N) */
+    const char *clientSocket; /* send the files to the server on this socket if it runs (--socket PATH) */
+    const char *cacheDirectory; /* replay unchanged files from this build cache (--cache DIR) */
+    Bool watch; /* assemble the files again whenever they change (--watch) */
+    int entFd; /* with run - write the .ent to this file descriptor (--ent-fd N), NO_DESCRIPTOR for a frame on stdout */
+    int extFd; /* the same for the .ext (--ext-fd N) */
+    Bool pipeline; /* run the stages of the files on their own threads (--pipeline) */
+    Bool allocStats; /* count the allocations and report them at exit (--alloc-stats) */
+    Bool perf; /* report the hardware counters of every stage of every file (--perf) */
+    const char *tracePath; /* write a trace of the files and their stages to this file (--trace PATH) */
+    unsigned int benchRuns; /* assemble every file this many times and print its timings (--bench N), 0 for no */
+    Bool sizeReport; /* print where the words of every file come from (--size-report) */
+    Bool check; /* only validate the files and directories, on a thread per processor unless -j is given (--check) */
+} AssemblerOptions;
+
+void assembleFile(char* fileName, AssemblerContext *context, BuildCache *cache, const AssemblerOptions *options);
+int parseOption(int argc, char const *argv[], int *i, AssemblerOptions *options);
+int parseNumberOption(const char *name, const char *arg, unsigned int min, unsigned int max, unsigned int *value);
+int parseDescriptorOption(const char *name, const char *arg, int *fd);
+int watchFiles(int argc, char const *argv[], int fileCount, AssemblerOptions *options);
+Bool pipelineFiles(int argc, char const *argv[], int fileCount, AssemblerOptions *options);
+int benchFiles(int argc, char const *argv[], int fileCount, AssemblerOptions *options);
+int checkFiles(int argc, char const *argv[], int fileCount, AssemblerOptions *options);
+void reportSize(char *fileName, AssemblerContext *context);
+void reportAllocStats(void);
+void unloadMacroLibraries(void);
+
+static MacroLibraries macroLibraries; /* the compiled macro libraries of every context, they live as long as the process */
 
 int main(int argc, char const *argv[])
 {
     char* inputFileName = NULL;
-    int i;
-    
-    if (argc < 2) {
+    AssemblerOptions options;
+    AssemblerContext *context; /* reused for every file */
+    BuildCache cache, *buildCache = NULL; /* NULL without --cache */
+    PerfRecorder perf; /* opened with --perf */
+    TraceStages traceStages; /* the stage spans of context with --trace */
+    ErrCode errCode;
+    int i, result, fileCount = 0, exitCode = 0;
+
+    options.jobs = 0;
+    options.maxErrors = 0;
+    options.serverSocket = NULL;
+    options.workers = DEFAULT_SERVER_WORKERS;
+    options.clientSocket = NULL;
+    options.cacheDirectory = NULL;
+    options.watch = FALSE;
+    options.entFd = NO_DESCRIPTOR;
+    options.extFd = NO_DESCRIPTOR;
+    options.pipeline = FALSE;
+    options.allocStats = FALSE;
+    options.perf = FALSE;
+    options.tracePath = NULL;
+    options.benchRuns = 0;
+    options.sizeReport = FALSE;
+    options.check = FALSE;
+
+    for (i = 1; i < argc; i++) { /* options come before the file names */
+        result = parseOption(argc, argv, &i, &options);
+        if (result == OPTION_ERROR)
+            return 1;
+        if (result == NOT_AN_OPTION)
+            fileCount++;
+    }
+    if (options.jobs == 0 && !options.check) /* --check uses a thread per processor without -j */
+        options.jobs = DEFAULT_JOBS;
+    if (options.allocStats) { /* reported on every way out of main */
+        enableAllocStats();
+        atexit(reportAllocStats);
+    }
+    if (initMacroLibraries(&macroLibraries, NULL) != UTIL_SUCCESS_S) {
+        printErrorMsg(MALLOC_ERROR_F, "macro libraries", 0);
+        return 1;
+    }
+    atexit(unloadMacroLibraries); /* before the report */
+
+    if (options.serverSocket != NULL) { /* serves until it is killed */
+        printErrorMsg(runServer(options.serverSocket, options.workers, &macroLibraries), "server", 0);
+        return 1;
+    }
+    if (options.watch) /* watches until it is killed */
+        return watchFiles(argc, argv, fileCount, &options);
+    if (options.benchRuns > 0)
+        return benchFiles(argc, argv, fileCount, &options);
+    if (options.check)
+        return checkFiles(argc, argv, fileCount, &options);
+
+    context = createAssemblerContext();
+    if (context == NULL) {
+        printErrorMsg(MALLOC_ERROR_F, "tables", 0);
+        return 1;
+    }
+    context->jobs = options.jobs;
+    context->maxErrors = options.maxErrors;
+    useDiskIncludes(context, &macroLibraries);
+    context->incremental = options.sizeReport; /* the report reads the kept line IR */
+    if (options.perf) {
+        openPerfRecorder(&perf);
+        context->stageHook = perfStageHook;
+        context->hookArg = &perf;
+    }
+    if (options.tracePath != NULL) {
+        errCode = openTrace(options.tracePath);
+        if (errCode != UTIL_SUCCESS_S) {
+            printErrorMsg(errCode, options.tracePath, 0);
+            freeAssemblerContext(context);
+            return 1;
+        }
+        atexit(closeTrace);
+    }
+    initTraceStages(&traceStages, context);
+
+    if (options.cacheDirectory != NULL) {
+        errCode = openBuildCache(&cache, options.cacheDirectory);
+        if (errCode == UTIL_SUCCESS_S) {
+            buildCache = &cache;
+            macroLibraries.directory = options.cacheDirectory; /* the compiled macro libraries go next to the runs */
+        }
+        else
+            printErrorMsg(errCode, NULL, 0); /* assemble without it */
+    }
+
+    if (fileCount == 0) {
         printf("No input files provided. will run with default file name 'test1.as'\n\n");
         inputFileName = "test1";
-        executeAssembler(inputFileName);
+        assembleFile(inputFileName, context, buildCache, &options);
+        if (options.sizeReport)
+            reportSize(inputFileName, context);
         printf("\ndone with file %s \n\n\n", inputFileName);
+        if (options.perf) {
+            endPerfFile(&perf, inputFileName, stderr);
+            closePerfRecorder(&perf);
+        }
+        freeAssemblerContext(context);
+        return 0;
+    }
+
+    if (options.pipeline && (options.clientSocket != NULL || buildCache != NULL || options.perf || options.sizeReport))
+        fprintf(stderr, "--pipeline is ignored with --socket, --cache, --perf and --size-report, the files are assembled one by one\n");
+    else if (options.pipeline && pipelineFiles(argc, argv, fileCount, &options)) {
+        freeAssemblerContext(context);
         return 0;
     }
 
     for (i = 1; i < argc; i++) {
+        if (parseOption(argc, argv, &i, &options) == OPTION_PARSED)
+            continue; /* already read in the first loop, i was moved past its value */
+        if (strcmp(argv[i], STREAM_FILE_NAME) == 0) { /* stdout is the output, nothing else is printed to it */
+            if (!assembleStream(stdin, stdout, options.entFd, options.extFd, context))
+                exitCode = 1;
+            continue;
+        }
+
         inputFileName = strDup((char*)argv[i]);
         printf("argv[%d]: %s\n", i, argv[i]);
-        executeAssembler(inputFileName);
+        if (options.perf)
+            beginPerfFile(&perf);
+        assembleFile(inputFileName, context, buildCache, &options);
+        if (options.sizeReport)
+            reportSize(inputFileName, context);
         printf("\ndone with file %s \n\n\n", inputFileName);
+        if (options.perf)
+            endPerfFile(&perf, inputFileName, stderr);
         free(inputFileName);
     }
 
-    return 0;
+    if (options.perf)
+        closePerfRecorder(&perf);
+    freeAssemblerContext(context);
+    return exitCode;
 }
 
-void executeAssembler(char* fileName)
+/* parseOption - reads the option at argv[*i] and moves *i to its value if it has one
+ * returns OPTION_PARSED, NOT_AN_OPTION (a file name) or OPTION_ERROR
+ */
+int parseOption(int argc, char const *argv[], int *i, AssemblerOptions *options)
 {
-    ErrCode errCode = NULL_INITIAL;
-    FILE *asFile = NULL, *amFile = NULL, *obFile = NULL;
-    unsigned int DCF = 0, ICF = 0;
-    CodeWord codeImage[MAX_MEMORY_SIZE] = {0};
-    DataWord dataImage[MAX_MEMORY_SIZE] = {0};
-    MacroTable* macroTable = createMacroTable();
-    SymbolTable* symbolTable  = createSymbolTable();
-    ErrorList* errorList = createErrorList(fileName);
-
-    if (errorList == NULL || macroTable == NULL || symbolTable == NULL) {
-        printErrorMsg(MALLOC_ERROR_F, "tables", 0);
-        return;
+    const char *arg = argv[*i];
+    const char *const *valued;
+
+    for (valued = valuedOptions; *valued != NULL; valued++)
+        if (strcmp(arg, *valued) == 0 && *i + 1 >= argc) { /* the last argument, it has no value */
+            fprintf(stderr, "%s needs a value\n", arg);
+            return OPTION_ERROR;
+        }
+
+    if (strcmp(arg, "-j") == 0 || strcmp(arg, "--jobs") == 0)
+        return parseNumberOption("jobs", argv[++*i], 1, MAX_JOBS, &options->jobs);
+    if (strncmp(arg, "-j", 2) == 0 && arg[2] != '\0') /* -jN */
+        return parseNumberOption("jobs", arg + 2, 1, MAX_JOBS, &options->jobs);
+    if (strcmp(arg, "--max-errors") == 0)
+        return parseNumberOption("max errors", argv[++*i], 1, MAX_OPTION_NUMBER, &options->maxErrors);
+    if (strcmp(arg, "--workers") == 0)
+        return parseNumberOption("workers", argv[++*i], 1, MAX_SERVER_WORKERS, &options->workers);
+    if (strcmp(arg, "--server") == 0) {
+        options->serverSocket = argv[++*i];
+        return OPTION_PARSED;
+    }
+    if (strcmp(arg, "--socket") == 0) {
+        options->clientSocket = argv[++*i];
+        return OPTION_PARSED;
+    }
+    if (strcmp(arg, "--cache") == 0) {
+        options->cacheDirectory = argv[++*i];
+        return OPTION_PARSED;
+    }
+    if (strcmp(arg, "--ent-fd") == 0)
+        return parseDescriptorOption("ent fd", argv[++*i], &options->entFd);
+    if (strcmp(arg, "--ext-fd") == 0)
+        return parseDescriptorOption("ext fd", argv[++*i], &options->extFd);
+    if (strcmp(arg, "--bench") == 0)
+        return parseNumberOption("bench runs", argv[++*i], 1, MAX_BENCH_RUNS, &options->benchRuns);
+    if (strcmp(arg, "--trace") == 0) {
+        options->tracePath = argv[++*i];
+        return OPTION_PARSED;
+    }
+    if (strcmp(arg, "--check") == 0) {
+        options->check = TRUE;
+        return OPTION_PARSED;
+    }
+    if (strcmp(arg, "--size-report") == 0) {
+        options->sizeReport = TRUE;
+        return OPTION_PARSED;
+    }
+    if (strcmp(arg, "--perf") == 0) {
+        options->perf = TRUE;
+        return OPTION_PARSED;
+    }
+    if (strcmp(arg, "--alloc-stats") == 0) {
+        options->allocStats = TRUE;
+        return OPTION_PARSED;
+    }
+    if (strcmp(arg, "--pipeline") == 0) {
+        options->pipeline = TRUE;
+        return OPTION_PARSED;
+    }
+    if (strcmp(arg, "--watch") == 0) {
+        options->watch = TRUE;
+        return OPTION_PARSED;
+    }
+    if (arg[0] == '-' && arg[1] != '\0') { /* - alone is stdin */
+        fprintf(stderr, "unknown option %s\n", arg);
+        return OPTION_ERROR;
     }
 
-    printf("Starting preprocessor...\n");
-    errorList->stage = "preprocessor";
+    return NOT_AN_OPTION;
+}
 
-    asFile = openFile(fileName, ".as", "r", &errCode);
-    if(errCode == FILE_READ_ERROR_F) 
-        errCode = INPUT_FILE_UNREADABLE_F;
+/* parseNumberOption - reads the number of an option, returns OPTION_PARSED or OPTION_ERROR */
+int parseNumberOption(const char *name, const char *arg, unsigned int min, unsigned int max, unsigned int *value)
+{
+    char *endPtr;
+    long number = strtol(arg, &endPtr, 10);
 
-    if (errCode != UTIL_SUCCESS_S){
-        printf("Error opening file %s.as: %s\n", fileName, getErrorMessage(errCode));
-        freeTableAndLists(macroTable, symbolTable , errorList); 
-        return;
+    if (endPtr == arg || *endPtr != '\0' || number < (long)min || number > (long)max) {
+        fprintf(stderr, "invalid number of %s '%s', should be between %u and %u\n", name, arg, min, max);
+        return OPTION_ERROR;
     }
+    *value = (unsigned int)number;
+    return OPTION_PARSED;
+}
 
-    amFile = openFile(fileName, ".am", "w", &errCode);
-    if (errCode != UTIL_SUCCESS_S) {
-        printf("Error opening file %s.am: %s\n", fileName, getErrorMessage(errCode));
-        freeTableAndLists(macroTable, symbolTable , errorList); 
-        freeFiles(asFile, NULL, NULL);
-        return;
-    }
+/* parseDescriptorOption - reads a file descriptor option, returns OPTION_PARSED or OPTION_ERROR */
+int parseDescriptorOption(const char *name, const char *arg, int *fd)
+{
+    unsigned int value;
 
-    errCode = executePreprocessor(asFile, amFile, macroTable, errorList);
-    if (errCode == PREPROCESSOR_FAILURE_S) {
-        freeFiles(asFile, amFile, NULL);
-        errCode = delFile(errorList->filename, ".am"); 
-        if (errCode != UTIL_SUCCESS_S)
-            addErrorToList(errorList, errCode);
-        printErrors(errorList);
-        freeTableAndLists(macroTable, symbolTable , errorList);
-        return;
-    }
-    printf("\nPreprocessor executed successfully.\n");
-    freeFiles(asFile, amFile, NULL);
+    if (parseNumberOption(name, arg, 0, MAX_OPTION_NUMBER, &value) == OPTION_ERROR)
+        return OPTION_ERROR;
+    *fd = (int)value;
+    return OPTION_PARSED;
+}
 
-    printf("Starting first pass...\n");
-    errorList->stage = "first pass";
+/* assembleFile - assembles fileName on the server if there is one, otherwise in this process (through the cache if it isn't NULL) */
+void assembleFile(char* fileName, AssemblerContext *context, BuildCache *cache, const AssemblerOptions *options)
+{
+    OutputTarget target;
 
-    amFile = openFile(fileName, ".am", "r", &errCode);
-    if (errCode != UTIL_SUCCESS_S) {
-        printf("Error opening file %s.am for reading: %s\n", fileName, getErrorMessage(errCode));
-        freeTableAndLists(macroTable, symbolTable , errorList);
+    if (options->clientSocket != NULL && forwardToServer(options->clientSocket, fileName, options->jobs, options->maxErrors))
         return;
-    }
-
-    errCode = executeFirstPass(amFile, dataImage, &DCF, &ICF, macroTable, symbolTable , errorList);
-    if (errCode == FIRSTPASS_FAILURE_S) {
-        printErrors(errorList);
-        freeTableAndLists(macroTable, symbolTable , errorList);
-        freeFiles(amFile, NULL, NULL);
+    if (cache != NULL && assembleWithCache(cache, fileName, context))
         return;
-    }
-    printf("\nFirst pass executed successfully.\n");
 
-    printf("Starting second pass...\n");
-    errorList->stage = "second pass";
-    rewind(amFile);
+    initOutputTarget(&target, stdout, stderr);
+    executeAssembler(fileName, NULL, 0, context, &target);
+    freeOutputTarget(&target);
+}
 
-    errCode = executeSecondPass(amFile, macroTable, symbolTable, codeImage, dataImage, &ICF, &DCF, errorList);
-    if (errCode == SECOND_PASS_FAILURE_S) {
-        freeFiles(amFile, NULL, NULL);
-        printSymbolTableSorted(symbolTable);
-        printErrors(errorList);
-        freeTableAndLists(macroTable, symbolTable , errorList);
-        return;
-    }
+/* pipelineFiles - assembles the files of argv with the pipeline, FALSE if it can't (nothing was done) */
+Bool pipelineFiles(int argc, char const *argv[], int fileCount, AssemblerOptions *options)
+{
+    PipelineFile *files = malloc(sizeof(PipelineFile) * fileCount);
+    ErrCode errCode;
+    int i, count = 0;
 
-    if (ICF + DCF > 164){
-        printf("Warning: ICF + DCF exceeds 164\n");
+    if (files == NULL)
+        return FALSE;
+    for (i = 1; i < argc; i++) {
+        if (parseOption(argc, argv, &i, options) != NOT_AN_OPTION)
+            continue;
+        if (strcmp(argv[i], STREAM_FILE_NAME) == 0) { /* its output is stdout, it can't be mixed with the reports */
+            fprintf(stderr, "--pipeline is ignored with -, the files are assembled one by one\n");
+            free(files);
+            return FALSE;
+        }
+        files[count].fileName = (char*)argv[i];
+        files[count].argIndex = i;
+        count++;
     }
 
-    printf("Writing output files...\n");
-    errorList->stage = "write files";
+    errCode = runPipeline(files, (unsigned int)count, options->jobs, options->maxErrors, &macroLibraries);
+    free(files);
+    if (errCode != UTIL_SUCCESS_S)
+        printErrorMsg(errCode, "pipeline", 0);
+    return errCode == UTIL_SUCCESS_S;
+}
 
-    obFile = openFile(fileName, ".ob", "w", &errCode);
-    if (errCode != UTIL_SUCCESS_S) {
-        printf("Error opening file %s.ob: %s\n", fileName, getErrorMessage(errCode));
-        freeTableAndLists(macroTable, symbolTable , errorList);
-        freeFiles(amFile, NULL, NULL);
-        return;
-    }
+/* reportAllocStats - prints the allocation stats of the run (--alloc-stats), registered with atexit */
+void reportAllocStats(void)
+{
+    printAllocStats(stderr);
+}
 
-    /* Write .ob file */
-    writeObjectFile(obFile, codeImage, ICF, dataImage, DCF);
+/* unloadMacroLibraries - unloads the compiled macro libraries, registered with atexit */
+void unloadMacroLibraries(void)
+{
+    freeMacroLibraries(&macroLibraries);
+}
+
+/* reportSize - prints the size report of fileName if context holds its run (not when the server or the cache did it) */
+void reportSize(char *fileName, AssemblerContext *context)
+{
+    ErrCode errCode;
 
-    freeFiles(obFile, NULL, NULL);
+    if (context->name == NULL || strcmp(context->name, fileName) != 0)
+        return;
+    errCode = printSizeReport(stdout, fileName, context);
+    if (errCode != UTIL_SUCCESS_S)
+        printErrorMsg(errCode, "size report", 0);
+}
 
-    /* Write .ent file by filename if there are entry symbols */
-    if (symbolTable->haveEntry) {
-        errCode = writeEntryFile(fileName, symbolTable, errorList);
+/* benchFiles - runs the benchmark on every file of argv (file or file.as), returns the exit code */
+int benchFiles(int argc, char const *argv[], int fileCount, AssemblerOptions *options)
+{
+    char *fileName;
+    size_t length;
+    ErrCode errCode;
+    int i, exitCode = 0;
+
+    if (fileCount == 0) {
+        fprintf(stderr, "--bench needs the names of the files to assemble\n");
+        return 1;
+    }
+    for (i = 1; i < argc; i++) {
+        if (parseOption(argc, argv, &i, options) != NOT_AN_OPTION)
+            continue;
+        fileName = strDup(argv[i]);
+        if (fileName == NULL) {
+            printErrorMsg(MALLOC_ERROR_F, "bench", 0);
+            return 1;
+        }
+        length = strlen(fileName);
+        if (length > 3 && strcmp(fileName + length - 3, ".as") == 0)
+            fileName[length - 3] = '\0'; /* readSourceFile adds it */
+        errCode = runBench(fileName, options->benchRuns, options->jobs, options->maxErrors, &macroLibraries);
         if (errCode != UTIL_SUCCESS_S) {
-            printf("Error writing .ent file: %s\n", getErrorMessage(errCode));
+            printErrorMsg(errCode, fileName, 0);
+            exitCode = 1;
         }
+        free(fileName);
     }
+    return exitCode;
+}
 
-    /* Write .ext file by filename if there are extern symbols */
-    if (symbolTable->haveExtern) {
-        errCode = writeExternFile(fileName, symbolTable, errorList);
-        if (errCode != UTIL_SUCCESS_S) {
-            printf("Error writing .ext file: %s\n", getErrorMessage(errCode));
-        }
+/* checkFiles - validates the files and directories of argv, returns the exit code */
+int checkFiles(int argc, char const *argv[], int fileCount, AssemblerOptions *options)
+{
+    char const **paths;
+    int i, exitCode;
+    unsigned int pathCount = 0;
+
+    if (fileCount == 0) {
+        fprintf(stderr, "--check needs the files or directories to check\n");
+        return 1;
+    }
+    paths = malloc(sizeof(char*) * fileCount);
+    if (paths == NULL) {
+        printErrorMsg(MALLOC_ERROR_F, "check", 0);
+        return 1;
     }
+    for (i = 1; i < argc; i++)
+        if (parseOption(argc, argv, &i, options) == NOT_AN_OPTION)
+            paths[pathCount++] = argv[i];
+    exitCode = runCheck(paths, pathCount, options->jobs, options->maxErrors, &macroLibraries);
+    free(paths);
+    return exitCode;
+}
+
+/* watchFiles - runs the watch mode on the file names of argv, returns the exit code */
+int watchFiles(int argc, char const *argv[], int fileCount, AssemblerOptions *options)
+{
+    char **fileNames;
+    int i, count = 0;
 
-    freeFiles(amFile, NULL, NULL);
-    freeTableAndLists(macroTable, symbolTable , errorList);
+    if (fileCount == 0) {
+        fprintf(stderr, "--watch needs the names of the files to watch\n");
+        return 1;
+    }
+    fileNames = malloc(sizeof(char*) * fileCount);
+    if (fileNames == NULL) {
+        printErrorMsg(MALLOC_ERROR_F, "watch", 0);
+        return 1;
+    }
+    for (i = 1; i < argc; i++)
+        if (parseOption(argc, argv, &i, options) == NOT_AN_OPTION)
+            fileNames[count++] = (char*)argv[i];
 
-    printf("Successfully executed file %s\n", fileName);
+    printErrorMsg(runWatch(fileNames, (unsigned int)count, options->jobs, options->maxErrors, &macroLibraries), "watch", 0);
+    free(fileNames);
+    return 1;
 }
@@ -0,0 +1,276 @@
+#define _POSIX_C_SOURCE 200809L /* for clock_gettime */
+#include "global.h"
+#include "error.h"
+#include "util.h"
+#include "lexer.h"
+#include "tables.h"
+#include "writeFiles.h"
+#include <time.h>
+
+/* microBench - times the hot functions of the lexer, the tables and the object writer one at a time on realistic
+ * inputs and prints ns per call, so a change in the end to end numbers (run --bench) can be pinned to a function.
+ * usage: microBench [min ms per benchmark] */
+
+#define DEFAULT_MIN_MS 100 /* every benchmark doubles its calls until a batch takes this long */
+#define FIRST_BATCH 64
+#define TABLE_SIZES 4
+#define OBJECT_CODE_WORDS 100 /* the size of the images writeObjectFile writes */
+#define OBJECT_DATA_WORDS 56
+
+typedef void (*BenchOp)(void *arg); /* one call of the function that is measured */
+
+static const unsigned int tableSizes[TABLE_SIZES] = {10, 100, 1000, 10000};
+
+static double nowNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+/* measure - calls op in doubling batches until one takes minMs, prints the ns per call of that batch */
+static void measure(const char *name, const char *input, BenchOp op, void *arg, double minMs)
+{
+    unsigned long calls = FIRST_BATCH, i;
+    double start, elapsed;
+
+    for (;;) {
+        start = nowNs();
+        for (i = 0; i < calls; i++)
+            op(arg);
+        elapsed = nowNs() - start;
+        if (elapsed >= minMs * 1e6 || calls > (unsigned long)1 << 40)
+            break;
+        calls *= 2;
+    }
+    printf("  %-28s %-28.28s %12.1f ns/op %12lu calls\n", name, input, elapsed / (double)calls, calls);
+}
+
+/* the inputs of the lexer benchmarks */
+
+typedef struct LineInput {
+    const char *text;
+    MacroTable *macroNames;
+    ErrorList *errorList;
+} LineInput;
+
+typedef struct TextInput { /* readTextLine walks the whole text */
+    TextBuffer text;
+    size_t position;
+} TextInput;
+
+static void benchReadTextLine(void *arg)
+{
+    TextInput *input = (TextInput*)arg;
+    ErrCode errorCode = NULL_INITIAL;
+    char *line;
+
+    if (input->position >= input->text.length)
+        input->position = 0;
+    line = readTextLine(input->text.text, input->text.length, &input->position, &errorCode);
+    free(line);
+}
+
+static void benchGetFirstToken(void *arg)
+{
+    ErrCode errorCode = NULL_INITIAL;
+    free(getFirstToken(((LineInput*)arg)->text, &errorCode));
+}
+
+static void benchCutFirstToken(void *arg)
+{
+    ErrCode errorCode = NULL_INITIAL;
+    char line[MAX_LINE_FILE_LENGTH + 2];
+
+    strcpy(line, ((LineInput*)arg)->text); /* it cuts the token out of the line */
+    free(cutFirstToken(line, &errorCode));
+}
+
+static void benchParseLine(void *arg)
+{
+    LineInput *input = (LineInput*)arg;
+    ErrCode errorCode = NULL_INITIAL;
+    freeParsedLine(parseLineText(input->text, &errorCode, input->macroNames, input->errorList));
+}
+
+static void benchDetermineOperandType(void *arg)
+{
+    LineInput *input = (LineInput*)arg;
+    operandType opType;
+    int number;
+    char *matLabel = NULL, *row = NULL, *col = NULL;
+
+    determineOperandType(input->text, &opType, &number, &matLabel, &row, &col, input->macroNames, input->errorList);
+    freeStrings(matLabel, row, col);
+}
+
+static void benchParseMatrixOperand(void *arg)
+{
+    char *name = NULL, *row = NULL, *col = NULL;
+    parseMatrixOperand(((LineInput*)arg)->text, &name, &row, &col);
+    freeStrings(name, row, col);
+}
+
+static void runLexerBenchmarks(double minMs)
+{
+    static const char *const lines[][2] = { /* line type, line */
+        {"instruction", "mov r1, r2"},
+        {"label instruction", "LOOP: cmp #-5, M1[r2][r7]"},
+        {"jump", "bne LOOP"},
+        {"no operands", "stop"},
+        {".data", "L0: .data -16, 55, 3, 2, 511, -512, 7"},
+        {".string", "STR: .string \"abcdefghij\""},
+        {".mat", "M0: .mat [2][2] 1,2,3,4"},
+        {".extern", ".extern X1"},
+        {".entry", ".entry LOOP"},
+        {"comment", "; a comment line"},
+        {"empty", "   "}
+    };
+    static const char *const operands[][2] = {
+        {"register", "r3"}, {"number", "#-17"}, {"label", "LOOP"}, {"matrix", "M1[r2][r7]"}
+    };
+    LineInput input;
+    TextInput text;
+    unsigned int i, copies;
+    char name[64];
+
+    input.macroNames = createMacroTable();
+    input.errorList = createErrorList("microBench");
+    initTextBuffer(&text.text);
+    text.position = 0;
+    for (copies = 0; copies < 100; copies++)
+        for (i = 0; i < sizeof(lines) / sizeof(lines[0]); i++)
+            appendLine(&text.text, lines[i][1]);
+    if (input.macroNames == NULL || input.errorList == NULL || text.text.text == NULL) {
+        printErrorMsg(MALLOC_ERROR_F, "microBench", 0);
+        exit(1);
+    }
+
+    printf("lexer:\n");
+    measure("readTextLine", "mixed lines", benchReadTextLine, &text, minMs);
+    input.text = "  LOOP: cmp #-5, M1[r2][r7]";
+    measure("getFirstToken", input.text, benchGetFirstToken, &input, minMs);
+    measure("cutFirstToken", input.text, benchCutFirstToken, &input, minMs);
+    for (i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+        sprintf(name, "parseLine %s", lines[i][0]);
+        input.text = lines[i][1];
+        measure(name, input.text, benchParseLine, &input, minMs);
+    }
+    for (i = 0; i < sizeof(operands) / sizeof(operands[0]); i++) {
+        sprintf(name, "operand %s", operands[i][0]);
+        input.text = operands[i][1];
+        measure(name, input.text, benchDetermineOperandType, &input, minMs);
+    }
+    input.text = "M1[r2][r7]";
+    measure("parseMatrixOperand", input.text, benchParseMatrixOperand, &input, minMs);
+
+    freeTextBuffer(&text.text);
+    freeTableAndLists(input.macroNames, NULL, input.errorList);
+}
+
+/* the tables, filled with size names and looked up at the oldest one (the end of the list) and at a missing one */
+
+typedef struct TableInput {
+    SymbolTable *symbols;
+    MacroTable *macros;
+    char name[32];
+} TableInput;
+
+static void benchFindSymbol(void *arg)
+{
+    TableInput *input = (TableInput*)arg;
+    findSymbol(input->symbols, input->name);
+}
+
+static void benchIsMacroExists(void *arg)
+{
+    TableInput *input = (TableInput*)arg;
+    isMacroExists(input->macros, input->name);
+}
+
+static void runTableBenchmarks(double minMs)
+{
+    TableInput input;
+    unsigned int size, i;
+    char label[64];
+
+    printf("tables:\n");
+    for (size = 0; size < TABLE_SIZES; size++) {
+        input.symbols = createSymbolTable();
+        input.macros = createMacroTable();
+        for (i = 0; input.symbols != NULL && input.macros != NULL && i < tableSizes[size]; i++) {
+            sprintf(input.name, "LABEL%u", i);
+            if (addSymbol(input.symbols, input.name, 100 + i, "mov") != TABLES_SUCCESS_S)
+                break;
+            sprintf(input.name, "macro%u", i);
+            if (addMacro(input.macros, input.name) != TABLES_SUCCESS_S)
+                break;
+        }
+        if (input.symbols == NULL || input.macros == NULL || i < tableSizes[size]) {
+            printErrorMsg(MALLOC_ERROR_F, "microBench", 0);
+            exit(1);
+        }
+
+        sprintf(label, "%u symbols, hit", tableSizes[size]);
+        strcpy(input.name, "LABEL0");
+        measure("findSymbol", label, benchFindSymbol, &input, minMs);
+        sprintf(label, "%u symbols, miss", tableSizes[size]);
+        strcpy(input.name, "MISSING");
+        measure("findSymbol", label, benchFindSymbol, &input, minMs);
+        sprintf(label, "%u macros, hit", tableSizes[size]);
+        strcpy(input.name, "macro0");
+        measure("isMacroExists", label, benchIsMacroExists, &input, minMs);
+        sprintf(label, "%u macros, miss", tableSizes[size]);
+        strcpy(input.name, "missing");
+        measure("isMacroExists", label, benchIsMacroExists, &input, minMs);
+
+        freeTableAndLists(input.macros, input.symbols, NULL);
+    }
+}
+
+/* the object writer, into /dev/null so only the formatting is timed (to_base4_unique is static, it is timed
+ * through writeObjectFile) */
+
+typedef struct ObjectInput {
+    FILE *sink;
+    CodeWord code[OBJECT_CODE_WORDS];
+    DataWord data[OBJECT_DATA_WORDS];
+} ObjectInput;
+
+static void benchWriteObjectFile(void *arg)
+{
+    ObjectInput *input = (ObjectInput*)arg;
+    writeObjectFile(input->sink, input->code, OBJECT_CODE_WORDS, input->data, OBJECT_DATA_WORDS);
+}
+
+static void runWriterBenchmarks(double minMs)
+{
+    static ObjectInput input;
+    unsigned int i;
+
+    input.sink = fopen("/dev/null", "w");
+    if (input.sink == NULL) {
+        printErrorMsg(FILE_WRITE_ERROR_F, "microBench", 0);
+        exit(1);
+    }
+    for (i = 0; i < OBJECT_CODE_WORDS; i++)
+        input.code[i].allBits = (i * 37) & 0x3FF;
+    for (i = 0; i < OBJECT_DATA_WORDS; i++)
+        input.data[i].value = (int)(i * 13) - 300;
+
+    printf("writer:\n");
+    measure("writeObjectFile", "100 code + 56 data words", benchWriteObjectFile, &input, minMs);
+    fclose(input.sink);
+}
+
+int main(int argc, char const *argv[])
+{
+    double minMs = DEFAULT_MIN_MS;
+
+    if (argc > 1 && atoi(argv[1]) > 0)
+        minMs = atoi(argv[1]);
+    runLexerBenchmarks(minMs);
+    runTableBenchmarks(minMs);
+    runWriterBenchmarks(minMs);
+    return 0;
+}
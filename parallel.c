@@ -0,0 +1,131 @@
+#include "parallel.h"
+#include "allocStats.h"
+
+typedef struct WorkerArgs { /* what a worker thread needs to run its task */
+    ParallelTask task;
+    void *taskArg;
+    unsigned int index; /* the number of the task, for the observer */
+    const TaskObserver *observer;
+    AllocStage stage; /* the allocations of the task count for the stage of the calling thread */
+} WorkerArgs;
+
+/* runTask - runs the task of workerArgs on this thread, between the calls of its observer */
+static void runTask(const WorkerArgs *workerArgs)
+{
+    Bool observed = workerArgs->observer != NULL && workerArgs->observer->hook != NULL;
+
+    if (observed)
+        workerArgs->observer->hook(workerArgs->observer->hookArg, workerArgs->index, FALSE);
+    workerArgs->task(workerArgs->taskArg);
+    if (observed)
+        workerArgs->observer->hook(workerArgs->observer->hookArg, workerArgs->index, TRUE);
+}
+
+static void* workerMain(void *arg)
+{
+    WorkerArgs *workerArgs = (WorkerArgs*)arg;
+    setAllocStage(workerArgs->stage);
+    runTask(workerArgs);
+    return NULL;
+}
+
+void runParallel(ParallelTask task, void *args, size_t argSize, unsigned int taskCount)
+{
+    runObservedParallel(task, args, argSize, taskCount, NULL);
+}
+
+void runObservedParallel(ParallelTask task, void *args, size_t argSize, unsigned int taskCount, const TaskObserver *observer)
+{
+    pthread_t threads[MAX_JOBS];
+    WorkerArgs workerArgs[MAX_JOBS];
+    Bool started[MAX_JOBS];
+    unsigned int i;
+
+    if (taskCount > MAX_JOBS) /* callers split their work into at most MAX_JOBS chunks */
+        taskCount = MAX_JOBS;
+
+    for (i = 1; i < taskCount; i++) { /* task 0 is run by the calling thread */
+        workerArgs[i].task = task;
+        workerArgs[i].taskArg = (char*)args + i * argSize;
+        workerArgs[i].index = i;
+        workerArgs[i].observer = observer;
+        workerArgs[i].stage = getAllocStage();
+        started[i] = (pthread_create(&threads[i], NULL, workerMain, &workerArgs[i]) == 0);
+        if (!started[i]) /* couldn't start a thread, run the task here */
+            runTask(&workerArgs[i]);
+    }
+
+    if (taskCount > 0) {
+        workerArgs[0].task = task;
+        workerArgs[0].taskArg = args;
+        workerArgs[0].index = 0;
+        workerArgs[0].observer = observer;
+        runTask(&workerArgs[0]);
+    }
+
+    for (i = 1; i < taskCount; i++)
+        if (started[i])
+            pthread_join(threads[i], NULL);
+}
+
+unsigned int chunkCount(unsigned int lineCount, unsigned int jobs)
+{
+    unsigned int chunks = lineCount / MIN_LINES_PER_CHUNK; /* the most chunks that are still worth a thread */
+
+    if (jobs > MAX_JOBS)
+        jobs = MAX_JOBS;
+    if (chunks > jobs)
+        chunks = jobs;
+    if (chunks == 0)
+        chunks = 1;
+    return chunks;
+}
+
+Bool initWorkQueue(WorkQueue *queue, unsigned int capacity)
+{
+    queue->items = malloc(sizeof(void*) * capacity);
+    if (queue->items == NULL)
+        return FALSE;
+    queue->capacity = capacity;
+    queue->head = 0;
+    queue->count = 0;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->notEmpty, NULL);
+    pthread_cond_init(&queue->notFull, NULL);
+    return TRUE;
+}
+
+void pushWorkQueue(WorkQueue *queue, void *item)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->capacity)
+        pthread_cond_wait(&queue->notFull, &queue->lock);
+    queue->items[(queue->head + queue->count) % queue->capacity] = item;
+    queue->count++;
+    pthread_cond_signal(&queue->notEmpty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+void* popWorkQueue(WorkQueue *queue)
+{
+    void *item;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0)
+        pthread_cond_wait(&queue->notEmpty, &queue->lock);
+    item = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    pthread_cond_signal(&queue->notFull);
+    pthread_mutex_unlock(&queue->lock);
+    return item;
+}
+
+void freeWorkQueue(WorkQueue *queue)
+{
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->notEmpty);
+    pthread_cond_destroy(&queue->notFull);
+    free(queue->items);
+    queue->items = NULL;
+}
@@ -0,0 +1,45 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+#include "global.h"
+#include <pthread.h>
+
+#define MAX_JOBS 64 /* maximum number of worker threads for one stage */
+#define DEFAULT_JOBS 1 /* by default every stage runs serially on the calling thread */
+#define MIN_LINES_PER_CHUNK 32 /* smaller chunks cost more in thread start up than they save */
+
+typedef void (*ParallelTask)(void *taskArg); /* one unit of work, gets its own element of the args array */
+/* called on the thread of task number task as it starts (done FALSE) and as it ends (done TRUE) */
+typedef void (*TaskHook)(void *hookArg, unsigned int task, Bool done);
+
+typedef struct TaskObserver { /* who is told about the tasks of runObservedParallel, for tracing (--trace) */
+    TaskHook hook; /* NULL for none */
+    void *hookArg;
+} TaskObserver;
+
+/* runs task once for every element of args (taskCount elements of argSize bytes each), each on its own thread.
+ * the calling thread runs the first task itself and returns only after all tasks are done.
+ * if a thread can't be started its task runs on the calling thread instead, so the result never changes */
+void runParallel(ParallelTask task, void *args, size_t argSize, unsigned int taskCount);
+/* runParallel that calls the hook of observer (if it isn't NULL) around every task */
+void runObservedParallel(ParallelTask task, void *args, size_t argSize, unsigned int taskCount, const TaskObserver *observer);
+
+/* a bounded first in first out queue of pointers between threads, push waits while it is full and pop while it is empty */
+typedef struct WorkQueue {
+    void **items;
+    unsigned int capacity;
+    unsigned int head; /* the oldest item */
+    unsigned int count;
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+} WorkQueue;
+
+Bool initWorkQueue(WorkQueue *queue, unsigned int capacity); /* FALSE if malloc failed */
+void pushWorkQueue(WorkQueue *queue, void *item);
+void* popWorkQueue(WorkQueue *queue);
+void freeWorkQueue(WorkQueue *queue);
+
+/* how many line-aligned chunks to split lineCount lines into for jobs threads (at least 1) */
+unsigned int chunkCount(unsigned int lineCount, unsigned int jobs);
+
+#endif
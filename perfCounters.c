@@ -0,0 +1,147 @@
+#define _DEFAULT_SOURCE /* for syscall and clock_gettime */
+#include "perfCounters.h"
+#include "global.h"
+#include "assembler.h"
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static const unsigned long counterEvents[PERF_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES
+};
+static const char *const stageNames[PERF_STAGES] = {"read", "preprocessor", "first pass", "second pass", "output"};
+
+/* openCounter - a counter of event for this process and the threads it starts from now on, -1 if it can't */
+static int openCounter(unsigned long event)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = event;
+    attr.inherit = 1; /* the worker threads of the passes count too */
+    attr.exclude_kernel = 1; /* allowed with perf_event_paranoid up to 2 */
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0UL);
+}
+
+static double clockMs(clockid_t clock)
+{
+    struct timespec now;
+    if (clock_gettime(clock, &now) != 0)
+        return 0;
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+static void takeSample(PerfRecorder *recorder, PerfSample *sample)
+{
+    int i;
+    __u64 value;
+
+    sample->wallMs = clockMs(CLOCK_MONOTONIC);
+    sample->cpuMs = clockMs(CLOCK_PROCESS_CPUTIME_ID);
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        value = 0;
+        if (recorder->fds[i] >= 0 && read(recorder->fds[i], &value, sizeof(value)) != sizeof(value))
+            value = 0;
+        sample->counters[i] = (unsigned long)value;
+    }
+}
+
+void openPerfRecorder(PerfRecorder *recorder)
+{
+    int i, openErrno = 0;
+
+    recorder->hardware = FALSE;
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        recorder->fds[i] = openCounter(counterEvents[i]);
+        if (recorder->fds[i] >= 0)
+            recorder->hardware = TRUE;
+        else if (openErrno == 0)
+            openErrno = errno;
+    }
+    if (!recorder->hardware)
+        fprintf(stderr, "--perf: hardware counters are not available (%s), reporting the clocks only\n",
+                strerror(openErrno));
+    beginPerfFile(recorder);
+}
+
+void closePerfRecorder(PerfRecorder *recorder)
+{
+    int i;
+    for (i = 0; i < PERF_COUNTERS; i++)
+        if (recorder->fds[i] >= 0)
+            close(recorder->fds[i]);
+}
+
+/* switchStage - charges what was used since the last switch to the stage that ran, then starts stage */
+static void switchStage(PerfRecorder *recorder, PerfStage stage)
+{
+    PerfSample now, *used = &recorder->stages[recorder->stage];
+    int i;
+
+    takeSample(recorder, &now);
+    used->wallMs += now.wallMs - recorder->last.wallMs;
+    used->cpuMs += now.cpuMs - recorder->last.cpuMs;
+    for (i = 0; i < PERF_COUNTERS; i++)
+        used->counters[i] += now.counters[i] - recorder->last.counters[i];
+    recorder->last = now;
+    recorder->stage = stage;
+}
+
+void perfStageHook(void *recorder, AssemblerStage stage)
+{
+    switchStage((PerfRecorder*)recorder, stage == STAGE_DONE ? PERF_STAGE_OUTPUT : (PerfStage)(PERF_STAGE_PREPROCESSOR + stage));
+}
+
+void beginPerfFile(PerfRecorder *recorder)
+{
+    memset(recorder->stages, 0, sizeof(recorder->stages));
+    recorder->stage = PERF_STAGE_READ;
+    takeSample(recorder, &recorder->last);
+}
+
+/* printCount - a counter column, - if the counter isn't open */
+static void printCount(FILE *stream, const PerfRecorder *recorder, const PerfSample *sample, int counter)
+{
+    if (recorder->fds[counter] >= 0)
+        fprintf(stream, " %13lu", sample->counters[counter]);
+    else
+        fprintf(stream, " %13s", "-");
+}
+
+static void printSample(FILE *stream, const PerfRecorder *recorder, const char *name, const PerfSample *sample)
+{
+    int i;
+
+    fprintf(stream, "  %-13s %9.3f %9.3f", name, sample->wallMs, sample->cpuMs);
+    for (i = 0; i < PERF_COUNTERS; i++)
+        printCount(stream, recorder, sample, i);
+    if (recorder->fds[0] >= 0 && recorder->fds[1] >= 0 && sample->counters[0] > 0) /* instructions per cycle */
+        fprintf(stream, " %5.2f\n", (double)sample->counters[1] / (double)sample->counters[0]);
+    else
+        fprintf(stream, " %5s\n", "-");
+}
+
+void endPerfFile(PerfRecorder *recorder, const char *fileName, FILE *stream)
+{
+    PerfSample total;
+    int stage, i;
+
+    switchStage(recorder, PERF_STAGE_READ);
+    memset(&total, 0, sizeof(total));
+    fprintf(stream, "perf %s:\n  %-13s %9s %9s %13s %13s %13s %13s %5s\n", fileName, "stage", "wall ms", "cpu ms",
+            "cycles", "instructions", "branch-miss", "cache-miss", "IPC");
+    for (stage = 0; stage < PERF_STAGES; stage++) {
+        printSample(stream, recorder, stageNames[stage], &recorder->stages[stage]);
+        total.wallMs += recorder->stages[stage].wallMs;
+        total.cpuMs += recorder->stages[stage].cpuMs;
+        for (i = 0; i < PERF_COUNTERS; i++)
+            total.counters[i] += recorder->stages[stage].counters[i];
+    }
+    printSample(stream, recorder, "total", &total);
+    beginPerfFile(recorder);
+}
@@ -0,0 +1,42 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+#include "global.h"
+#include "assembler.h"
+
+/* the stage profiler of the command line (--perf): reads the hardware counters of the process (perf_event_open) at
+ * every stage boundary of executeAssembler and prints what every stage of a file used.
+ * the counters include the worker threads of the passes (-j), they are inherited by the threads they start.
+ * where perf events aren't available (containers, no PMU) only the software clocks are reported */
+
+#define PERF_COUNTERS 4 /* cycles, instructions, branch misses, cache misses */
+#define PERF_STAGES 5
+
+typedef enum PerfStage {
+    PERF_STAGE_READ, /* reading the .as file, until the preprocessor starts */
+    PERF_STAGE_PREPROCESSOR,
+    PERF_STAGE_FIRST_PASS,
+    PERF_STAGE_SECOND_PASS,
+    PERF_STAGE_OUTPUT /* the messages and the output files, after the last stage that ran */
+} PerfStage;
+
+typedef struct PerfSample { /* the counters at one moment, or what a stage used between two */
+    double wallMs;
+    double cpuMs; /* of the whole process */
+    unsigned long counters[PERF_COUNTERS];
+} PerfSample;
+
+typedef struct PerfRecorder {
+    int fds[PERF_COUNTERS]; /* -1 for a counter that couldn't be opened */
+    Bool hardware; /* at least one counter is open */
+    PerfStage stage; /* the stage that runs now */
+    PerfSample last; /* the sample taken when it started */
+    PerfSample stages[PERF_STAGES]; /* what every stage of the current file used */
+} PerfRecorder;
+
+void openPerfRecorder(PerfRecorder *recorder); /* opens the counters, prints once why if it can't */
+void closePerfRecorder(PerfRecorder *recorder);
+void perfStageHook(void *recorder, AssemblerStage stage); /* the StageHook of the context, hookArg is the recorder */
+void beginPerfFile(PerfRecorder *recorder); /* before executeAssembler */
+void endPerfFile(PerfRecorder *recorder, const char *fileName, FILE *stream); /* after it, prints the report */
+
+#endif
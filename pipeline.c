@@ -0,0 +1,171 @@
+#include "pipeline.h"
+#include "global.h"
+#include "assembler.h"
+#include "driver.h"
+#include "error.h"
+#include "util.h"
+#include "parallel.h"
+#include "trace.h"
+
+typedef struct PipelineItem { /* a file on its way through the stages */
+    const PipelineFile *file;
+    ErrCode readError; /* UTIL_SUCCESS_S, or why fileName.as couldn't be read */
+    AssemblerContext *context;
+    TraceStages stages; /* the stage spans of context with --trace */
+    double start; /* when the file was read, for its trace span */
+} PipelineItem;
+
+typedef struct Pipeline {
+    const PipelineFile *files;
+    unsigned int count;
+    WorkQueue freeItems; /* items the report stage is done with */
+    WorkQueue preprocessed; /* read and preprocessed, waiting for the passes */
+    WorkQueue assembled; /* waiting for the report stage */
+} Pipeline;
+
+/* the stages of one file */
+
+static void preprocessItem(PipelineItem *item, const PipelineFile *file, TextBuffer *source)
+{
+    item->file = file;
+    item->start = traceClock();
+    source->length = 0;
+    item->readError = readSourceFile(file->fileName, NULL, source);
+    if (item->readError == UTIL_SUCCESS_S)
+        preprocessSource(item->context, file->fileName, source->text != NULL ? source->text : "", source->length);
+}
+
+static void passItem(PipelineItem *item)
+{
+    if (item->readError == UTIL_SUCCESS_S)
+        assembleProgram(item->context);
+}
+
+/* reportItem - prints what a run of the file prints and writes its files */
+static void reportItem(PipelineItem *item)
+{
+    OutputTarget target;
+
+    printf("argv[%d]: %s\n", item->file->argIndex, item->file->fileName);
+    initOutputTarget(&target, stdout, stderr);
+    if (item->readError != UTIL_SUCCESS_S) {
+        reportReadError(item->file->fileName, item->readError, &target);
+        traceSpan(item->file->fileName, "file", item->file->fileName, item->start);
+    }
+    else {
+        reportAssembly(item->file->fileName, item->context, &target);
+        traceFile(item->file->fileName, item->context, item->start);
+    }
+    freeOutputTarget(&target);
+    printf("\ndone with file %s \n\n\n", item->file->fileName);
+}
+
+/* the stage threads */
+
+static void* preprocessStage(void *arg)
+{
+    Pipeline *pipeline = (Pipeline*)arg;
+    TextBuffer source; /* reused for every file */
+    unsigned int i;
+
+    initTextBuffer(&source);
+    for (i = 0; i < pipeline->count; i++) {
+        PipelineItem *item = popWorkQueue(&pipeline->freeItems);
+        preprocessItem(item, &pipeline->files[i], &source);
+        pushWorkQueue(&pipeline->preprocessed, item);
+    }
+    freeTextBuffer(&source);
+    return NULL;
+}
+
+static void* passStage(void *arg)
+{
+    Pipeline *pipeline = (Pipeline*)arg;
+    unsigned int i;
+
+    for (i = 0; i < pipeline->count; i++) {
+        PipelineItem *item = popWorkQueue(&pipeline->preprocessed);
+        passItem(item);
+        pushWorkQueue(&pipeline->assembled, item);
+    }
+    return NULL;
+}
+
+/* runInline - runs the stages that have no thread on the calling thread, one file at a time through all of them.
+ * with every stage inline it is a plain run of one file after the other */
+static void runInline(Pipeline *pipeline, Bool preprocess, Bool passes)
+{
+    TextBuffer source;
+    unsigned int i;
+
+    initTextBuffer(&source);
+    for (i = 0; i < pipeline->count; i++) {
+        PipelineItem *item;
+        if (preprocess) {
+            item = popWorkQueue(&pipeline->freeItems);
+            preprocessItem(item, &pipeline->files[i], &source);
+        }
+        else
+            item = popWorkQueue(passes ? &pipeline->preprocessed : &pipeline->assembled);
+        if (passes)
+            passItem(item);
+        reportItem(item);
+        pushWorkQueue(&pipeline->freeItems, item);
+    }
+    freeTextBuffer(&source);
+}
+
+ErrCode runPipeline(const PipelineFile files[], unsigned int count, unsigned int jobs, unsigned int maxErrors,
+                    MacroLibraries *libraries)
+{
+    Pipeline pipeline;
+    PipelineItem items[PIPELINE_DEPTH];
+    pthread_t preprocessThread, passThread;
+    Bool preprocessStarted = FALSE, passStarted = FALSE;
+    ErrCode errCode = UTIL_SUCCESS_S;
+    unsigned int i, made = 0;
+
+    pipeline.files = files;
+    pipeline.count = count;
+    if (!initWorkQueue(&pipeline.freeItems, PIPELINE_DEPTH))
+        return MALLOC_ERROR_F;
+    if (!initWorkQueue(&pipeline.preprocessed, PIPELINE_DEPTH)) {
+        freeWorkQueue(&pipeline.freeItems);
+        return MALLOC_ERROR_F;
+    }
+    if (!initWorkQueue(&pipeline.assembled, PIPELINE_DEPTH)) {
+        freeWorkQueue(&pipeline.freeItems);
+        freeWorkQueue(&pipeline.preprocessed);
+        return MALLOC_ERROR_F;
+    }
+
+    for (; made < PIPELINE_DEPTH; made++) {
+        items[made].context = createAssemblerContext();
+        if (items[made].context == NULL)
+            break;
+        items[made].context->jobs = jobs;
+        items[made].context->maxErrors = maxErrors;
+        useDiskIncludes(items[made].context, libraries);
+        initTraceStages(&items[made].stages, items[made].context);
+        pushWorkQueue(&pipeline.freeItems, &items[made]);
+    }
+
+    if (made == 0)
+        errCode = MALLOC_ERROR_F;
+    else {
+        preprocessStarted = pthread_create(&preprocessThread, NULL, preprocessStage, &pipeline) == 0;
+        passStarted = preprocessStarted && pthread_create(&passThread, NULL, passStage, &pipeline) == 0;
+        runInline(&pipeline, !preprocessStarted, !passStarted); /* only the report stage if both threads started */
+        if (passStarted)
+            pthread_join(passThread, NULL);
+        if (preprocessStarted)
+            pthread_join(preprocessThread, NULL);
+    }
+
+    for (i = 0; i < made; i++)
+        freeAssemblerContext(items[i].context);
+    freeWorkQueue(&pipeline.freeItems);
+    freeWorkQueue(&pipeline.preprocessed);
+    freeWorkQueue(&pipeline.assembled);
+    return errCode;
+}
@@ -0,0 +1,23 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+#include "global.h"
+#include "error.h"
+#include "macroLibrary.h" /* for MacroLibraries */
+
+/* the pipelined batch driver (--pipeline): every stage of a run of many files is its own thread, fed by a
+ * bounded queue, so file N+1 is read and preprocessed while file N is in its passes and file N-1 is reported
+ * and written. the reports are printed by one stage in the order of the files, so the output is the same as
+ * assembling them one after the other */
+
+#define PIPELINE_DEPTH 4 /* files in the pipeline at once, every one has its own AssemblerContext */
+
+typedef struct PipelineFile { /* a file of the run */
+    char *fileName; /* without .as */
+    int argIndex; /* its index in argv, for the argv[N] line */
+} PipelineFile;
+
+/* assembles the files in order, printing what a run of each one prints */
+ErrCode runPipeline(const PipelineFile files[], unsigned int count, unsigned int jobs, unsigned int maxErrors,
+                    MacroLibraries *libraries);
+
+#endif
@@ -4,27 +4,38 @@
 #include "lexer.h"
 #include "util.h"
 #include "tables.h"
+#include "macroLibrary.h"
+#include "probes.h"
+#include "allocStats.h"
+
+static void includeMacroFile(MacroTable *macroTable, const char *line, ErrorList *errorList);
 
 /* * executePreprocessor - main function for the preprocessor.
- * it reads the .as file, processes macro definitions and uses, and writes to the .am file.
+ * it reads the .as source text line by line, processes macro definitions and uses, and writes the expanded source to amText
+ * (the caller writes amText to the .am file, the first pass lexes it straight from memory).
+ * every macro call is recorded in the table with the .am lines it became (for --size-report).
+ * mcroinclude lines add the macros of a macro library (macroLibrary.h), found next to the includeBase of the table
+ * and read with its include reader.
  * it also handles errors and adds them to the error list.
  * Returns PREPROCESSOR_SUCCESS_S on success, PREPROCESSOR_FAILURE_S on failure.
  */
-ErrCode executePreprocessor(FILE *asFile, FILE *amFile, MacroTable *macroTable, ErrorList *errorList)
+ErrCode executePreprocessor(const char *source, size_t length, TextBuffer *amText, MacroTable *macroTable, ErrorList *errorList)
 {
-    char *line, *firstToken; /* line to read from the .as file and first token of the line */
+    char *line, *firstToken; /* line to read from the .as source and first token of the line */
+    size_t position = 0; /* the start of the next line in source */
     ErrCode errorCode = NULL_INITIAL; /* Initialize error code */
     Bool inMacroDef = FALSE; /* flag to indicate if the current line is a macro definition line */
+    unsigned int amLines = 0; /* the lines written to the .am text */
     errorList->currentLine = 0; /* reset the current line number */
 
     while (errorCode != EOF_REACHED_S) {
 
-        if (errorList->fatalError) /* check if there was a fatal error in previous iterations */
+        if (isStageStopped(errorList)) /* check if there was a fatal error (or too many errors) in previous iterations */
             return PREPROCESSOR_FAILURE_S;
         
         errorList->currentLine++;
 
-        line = readLine(asFile, &errorCode); /* read a line from the .as file 1 */
+        line = readTextLine(source, length, &position, &errorCode); /* read a line from the .as source 1 */
         if (errorCode == EOF_REACHED_S)
             break; /* end of file reached, exit the loop */
 
@@ -32,14 +43,15 @@ ErrCode executePreprocessor(FILE *asFile, FILE *amFile, MacroTable *macroTable,
             addErrorToList(errorList, errorCode);
             if (errorCode == LINE_TOO_LONG_E) /* if the line is too long, skip it and continue to the next line */
                 continue; 
-            /* all other errors we didn't check in readLine() are fatal */
+            /* all other errors we didn't check in readTextLine() are fatal */
             return PREPROCESSOR_FAILURE_S; 
         }
 
         firstToken = getFirstToken(line, &errorCode); /* get the first token from the line */    
         if(errorCode == END_OF_LINE_S){ /* if the line is empty or contains only whitespace */
-            fputs(line, amFile);
-            fputc('\n', amFile); /* write the empty line to the .am file */
+            if (appendLine(amText, line) != UTIL_SUCCESS_S) /* write the empty line to the .am text */
+                addErrorToList(errorList, MALLOC_ERROR_F);
+            amLines++;
             freeStrings(line, firstToken, NULL); /* free the memory allocated for the line and first token */
             continue; /* skip to the next line */
         }
@@ -55,8 +67,8 @@ ErrCode executePreprocessor(FILE *asFile, FILE *amFile, MacroTable *macroTable,
             cutnChar(line, strlen(firstToken)); /* cut the first word from the line for processing */
             if(!isEndOfLine(line)) /* if there are some extraneous text after the macro name */
                 addErrorToList(errorList, EXTRANEOUS_TEXT_E);
-            else /* if the line is just a macro use line */
-                spreadMacro(macroTable, firstToken, amFile); /* spread the macro body into the .am file */
+            else if (spreadMacro(macroTable, firstToken, amText, &amLines) != UTIL_SUCCESS_S) /* spread the macro body into the .am text */
+                addErrorToList(errorList, MALLOC_ERROR_F);
         }
         else if (isMacroDef(firstToken)) { /* check if the line is a macro definition line 3 */
             cutnChar(line, strlen(firstToken)); /* cut the first word from the line for processing */
@@ -75,15 +87,22 @@ ErrCode executePreprocessor(FILE *asFile, FILE *amFile, MacroTable *macroTable,
             else
                 inMacroDef = FALSE; /* reset the flag to indicate that we are no longer in a macro definition 8 */
         }
+        else if (isMacroInclude(firstToken)) { /* check if the line includes a macro library */
+            cutnChar(line, strlen(firstToken)); /* cut the first word from the line for processing */
+            if (inMacroDef) /* the body would hold the include line, not the macros */
+                addErrorToList(errorList, MACRO_INCLUDE_IN_MACRO_E);
+            else
+                includeMacroFile(macroTable, line, errorList);
+        }
         else if (inMacroDef) { /* if we are in a macro definition 6 */
             errorCode = addMacroLine(macroTable, line); /* add the line to the macro body */
             if (errorCode != TABLES_SUCCESS_S)  /* check if the line was added successfully */
                 addErrorToList(errorList, errorCode); /* add the error to the error list */
         }
-        else { /* if the line is just a regular line unrelated to macros */
-            fputs(line, amFile); /* write the line to the .am file */
-            fputc('\n', amFile); /* add a newline character after the line */
-        }
+        else if (appendLine(amText, line) != UTIL_SUCCESS_S) /* a regular line unrelated to macros goes to the .am text */
+            addErrorToList(errorList, MALLOC_ERROR_F);
+        else
+            amLines++;
 
         freeStrings(line, firstToken, NULL); /* free the line memory */
 
@@ -95,17 +114,72 @@ ErrCode executePreprocessor(FILE *asFile, FILE *amFile, MacroTable *macroTable,
     return PREPROCESSOR_SUCCESS_S;
 }
 
-void spreadMacro(MacroTable *macroTable, const char *macroName, FILE *amFile)
+/* includeMacroFile - loads the library named on an include line and adds its macros to the table */
+static void includeMacroFile(MacroTable *macroTable, const char *line, ErrorList *errorList)
+{
+    ErrCode errorCode = NULL_INITIAL;
+    char *path = parseIncludePath(line, &errorCode), *resolved = NULL;
+    const MacroLibrary *library = NULL;
+    ContentHash fileHash;
+
+    if (path == NULL) {
+        addErrorToList(errorList, errorCode == UTIL_SUCCESS_S ? MALLOC_ERROR_F : errorCode);
+        return;
+    }
+    resolved = resolveIncludePath(macroTable->includeBase, path);
+    if (resolved == NULL) {
+        addErrorToList(errorList, MALLOC_ERROR_F);
+        free(path);
+        return;
+    }
+    errorCode = loadMacroLibrary(macroTable, resolved, &library, &fileHash);
+    if (recordIncludedFile(macroTable, resolved, errorCode != MACRO_INCLUDE_UNREADABLE_E ? &fileHash : NULL)
+        != UTIL_SUCCESS_S) { /* the build cache needs every file the run read */
+        if (errorCode == UTIL_SUCCESS_S)
+            releaseMacroLibrary(library);
+        errorCode = MALLOC_ERROR_F;
+    }
+    if (errorCode == UTIL_SUCCESS_S)
+        errorCode = includeMacroLibrary(macroTable, library);
+    if (errorCode != UTIL_SUCCESS_S && errorCode != TABLES_SUCCESS_S)
+        addErrorToList(errorList, errorCode);
+    freeStrings(path, resolved, NULL);
+}
+
+/* spreadMacro - appends the macro body lines to the .am text
+ * errorCode:  MALLOC_ERROR_F, UTIL_SUCCESS_S
+ */
+ErrCode spreadMacro(MacroTable *macroTable, const char *macroName, TextBuffer *amText, unsigned int *amLines)
 {
-    MacroBody *macroBody = findMacro(macroTable, macroName); /* find the macro body in the table */
-    /* macroBody cannot be NULL here because we checked if the macro exists before calling this function */
+    MacroNode *node = findMacroNode(macroTable, macroName); /* find the macro in the table */
+    MacroBody *macroBody = node != NULL ? node->bodyHead : NULL;
+    const MacroLibrary *library;
+    const LibraryMacro *included;
+    unsigned int lines = 0;
+    /* node is NULL here only for a macro of an included library, we checked it exists before the call */
 
+    PROBE1(macro__expand, macroName);
+    if (node == NULL && (included = findIncludedMacro(macroTable, macroName, &library)) != NULL) {
+        if (appendBytes(amText, libraryMacroBody(library, included), included->bodyLength) != UTIL_SUCCESS_S)
+            return MALLOC_ERROR_F; /* the lines are joined already */
+        PROBE2(macro__expand__done, macroName, included->lineCount);
+        if (addMacroExpansion(macroTable, libraryMacroName(library, included), *amLines, included->lineCount) != TABLES_SUCCESS_S)
+            return MALLOC_ERROR_F;
+        *amLines += included->lineCount;
+        return UTIL_SUCCESS_S;
+    }
     while (macroBody != NULL) { /* iterate through the macro body */
         MacroBody *next = macroBody->nextLine; /* save the next line */
-        fputs(macroBody->line, amFile); /* write the current line to the .am file */
-        fputc('\n', amFile); /* write the empty line to the .am file */
+        if (appendLine(amText, macroBody->line) != UTIL_SUCCESS_S) /* write the current line to the .am text */
+            return MALLOC_ERROR_F;
         macroBody = next; /* move to the next line */
+        lines++;
     }
+    PROBE2(macro__expand__done, macroName, lines);
+    if (node != NULL && addMacroExpansion(macroTable, node->macroName, *amLines, lines) != TABLES_SUCCESS_S)
+        return MALLOC_ERROR_F;
+    *amLines += lines;
+    return UTIL_SUCCESS_S;
 }
 
 ErrCode macroDef(MacroTable* macroTable, char* line) /* add a line to the macro body */
@@ -4,11 +4,13 @@
 #include "error.h"
 #include "lexer.h"
 #include "tables.h"
+#include "util.h" /* for TextBuffer */
 /* Preprocessor functions prototypes */
 
-ErrCode executePreprocessor(FILE *asFile, FILE *amFile, MacroTable *macroTable, ErrorList *errorList); /* main function for the preprocessor */
+ErrCode executePreprocessor(const char *source, size_t length, TextBuffer *amText, MacroTable *macroTable, ErrorList *errorList); /* main function for the preprocessor */
 
-void spreadMacro(MacroTable* macroTable, const char* macroName, FILE* amFile); /* spread the macro body into the .am file */
+/* spread the macro body into the .am text at line *amLines, records the expansion in the table and moves *amLines past it */
+ErrCode spreadMacro(MacroTable* macroTable, const char* macroName, TextBuffer* amText, unsigned int *amLines);
 ErrCode macroDef(MacroTable* macroTable, char* line); /* add a line to the macro body */
 
 #endif
@@ -0,0 +1,24 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/* static tracepoints (USDT) of the provider "assembler", for bpftrace and perf on hosts that run the assembler:
+ *   stage__enter(name, stage)      a stage of a file starts (AssemblerStage)
+ *   stage__exit(name, stage)       and ends
+ *   line(lineNumber, lineType)     a line was lexed, lineType is -1 if it failed
+ *   macro__expand(name)            a macro call starts to be spread into the .am text
+ *   macro__expand__done(name, lines)
+ *   symbol__insert(name, address)
+ *   symbol__lookup(name, found)
+ * with ASSEMBLER_PROBES (the default of the Makefile when <sys/sdt.h> is installed) they are nops with an ELF
+ * note that a tracer can attach to without a rebuild, otherwise they are not there at all (make probeFlags=) */
+
+#ifdef ASSEMBLER_PROBES
+#include <sys/sdt.h>
+#define PROBE1(name, a) DTRACE_PROBE1(assembler, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(assembler, name, a, b)
+#else
+#define PROBE1(name, a) ((void)0)
+#define PROBE2(name, a, b) ((void)0)
+#endif
+
+#endif
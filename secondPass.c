@@ -6,6 +6,24 @@
 #include <ctype.h> /* for isdigit */
 #include "util.h"
 #include "lexer.h"
+#include "parallel.h"
+#include "allocStats.h"
+
+/* after the first pass every instruction knows its start address and the symbol table is only read,
+   so the instruction lines are split into chunks and each chunk is encoded on its own thread into
+   its own range of the code image. extern use-sites and errors go into per chunk lists which are
+   merged in chunk order - that is address and line order - so the output is the same as serial */
+typedef struct SecondPassChunk { /* a line-aligned slice of the program encoded by one worker */
+    ParsedProgram *program;
+    unsigned int firstLine; /* first line of the chunk (0 based) */
+    unsigned int endLine; /* one past the last line of the chunk */
+    SymbolTable *symbolTable; /* read only while the chunks are encoded */
+    CodeWord *codeImage;
+    ExternList externs; /* the chunk's extern use-sites, in address order */
+    ErrorList *errorList; /* the chunk's own errors, in line order */
+} SecondPassChunk;
+
+static void encodeChunk(void *arg);
 
 static int operandTypeToAddrField(operandType op)
 {
@@ -23,14 +41,28 @@ static int operandTypeToAddrField(operandType op)
     }
 }
 
+/* store a word in the code image, words past the end of the memory (or without an image) are dropped */
+static void storeWord(CodeWord codeImage[], unsigned int address, CodeWord word)
+{
+    if (codeImage != NULL && address < MAX_MEMORY_SIZE)
+        codeImage[address].allBits = word.allBits;
+}
+
+/* record an extern use-site, the .ext file holds absolute addresses */
+static void addExternUse(ExternList *externs, const char *name, unsigned int address, ErrorList *errorList)
+{
+    if (externs != NULL && recordExternReference(externs, name, CODE_START_ADDRESS + address) != UTIL_SUCCESS_S)
+        addErrorToList(errorList, MALLOC_ERROR_F);
+}
+
 /* encode a matrix operand: we write two words:
    1) LabelWord for matrix base address (ARE depends on symbol type)
    2) MatrixRegistersWord containing row register (bits 6-9) and col register (bits 2-5)
-   address is the next code address (absolute, e.g. 100..255) to store at; it will be incremented.
+   address is the next code image index to store at (address 100 is index 0); it will be incremented.
 */
 ErrCode encodeMatrixOperand(const char *matLabel, const char *rowStr, const char *colStr,
                             CodeWord codeImage[], unsigned int *address,
-                            SymbolTable *symbolTable, ErrorList *errorList)
+                            SymbolTable *symbolTable, ExternList *externs, ErrorList *errorList)
 {
     SymbolNode *sym;
     CodeWord lw;
@@ -49,10 +81,10 @@ ErrCode encodeMatrixOperand(const char *matLabel, const char *rowStr, const char
     if (sym->type == EXTERN_SYMBOL) lw.labelWord.ARE = 1; /* extern */
     else lw.labelWord.ARE = 2; /* relocatable */
 
-    codeImage[*address].allBits = lw.allBits;
+    storeWord(codeImage, *address, lw);
 
     if (sym->type == EXTERN_SYMBOL) {
-        recordExternReference(sym->symbolName, *address);
+        addExternUse(externs, sym->symbolName, *address, errorList);
     }
     (*address)++;
 
@@ -71,238 +103,205 @@ ErrCode encodeMatrixOperand(const char *matLabel, const char *rowStr, const char
     mrw.matrixRegistersWord.ARE = 0; /* absolute */
     mrw.matrixRegistersWord.registerRow = (unsigned int)rrow & 0xF;
     mrw.matrixRegistersWord.registerCol = (unsigned int)rcol & 0xF;
-    codeImage[*address].allBits = mrw.allBits;
+    storeWord(codeImage, *address, mrw);
     (*address)++;
 
     return SECOND_PASS_SUCCESS_S;
 }
 
-/* main second pass routine */
-ErrCode executeSecondPass(FILE* amFile, MacroTable* macroTable,
-                          SymbolTable* symbolTable, CodeWord codeImage[],
-                          DataWord dataImage[], unsigned int *IC,
-                          unsigned int *DC, ErrorList* errorList)
+/* encode a number operand word, the value was parsed and range checked by the lexer */
+static void encodeNumberOperand(int value, CodeWord codeImage[], unsigned int *address)
 {
-    ErrCode err;
-    unsigned int address;
-    parsedLine *pLine;
-
-    err = NULL_INITIAL;
-    address = 100; /* code begins at memory address 100 decimal */
-    errorList->currentLine = 0;
-
-    rewind(amFile);
+    CodeWord nw;
 
-    while (1) {
-        if (errorList->fatalError)
-            return SECOND_PASS_FAILURE_S;
+    memset(&nw, 0, sizeof(CodeWord));
+    nw.numberWord.numberVal = (unsigned int)value & 0xFF;
+    nw.numberWord.ARE = 0;
+    storeWord(codeImage, *address, nw);
+    (*address)++;
+}
 
-        errorList->currentLine++;
+/* encode a label operand word, notExistError is reported if the label is not in the symbol table */
+static void encodeLabelOperand(const char *label, ErrCode notExistError, CodeWord codeImage[], unsigned int *address,
+                               SymbolTable *symbolTable, ExternList *externs, ErrorList *errorList)
+{
+    SymbolNode *sym;
+    CodeWord lw;
 
-        pLine = readParsedLine(amFile, &err, macroTable, errorList);
-        if (err == EOF_REACHED_S) {
-            break;
-        }
-        if (err == LEXER_FAILURE_S) {
-            continue;
+    memset(&lw, 0, sizeof(CodeWord));
+    sym = findSymbol(symbolTable, label);
+    if (sym == NULL) {
+        addErrorToList(errorList, notExistError);
+        lw.labelWord.labelAddress = 0;
+        lw.labelWord.ARE = 2;
+    } else {
+        lw.labelWord.labelAddress = (unsigned int)(sym->address & 0xFF);
+        if (sym->type == EXTERN_SYMBOL) {
+            lw.labelWord.ARE = 1;
+            addExternUse(externs, sym->symbolName, *address, errorList);
+        } else {
+            lw.labelWord.ARE = 2;
         }
+    }
+    storeWord(codeImage, *address, lw);
+    (*address)++;
+}
 
-        if (pLine->typesOfLine == EMPTY_LINE || pLine->typesOfLine == COMMENT_LINE) {
-            freeParsedLine(pLine);
-            continue;
-        }
+/* encode a register operand word, src or dest may be NULL if that register is not used */
+static void encodeRegisterOperand(const char *src, const char *dest, CodeWord codeImage[], unsigned int *address)
+{
+    CodeWord rw;
 
-        if (pLine->typesOfLine == DIRECTIVE_LINE) {
-            if (strcmp(pLine->lineContentUnion.directive.directiveName, ".entry") == 0) {
-                char *entryLabel;
-                SymbolNode *sym;
-                entryLabel = pLine->lineContentUnion.directive.directiveLabel;
-                sym = findSymbol(symbolTable, entryLabel);
-                if (sym == NULL) {
-                    addErrorToList(errorList, ENTRY_LABEL_DOES_NOT_EXIST_E);
-                } else {
-                    sym->isEntry = TRUE;
-                    symbolTable->haveEntry = TRUE;
-                }
-            }
-            freeParsedLine(pLine);
-            continue;
-        }
+    memset(&rw, 0, sizeof(CodeWord));
+    rw.registerWord.ARE = 0;
+    rw.registerWord.registerSrc = src != NULL ? (unsigned int)getRegisterNumber(src) & 0xF : 0;
+    rw.registerWord.registerDest = dest != NULL ? (unsigned int)getRegisterNumber(dest) & 0xF : 0;
+    storeWord(codeImage, *address, rw);
+    (*address)++;
+}
 
-        if (pLine->typesOfLine == INSTRUCTION_LINE) {
-            CodeWord first;
-            operandType op1, op2;
-            int srcAddr, dstAddr;
-            OpCodeNumber op;
+/* encode all the words of one instruction line starting at code image index address */
+void encodeInstruction(parsedLine *pLine, unsigned int address, CodeWord codeImage[],
+                       SymbolTable *symbolTable, ExternList *externs, ErrorList *errorList)
+{
+    CodeWord first;
+    operandType op1, op2;
+    int srcAddr, dstAddr;
+    OpCodeNumber op;
+    struct instructionData *instruction = &pLine->lineContentUnion.instruction;
+
+    memset(&first, 0, sizeof(CodeWord));
+
+    op = getOpCodeNumber(instruction->operationName);
+    if (op == invalid) {
+        addErrorToList(errorList, INVALID_DIRECTIVE_E);
+        return;
+    }
 
-            memset(&first, 0, sizeof(CodeWord));
+    first.firstWord.opCode = (unsigned int)op & 0xF;
+
+    op1 = instruction->operand1Type;
+    op2 = instruction->operand2Type;
+
+    srcAddr = operandTypeToAddrField(op1);
+    dstAddr = operandTypeToAddrField(op2);
+
+    first.firstWord.srcAddress = (unsigned int)(srcAddr & 0x3);
+    first.firstWord.destAddress = (unsigned int)(dstAddr & 0x3);
+    first.firstWord.ARE = 0; /* absolute */
+    storeWord(codeImage, address, first);
+    address++;
+
+    /* Encode operands extras */
+
+    /* Operand 1 */
+    if (op1 == NUMBER_OPERAND) {
+        encodeNumberOperand(instruction->number1, codeImage, &address);
+    } else if (op1 == REGISTER_OPERAND) {
+        if (op2 != REGISTER_OPERAND) /* two registers share one word, written with operand 2 */
+            encodeRegisterOperand(instruction->operand1, NULL, codeImage, &address);
+    } else if (op1 == MATRIX_TABLE_OPERAND || op1 == MATRIX_SYNTAX_OPERAND) {
+        encodeMatrixOperand(instruction->operand1, instruction->row1, instruction->col1,
+                            codeImage, &address, symbolTable, externs, errorList);
+    } else if (op1 == LABEL_TABLE_OPERAND || op1 == LABEL_SYNTAX_OPERAND) {
+        encodeLabelOperand(instruction->operand1, OPERAND1_LABEL_DOES_NOT_EXIST_E,
+                           codeImage, &address, symbolTable, externs, errorList);
+    }
 
-            op = getOpCodeNumber(pLine->lineContentUnion.instruction.operationName);
-            if (op == invalid) {
-                addErrorToList(errorList, INVALID_DIRECTIVE_E);
-                freeParsedLine(pLine);
-                continue;
-            }
+    /* Operand 2 */
+    if (op2 == NUMBER_OPERAND) {
+        encodeNumberOperand(instruction->number2, codeImage, &address);
+    } else if (op2 == REGISTER_OPERAND) {
+        encodeRegisterOperand(op1 == REGISTER_OPERAND ? instruction->operand1 : NULL,
+                              instruction->operand2, codeImage, &address);
+    } else if (op2 == MATRIX_TABLE_OPERAND || op2 == MATRIX_SYNTAX_OPERAND) {
+        encodeMatrixOperand(instruction->operand2, instruction->row2, instruction->col2,
+                            codeImage, &address, symbolTable, externs, errorList);
+    } else if (op2 == LABEL_TABLE_OPERAND || op2 == LABEL_SYNTAX_OPERAND) {
+        encodeLabelOperand(instruction->operand2, OPERAND2_LABEL_DOES_NOT_EXIST_E,
+                           codeImage, &address, symbolTable, externs, errorList);
+    }
+}
 
-            first.firstWord.opCode = (unsigned int)op & 0xF;
+/* encode the instructions of one chunk and check its .entry labels exist */
+static void encodeChunk(void *arg)
+{
+    SecondPassChunk *chunk = (SecondPassChunk*)arg;
+    unsigned int line;
 
-            op1 = pLine->lineContentUnion.instruction.operand1Type;
-            op2 = pLine->lineContentUnion.instruction.operand2Type;
+    for (line = chunk->firstLine; line < chunk->endLine; line++) {
+        parsedLine *pLine = chunk->program->lines[line];
+        if (isStageStopped(chunk->errorList))
+            return;
 
-            srcAddr = operandTypeToAddrField(op1);
-            dstAddr = operandTypeToAddrField(op2);
+        chunk->errorList->currentLine = line + 1;
+        if (pLine == NULL)
+            continue;
 
-            first.firstWord.srcAddress = (unsigned int)(srcAddr & 0x3);
-            first.firstWord.destAddress = (unsigned int)(dstAddr & 0x3);
-            first.firstWord.ARE = 0; /* absolute */
-            codeImage[address].allBits = first.allBits;
-            address++;
+        if (pLine->typesOfLine == DIRECTIVE_LINE) {
+            /* the symbol itself is marked after the workers are done, the table is read only until then */
+            if (strcmp(pLine->lineContentUnion.directive.directiveName, ".entry") == 0 &&
+                findSymbol(chunk->symbolTable, pLine->lineContentUnion.directive.directiveLabel) == NULL)
+                addErrorToList(chunk->errorList, ENTRY_LABEL_DOES_NOT_EXIST_E);
+        }
+        else if (pLine->typesOfLine == INSTRUCTION_LINE)
+            encodeInstruction(pLine, chunk->program->addresses[line], chunk->codeImage, chunk->symbolTable,
+                              chunk->codeImage != NULL ? &chunk->externs : NULL, chunk->errorList);
+    }
+}
 
-            /* Encode operands extras */
+/* main second pass routine */
+ErrCode executeSecondPass(ParsedProgram* program, SymbolTable* symbolTable, CodeWord codeImage[],
+                          unsigned int *IC, ExternList* externs, ErrorList* errorList, unsigned int jobs,
+                          const TaskObserver *observer)
+{
+    SecondPassChunk chunks[MAX_JOBS];
+    unsigned int chunksAmount, linesPerChunk, i, line;
 
-            /* Operand 1 */
-            if (op1 == NUMBER_OPERAND) {
-                CodeWord nw;
-                ErrCode e;
-                int val;
+    errorList->currentLine = 0;
 
-                memset(&nw, 0, sizeof(CodeWord));
-                e = isNumberOperand(pLine->lineContentUnion.instruction.operand1);
-                if (e != UTIL_SUCCESS_S) {
-                    addErrorToList(errorList, NUMBER_OPERAND_IS_NOT_INTEGER_E);
-                }
-                val = atoi(pLine->lineContentUnion.instruction.operand1 + 1);
-                nw.numberWord.numberVal = val & 0xFF;
-                nw.numberWord.ARE = 0;
-                codeImage[address].allBits = nw.allBits;
-                address++;
-            } else if (op1 == REGISTER_OPERAND) {
-                if (op2 == REGISTER_OPERAND) {
-                    /* postpone */
-                } else {
-                    CodeWord rw;
-                    registersNumber rsrc;
-
-                    memset(&rw, 0, sizeof(CodeWord));
-                    rw.registerWord.ARE = 0;
-                    rsrc = getRegisterNumber(pLine->lineContentUnion.instruction.operand1);
-                    rw.registerWord.registerSrc = (unsigned int)rsrc & 0xF;
-                    rw.registerWord.registerDest = 0;
-                    codeImage[address].allBits = rw.allBits;
-                    address++;
-                }
-            } else if (op1 == MATRIX_TABLE_OPERAND || op1 == MATRIX_SYNTAX_OPERAND) {
-                encodeMatrixOperand(pLine->lineContentUnion.instruction.operand1,
-                                   pLine->lineContentUnion.instruction.row1,
-                                   pLine->lineContentUnion.instruction.col1,
-                                   codeImage, &address, symbolTable, errorList);
-            } else if (op1 == LABEL_TABLE_OPERAND || op1 == LABEL_SYNTAX_OPERAND) {
-                SymbolNode *sym;
-                CodeWord lw;
-                char *label;
-
-                memset(&lw, 0, sizeof(CodeWord));
-                label = pLine->lineContentUnion.instruction.operand1;
-                sym = findSymbol(symbolTable, label);
-                if (sym == NULL) {
-                    addErrorToList(errorList, OPERAND1_LABEL_DOES_NOT_EXIST_E);
-                    lw.labelWord.labelAddress = 0;
-                    lw.labelWord.ARE = 2;
-                } else {
-                    lw.labelWord.labelAddress = (unsigned int)(sym->address & 0xFF);
-                    if (sym->type == EXTERN_SYMBOL) {
-                        lw.labelWord.ARE = 1;
-                        recordExternReference(sym->symbolName, address);
-                    } else {
-                        lw.labelWord.ARE = 2;
-                    }
-                }
-                codeImage[address].allBits = lw.allBits;
-                address++;
-            }
+    chunksAmount = chunkCount(program->count, jobs);
+    linesPerChunk = (program->count + chunksAmount - 1) / chunksAmount;
+    for (i = 0; i < chunksAmount; i++) {
+        chunks[i].program = program;
+        chunks[i].firstLine = i * linesPerChunk < program->count ? i * linesPerChunk : program->count;
+        chunks[i].endLine = (i + 1) * linesPerChunk < program->count ? (i + 1) * linesPerChunk : program->count;
+        chunks[i].symbolTable = symbolTable;
+        chunks[i].codeImage = codeImage;
+        initExternList(&chunks[i].externs);
+        chunks[i].errorList = createChildErrorList(errorList);
+        if (chunks[i].errorList == NULL) { /* the chunk can't report errors, so it can't run */
+            addErrorToList(errorList, MALLOC_ERROR_F);
+            chunks[i].endLine = chunks[i].firstLine;
+        }
+    }
 
-            /* Operand 2 */
-            if (op2 == NUMBER_OPERAND) {
-                CodeWord nw;
-                ErrCode e;
-                int val;
+    runObservedParallel(encodeChunk, chunks, sizeof(SecondPassChunk), chunksAmount, observer);
 
-                memset(&nw, 0, sizeof(CodeWord));
-                e = isNumberOperand(pLine->lineContentUnion.instruction.operand2);
-                if (e != UTIL_SUCCESS_S) {
-                    addErrorToList(errorList, NUMBER_OPERAND_IS_NOT_INTEGER_E);
-                }
-                val = atoi(pLine->lineContentUnion.instruction.operand2 + 1);
-                nw.numberWord.numberVal = val & 0xFF;
-                nw.numberWord.ARE = 0;
-                codeImage[address].allBits = nw.allBits;
-                address++;
-            } else if (op2 == REGISTER_OPERAND) {
-                if (op1 == REGISTER_OPERAND) {
-                    CodeWord rr;
-                    registersNumber rsrc, rdst;
-
-                    memset(&rr, 0, sizeof(CodeWord));
-                    rr.registerWord.ARE = 0;
-                    rsrc = getRegisterNumber(pLine->lineContentUnion.instruction.operand1);
-                    rdst = getRegisterNumber(pLine->lineContentUnion.instruction.operand2);
-                    rr.registerWord.registerSrc = (unsigned int)rsrc & 0xF;
-                    rr.registerWord.registerDest = (unsigned int)rdst & 0xF;
-                    codeImage[address].allBits = rr.allBits;
-                    address++;
-                } else {
-                    CodeWord rw;
-                    registersNumber rdst;
-
-                    memset(&rw, 0, sizeof(CodeWord));
-                    rw.registerWord.ARE = 0;
-                    rdst = getRegisterNumber(pLine->lineContentUnion.instruction.operand2);
-                    rw.registerWord.registerSrc = 0;
-                    rw.registerWord.registerDest = (unsigned int)rdst & 0xF;
-                    codeImage[address].allBits = rw.allBits;
-                    address++;
-                }
-            } else if (op2 == MATRIX_TABLE_OPERAND || op2 == MATRIX_SYNTAX_OPERAND) {
-                encodeMatrixOperand(pLine->lineContentUnion.instruction.operand2,
-                                   pLine->lineContentUnion.instruction.row2,
-                                   pLine->lineContentUnion.instruction.col2,
-                                   codeImage, &address, symbolTable, errorList);
-            } else if (op2 == LABEL_TABLE_OPERAND || op2 == LABEL_SYNTAX_OPERAND) {
-                SymbolNode *sym;
-                CodeWord lw;
-                char *label;
-
-                memset(&lw, 0, sizeof(CodeWord));
-                label = pLine->lineContentUnion.instruction.operand2;
-                sym = findSymbol(symbolTable, label);
-                if (sym == NULL) {
-                    addErrorToList(errorList, OPERAND2_LABEL_DOES_NOT_EXIST_E);
-                    lw.labelWord.labelAddress = 0;
-                    lw.labelWord.ARE = 2;
-                } else {
-                    lw.labelWord.labelAddress = (unsigned int)(sym->address & 0xFF);
-                    if (sym->type == EXTERN_SYMBOL) {
-                        lw.labelWord.ARE = 1;
-                        recordExternReference(sym->symbolName, address);
-                    } else {
-                        lw.labelWord.ARE = 2;
-                    }
+    /* merge in line order: the errors, the extern use-sites and the .entry marks */
+    for (i = 0; i < chunksAmount; i++) {
+        for (line = chunks[i].firstLine; line < chunks[i].endLine && !isStageStopped(errorList); line++) {
+            parsedLine *pLine = program->lines[line];
+            errorList->currentLine = line + 1;
+            moveLineErrors(errorList, chunks[i].errorList, errorList->currentLine);
+
+            if (pLine != NULL && pLine->typesOfLine == DIRECTIVE_LINE &&
+                strcmp(pLine->lineContentUnion.directive.directiveName, ".entry") == 0) {
+                SymbolNode *sym = findSymbol(symbolTable, pLine->lineContentUnion.directive.directiveLabel);
+                if (sym != NULL) {
+                    sym->isEntry = TRUE;
+                    symbolTable->haveEntry = TRUE;
                 }
-                codeImage[address].allBits = lw.allBits;
-                address++;
             }
-
-            freeParsedLine(pLine);
-            continue;
         }
-
-        freeParsedLine(pLine);
+        appendExternList(externs, &chunks[i].externs);
+        freeErrorsList(chunks[i].errorList);
     }
 
-    if (errorList->count > 0)
+    if (errorList->count > 0 || errorList->fatalError)
         return SECOND_PASS_FAILURE_S;
 
-    /* no change to *IC or *DC here */
+    /* no change to *IC here */
 
     return SECOND_PASS_SUCCESS_S;
 }
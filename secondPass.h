@@ -4,14 +4,25 @@
 #include <stdio.h>
 #include "global.h"   
 #include "lexer.h"      
+#include "writeFiles.h" /* for ExternList */
+#include "parallel.h" /* for TaskObserver */
 
 #define SECOND_PASS_SUCCESS_S 0
 #define SECOND_PASS_FAILURE_S 1
 
 
-ErrCode executeSecondPass(FILE* amFile, MacroTable* macroTable,
-                          SymbolTable* symbolTable, CodeWord codeImage[],
-                          DataWord dataImage[], unsigned int *IC,
-                          unsigned int *DC, ErrorList* errorList);
+#define CODE_START_ADDRESS 100 /* code image index 0 is memory address 100 */
+
+/* encodes the instructions of program (lexed by the first pass) into codeImage on up to jobs threads.
+ * with a NULL codeImage it only resolves the symbols and reports the errors, no extern use-sites are recorded */
+ErrCode executeSecondPass(ParsedProgram* program, SymbolTable* symbolTable, CodeWord codeImage[],
+                          unsigned int *IC, ExternList* externs, ErrorList* errorList, unsigned int jobs,
+                          const TaskObserver *observer);
+
+void encodeInstruction(parsedLine *pLine, unsigned int address, CodeWord codeImage[],
+                       SymbolTable *symbolTable, ExternList *externs, ErrorList *errorList);
+ErrCode encodeMatrixOperand(const char *matLabel, const char *rowStr, const char *colStr,
+                            CodeWord codeImage[], unsigned int *address,
+                            SymbolTable *symbolTable, ExternList *externs, ErrorList *errorList);
 
 #endif /* SECOND_PASS_H */
@@ -0,0 +1,327 @@
+#define _POSIX_C_SOURCE 200809L /* for sockets, open_memstream and getcwd */
+#include "server.h"
+#include "global.h"
+#include "assembler.h"
+#include "driver.h"
+#include "error.h"
+#include "util.h"
+#include "parallel.h"
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+static const char *serverSocketPath = NULL; /* removed by the signal handler when the server is stopped */
+
+#define MAX_REQUEST_ERRORS 1000000 /* the largest --max-errors of a request, like the command line */
+
+typedef struct ServerWorkers { /* what every worker thread gets */
+    int listenFd;
+    MacroLibraries *libraries;
+} ServerWorkers;
+
+typedef struct ServerRequest {
+    char *name;
+    char *directory; /* NULL if the client didn't send one */
+    const char *source; /* points into the received frames, NULL if the client didn't send one */
+    size_t sourceLength;
+    unsigned int jobs;
+    unsigned int maxErrors;
+} ServerRequest;
+
+/* socket functions */
+
+static Bool writeAll(int fd, const char *data, size_t length)
+{
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return FALSE;
+        data += written;
+        length -= (size_t)written;
+    }
+    return TRUE;
+}
+
+static Bool readAll(int fd, char *data, size_t length)
+{
+    while (length > 0) {
+        ssize_t got = read(fd, data, length);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return FALSE;
+        data += got;
+        length -= (size_t)got;
+    }
+    return TRUE;
+}
+
+/* receiveFrame - appends the next frame of fd to frames, FALSE if the connection broke */
+static Bool receiveFrame(int fd, TextBuffer *frames, FrameTag *tag)
+{
+    char header[FRAME_HEADER_LENGTH], chunk[BUFSIZ];
+    const unsigned char *bytes = (const unsigned char*)header;
+    unsigned long length;
+
+    if (!readAll(fd, header, FRAME_HEADER_LENGTH) || appendBytes(frames, header, FRAME_HEADER_LENGTH) != UTIL_SUCCESS_S)
+        return FALSE;
+    *tag = (FrameTag)bytes[0];
+    length = ((unsigned long)bytes[1] << 24) | ((unsigned long)bytes[2] << 16) | ((unsigned long)bytes[3] << 8) | bytes[4];
+    if (length > MAX_FRAME_LENGTH)
+        return FALSE;
+
+    while (length > 0) {
+        size_t part = length < sizeof(chunk) ? (size_t)length : sizeof(chunk);
+        if (!readAll(fd, chunk, part) || appendBytes(frames, chunk, part) != UTIL_SUCCESS_S)
+            return FALSE;
+        length -= part;
+    }
+    return TRUE;
+}
+
+/* receiveFrames - reads frames up to and including END */
+static Bool receiveFrames(int fd, TextBuffer *frames)
+{
+    FrameTag tag = FRAME_END;
+    while (receiveFrame(fd, frames, &tag))
+        if (tag == FRAME_END)
+            return TRUE;
+    return FALSE;
+}
+
+/* server side */
+
+/* numberFrame - a decimal number frame clamped to [min, max] */
+static unsigned int numberFrame(const char *data, size_t length, unsigned int min, unsigned int max)
+{
+    unsigned long number = 0;
+    size_t i;
+    for (i = 0; i < length && isdigit((unsigned char)data[i]) && number <= max; i++)
+        number = number * 10 + (unsigned long)(data[i] - '0');
+    return number < min ? min : number > max ? max : (unsigned int)number;
+}
+
+static void initServerRequest(ServerRequest *request)
+{
+    request->name = NULL;
+    request->directory = NULL;
+    request->source = NULL;
+    request->sourceLength = 0;
+    request->jobs = DEFAULT_JOBS;
+    request->maxErrors = 0;
+}
+
+/* parseRequest - reads the fields of a request out of its frames */
+static Bool parseRequest(const TextBuffer *frames, ServerRequest *request)
+{
+    size_t position = 0, length;
+    const char *data;
+    FrameTag tag;
+
+    while (nextFrame(frames->text, frames->length, &position, &tag, &data, &length) && tag != FRAME_END) {
+        if (tag == FRAME_NAME && request->name == NULL)
+            request->name = strnDup(data, (unsigned int)length);
+        else if (tag == FRAME_DIRECTORY && request->directory == NULL)
+            request->directory = strnDup(data, (unsigned int)length);
+        else if (tag == FRAME_SOURCE) {
+            request->source = data;
+            request->sourceLength = length;
+        }
+        else if (tag == FRAME_JOBS)
+            request->jobs = numberFrame(data, length, 1, MAX_JOBS);
+        else if (tag == FRAME_MAX_ERRORS)
+            request->maxErrors = numberFrame(data, length, 0, MAX_REQUEST_ERRORS);
+    }
+    return request->name != NULL && request->name[0] != '\0';
+}
+
+/* serveRequest - assembles one request with the worker's context and sends back the captured run */
+static void serveRequest(int fd, AssemblerContext *context)
+{
+    ServerRequest request;
+    OutputTarget target;
+    TextBuffer frames, response;
+
+    initServerRequest(&request);
+    initTextBuffer(&frames);
+    initTextBuffer(&response);
+    if (receiveFrames(fd, &frames) && parseRequest(&frames, &request) && initCaptureTarget(&target) == UTIL_SUCCESS_S) {
+        context->jobs = request.jobs;
+        context->maxErrors = request.maxErrors;
+        target.directory = request.directory;
+        executeAssembler(request.name, request.source, request.sourceLength, context, &target);
+        if (encodeCapturedRun(&target, &response) == UTIL_SUCCESS_S)
+            writeAll(fd, response.text, response.length);
+        freeOutputTarget(&target);
+    }
+    freeStrings(request.name, request.directory, NULL);
+    freeTextBuffer(&frames);
+    freeTextBuffer(&response);
+}
+
+/* setTimeouts - a read or write of the connection fails after SERVER_TIMEOUT_SECONDS, so an idle client can't
+ * hold the worker */
+static void setTimeouts(int fd)
+{
+    struct timeval timeout;
+
+    timeout.tv_sec = SERVER_TIMEOUT_SECONDS;
+    timeout.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+static void* serverWorkerMain(void *arg)
+{
+    const ServerWorkers *server = (const ServerWorkers*)arg;
+    int listenFd = server->listenFd, fd;
+    AssemblerContext *context = createAssemblerContext(); /* warm between the requests of this worker */
+
+    if (context == NULL) {
+        printErrorMsg(MALLOC_ERROR_F, "server", 0);
+        return NULL;
+    }
+    useDiskIncludes(context, server->libraries); /* the workers share the compiled macro libraries */
+    context->incremental = TRUE; /* an editor sending the same file again only pays for its edit */
+    for (;;) {
+        fd = accept(listenFd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        setTimeouts(fd);
+        serveRequest(fd, context);
+        close(fd);
+    }
+    freeAssemblerContext(context);
+    return NULL;
+}
+
+static void stopServer(int signalNumber)
+{
+    (void)signalNumber;
+    if (serverSocketPath != NULL)
+        unlink(serverSocketPath);
+    _exit(0);
+}
+
+/* connectSocket - a connected socket to socketPath, -1 if nothing listens there */
+static int connectSocket(const char *socketPath)
+{
+    struct sockaddr_un address;
+    int fd;
+
+    if (strlen(socketPath) >= sizeof(address.sun_path))
+        return -1;
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+ErrCode runServer(const char *socketPath, unsigned int workers, MacroLibraries *libraries)
+{
+    struct sockaddr_un address;
+    pthread_t threads[MAX_SERVER_WORKERS];
+    ServerWorkers server;
+    unsigned int i, started = 0;
+    int listenFd, fd;
+
+    fd = connectSocket(socketPath);
+    if (fd >= 0) { /* a live server, don't steal its socket */
+        close(fd);
+        return SERVER_ALREADY_RUNNING_F;
+    }
+    if (strlen(socketPath) >= sizeof(address.sun_path))
+        return SERVER_SOCKET_ERROR_F;
+
+    unlink(socketPath); /* left by a server that was killed */
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0)
+        return SERVER_SOCKET_ERROR_F;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+    if (bind(listenFd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(listenFd);
+        return SERVER_SOCKET_ERROR_F;
+    }
+    /* only the owner can connect, set before listen so no one connects in between */
+    if (chmod(socketPath, S_IRUSR | S_IWUSR) != 0 || listen(listenFd, SERVER_BACKLOG) != 0) {
+        unlink(socketPath);
+        close(listenFd);
+        return SERVER_SOCKET_ERROR_F;
+    }
+
+    serverSocketPath = socketPath;
+    signal(SIGPIPE, SIG_IGN); /* a client that went away only fails its own write */
+    signal(SIGINT, stopServer);
+    signal(SIGTERM, stopServer);
+
+    server.listenFd = listenFd;
+    server.libraries = libraries;
+    if (workers > MAX_SERVER_WORKERS)
+        workers = MAX_SERVER_WORKERS;
+    for (i = 1; i < workers; i++) /* the calling thread is the first worker */
+        if (pthread_create(&threads[started], NULL, serverWorkerMain, &server) == 0)
+            started++;
+
+    printf("assembler server listening on %s with %u worker(s)\n", socketPath, started + 1);
+    fflush(stdout);
+    serverWorkerMain(&server);
+
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    close(listenFd);
+    unlink(socketPath);
+    return SERVER_SOCKET_ERROR_F; /* accept only fails if the socket broke */
+}
+
+/* client side */
+
+Bool forwardToServer(const char *socketPath, char *fileName, unsigned int jobs, unsigned int maxErrors)
+{
+    char directory[MAX_PATH_LENGTH], number[2][16];
+    TextBuffer request, response;
+    Bool answered = FALSE;
+    int fd;
+
+    fd = connectSocket(socketPath);
+    if (fd < 0)
+        return FALSE; /* no server, the caller assembles the file itself */
+    signal(SIGPIPE, SIG_IGN);
+
+    if (getcwd(directory, sizeof(directory)) == NULL)
+        directory[0] = '\0';
+    sprintf(number[0], "%u", jobs);
+    sprintf(number[1], "%u", maxErrors);
+    initTextBuffer(&request);
+    initTextBuffer(&response);
+    if (appendFrame(&request, FRAME_NAME, fileName, strlen(fileName)) == UTIL_SUCCESS_S &&
+        (directory[0] == '\0' || appendFrame(&request, FRAME_DIRECTORY, directory, strlen(directory)) == UTIL_SUCCESS_S) &&
+        appendFrame(&request, FRAME_JOBS, number[0], strlen(number[0])) == UTIL_SUCCESS_S &&
+        appendFrame(&request, FRAME_MAX_ERRORS, number[1], strlen(number[1])) == UTIL_SUCCESS_S &&
+        appendFrame(&request, FRAME_END, NULL, 0) == UTIL_SUCCESS_S &&
+        writeAll(fd, request.text, request.length) && receiveFrames(fd, &response))
+        answered = replayCapturedRun(response.text, response.length, fileName); /* a cut response is assembled here again */
+
+    freeTextBuffer(&request);
+    freeTextBuffer(&response);
+    close(fd);
+    return answered;
+}
@@ -0,0 +1,26 @@
+#ifndef SERVER_H
+#define SERVER_H
+#include "global.h"
+#include "error.h"
+#include "macroLibrary.h" /* for MacroLibraries */
+
+/* a long running assembler that serves requests on a local (Unix domain) socket, and the client side of run.
+ * every worker thread keeps its own AssemblerContext between requests, they share the compiled macro libraries.
+ * a request is a list of frames (see driver.h): NAME, [DIRECTORY], [SOURCE], [JOBS], [MAX_ERRORS], END
+ * NAME is the file name as given to run, it is read from DIRECTORY (the working directory of the client) unless
+ * the request has the SOURCE inline. the response is the captured run, what a local run would print and write.
+ * the socket is made with mode 0600, only its owner can connect (every request reads files as the server user).
+ * a client has SERVER_TIMEOUT_SECONDS for each read or write of its connection, a silent client only holds a
+ * worker that long */
+
+#define DEFAULT_SERVER_WORKERS 4 /* requests served at the same time */
+#define MAX_SERVER_WORKERS 64
+#define SERVER_BACKLOG 64 /* connections waiting for a worker */
+#define MAX_PATH_LENGTH 4096
+#define SERVER_TIMEOUT_SECONDS 5
+
+ErrCode runServer(const char *socketPath, unsigned int workers, MacroLibraries *libraries); /* serves until killed, returns only if setup failed */
+/* assembles fileName on the server at socketPath, returns FALSE if no server answered (so nothing was done) */
+Bool forwardToServer(const char *socketPath, char *fileName, unsigned int jobs, unsigned int maxErrors);
+
+#endif
@@ -0,0 +1,157 @@
+#include "sizeReport.h"
+#include "global.h"
+#include "error.h"
+#include "assembler.h"
+#include "driver.h" /* for MEMORY_WARNING_WORDS */
+#include "firstPass.h"
+#include "lexer.h"
+#include "tables.h"
+#include "util.h"
+
+#define INITIAL_SIZE_ENTRIES 16
+
+/* findEntry - the entry of name in table, a new one if it has none, NULL if malloc failed */
+static SizeEntry* findEntry(SizeTable *table, const char *name)
+{
+    unsigned int i;
+    SizeEntry *grown;
+
+    for (i = 0; i < table->count; i++)
+        if (strcmp(table->entries[i].name, name) == 0)
+            return &table->entries[i];
+    if (table->count == table->capacity) {
+        grown = realloc(table->entries, sizeof(SizeEntry) * (table->capacity == 0 ? INITIAL_SIZE_ENTRIES : table->capacity * 2));
+        if (grown == NULL)
+            return NULL;
+        table->entries = grown;
+        table->capacity = table->capacity == 0 ? INITIAL_SIZE_ENTRIES : table->capacity * 2;
+    }
+    table->entries[table->count].name = name;
+    table->entries[table->count].codeWords = 0;
+    table->entries[table->count].dataWords = 0;
+    table->entries[table->count].expansions = 0;
+    return &table->entries[table->count++];
+}
+
+/* chargeLine - charges the words of .am line (from 0) to its label, its macro (NULL for none) and its kind */
+static ErrCode chargeLine(SizeTable tables[3], const ParsedProgram *program, unsigned int line, const char *macroName,
+                          const char **label)
+{
+    parsedLine *pLine = line < program->count ? program->lines[line] : NULL;
+    unsigned int code = 0, data = 0;
+    const char *kind;
+    SizeEntry *entry;
+    int i;
+
+    if (pLine == NULL)
+        return UTIL_SUCCESS_S;
+    if (pLine->typesOfLine == INSTRUCTION_LINE) {
+        code = pLine->lineContentUnion.instruction.wordCount;
+        kind = INSTRUCTION_KIND_NAME;
+    }
+    else if (isDataDirective(pLine)) {
+        data = pLine->lineContentUnion.directive.dataCount;
+        kind = pLine->lineContentUnion.directive.directiveName;
+    }
+    else
+        return UTIL_SUCCESS_S; /* .entry, .extern, comments and empty lines have no words */
+    if (pLine->label != NULL)
+        *label = pLine->label;
+
+    for (i = 0; i < 3; i++) {
+        const char *name = i == 0 ? *label : i == 1 ? macroName : kind;
+        if (name == NULL)
+            continue;
+        entry = findEntry(&tables[i], name);
+        if (entry == NULL)
+            return MALLOC_ERROR_F;
+        entry->codeWords += code;
+        entry->dataWords += data;
+    }
+    return UTIL_SUCCESS_S;
+}
+
+/* chargeProgram - charges every .am line, the lines of a macro call to its macro */
+static ErrCode chargeProgram(SizeTable tables[3], AssemblerContext *context)
+{
+    const MacroTable *macroTable = context->macroTable;
+    const MacroExpansion *expansion = macroTable->expansions, *end = expansion + macroTable->expansionCount;
+    const char *label = NO_LABEL_NAME, *macroName;
+    ErrCode errCode = UTIL_SUCCESS_S;
+    SizeEntry *macro;
+    unsigned int line;
+
+    for (; expansion < end; expansion++) { /* every call, even of an empty macro */
+        macro = findEntry(&tables[1], expansion->macroName);
+        if (macro == NULL)
+            return MALLOC_ERROR_F;
+        macro->expansions++;
+    }
+
+    expansion = macroTable->expansions;
+    for (line = 0; line < context->program->count && errCode == UTIL_SUCCESS_S; line++) {
+        while (expansion < end && line >= expansion->firstLine + expansion->lineCount)
+            expansion++; /* the calls are in line order */
+        macroName = expansion < end && line >= expansion->firstLine ? expansion->macroName : NULL;
+        errCode = chargeLine(tables, context->program, line, macroName, &label);
+    }
+    return errCode;
+}
+
+static int compareEntries(const void *a, const void *b)
+{
+    const SizeEntry *x = (const SizeEntry*)a, *y = (const SizeEntry*)b;
+    unsigned int xWords = x->codeWords + x->dataWords, yWords = y->codeWords + y->dataWords;
+    if (xWords != yWords)
+        return xWords < yWords ? 1 : -1;
+    return strcmp(x->name, y->name);
+}
+
+static void printTable(FILE *stream, SizeTable *table, const char *title, Bool expansions)
+{
+    unsigned int i;
+
+    qsort(table->entries, table->count, sizeof(SizeEntry), compareEntries);
+    fprintf(stream, "  %-32s %10s %6s %6s %6s\n", title, expansions ? "expansions" : "", "code", "data", "total");
+    for (i = 0; i < table->count; i++) {
+        SizeEntry *entry = &table->entries[i];
+        int length = (int)strlen(entry->name);
+        if (length > 0 && entry->name[length - 1] == ':') /* labels are kept with their colon */
+            length--;
+        fprintf(stream, "  %.*s%*s", length, entry->name, 32 - (length < 32 ? length : 32), "");
+        if (expansions)
+            fprintf(stream, " %10u", entry->expansions);
+        else
+            fprintf(stream, " %10s", "");
+        fprintf(stream, " %6u %6u %6u\n", entry->codeWords, entry->dataWords, entry->codeWords + entry->dataWords);
+    }
+    if (table->count == 0)
+        fprintf(stream, "  (none)\n");
+}
+
+ErrCode printSizeReport(FILE *stream, char *fileName, AssemblerContext *context)
+{
+    SizeTable tables[3]; /* labels, macros, kinds of line */
+    ErrCode errCode;
+    int i;
+
+    if (context->stage != STAGE_DONE || context->program == NULL)
+        return UTIL_SUCCESS_S; /* nothing was assembled, nothing to report */
+    for (i = 0; i < 3; i++) {
+        tables[i].entries = NULL;
+        tables[i].count = 0;
+        tables[i].capacity = 0;
+    }
+    errCode = chargeProgram(tables, context);
+
+    if (errCode == UTIL_SUCCESS_S) {
+        fprintf(stream, "size report of %s: %u code words, %u data words, %u of %u words\n", fileName, context->ICF,
+                context->DCF, context->ICF + context->DCF, MEMORY_WARNING_WORDS);
+        printTable(stream, &tables[0], "label", FALSE);
+        printTable(stream, &tables[1], "macro", TRUE);
+        printTable(stream, &tables[2], "kind of line", FALSE);
+    }
+    for (i = 0; i < 3; i++)
+        free(tables[i].entries);
+    return errCode;
+}
@@ -0,0 +1,33 @@
+#ifndef SIZE_REPORT_H
+#define SIZE_REPORT_H
+#include "global.h"
+#include "error.h"
+#include "assembler.h"
+
+/* the size report (--size-report): where the code and data words of an assembled file come from.
+ * every word is charged to the label it is under (the last label before it), to the macro call whose expansion
+ * made its line and to its kind of line (instructions, .data, .string, .mat), and each is printed as a table
+ * sorted by words, so the biggest users of the memory limit come first.
+ * it needs the kept line IR of the context (context->incremental), the macro calls are the expansions the
+ * preprocessor recorded in the macro table */
+
+#define NO_LABEL_NAME "(no label)"
+#define INSTRUCTION_KIND_NAME "instructions"
+
+typedef struct SizeEntry { /* the words charged to a label, a macro or a kind of line */
+    const char *name; /* points into the IR, the macro table, an included library or a literal */
+    unsigned int codeWords;
+    unsigned int dataWords;
+    unsigned int expansions; /* of a macro */
+} SizeEntry;
+
+typedef struct SizeTable {
+    SizeEntry *entries;
+    unsigned int count;
+    unsigned int capacity;
+} SizeTable;
+
+/* prints the report of fileName to stream, context must hold its successful run with its line IR */
+ErrCode printSizeReport(FILE *stream, char *fileName, AssemblerContext *context);
+
+#endif
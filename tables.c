@@ -3,6 +3,9 @@
 #include "error.h"
 #include "lexer.h" /* for isMacroNameValid */
 #include "util.h" /* for strDup */
+#include "macroLibrary.h" /* for findIncludedMacro and releaseMacroLibrary */
+#include "probes.h"
+#include "allocStats.h"
 
 /* MacroTable functions that operate on the MacroTable struct (linked list)*/
 MacroTable* createMacroTable()
@@ -14,6 +17,19 @@ MacroTable* createMacroTable()
     }
 
     newTable->macroHead = NULL; /* initialize the head of the list to NULL */
+    newTable->libraries = NULL;
+    newTable->includeBase = NULL; /* the working directory */
+    newTable->expansions = NULL;
+    newTable->expansionCount = 0;
+    newTable->expansionCapacity = 0;
+    newTable->includedFiles = NULL;
+    newTable->readInclude = NULL; /* no includes until the caller gives a reader */
+    newTable->readerArg = NULL;
+    newTable->macroLibraries = NULL;
+    if (pthread_mutex_init(&newTable->includedFilesLock, NULL) != 0) {
+        free(newTable);
+        return NULL;
+    }
     return newTable; /* return the new table */
 }
 
@@ -63,25 +79,55 @@ ErrCode addMacroLine(MacroTable* macroTable, const char* line)
 }
 
 MacroBody* findMacro(MacroTable* macroTable, const char* macroName)
+{
+    MacroNode* node = findMacroNode(macroTable, macroName);
+    return node != NULL ? node->bodyHead : NULL; /* the body of the found macro */
+}
+
+MacroNode* findMacroNode(MacroTable* macroTable, const char* macroName)
 {
     MacroNode* current; /* used to iterate through the macro list */
 
     current = macroTable->macroHead;
     while (current != NULL) {
-        if (strcmp(current->macroName, macroName) == 0) 
-            return current->bodyHead; /* return the body of the found macro */
+        if (strcmp(current->macroName, macroName) == 0)
+            return current;
         current = current->nextMacro;
     }
 
     return NULL; /* Macro not found */
 }
 
+/* addMacroExpansion - records that a call of macroName became lineCount .am lines from firstLine
+ * errorCode: MALLOC_ERROR_F, TABLES_SUCCESS_S */
+ErrCode addMacroExpansion(MacroTable* macroTable, const char* macroName, unsigned int firstLine, unsigned int lineCount)
+{
+    MacroExpansion* grown;
+    unsigned int capacity;
+
+    if (macroTable->expansionCount == macroTable->expansionCapacity) {
+        capacity = macroTable->expansionCapacity == 0 ? INITIAL_EXPANSIONS : macroTable->expansionCapacity * 2;
+        grown = realloc(macroTable->expansions, sizeof(MacroExpansion) * capacity);
+        if (grown == NULL)
+            return MALLOC_ERROR_F;
+        macroTable->expansions = grown;
+        macroTable->expansionCapacity = capacity;
+    }
+    macroTable->expansions[macroTable->expansionCount].macroName = macroName;
+    macroTable->expansions[macroTable->expansionCount].firstLine = firstLine;
+    macroTable->expansions[macroTable->expansionCount].lineCount = lineCount;
+    macroTable->expansionCount++;
+    return TABLES_SUCCESS_S;
+}
+
 /** isMacroExists - checks if a macro with the given name exists in the table.
  * Returns TRUE if the macro exists, otherwise returns FALSE.
  */
 Bool isMacroExists(MacroTable* macroTable, const char* macroName)
 {
-    return findMacro(macroTable, macroName) != NULL; /* check if the macro exists by trying to find it */
+    if (findMacro(macroTable, macroName) != NULL) /* check if the macro exists by trying to find it */
+        return TRUE;
+    return macroTable->libraries != NULL && findIncludedMacro(macroTable, macroName, NULL) != NULL;
 }
 
 void freeMacroTable(MacroTable* macroTable)
@@ -89,9 +135,47 @@ void freeMacroTable(MacroTable* macroTable)
     if (macroTable == NULL) /* check if the table is NULL */
         return; /* exit if the table is NULL */
     freeMacroNode(macroTable->macroHead); /* free the first macro node */
+    while (macroTable->libraries != NULL) { /* the list and its references, the libraries may stay loaded */
+        IncludedLibrary *next = macroTable->libraries->next;
+        releaseMacroLibrary(macroTable->libraries->library);
+        free(macroTable->libraries);
+        macroTable->libraries = next;
+    }
+    while (macroTable->includedFiles != NULL) {
+        IncludedFile *next = macroTable->includedFiles->next;
+        free(macroTable->includedFiles->path);
+        free(macroTable->includedFiles);
+        macroTable->includedFiles = next;
+    }
+    pthread_mutex_destroy(&macroTable->includedFilesLock);
+    free(macroTable->includeBase);
+    free(macroTable->expansions);
     free(macroTable);
 }
 
+ErrCode readIncludedData(MacroTable* macroTable, const char* path, IncludedData* data)
+{
+    data->bytes = NULL;
+    data->size = 0;
+    data->release = NULL;
+    data->handle = NULL;
+    if (macroTable == NULL || macroTable->readInclude == NULL)
+        return INPUT_FILE_UNREADABLE_F;
+    if (macroTable->readInclude(macroTable->readerArg, path, data) != UTIL_SUCCESS_S)
+        return INPUT_FILE_UNREADABLE_F; /* the reader left data empty */
+    return UTIL_SUCCESS_S;
+}
+
+void releaseIncludedData(IncludedData* data)
+{
+    if (data->release != NULL)
+        data->release(data);
+    data->bytes = NULL;
+    data->size = 0;
+    data->release = NULL;
+    data->handle = NULL;
+}
+
 
 /* "private" macro functions */
 void printMacroTable(MacroTable *macroTable)
@@ -237,6 +321,7 @@ ErrCode addSymbol(SymbolTable* table, const char* name, unsigned int address, co
         table->haveExtern = TRUE;
 
     table->count++;
+    PROBE2(symbol__insert, newSymbol->symbolName, address);
     return TABLES_SUCCESS_S;
 }
 
@@ -246,10 +331,13 @@ SymbolNode* findSymbol(SymbolTable *table, const char *name)
 
     current = table->head;
     while (current != NULL) {
-        if (strcmp(current->symbolName, name) == 0)
+        if (strcmp(current->symbolName, name) == 0) {
+            PROBE2(symbol__lookup, name, 1);
             return current;
+        }
         current = current->next;
     }
+    PROBE2(symbol__lookup, name, 0);
     return NULL;
 }
 
@@ -314,18 +402,18 @@ void printSymbolTable(SymbolTable* table)
     printf("\n");
 }
 
-void printSymbolTableSorted(SymbolTable* symbolTable) 
+void printSymbolTableSorted(FILE *stream, SymbolTable* symbolTable) 
 {
     SymbolNode* current; /* used to iterate through the symbol nodes */
     SymbolNode* currentSmallest; /* used to find the smallest address */
     unsigned int lastSmallest = 0, biggest = 0, count = 0, totalSymbols = 0; /* used to find the smallest address */
-    printf("\n");
+    fprintf(stream, "\n");
     if (symbolTable == NULL || symbolTable->head == NULL) {
-        printf("Symbol table is empty.\n");
+        fprintf(stream, "Symbol table is empty.\n");
         return;
     }
 
-    printf("Symbol Table (Sorted) :\n");
+    fprintf(stream, "Symbol Table (Sorted) :\n");
     
 
     current = symbolTable->head;
@@ -335,8 +423,8 @@ void printSymbolTableSorted(SymbolTable* symbolTable)
         current = current->next;
         totalSymbols++; /* count the number of symbols */
     }
-    printf("Total symbols: %u\n", totalSymbols);
-    printf("Name\tAddress\tType\tisEntry\tisMat\n");
+    fprintf(stream, "Total symbols: %u\n", totalSymbols);
+    fprintf(stream, "Name\tAddress\tType\tisEntry\tisMat\n");
 
     current = symbolTable->head;
     count = 0;
@@ -344,7 +432,7 @@ void printSymbolTableSorted(SymbolTable* symbolTable)
     while (current != NULL) { /* iterate through the symbol nodes */
         SymbolNode* next = current->next; /* save the next node */
         if (current->type == EXTERN_SYMBOL) { /* if the symbol is an entry symbol */
-            printf("%s\t%u\t%s\n", current->symbolName, current->address,
+            fprintf(stream, "%s\t%u\t%s\n", current->symbolName, current->address,
                 (current->type == CODE_SYMBOL) ? "Code" :
                 (current->type == DATA_SYMBOL) ? "Data" :
                 (current->type == EXTERN_SYMBOL) ? "Extern" : "Undefined");
@@ -364,7 +452,7 @@ void printSymbolTableSorted(SymbolTable* symbolTable)
             current = current->next;
         }
         if (currentSmallest != NULL) {
-            printf("%s\t%u\t%s\t%d\t%d\n", currentSmallest->symbolName, currentSmallest->address,
+            fprintf(stream, "%s\t%u\t%s\t%d\t%d\n", currentSmallest->symbolName, currentSmallest->address,
                         (currentSmallest->type == CODE_SYMBOL) ? "Code" :
                         (currentSmallest->type == DATA_SYMBOL) ? "Data" :
                         (currentSmallest->type == EXTERN_SYMBOL) ? "Extern" : "Undefined",
@@ -373,7 +461,7 @@ void printSymbolTableSorted(SymbolTable* symbolTable)
         }
         count++;
     }
-    printf("\n");
+    fprintf(stream, "\n");
 }
 
 SymbolNode* createSymbolNode(const char* name, unsigned int address, const char* firstToken)
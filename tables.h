@@ -3,6 +3,21 @@
 
 #include "global.h"
 #include "error.h"
+#include <pthread.h>
+
+/* included files: the files a source includes (mcroinclude, .incbin) are read through the reader of its macro
+ * table, which the caller of the library gives it (AssemblerContext.readInclude). the command line reads them
+ * from disk (readIncludeFromDisk in driver.h) */
+
+typedef struct IncludedData { /* the contents of an included file, as the reader gave them */
+    const unsigned char* bytes; /* NULL for an empty file */
+    size_t size;
+    void (*release)(struct IncludedData* data); /* set by the reader, frees or unmaps bytes, NULL if nothing to free */
+    void* handle; /* for release */
+} IncludedData;
+
+/* reads the file at path into data, UTIL_SUCCESS_S or INPUT_FILE_UNREADABLE_F if it can't be read */
+typedef ErrCode (*IncludeReader)(void* readerArg, const char* path, IncludedData* data);
 
 /* MacroTable definitions */
 
@@ -18,8 +33,31 @@ typedef struct MacroNode {  /* linked list of all the macros */
     struct MacroNode* nextMacro; /* pointer to the next macro in the list */
 } MacroNode;
 
+typedef struct IncludedLibrary { /* a macro library included by the file (macroLibrary.h) */
+    const struct MacroLibrary* library; /* the table holds a reference, freeMacroTable releases it */
+    struct IncludedLibrary* next; /* the next one in include order */
+} IncludedLibrary;
+
+#define INITIAL_EXPANSIONS 16 /* the expansion array doubles from this */
+
+typedef struct MacroExpansion { /* a macro call of the source and the .am lines its body became */
+    const char* macroName; /* points into the table or into an included library */
+    unsigned int firstLine; /* the first .am line of the body (0 based) */
+    unsigned int lineCount;
+} MacroExpansion;
+
 typedef struct MacroTable { /* head of linked list of all the macros */
     MacroNode* macroHead; /* pointer to the first macro in the list */
+    IncludedLibrary* libraries; /* searched after the macros of the file */
+    char* includeBase; /* the path of the .as file, mcroinclude and .incbin paths are relative to its directory */
+    MacroExpansion* expansions; /* every macro call, in .am line order (recorded by the preprocessor) */
+    unsigned int expansionCount;
+    unsigned int expansionCapacity;
+    struct IncludedFile* includedFiles; /* the files the run read (macroLibrary.h), in the order they were read */
+    pthread_mutex_t includedFilesLock; /* the lexer records them from the threads of the first pass */
+    IncludeReader readInclude; /* reads the included files, NULL fails every include */
+    void* readerArg; /* passed to readInclude */
+    struct MacroLibraries* macroLibraries; /* shares the compiled macro libraries (macroLibrary.h), NULL to compile them for this table */
 } MacroTable;
 
 /* "public" macro functions */
@@ -27,8 +65,12 @@ MacroTable* createMacroTable();
 ErrCode addMacro(MacroTable* macroTable , const char* name);
 ErrCode addMacroLine(MacroTable* macroTable, const char* line);
 MacroBody* findMacro(MacroTable* macroTable, const char* macroName);
+MacroNode* findMacroNode(MacroTable* macroTable, const char* macroName); /* NULL if the file didn't define it */
+ErrCode addMacroExpansion(MacroTable* macroTable, const char* macroName, unsigned int firstLine, unsigned int lineCount);
 Bool isMacroExists(MacroTable* macroTable, const char* macroName);
 void freeMacroTable(MacroTable* macroTable);
+ErrCode readIncludedData(MacroTable* macroTable, const char* path, IncludedData* data); /* with the reader of the table, NULL table or reader fail */
+void releaseIncludedData(IncludedData* data); /* gives data back to its reader, data is empty after it */
 
 /* "private" macro functions */
 void printMacroTable(MacroTable* macroTable); /* print the macro table for debugging purposes */
@@ -73,7 +115,7 @@ void freeSymbolTable(SymbolTable* table);
 
 /* "private" symbol functions */
 void printSymbolTable(SymbolTable* table);
-void printSymbolTableSorted(SymbolTable* table); /* print the symbol table sorted by address for debugging purposes */
+void printSymbolTableSorted(FILE *stream, SymbolTable* table); /* print the symbol table sorted by address for debugging purposes */
 SymbolNode* createSymbolNode(const char* name, unsigned int address, const char* firstToken);
 void freeSymbolNode(SymbolNode* node);
 
@@ -0,0 +1,10 @@
+; .space and .incbin failures, one error code per line
+
+MAIN: stop
+ZERO: .space 0
+NEG: .space -3
+NAME: .space x
+NOPATH: .incbin testData.bin
+NOFILE: .incbin "noSuchFile.bin"
+EMPTY: .incbin "testDataEmpty.bin"
+CUT: .incbin "testDataPadding.bin"
@@ -0,0 +1,14 @@
+; mcroinclude, .incbin: the macros of testMacros.mh are used as if written here,
+; table puts the words of testData.bin in the data image
+
+mcroinclude "testMacros.mh"
+
+MAIN: lea TABLE, r1
+    saveR1
+    prn TABLE
+    prn SAMPLES
+    stop
+
+SAVED: .data 0
+SAMPLES: .incbin "testData.bin"
+table
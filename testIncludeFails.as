@@ -0,0 +1,10 @@
+; mcroinclude failures, one error code per line
+
+mcroinclude testMacros.mh
+mcroinclude "noSuchFile.mh"
+mcroinclude "testMacrosLine.mh"
+mcroinclude "testMacrosUnclosed.mh"
+mcro inner
+mcroinclude "testMacros.mh"
+mcroend
+MAIN: stop
@@ -0,0 +1,353 @@
+; a long program: enough lines for the passes of -j4 to run on several chunks
+
+.extern EXTA
+.entry L1
+.entry TABLE
+
+MAIN: lea TABLE, r1
+
+; block 0
+L0: inc r0
+    jsr EXTA
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 1
+L1: inc r1
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 2
+L2: inc r2
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 3
+L3: inc r3
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 4
+L4: inc r4
+    jsr L5
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 5
+L5: inc r5
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 6
+L6: inc r6
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 7
+L7: inc r7
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 8
+L8: inc r0
+    jsr EXTA
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 9
+L9: inc r1
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 10
+L10: inc r2
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 11
+L11: inc r3
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 12
+L12: inc r4
+    jsr L13
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 13
+L13: inc r5
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 14
+L14: inc r6
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 15
+L15: inc r7
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 16
+L16: inc r0
+    jsr EXTA
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 17
+L17: inc r1
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 18
+L18: inc r2
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 19
+L19: inc r3
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 20
+L20: inc r4
+    jsr L21
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 21
+L21: inc r5
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 22
+L22: inc r6
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 23
+L23: inc r7
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 24
+L24: inc r0
+    jsr EXTA
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 25
+L25: inc r1
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 26
+L26: inc r2
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 27
+L27: inc r3
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 28
+L28: inc r4
+    jsr L29
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 29
+L29: inc r5
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 30
+L30: inc r6
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 31
+L31: inc r7
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+; block 32
+L32: inc r0
+    jsr EXTA
+
+; the registers are left as they are
+;
+;
+;
+;
+;
+
+L33: stop
+
+TABLE: .data 1, -2, 3
+TEXT: .string "long"
+GRID: .mat [2][2] 1, 2, 3, 4
+BUF: .space 3
@@ -0,0 +1,10 @@
+; .space reserves zeroed data words
+
+MAIN: lea BUF, r2
+    mov #7, BUF
+    prn BUF
+    stop
+
+BUF: .space 5
+ONE: .space +1
+.data 4
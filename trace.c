@@ -0,0 +1,179 @@
+#define _DEFAULT_SOURCE /* for syscall, getpid and clock_gettime */
+#include "trace.h"
+#include "global.h"
+#include "error.h"
+#include "assembler.h"
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+static FILE *traceOutput = NULL;
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+static Bool firstEvent = TRUE; /* no comma before it */
+static double startMs = 0;
+static long processId = 0;
+
+static const char *const stageNames[] = {"preprocessor", "first pass", "second pass"};
+
+static double nowMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+ErrCode openTrace(const char *path)
+{
+    traceOutput = fopen(path, "w");
+    if (traceOutput == NULL)
+        return TRACE_FILE_ERROR_F;
+    startMs = nowMs();
+    processId = (long)getpid();
+    fprintf(traceOutput, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    return UTIL_SUCCESS_S;
+}
+
+void closeTrace(void)
+{
+    if (traceOutput == NULL)
+        return;
+    fprintf(traceOutput, "\n]}\n");
+    fclose(traceOutput);
+    traceOutput = NULL;
+}
+
+Bool tracing(void)
+{
+    return traceOutput != NULL;
+}
+
+double traceClock(void)
+{
+    return (nowMs() - startMs) * 1000.0;
+}
+
+/* writeString - text as a JSON string */
+static void writeString(const char *text)
+{
+    fputc('"', traceOutput);
+    for (; *text != '\0'; text++) {
+        if (*text == '"' || *text == '\\')
+            fprintf(traceOutput, "\\%c", *text);
+        else if ((unsigned char)*text < ' ')
+            fprintf(traceOutput, "\\u%04x", (unsigned char)*text);
+        else
+            fputc(*text, traceOutput);
+    }
+    fputc('"', traceOutput);
+}
+
+/* beginEvent - starts the next event with its common fields, called with traceLock held */
+static void beginEvent(const char *name, const char *category, char phase, double time)
+{
+    fprintf(traceOutput, firstEvent ? "\n{\"name\":" : ",\n{\"name\":");
+    firstEvent = FALSE;
+    writeString(name);
+    fprintf(traceOutput, ",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%ld,\"tid\":%ld", category, phase, time,
+            processId, (long)syscall(SYS_gettid));
+}
+
+void traceSpan(const char *name, const char *category, const char *fileName, double start)
+{
+    double end;
+
+    if (traceOutput == NULL)
+        return;
+    end = traceClock();
+    pthread_mutex_lock(&traceLock);
+    beginEvent(name, category, 'X', start);
+    fprintf(traceOutput, ",\"dur\":%.3f,\"args\":{\"file\":", end - start);
+    writeString(fileName);
+    fprintf(traceOutput, "}}");
+    pthread_mutex_unlock(&traceLock);
+}
+
+/* the stages of a context */
+
+void initTraceStages(TraceStages *stages, AssemblerContext *context)
+{
+    stages->context = context;
+    stages->stage = STAGE_DONE;
+    stages->start = 0;
+    stages->nextHook = NULL;
+    stages->nextArg = NULL;
+    if (traceOutput == NULL)
+        return;
+    stages->nextHook = context->stageHook; /* --perf */
+    stages->nextArg = context->hookArg;
+    context->stageHook = traceStageHook;
+    context->chunkHook = traceChunkHook;
+    context->hookArg = stages;
+}
+
+/* traceStageHook - ends the span of the stage that ran and starts the one of stage */
+void traceStageHook(void *arg, AssemblerStage stage)
+{
+    TraceStages *stages = (TraceStages*)arg;
+    double now = traceClock();
+
+    if (stages->stage != STAGE_DONE)
+        traceSpan(stageNames[stages->stage], "stage", stages->context->name != NULL ? stages->context->name : "",
+                  stages->start);
+    stages->stage = stage;
+    stages->start = now;
+    if (stages->nextHook != NULL)
+        stages->nextHook(stages->nextArg, stage);
+}
+
+/* traceChunkHook - the span of a chunk of the running stage, on the thread that ran it */
+void traceChunkHook(void *arg, unsigned int chunk, Bool done)
+{
+    TraceStages *stages = (TraceStages*)arg;
+    char name[64];
+
+    if (!done) {
+        stages->chunkStarts[chunk] = traceClock();
+        return;
+    }
+    sprintf(name, "%s chunk %u", stages->stage != STAGE_DONE ? stageNames[stages->stage] : "", chunk);
+    traceSpan(name, "chunk", stages->context->name != NULL ? stages->context->name : "", stages->chunkStarts[chunk]);
+}
+
+/* countLines - the lines of the .am text */
+static unsigned long countLines(const TextBuffer *text)
+{
+    unsigned long lines = 0;
+    size_t i;
+
+    for (i = 0; i < text->length; i++)
+        if (text->text[i] == '\n')
+            lines++;
+    return lines;
+}
+
+/* traceFile - the span of a whole file with what it assembled to, and the same numbers as counters */
+void traceFile(const char *fileName, const AssemblerContext *context, double start)
+{
+    unsigned long lines, symbols;
+    double end;
+
+    if (traceOutput == NULL)
+        return;
+    end = traceClock();
+    lines = countLines(&context->amText);
+    symbols = context->symbolTable != NULL ? context->symbolTable->count : 0;
+
+    pthread_mutex_lock(&traceLock);
+    beginEvent(fileName, "file", 'X', start);
+    fprintf(traceOutput, ",\"dur\":%.3f,\"args\":{\"lines\":%lu,\"symbols\":%lu,\"code words\":%u,\"data words\":%u,"
+            "\"assembled\":%s}}", end - start, lines, symbols, context->ICF, context->DCF,
+            context->stage == STAGE_DONE ? "true" : "false");
+    beginEvent("lines", "file", 'C', end);
+    fprintf(traceOutput, ",\"args\":{\"lines\":%lu}}", lines);
+    beginEvent("symbols", "file", 'C', end);
+    fprintf(traceOutput, ",\"args\":{\"symbols\":%lu}}", symbols);
+    beginEvent("words", "file", 'C', end);
+    fprintf(traceOutput, ",\"args\":{\"code\":%u,\"data\":%u}}", context->ICF, context->DCF);
+    pthread_mutex_unlock(&traceLock);
+}
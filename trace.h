@@ -0,0 +1,34 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include "global.h"
+#include "error.h"
+#include "assembler.h"
+#include "parallel.h" /* for MAX_JOBS */
+
+/* the build trace (--trace FILE): a span for every file, every stage of it, every chunk the passes run on their
+ * threads (-j) and every output file it writes, in the trace event JSON of chrome://tracing and Perfetto. spans
+ * carry the id of the thread that ran them and every file adds counters of its lines, symbols and emitted words.
+ * there is one trace per process, every function does nothing while it isn't open */
+
+typedef struct TraceStages { /* the stage and chunk spans of one context, its hookArg with traceStageHook */
+    AssemblerContext *context;
+    AssemblerStage stage; /* the stage that runs, STAGE_DONE for none */
+    double start;
+    double chunkStarts[MAX_JOBS]; /* of the chunks of the stage, each written by the thread of its chunk */
+    StageHook nextHook; /* the hook the context had before (--perf), called after the span */
+    void *nextArg;
+} TraceStages;
+
+ErrCode openTrace(const char *path); /* UTIL_SUCCESS_S or TRACE_FILE_ERROR_F */
+void closeTrace(void); /* ends the JSON and closes the file */
+Bool tracing(void);
+double traceClock(void); /* microseconds since openTrace, the start of a span */
+void traceSpan(const char *name, const char *category, const char *fileName, double start); /* from start to now */
+
+/* sets the stage and chunk hooks of context if tracing, a stage hook it already has (--perf) is still called */
+void initTraceStages(TraceStages *stages, AssemblerContext *context);
+void traceStageHook(void *stages, AssemblerStage stage);
+void traceChunkHook(void *stages, unsigned int chunk, Bool done);
+void traceFile(const char *fileName, const AssemblerContext *context, double start); /* the span and counters of a file */
+
+#endif
@@ -1,54 +1,49 @@
 #include "util.h"
 #include "global.h"
+#include "allocStats.h"
 
 /* scanning functions */
 
 /**
- * readLine - reads a line from the file and returns it as a string.
+ * readTextLine - reads the line of text that starts at *position and returns it as a string.
+ * *position is moved to the start of the next line, a trailing '\r' (CRLF files) is not part of the line.
  * if the line is longer than MAX_LINE_FILE_LENGTH, it will return NULL and set errorCode to LINE_TOO_LONG_E.
  * if memory allocation fails, returns NULL and sets errorCode to MALLOC_ERROR_F.
- * if end of file is reached, returns NULL and sets errorCode to EOF_REACHED_S.
- * errorCode:  EOF_REACHED_S , LINE_TOO_LONG_E, MALLOC_ERROR_F, FILE_READ_ERROR_F, UTIL_SUCCESS_S
+ * if the end of the text is reached, returns NULL and sets errorCode to EOF_REACHED_S.
+ * errorCode:  EOF_REACHED_S , LINE_TOO_LONG_E, MALLOC_ERROR_F, UTIL_SUCCESS_S
  */
-char* readLine(FILE *fp, ErrCode *errorCode)
+char* readTextLine(const char *text, size_t length, size_t *position, ErrCode *errorCode)
 {
-    /* overlength should store \n or \r if line is under MAX_LINE_FILE_LENGTH */
-    char *line = malloc(MAX_LINE_FILE_LENGTH + OVER_LENGTH  + NULL_TERMINATOR);
-    char next; 
+    const char *start = text + *position, *newLine;
+    size_t lineLength;
+    char *line;
     *errorCode = NULL_INITIAL; /* reset error code to initial state */
 
-    if (line == NULL) {
-        *errorCode = MALLOC_ERROR_F;
-        return NULL; /* malloc failed */
+    if (*position >= length) {
+        *errorCode = EOF_REACHED_S;
+        return NULL; /* end of text */
     }
 
-    /* overlength should store \n or \r if line is under MAX_LINE_FILE_LENGTH */
-    if (fgets(line, MAX_LINE_FILE_LENGTH + OVER_LENGTH  + NULL_TERMINATOR, fp) == NULL) {
-        free(line);
-        if (feof(fp))
-            *errorCode = EOF_REACHED_S;
-        else 
-            *errorCode = FILE_READ_ERROR_F;
-        return NULL; /* end of file or error */
-    }
+    newLine = memchr(start, '\n', length - *position);
+    lineLength = newLine != NULL ? (size_t)(newLine - start) : length - *position;
+    *position += lineLength + (newLine != NULL ? 1 : 0); /* skip the '\n' too */
+    if (lineLength > 0 && start[lineLength - 1] == '\r')
+        lineLength--;
 
-    next = fgetc(fp); /* peek on the next character */
-    if (next != EOF)  /* if the next character is not EOF, it means the line is longer than MAX_LINE_FILE_LENGTH */
-        ungetc(next, fp); /* put back the next character to the input stream */
-    
-    if (strchr(line, '\n') == NULL && strchr(line, '\r') == NULL && next != EOF) {
-        char c; /* discard the rest of the line from the input stream */
-        while ((c = fgetc(fp)) != '\n' && c != EOF);
+    if (lineLength > MAX_LINE_FILE_LENGTH) {
         *errorCode = LINE_TOO_LONG_E;
-        free(line);
-        return NULL; /* line is too long, return NULL */
+        return NULL; /* line is too long, it was skipped */
     }
-    else {
-        line[strcspn(line, "\r\n")] = '\0'; /* remove the newline or carriage return character from the end of the line */
-        if ( strlen(line) == MAX_LINE_FILE_LENGTH)  /* if the line is exactly MAX_LINE_FILE_LENGTH characters long, it has a remaining '\n' */
-            (void) fgetc(fp);  /* discard the unused character '\n' from the input stream */
-        *errorCode = UTIL_SUCCESS_S; /* set error code to success */
+
+    line = malloc(lineLength + NULL_TERMINATOR);
+    if (line == NULL) {
+        *errorCode = MALLOC_ERROR_F;
+        return NULL; /* malloc failed */
     }
+    memcpy(line, start, lineLength);
+    line[lineLength] = '\0';
+    line[strcspn(line, "\r")] = '\0'; /* a lone '\r' ends the line like it did when reading with fgets */
+    *errorCode = UTIL_SUCCESS_S;
     return line;
 }
 
@@ -195,6 +190,19 @@ char* mergeStrings(const char *start, const char *end)
     return merged;
 }
 
+char* joinPath(const char *directory, const char *name)
+{
+    char *joined;
+
+    if (directory == NULL || name[0] == '/')
+        return strDup(name);
+    joined = malloc(strlen(directory) + strlen(name) + 2); /* the slash and the null terminator */
+    if (joined == NULL)
+        return NULL;
+    sprintf(joined, "%s/%s", directory, name);
+    return joined;
+}
+
 void cutnChar(char *str, int n)
 {
     int spacesCount = 0, cuttingLength = n; /* length to cut from the string */
@@ -212,6 +220,154 @@ void cutnChar(char *str, int n)
     memmove(str, str + cuttingLength, strlen(str) - cuttingLength + NULL_TERMINATOR); /* Move the string left by the number of leading spaces */
 }
 
+/* text buffer functions */
+
+void initTextBuffer(TextBuffer *buffer)
+{
+    buffer->text = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+}
+
+/**
+ * appendBytes - appends n bytes of str to the end of the buffer, growing it if needed.
+ * errorCode:  MALLOC_ERROR_F, UTIL_SUCCESS_S
+ */
+ErrCode appendBytes(TextBuffer *buffer, const char *str, size_t n)
+{
+    if (buffer->length + n + NULL_TERMINATOR > buffer->capacity) { /* not enough room for str */
+        size_t newCapacity = buffer->capacity == 0 ? INITIAL_TEXT_BUFFER_SIZE : buffer->capacity;
+        char *temp;
+        while (buffer->length + n + NULL_TERMINATOR > newCapacity)
+            newCapacity *= 2;
+
+        temp = realloc(buffer->text, newCapacity);
+        if (temp == NULL)
+            return MALLOC_ERROR_F;
+        buffer->text = temp;
+        buffer->capacity = newCapacity;
+    }
+
+    memcpy(buffer->text + buffer->length, str, n);
+    buffer->length += n;
+    buffer->text[buffer->length] = '\0';
+    return UTIL_SUCCESS_S;
+}
+
+/**
+ * appendText - appends str to the end of the buffer, growing it if needed.
+ * errorCode:  MALLOC_ERROR_F, UTIL_SUCCESS_S
+ */
+ErrCode appendText(TextBuffer *buffer, const char *str)
+{
+    return appendBytes(buffer, str, strlen(str));
+}
+
+ErrCode appendLine(TextBuffer *buffer, const char *line)
+{
+    ErrCode errorCode = appendText(buffer, line);
+    if (errorCode != UTIL_SUCCESS_S)
+        return errorCode;
+    return appendText(buffer, "\n");
+}
+
+/**
+ * readFileText - appends the whole content of fp to the buffer.
+ * errorCode:  MALLOC_ERROR_F, FILE_READ_ERROR_F, UTIL_SUCCESS_S
+ */
+ErrCode readFileText(FILE *fp, TextBuffer *buffer)
+{
+    char chunk[BUFSIZ];
+    size_t n;
+
+    while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+        if (appendBytes(buffer, chunk, n) != UTIL_SUCCESS_S)
+            return MALLOC_ERROR_F;
+
+    return ferror(fp) ? FILE_READ_ERROR_F : UTIL_SUCCESS_S;
+}
+
+void freeTextBuffer(TextBuffer *buffer)
+{
+    if (buffer->text != NULL)
+        free(buffer->text);
+    initTextBuffer(buffer);
+}
+
+/* content hash functions */
+
+static const unsigned int laneOffsets[CONTENT_HASH_LANES] = {FNV_OFFSET_LOW, 3735928559U, 2654435769U, 1779033703U};
+
+void initContentHash(ContentHash *hash)
+{
+    int lane;
+    for (lane = 0; lane < CONTENT_HASH_LANES; lane++)
+        hash->lanes[lane] = laneOffsets[lane];
+}
+
+void updateContentHash(ContentHash *hash, const void *data, size_t length)
+{
+    const unsigned char *bytes = (const unsigned char*)data;
+    unsigned int a = hash->lanes[0], b = hash->lanes[1], c = hash->lanes[2], d = hash->lanes[3];
+    size_t i;
+
+    for (i = 0; i < length; i++) { /* every lane mixes in the one before it, so the lanes differ */
+        a = ((a ^ bytes[i]) * FNV_PRIME) & 0xFFFFFFFFU;
+        b = ((b ^ bytes[i] ^ (a >> 24)) * FNV_PRIME) & 0xFFFFFFFFU;
+        c = ((c ^ bytes[i] ^ (b >> 16)) * FNV_PRIME) & 0xFFFFFFFFU;
+        d = ((d ^ bytes[i] ^ (c >> 8)) * FNV_PRIME) & 0xFFFFFFFFU;
+    }
+    hash->lanes[0] = a;
+    hash->lanes[1] = b;
+    hash->lanes[2] = c;
+    hash->lanes[3] = d;
+}
+
+void formatContentHash(const ContentHash *hash, char *text)
+{
+    int lane;
+    for (lane = CONTENT_HASH_LANES - 1; lane >= 0; lane--, text += 8)
+        sprintf(text, "%08x", hash->lanes[lane] & 0xFFFFFFFFU);
+}
+
+Bool parseContentHash(const char *text, ContentHash *hash)
+{
+    int lane, i;
+    unsigned int value;
+
+    for (lane = CONTENT_HASH_LANES - 1; lane >= 0; lane--) {
+        for (value = 0, i = 0; i < 8; i++, text++) {
+            if (!isxdigit((unsigned char)*text))
+                return FALSE;
+            value = value << 4 | (unsigned int)(isdigit((unsigned char)*text) ? *text - '0' : tolower((unsigned char)*text) - 'a' + 10);
+        }
+        hash->lanes[lane] = value;
+    }
+    return TRUE;
+}
+
+Bool sameContentHash(const ContentHash *a, const ContentHash *b)
+{
+    return memcmp(a->lanes, b->lanes, sizeof(a->lanes)) == 0;
+}
+
+Bool hashFile(const char *path, ContentHash *hash)
+{
+    char chunk[BUFSIZ];
+    size_t n;
+    Bool read;
+    FILE *fp = fopen(path, "rb");
+
+    if (fp == NULL)
+        return FALSE;
+    initContentHash(hash);
+    while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+        updateContentHash(hash, chunk, n);
+    read = !ferror(fp); /* a directory opens but can't be read */
+    fclose(fp);
+    return read;
+}
+
 /* file management functions */
 
 FILE* openFile(const char *filename,const char *ending, const char *mode, ErrCode *errorCode)
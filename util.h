@@ -8,11 +8,10 @@
 #define UTIL_FAILURE_S 1
 
 /* utility functions prototypes */
-#define OVER_LENGTH  1 /* overlength should store \n or \r if line is under MAX_LINE_FILE_LENGTH */
 #define INCLUDE_LAST_CHAR 1
 
 /* scanning functions */
-char* readLine(FILE *fp, ErrCode *errorCode);
+char* readTextLine(const char *text, size_t length, size_t *position, ErrCode *errorCode); /* read the line at *position */
 char* getFirstToken(const char *str, ErrCode *errorCode); /* get the first token from the string */
 char* cutFirstToken(char *str, ErrCode *errorCode); /* cut the first token from the string */
 
@@ -23,8 +22,42 @@ char* strDup(const char* src); /* string duplication */
 char* strnDup(const char *src, unsigned int n); /* duplicate the first n characters of a string */
 char* trimmedDup(const char *str); /* duplicate a string and trim leading and trailing spaces */
 char* mergeStrings(const char* str1, const char* str2); /* merge two strings */
+char* joinPath(const char* directory, const char* name); /* directory/name, a copy of name if it is absolute or directory is NULL */
 void cutnChar(char *str, int n); /* cut the first n characters from the string */
 
+/* text buffer functions */
+typedef struct TextBuffer { /* growable null terminated text, e.g. the expanded .am source */
+    char* text; /* the text itself, NULL until something is appended */
+    size_t length; /* length of the text without the null terminator */
+    size_t capacity; /* allocated size of text */
+} TextBuffer;
+
+#define INITIAL_TEXT_BUFFER_SIZE 1024
+
+void initTextBuffer(TextBuffer *buffer);
+ErrCode appendBytes(TextBuffer *buffer, const char *str, size_t n); /* append n bytes to the buffer */
+ErrCode appendText(TextBuffer *buffer, const char *str); /* append a string to the buffer */
+ErrCode appendLine(TextBuffer *buffer, const char *line); /* append a string and a '\n' to the buffer */
+ErrCode readFileText(FILE *fp, TextBuffer *buffer); /* append the whole file to the buffer */
+void freeTextBuffer(TextBuffer *buffer);
+
+/* content hash functions */
+#define CONTENT_HASH_LANES 4
+typedef struct ContentHash { /* a 128 bit hash of some bytes, four FNV-1a lanes with different offsets */
+    unsigned int lanes[CONTENT_HASH_LANES];
+} ContentHash;
+
+#define FNV_OFFSET_LOW 2166136261U /* the FNV-1a 32 bit offset basis, of the first lane */
+#define FNV_PRIME 16777619U
+#define CONTENT_HASH_DIGITS (CONTENT_HASH_LANES * 8) /* hex digits of formatContentHash */
+
+void initContentHash(ContentHash *hash);
+void updateContentHash(ContentHash *hash, const void *data, size_t length); /* hash more bytes */
+void formatContentHash(const ContentHash *hash, char *text); /* CONTENT_HASH_DIGITS hex digits and a null */
+Bool parseContentHash(const char *text, ContentHash *hash); /* the digits of formatContentHash, FALSE if they aren't */
+Bool sameContentHash(const ContentHash *a, const ContentHash *b);
+Bool hashFile(const char *path, ContentHash *hash); /* the hash of the contents of path, FALSE if it can't be read */
+
 /* file management functions */
 FILE* openFile(const char *filename, const char *ending, const char *mode, ErrCode *errorCode);
 ErrCode delFile(const char *filename, const char *ending);
@@ -0,0 +1,213 @@
+#define _POSIX_C_SOURCE 200809L /* for poll and clock_gettime */
+#include "watch.h"
+#include "global.h"
+#include "assembler.h"
+#include "driver.h"
+#include "error.h"
+#include "util.h"
+#include "macroLibrary.h" /* for IncludedFile and MacroLibraries */
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "allocStats.h"
+
+typedef struct WatchedPath { /* a file a run read (mcroinclude, .incbin), a change to it changes the run */
+    char *directory;
+    char *baseName;
+    int watch;
+    struct WatchedPath *next;
+} WatchedPath;
+
+typedef struct WatchedFile {
+    char *fileName; /* as given on the command line, without .as */
+    char *directory; /* the directory that is watched */
+    char *baseName; /* the name of fileName.as inside directory */
+    int watch; /* the inotify watch of directory */
+    WatchedPath *includes; /* the files the last run read */
+    Bool changed; /* written since it was last assembled */
+    AssemblerContext *context; /* warm between the runs of this file */
+} WatchedFile;
+
+/* splitPath - the directory of path and the name inside it, MALLOC_ERROR_F if either couldn't be allocated */
+static ErrCode splitPath(const char *path, const char *ending, char **directory, char **baseName)
+{
+    const char *slash = strrchr(path, '/');
+
+    *directory = slash == NULL ? strDup(".") : slash == path ? strDup("/") : strnDup(path, (unsigned int)(slash - path));
+    *baseName = mergeStrings(slash == NULL ? path : slash + 1, ending);
+    return *directory == NULL || *baseName == NULL ? MALLOC_ERROR_F : UTIL_SUCCESS_S;
+}
+
+/* initWatchedFile - splits fileName.as into its directory and name and makes its context */
+static ErrCode initWatchedFile(WatchedFile *file, char *fileName, unsigned int jobs, unsigned int maxErrors,
+                               MacroLibraries *libraries)
+{
+    ErrCode errCode = splitPath(fileName, ".as", &file->directory, &file->baseName);
+
+    file->fileName = fileName;
+    file->watch = -1;
+    file->includes = NULL;
+    file->changed = FALSE;
+    file->context = createAssemblerContext();
+    if (errCode != UTIL_SUCCESS_S || file->context == NULL)
+        return MALLOC_ERROR_F;
+    file->context->jobs = jobs;
+    file->context->maxErrors = maxErrors;
+    useDiskIncludes(file->context, libraries);
+    file->context->incremental = TRUE;
+    return UTIL_SUCCESS_S;
+}
+
+static void freeWatchedPaths(WatchedPath *path)
+{
+    WatchedPath *next;
+    for (; path != NULL; path = next) {
+        next = path->next;
+        freeStrings(path->directory, path->baseName, NULL);
+        free(path);
+    }
+}
+
+/* watchIncludes - replaces the includes of file with the files its last run read and watches their directories.
+ * the old watches stay, a directory has one watch for every file in it. a directory that can't be watched (it
+ * doesn't exist) is skipped, the run already reported the file */
+static ErrCode watchIncludes(int watchFd, WatchedFile *file)
+{
+    const IncludedFile *included = file->context->macroTable != NULL ? file->context->macroTable->includedFiles : NULL;
+    WatchedPath *path, **last = &file->includes;
+
+    freeWatchedPaths(file->includes);
+    file->includes = NULL;
+    for (; included != NULL; included = included->next) {
+        path = malloc(sizeof(WatchedPath));
+        if (path == NULL)
+            return MALLOC_ERROR_F;
+        path->next = NULL;
+        *last = path; /* freed with the list even if the split fails */
+        last = &path->next;
+        if (splitPath(included->path, "", &path->directory, &path->baseName) != UTIL_SUCCESS_S)
+            return MALLOC_ERROR_F;
+        path->watch = inotify_add_watch(watchFd, path->directory, IN_CLOSE_WRITE | IN_MOVED_TO);
+    }
+    return UTIL_SUCCESS_S;
+}
+
+static void freeWatchedFile(WatchedFile *file)
+{
+    freeStrings(file->directory, file->baseName, NULL);
+    freeWatchedPaths(file->includes);
+    freeAssemblerContext(file->context);
+}
+
+static double elapsedMs(const struct timespec *start, const struct timespec *end)
+{
+    return (double)(end->tv_sec - start->tv_sec) * 1000.0 + (double)(end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+/* assembleWatched - assembles the file like a normal run, prints how long it took and watches the files it read */
+static ErrCode assembleWatched(int watchFd, WatchedFile *file)
+{
+    struct timespec start, end;
+    OutputTarget target;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    initOutputTarget(&target, stdout, stderr);
+    executeAssembler(file->fileName, NULL, 0, file->context, &target);
+    freeOutputTarget(&target);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("\ndone with file %s in %.3f ms\n\n\n", file->fileName, elapsedMs(&start, &end));
+    fflush(stdout);
+    return watchIncludes(watchFd, file);
+}
+
+/* readEvents - marks the files the events of watchFd are about, FALSE if reading failed */
+static Bool readEvents(int watchFd, WatchedFile files[], unsigned int count)
+{
+    union { /* aligned for struct inotify_event */
+        struct inotify_event event;
+        char bytes[WATCH_EVENT_BUFFER];
+    } buffer;
+    ssize_t length = read(watchFd, buffer.bytes, sizeof(buffer.bytes));
+    const struct inotify_event *event;
+    ssize_t position;
+    unsigned int i;
+    const WatchedPath *path;
+
+    if (length < 0)
+        return errno == EINTR || errno == EAGAIN;
+    for (position = 0; position < length; position += (ssize_t)(sizeof(struct inotify_event) + event->len)) {
+        event = (const struct inotify_event*)(buffer.bytes + position);
+        if (event->len == 0)
+            continue;
+        for (i = 0; i < count; i++)
+            if (files[i].watch == event->wd && strcmp(files[i].baseName, event->name) == 0)
+                files[i].changed = TRUE;
+            else
+                for (path = files[i].includes; path != NULL; path = path->next)
+                    if (path->watch == event->wd && strcmp(path->baseName, event->name) == 0)
+                        files[i].changed = TRUE;
+    }
+    return TRUE;
+}
+
+ErrCode runWatch(char *fileNames[], unsigned int count, unsigned int jobs, unsigned int maxErrors, MacroLibraries *libraries)
+{
+    struct pollfd watchPoll;
+    WatchedFile *files = calloc(count + 1, sizeof(WatchedFile));
+    ErrCode errCode = UTIL_SUCCESS_S;
+    unsigned int i;
+    int watchFd = -1;
+
+    if (files == NULL)
+        return MALLOC_ERROR_F;
+    for (i = 0; i < count && errCode == UTIL_SUCCESS_S; i++)
+        errCode = initWatchedFile(&files[i], fileNames[i], jobs, maxErrors, libraries);
+
+    if (errCode == UTIL_SUCCESS_S) {
+        watchFd = inotify_init();
+        if (watchFd < 0)
+            errCode = WATCH_ERROR_F;
+    }
+    for (i = 0; i < count && errCode == UTIL_SUCCESS_S; i++) { /* a directory added again gets the same watch */
+        files[i].watch = inotify_add_watch(watchFd, files[i].directory, IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (files[i].watch < 0)
+            errCode = WATCH_ERROR_F;
+    }
+
+    if (errCode == UTIL_SUCCESS_S) {
+        for (i = 0; i < count && errCode == UTIL_SUCCESS_S; i++)
+            errCode = assembleWatched(watchFd, &files[i]);
+    }
+    if (errCode == UTIL_SUCCESS_S) {
+        printf("watching %u file(s) for changes\n", count);
+        fflush(stdout);
+
+        watchPoll.fd = watchFd;
+        watchPoll.events = POLLIN;
+        while (readEvents(watchFd, files, count)) {
+            while (poll(&watchPoll, 1, WATCH_SETTLE_MS) > 0) /* let the save finish */
+                if (!readEvents(watchFd, files, count))
+                    break;
+            for (i = 0; i < count && errCode == UTIL_SUCCESS_S; i++) {
+                if (!files[i].changed)
+                    continue;
+                files[i].changed = FALSE;
+                errCode = assembleWatched(watchFd, &files[i]);
+            }
+            if (errCode != UTIL_SUCCESS_S)
+                break;
+        }
+        if (errCode == UTIL_SUCCESS_S)
+            errCode = WATCH_ERROR_F;
+    }
+
+    if (watchFd >= 0)
+        close(watchFd);
+    for (i = 0; i < count; i++)
+        freeWatchedFile(&files[i]);
+    free(files);
+    return errCode;
+}
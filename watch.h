@@ -0,0 +1,19 @@
+#ifndef WATCH_H
+#define WATCH_H
+#include "global.h"
+#include "error.h"
+#include "macroLibrary.h" /* for MacroLibraries */
+
+/* watch mode: assembles the files once, then waits on inotify for their .as files to be written and assembles
+ * only the ones that changed, printing how long every run took.
+ * every file keeps its own incremental AssemblerContext, so a save only pays for the lines it edited.
+ * the files a run read (mcroinclude, .incbin) are watched too, the list is refreshed after every run of the file.
+ * the directories are watched and not the files, editors often save by renaming a new file over the old one */
+
+#define WATCH_SETTLE_MS 50 /* wait this long for more events after a change, one save can write a file several times */
+#define WATCH_EVENT_BUFFER 4096
+
+/* returns only on failure, the runs share the compiled macro libraries of libraries */
+ErrCode runWatch(char *fileNames[], unsigned int count, unsigned int jobs, unsigned int maxErrors, MacroLibraries *libraries);
+
+#endif
@@ -3,39 +3,50 @@
 #include <stdlib.h>
 #include <string.h>
 #include "util.h" /* for strDup */
+#include "allocStats.h"
 
-/* local structure for holding extern references recorded during second pass */
-typedef struct ExternRec {
-    char *name;
-    unsigned int address; /* decimal address */
-    struct ExternRec *next;
-} ExternRec;
-
-static ExternRec *externHead = NULL;
+void initExternList(ExternList *externs)
+{
+    externs->head = NULL;
+    externs->tail = NULL;
+}
 
-/* helper: add extern rec */
-void recordExternReference(const char *symName, unsigned int address)
+/* helper: add extern rec at the end of the list (the second pass records them in address order) */
+ErrCode recordExternReference(ExternList *externs, const char *symName, unsigned int address)
 {
     ExternRec *node = (ExternRec*)malloc(sizeof(ExternRec));
-    if (!node) return;
+    if (!node) return MALLOC_ERROR_F;
     node->name = strDup(symName);
-    if (!node->name) { free(node); return; }
+    if (!node->name) { free(node); return MALLOC_ERROR_F; }
     node->address = address;
-    node->next = externHead;
-    externHead = node;
+    node->next = NULL;
+    if (externs->tail) externs->tail->next = node;
+    else externs->head = node;
+    externs->tail = node;
+    return UTIL_SUCCESS_S;
+}
+
+/* move all the records of src to the end of dest */
+void appendExternList(ExternList *dest, ExternList *src)
+{
+    if (!src->head) return;
+    if (dest->tail) dest->tail->next = src->head;
+    else dest->head = src->head;
+    dest->tail = src->tail;
+    initExternList(src);
 }
 
 /* clear list (call after finishing file) */
-void clearExternRecords(void)
+void clearExternRecords(ExternList *externs)
 {
-    ExternRec *cur = externHead;
+    ExternRec *cur = externs->head;
     while (cur) {
         ExternRec *n = cur->next;
         free(cur->name);
         free(cur);
         cur = n;
     }
-    externHead = NULL;
+    initExternList(externs);
 }
 
 /* convert unsigned 10-bit value to base-4 unique string of length digits (5 for full word, 4 for address) */
@@ -78,7 +89,7 @@ ErrCode writeObjectFile(FILE *fp, CodeWord codeImage[], unsigned int codeSize, D
     /* write code segment: addresses from 100 to 100 + codeSize - 1 */
     {
         unsigned int i;
-        for (i = 0; i < codeSize; ++i) {
+        for (i = 0; i < codeSize && i < MAX_MEMORY_SIZE; ++i) {
             unsigned int addr = 100u + i;
             char addrStr[8], codeStr[8];
             to_base4_unique(addr, 4, addrStr);
@@ -106,69 +117,57 @@ ErrCode writeObjectFile(FILE *fp, CodeWord codeImage[], unsigned int codeSize, D
     return UTIL_SUCCESS_S;
 }
 
-ErrCode writeEntryFile(const char *filename, SymbolTable *symbolTable, ErrorList *errorList)
+/* collectEntries - makes an array of the entry symbols in symbol table order (the names point into the table) */
+ErrCode collectEntries(SymbolTable *symbolTable, EntryRec **entries, unsigned int *count)
 {
-    if (!symbolTable || !filename) return FILE_WRITE_ERROR_F;
-
-    /* create filename with .ent */
-    char *full = (char*)malloc(strlen(filename) + 5);
-    if (!full) return MALLOC_ERROR_F;
-    strcpy(full, filename);
-    strcat(full, ".ent");
-
-    FILE *fp = fopen(full, "w");
-    if (!fp) {
-        free(full);
-        return FILE_WRITE_ERROR_F;
-    }
+    SymbolNode *cur;
+    unsigned int i = 0;
+
+    *entries = NULL;
+    *count = 0;
+    for (cur = symbolTable->head; cur; cur = cur->next)
+        if (cur->isEntry)
+            (*count)++;
+    if (*count == 0)
+        return UTIL_SUCCESS_S;
 
-    SymbolNode *cur = symbolTable->head;
-    while (cur) {
+    *entries = (EntryRec*)malloc(*count * sizeof(EntryRec));
+    if (!*entries) {
+        *count = 0;
+        return MALLOC_ERROR_F;
+    }
+    for (cur = symbolTable->head; cur; cur = cur->next)
         if (cur->isEntry) {
-            char addr[8];
-            to_base4_unique(cur->address, 4, addr);
-            fprintf(fp, "%s %s\n", cur->symbolName, addr);
+            (*entries)[i].name = cur->symbolName;
+            (*entries)[i].address = cur->address;
+            i++;
         }
-        cur = cur->next;
-    }
-
-    fclose(fp);
-    free(full);
     return UTIL_SUCCESS_S;
 }
 
-ErrCode writeExternFile(const char *filename, SymbolTable *symbolTable, ErrorList *errorList)
+ErrCode writeEntryFile(FILE *fp, const EntryRec entries[], unsigned int count)
 {
-    /* extern references list populated by second pass */
-    if (externHead == NULL) {
-        /* no extern references -> no file to write */
-        return UTIL_SUCCESS_S;
-    }
-
-    if (!filename) return FILE_WRITE_ERROR_F;
-
-    char *full = (char*)malloc(strlen(filename) + 5);
-    if (!full) return MALLOC_ERROR_F;
-    strcpy(full, filename);
-    strcat(full, ".ext");
+    unsigned int i;
+    if (!fp) return FILE_WRITE_ERROR_F;
 
-    FILE *fp = fopen(full, "w");
-    if (!fp) {
-        free(full);
-        return FILE_WRITE_ERROR_F;
+    for (i = 0; i < count; ++i) {
+        char addr[8];
+        to_base4_unique(entries[i].address, 4, addr);
+        fprintf(fp, "%s %s\n", entries[i].name, addr);
     }
+    return UTIL_SUCCESS_S;
+}
 
-    ExternRec *cur = externHead;
-    while (cur) {
+ErrCode writeExternFile(FILE *fp, const ExternList *externs)
+{
+    ExternRec *cur;
+    if (!fp) return FILE_WRITE_ERROR_F;
+
+    /* extern references list populated by second pass */
+    for (cur = externs->head; cur; cur = cur->next) {
         char addr[8];
         to_base4_unique(cur->address, 4, addr);
         fprintf(fp, "%s %s\n", cur->name, addr);
-        cur = cur->next;
     }
-
-    fclose(fp);
-    free(full);
-    /* clear extern records after writing (optional) */
-    clearExternRecords();
     return UTIL_SUCCESS_S;
 }
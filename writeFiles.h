@@ -5,18 +5,38 @@
 #include "tables.h"
 #include "error.h"
 
+/* extern references recorded during the second pass for the .ext file */
+typedef struct ExternRec {
+    char *name;
+    unsigned int address; /* decimal address */
+    struct ExternRec *next;
+} ExternRec;
+
+typedef struct ExternList {
+    ExternRec *head;
+    ExternRec *tail;
+} ExternList;
+
+/* entry symbols for the .ent file */
+typedef struct EntryRec {
+    const char *name; /* points into the symbol table */
+    unsigned int address; /* decimal address */
+} EntryRec;
+
 /* record extern reference for .ext file */
-void recordExternReference(const char *symName, unsigned int address);
-void clearExternRecords(void);
+void initExternList(ExternList *externs);
+ErrCode recordExternReference(ExternList *externs, const char *symName, unsigned int address);
+void appendExternList(ExternList *dest, ExternList *src);
+void clearExternRecords(ExternList *externs);
 
 /* write output files */
 ErrCode writeObjectFile(FILE *fp, CodeWord codeImage[], unsigned int codeSize,
                         DataWord dataImage[], unsigned int dataSize);
 
-ErrCode writeEntryFile(const char *filename, SymbolTable *symbolTable,
-                       ErrorList *errorList);
+ErrCode collectEntries(SymbolTable *symbolTable, EntryRec **entries, unsigned int *count);
+
+ErrCode writeEntryFile(FILE *fp, const EntryRec entries[], unsigned int count);
 
-ErrCode writeExternFile(const char *filename, SymbolTable *symbolTable,
-                        ErrorList *errorList);
+ErrCode writeExternFile(FILE *fp, const ExternList *externs);
 
 #endif